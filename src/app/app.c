@@ -27,6 +27,8 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdlib.h>
+
 #include <iot/common/macros.h>
 #include <iot/common/mm.h>
 #include <iot/common/log.h>
@@ -69,6 +71,7 @@ typedef struct {
 } pending_t;
 
 
+static const char *appfw_address(void);
 static int transport_connect(iot_app_t *app, const char *server);
 static void recv_cb(iot_transport_t *t, iot_json_t *msg, void *user_data);
 static void closed_cb(iot_transport_t *t, int error, void *user_data);
@@ -169,7 +172,7 @@ int iot_app_event_subscribe(iot_app_t *app, char **events,
     if (app->event_cb == NULL)
         goto invalid;
 
-    if (transport_connect(app, IOT_APPFW_ADDRESS) < 0)
+    if (transport_connect(app, appfw_address()) < 0)
         return -1;
 
     req = NULL;
@@ -221,7 +224,7 @@ int iot_app_event_send(iot_app_t *app, const char *event, iot_json_t *data,
     if (!event || !*event || !target)
         goto invalid;
 
-    if (transport_connect(app, IOT_APPFW_ADDRESS) < 0)
+    if (transport_connect(app, appfw_address()) < 0)
         return -1;
 
     pl = iot_json_create(IOT_JSON_OBJECT);
@@ -284,7 +287,7 @@ static int app_list(iot_app_t *app, int running, iot_app_list_cb_t cb,
     pending_t  *pnd;
     int         seq;
 
-    if (transport_connect(app, IOT_APPFW_ADDRESS) < 0)
+    if (transport_connect(app, appfw_address()) < 0)
         return -1;
 
     req = NULL;
@@ -407,6 +410,14 @@ static inline void dump_message(iot_json_t *msg, const char *fmt, ...)
 }
 
 
+static const char *appfw_address(void)
+{
+    const char *addr = getenv(IOT_APPFW_ADDRESS_ENVVAR);
+
+    return addr != NULL && *addr ? addr : IOT_APPFW_ADDRESS;
+}
+
+
 static int transport_connect(iot_app_t *app, const char *server)
 {
     static iot_transport_evt_t evt = {
@@ -430,7 +441,8 @@ static int transport_connect(iot_app_t *app, const char *server)
     if (alen <= 0)
         goto invalid;
 
-    flags  = IOT_TRANSPORT_MODE_JSON | IOT_TRANSPORT_REUSEADDR;
+    flags  = IOT_TRANSPORT_MODE_JSON | IOT_TRANSPORT_MODE_MSGPACK |
+        IOT_TRANSPORT_MODE_COMPRESS | IOT_TRANSPORT_REUSEADDR;
     app->t = iot_transport_create(app->ml, type, &evt, app, flags);
 
     if (app->t == NULL)
@@ -41,8 +41,10 @@
 #include <iot/common/mainloop.h>
 #include <iot/common/transport.h>
 #include <iot/common/json.h>
+#include <iot/common/msgpack.h>
 #include <iot/common/socket-utils.h>
 #include <iot/common/file-utils.h>
+#include <iot/common/memfd.h>
 #include <iot/common/utils.h>
 
 #endif /* __IOT_COMMON_H__ */
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+
+#include <iot/config.h>
+
+#ifdef LZ4_ENABLED
+#  include <lz4.h>
+#endif
+
+#include <iot/common/macros.h>
+#include <iot/common/json.h>
+#include <iot/common/compress.h>
+
+#define ZHDR_SIZE sizeof(uint32_t)       /* original size in front of data */
+
+
+#ifdef LZ4_ENABLED
+
+int iot_compress_available(void)
+{
+    return TRUE;
+}
+
+
+ssize_t iot_compress(const void *data, size_t size, iot_json_buf_t *b,
+                     size_t hdr)
+{
+    uint32_t osize;
+    int      room, n;
+
+    if (size <= ZHDR_SIZE || size > LZ4_MAX_INPUT_SIZE) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    /* only accept output that ends up smaller than the original */
+    room = (int)(size - ZHDR_SIZE - 1);
+
+    b->used = 0;
+
+    if (iot_json_buf_reserve(b, hdr + ZHDR_SIZE + room) < 0)
+        return -1;
+
+    n = LZ4_compress_default(data, b->data + hdr + ZHDR_SIZE, (int)size, room);
+
+    if (n <= 0) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    osize = htobe32((uint32_t)size);
+    memcpy(b->data + hdr, &osize, sizeof(osize));
+
+    b->used = hdr + ZHDR_SIZE + n;
+
+    return (ssize_t)(ZHDR_SIZE + n);
+}
+
+
+ssize_t iot_decompress(const void *data, size_t size, iot_json_buf_t *b,
+                       size_t max)
+{
+    uint32_t osize;
+    int      n;
+
+    if (size <= ZHDR_SIZE || size - ZHDR_SIZE > LZ4_MAX_INPUT_SIZE) {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    memcpy(&osize, data, sizeof(osize));
+    osize = be32toh(osize);
+
+    if (osize > max || osize > LZ4_MAX_INPUT_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    b->used = 0;
+
+    if (iot_json_buf_reserve(b, osize) < 0)
+        return -1;
+
+    n = LZ4_decompress_safe((const char *)data + ZHDR_SIZE, b->data,
+                            (int)(size - ZHDR_SIZE), (int)osize);
+
+    if (n < 0 || (uint32_t)n != osize) {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    b->used = osize;
+    b->data[osize] = '\0';
+
+    return (ssize_t)osize;
+}
+
+
+#else /* !LZ4_ENABLED */
+
+
+int iot_compress_available(void)
+{
+    return FALSE;
+}
+
+
+ssize_t iot_compress(const void *data, size_t size, iot_json_buf_t *b,
+                     size_t hdr)
+{
+    IOT_UNUSED(data);
+    IOT_UNUSED(size);
+    IOT_UNUSED(b);
+    IOT_UNUSED(hdr);
+
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+
+ssize_t iot_decompress(const void *data, size_t size, iot_json_buf_t *b,
+                       size_t max)
+{
+    IOT_UNUSED(data);
+    IOT_UNUSED(size);
+    IOT_UNUSED(b);
+    IOT_UNUSED(max);
+
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+
+#endif /* !LZ4_ENABLED */
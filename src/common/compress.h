@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IOT_COMPRESS_H__
+#define __IOT_COMPRESS_H__
+
+#include <sys/types.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/json.h>
+
+IOT_CDECL_BEGIN
+
+/*
+ * Compression of transport frames.
+ *
+ * Transports can compress large messages before putting them on the wire.
+ * Compressed frames are flagged in the frame header (IOT_FRAGBUF_COMPRESSED)
+ * and carry the 32-bit big-endian size of the original message followed
+ * by the message compressed as a single LZ4 block. LZ4 is fast enough on
+ * both sides to be a net win even on a loaded embedded target, while still
+ * typically shrinking our JSON messages to a fraction of their size.
+ *
+ * Compression is only available if the library has been built with LZ4
+ * support. Otherwise compressing and decompressing fails with EOPNOTSUPP.
+ */
+
+/** Check whether frame compression is available. */
+int iot_compress_available(void);
+
+/**
+ * Compress data into the buffer after hdr bytes of headroom. Fail with
+ * ENOSPC if compression would not make the data any smaller.
+ */
+ssize_t iot_compress(const void *data, size_t size, iot_json_buf_t *b,
+                     size_t hdr);
+
+/** Decompress data into the buffer, failing with EMSGSIZE above max bytes. */
+ssize_t iot_decompress(const void *data, size_t size, iot_json_buf_t *b,
+                       size_t max);
+
+IOT_CDECL_END
+
+#endif /* __IOT_COMPRESS_H__ */
@@ -27,6 +27,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -35,11 +36,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <poll.h>
 
 #include <iot/common/macros.h>
 #include <iot/common/mm.h>
 #include <iot/common/log.h>
 #include <iot/common/transport.h>
+#include <iot/common/msgpack.h>
+#include <iot/common/compress.h>
+#include <iot/common/fragbuf.h>
+#include <iot/common/outq.h>
 
 #ifndef UNIX_PATH_MAX
 #    define UNIX_PATH_MAX sizeof(((struct sockaddr_un *)NULL)->sun_path)
@@ -53,16 +59,30 @@
 #define UNXDL 4
 
 
-#define DEFAULT_SIZE 1024                /* default input buffer size */
+#define RECV_BATCH   16                  /* max. datagrams per receive */
+#define RECV_SIZE    (64 * 1024)         /* max. default datagram size */
+#define RECV_POOL    (128 * 1024)        /* max. input buffer pool size */
+#define RECV_CTRL    CMSG_SPACE(IOT_TRANSPORT_MAXFDS * sizeof(int))
+#define OBUF_KEEP    (16 * 1024)         /* max. idle output buffer to keep */
 
 typedef struct {
     IOT_TRANSPORT_PUBLIC_FIELDS;         /* common transport fields */
     int             sock;                /* UDP socket */
     int             family;              /* socket family */
     iot_io_watch_t *iow;                 /* socket I/O watch */
-    void           *ibuf;                /* input buffer */
-    size_t          isize;               /* input buffer size */
-    size_t          idata;               /* amount of input data */
+    void           *ibuf;                /* input buffer pool */
+    size_t          isize;               /* size of a single input buffer */
+    int             icnt;                /* number of input buffers */
+    struct mmsghdr *imsg;                /* input message headers */
+    struct iovec   *iiov;                /* input buffer vectors */
+    iot_sockaddr_t *iaddr;               /* input sender addresses */
+    void           *ictl;                /* input control buffers, if any */
+    iot_json_buf_t  obuf;                /* JSON output buffer */
+    iot_json_buf_t  zbuf;                /* (de)compression buffer */
+    iot_outq_t     *oq;                  /* output queue */
+    iot_io_watch_t *ow;                  /* output queue I/O watch */
+    iot_deferred_t *flush;               /* batched output flush */
+    int             full;                /* queue over high watermark */
 } dgrm_t;
 
 
@@ -267,12 +287,18 @@ static int dgrm_open(iot_transport_t *mu)
 static int dgrm_createfrom(iot_transport_t *mu, void *conn)
 {
     dgrm_t         *u = (dgrm_t *)mu;
+    iot_sockaddr_t  addr;
+    socklen_t       alen;
     int             on;
     iot_io_event_t  events;
 
     u->sock = *(int *)conn;
 
     if (u->sock >= 0) {
+        alen = sizeof(addr);
+        if (getsockname(u->sock, &addr.any, &alen) == 0)
+            u->family = addr.any.sa_family;
+
         if (mu->flags & IOT_TRANSPORT_REUSEADDR) {
             on = 1;
             setsockopt(u->sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
@@ -317,6 +343,24 @@ static int dgrm_listen(iot_transport_t *mt, int backlog)
 }
 
 
+static void free_input(dgrm_t *u)
+{
+    iot_free(u->ibuf);
+    iot_free(u->imsg);
+    iot_free(u->iiov);
+    iot_free(u->iaddr);
+    iot_free(u->ictl);
+
+    u->ibuf  = NULL;
+    u->isize = 0;
+    u->icnt  = 0;
+    u->imsg  = NULL;
+    u->iiov  = NULL;
+    u->iaddr = NULL;
+    u->ictl  = NULL;
+}
+
+
 static void dgrm_close(iot_transport_t *mu)
 {
     dgrm_t *u = (dgrm_t *)mu;
@@ -324,10 +368,19 @@ static void dgrm_close(iot_transport_t *mu)
     iot_del_io_watch(u->iow);
     u->iow = NULL;
 
-    iot_free(u->ibuf);
-    u->ibuf  = NULL;
-    u->isize = 0;
-    u->idata = 0;
+    free_input(u);
+
+    iot_json_buf_cleanup(&u->obuf);
+    iot_json_buf_cleanup(&u->zbuf);
+
+    iot_del_io_watch(u->ow);
+    u->ow = NULL;
+
+    iot_del_deferred(u->flush);
+    u->flush = NULL;
+
+    iot_outq_destroy(u->oq);
+    u->oq = NULL;
 
     if (u->sock >= 0){
         close(u->sock);
@@ -336,79 +389,276 @@ static void dgrm_close(iot_transport_t *mu)
 }
 
 
-static void dgrm_recv_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
-                         void *user_data)
+/*
+ * Datagrams are received in batches with a single recvmmsg(2) into a
+ * pool of buffers, allocated when the first datagram arrives. Initially
+ * buffers are sized to the socket receive buffer size, capped at
+ * RECV_SIZE and the maximum frame size. Since we ask the kernel for the
+ * real length of truncated datagrams (MSG_TRUNC), a datagram which does
+ * not fit is dropped but the buffers are grown to accommodate similar
+ * ones in the future.
+ *
+ * The pool costs RECV_POOL (128 KiB) per receiving transport, for
+ * instance 2 buffers of 64 KiB by default, or RECV_BATCH (16) buffers
+ * if they are 8 KiB or smaller. Once grown past RECV_POOL, the pool is a
+ * single buffer sized for the largest datagram seen.
+ */
+
+static size_t input_size(dgrm_t *u)
 {
-    dgrm_t          *u  = (dgrm_t *)user_data;
-    iot_transport_t *mu = (iot_transport_t *)u;
-    iot_sockaddr_t   addr;
-    socklen_t        addrlen;
-    uint32_t         size;
+    socklen_t len;
+    int       size;
+
+    len = sizeof(size);
+
+    if (getsockopt(u->sock, SOL_SOCKET, SO_RCVBUF, &size, &len) < 0 ||
+        size <= 0 || size > RECV_SIZE)
+        size = RECV_SIZE;
+
+    if ((size_t)size > u->input.maxframe + sizeof(uint32_t))
+        size = u->input.maxframe + sizeof(uint32_t);
+
+    return size;
+}
+
+
+static int alloc_input(dgrm_t *u, size_t size)
+{
+    struct msghdr *hdr;
+    int            cnt, i;
+
+    free_input(u);
+
+    if ((cnt = RECV_POOL / size) > RECV_BATCH)
+        cnt = RECV_BATCH;
+    else if (cnt < 1)
+        cnt = 1;
+
+    u->ibuf  = iot_alloc(cnt * size);
+    u->imsg  = iot_allocz_array(struct mmsghdr, cnt);
+    u->iiov  = iot_allocz_array(struct iovec  , cnt);
+    u->iaddr = iot_allocz_array(iot_sockaddr_t, cnt);
+
+    /* only receive descriptors if we have someone to pass them to */
+    if (u->family == AF_UNIX && u->evt.recvjsonfds != NULL)
+        u->ictl = iot_alloc(cnt * RECV_CTRL);
+
+    if (!u->ibuf || !u->imsg || !u->iiov || !u->iaddr ||
+        (!u->ictl && u->family == AF_UNIX && u->evt.recvjsonfds != NULL)) {
+        free_input(u);
+        return FALSE;
+    }
+
+    u->isize = size;
+    u->icnt  = cnt;
+
+    for (i = 0; i < cnt; i++) {
+        u->iiov[i].iov_base = u->ibuf + i * size;
+        u->iiov[i].iov_len  = size;
+
+        hdr = &u->imsg[i].msg_hdr;
+        hdr->msg_name    = &u->iaddr[i];
+        hdr->msg_iov     = &u->iiov[i];
+        hdr->msg_iovlen  = 1;
+    }
+
+    return TRUE;
+}
+
+
+static void close_fds(int *fds, int nfd)
+{
+    while (nfd-- > 0)
+        close(fds[nfd]);
+}
+
+
+static int get_fds(struct msghdr *hdr, int *fds)
+{
+    struct cmsghdr *cmsg;
+    int             nfd, n;
+
+    nfd = 0;
+
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        if (nfd + n > IOT_TRANSPORT_MAXFDS) {
+            close_fds((int *)CMSG_DATA(cmsg), n);
+            continue;
+        }
+
+        memcpy(fds + nfd, CMSG_DATA(cmsg), n * sizeof(int));
+        nfd += n;
+    }
+
+    return nfd;
+}
+
+
+static int recv_datagram(dgrm_t *u, int i, size_t *growp)
+{
+    iot_transport_t *mu  = (iot_transport_t *)u;
+    size_t           len     = u->imsg[i].msg_len;
+    socklen_t        addrlen = u->imsg[i].msg_hdr.msg_namelen;
+    uint32_t         size, flags;
     ssize_t          n;
     void            *data;
-    int              old, error;
+    int              fds[IOT_TRANSPORT_MAXFDS], nfd, error;
 
-    IOT_UNUSED(w);
+    nfd = u->ictl ? get_fds(&u->imsg[i].msg_hdr, fds) : 0;
 
-    if (events & IOT_IO_EVENT_IN) {
-        if (u->idata == u->isize) {
-            if (u->isize != 0) {
-                old      = u->isize;
-                u->isize *= 2;
-            }
-            else {
-                old      = 0;
-                u->isize = DEFAULT_SIZE;
-            }
-            if (!iot_reallocz(u->ibuf, old, u->isize)) {
-                error = ENOMEM;
-            fatal_error:
-            closed:
-                dgrm_disconnect(mu);
-
-                if (u->evt.closed != NULL)
-                    IOT_TRANSPORT_BUSY(mu, {
-                            mu->evt.closed(mu, error, mu->user_data);
-                        });
-
-                u->check_destroy(mu);
-                return;
+    if (nfd > 0 && (u->imsg[i].msg_hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        close_fds(fds, nfd);
+        nfd = 0;
+    }
+
+    if (u->imsg[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        if (len - sizeof(size) > u->input.maxframe)
+            iot_log_error("%s(): dropping datagram of %zu bytes, exceeds "
+                          "limit (%zu bytes).", __FUNCTION__,
+                          len, u->input.maxframe);
+        else {
+            iot_log_error("%s(): dropping truncated datagram of %zu bytes, "
+                          "growing receive buffers.",
+                          __FUNCTION__, len);
+            if (len > *growp)
+                *growp = len;
+        }
+
+        u->stats.errors++;
+        return 0;
+    }
+
+    data = u->iiov[i].iov_base;
+    u->stats.bytes_in += len;
+
+    if (len >= sizeof(size)) {
+        memcpy(&size, data, sizeof(size));
+        size  = ntohl(size);
+        flags = size & ~IOT_FRAGBUF_SIZE_MASK;
+        size &= IOT_FRAGBUF_SIZE_MASK;
+    }
+    else
+        flags = 0;
+
+    if (len < sizeof(size) || len != size + sizeof(size)) {
+        u->stats.errors++;
+        close_fds(fds, nfd);
+        return EPROTO;
+    }
+
+    data += sizeof(size);
+
+    if (!(u->mode & IOT_TRANSPORT_MODE_JSON)) {
+        close_fds(fds, nfd);
+        error = mu->recv_data(mu, data, size, &u->iaddr[i], addrlen);
+    }
+    else {
+        iot_json_t *msg;
+
+        if (flags & IOT_FRAGBUF_COMPRESSED) {
+            n = iot_decompress(data, size, &u->zbuf, u->input.maxframe);
+
+            if (n < 0) {
+                iot_log_error("%s(): dropping undecompressable datagram (%d: "
+                              "%s).", __FUNCTION__, errno, strerror(errno));
+                u->stats.errors++;
+                close_fds(fds, nfd);
+                return 0;
             }
+
+            data = u->zbuf.data;
+            size = (uint32_t)n;
         }
 
-        if (recv(fd, &size, sizeof(size), MSG_PEEK) != sizeof(size)) {
-            error = EIO;
-            goto fatal_error;
+        if (iot_msgpack_detect(data, size))
+            msg = iot_msgpack_decode(data, size);
+        else
+            msg = iot_json_string_to_object(data, size);
+
+        if (u->zbuf.size > OBUF_KEEP)
+            iot_json_buf_cleanup(&u->zbuf);
+
+        if (msg != NULL) {
+            if (nfd > 0)
+                error = mu->recv_fds(mu, msg, fds, nfd);
+            else
+                error = mu->recv_data(mu, msg, 0, &u->iaddr[i], addrlen);
+            iot_json_unref(msg);
         }
+        else {
+            iot_log_error("%s(): dropping malformed JSON datagram.",
+                          __FUNCTION__);
+            u->stats.errors++;
+            close_fds(fds, nfd);
+            error = 0;
+        }
+    }
 
-        size = ntohl(size);
+    return error;
+}
 
-        if (u->isize < size + sizeof(size)) {
-            old      = u->isize;
-            u->isize = size + sizeof(size);
 
-            if (!iot_reallocz(u->ibuf, old, u->isize)) {
-                error = ENOMEM;
-                goto fatal_error;
+static void dgrm_recv_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                         void *user_data)
+{
+    dgrm_t          *u  = (dgrm_t *)user_data;
+    iot_transport_t *mu = (iot_transport_t *)u;
+    size_t           grow;
+    int              i, n, error;
+
+    IOT_UNUSED(w);
+
+    if (events & IOT_IO_EVENT_IN) {
+        if (u->ibuf == NULL && !alloc_input(u, input_size(u))) {
+            error = ENOMEM;
+        fatal_error:
+        closed:
+            dgrm_disconnect(mu);
+
+            if (u->evt.closed != NULL)
+                IOT_TRANSPORT_BUSY(mu, {
+                        mu->evt.closed(mu, error, mu->user_data);
+                    });
+
+            u->check_destroy(mu);
+            return;
+        }
+
+        for (i = 0; i < u->icnt; i++) {
+            u->imsg[i].msg_hdr.msg_namelen = sizeof(u->iaddr[i]);
+            u->imsg[i].msg_hdr.msg_flags   = 0;
+
+            if (u->ictl != NULL) {
+                u->imsg[i].msg_hdr.msg_control    = u->ictl + i * RECV_CTRL;
+                u->imsg[i].msg_hdr.msg_controllen = RECV_CTRL;
             }
         }
 
-        addrlen = sizeof(addr);
-        n = recvfrom(fd, u->ibuf, size + sizeof(size), 0, &addr.any, &addrlen);
+        n = recvmmsg(fd, u->imsg, u->icnt,
+                     MSG_DONTWAIT | MSG_TRUNC | MSG_CMSG_CLOEXEC, NULL);
 
-        if (n != (ssize_t)(size + sizeof(size))) {
-            error = n < 0 ? EIO : EPROTO;
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            error = EIO;
             goto fatal_error;
         }
 
-        data  = u->ibuf + sizeof(size);
-        error = mu->recv_data(mu, data, size, &addr, addrlen);
+        for (i = 0, grow = 0; i < n; i++) {
+            if ((error = recv_datagram(u, i, &grow)) != 0)
+                goto fatal_error;
 
-        if (error)
-            goto fatal_error;
+            if (u->check_destroy(mu))
+                return;
+        }
 
-        if (u->check_destroy(mu))
-            return;
+        if (grow > u->isize && !alloc_input(u, grow)) {
+            error = ENOMEM;
+            goto fatal_error;
+        }
     }
 
     if (events & IOT_IO_EVENT_HUP) {
@@ -490,6 +740,14 @@ static int dgrm_disconnect(iot_transport_t *mu)
 
 
     if (u->connected) {
+        iot_del_io_watch(u->ow);
+        u->ow = NULL;
+
+        iot_del_deferred(u->flush);
+        u->flush = NULL;
+
+        iot_outq_reset(u->oq);
+
         connect(u->sock, &none, sizeof(none));
 
         return TRUE;
@@ -499,113 +757,347 @@ static int dgrm_disconnect(iot_transport_t *mu)
 }
 
 
-static int dgrm_sendraw(iot_transport_t *mu, void *data, size_t size)
+static void check_writable(dgrm_t *u)
 {
-    dgrm_t  *u = (dgrm_t *)mu;
-    ssize_t  n;
+    iot_transport_t *mu = (iot_transport_t *)u;
 
-    if (u->connected) {
-        n = write(u->sock, data, size);
+    if (!u->full || iot_outq_size(u->oq) > u->queue.lowmark)
+        return;
+
+    u->full = FALSE;
+
+    if (u->evt.writable != NULL) {
+        IOT_TRANSPORT_BUSY(mu, {
+                mu->evt.writable(mu, mu->user_data);
+            });
+
+        u->check_destroy(mu);
+    }
+}
+
+
+static void dgrm_send_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                         void *user_data);
+
+static int write_queue(dgrm_t *u)
+{
+    size_t size = iot_outq_size(u->oq);
+    int    r;
+
+    r = iot_outq_flush(u->oq, u->sock);
+    u->stats.bytes_out += size - iot_outq_size(u->oq);
+
+    return r;
+}
+
+
+static void flush_queue(dgrm_t *u)
+{
+    if (write_queue(u) < 0)
+        iot_debug("transport %p: failed to send datagram (%d: %s)", u,
+                  errno, strerror(errno));
+
+    if (iot_outq_size(u->oq) == 0) {
+        iot_del_io_watch(u->ow);
+        u->ow = NULL;
+    }
+    else if (u->ow == NULL) {
+        u->ow = iot_add_io_watch(u->ml, u->sock, IOT_IO_EVENT_OUT,
+                                 dgrm_send_cb, u);
+
+        if (u->ow == NULL)
+            iot_log_error("Failed to add output watch for transport %p.", u);
+    }
+
+    check_writable(u);
+}
+
+
+static void dgrm_send_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                         void *user_data)
+{
+    dgrm_t *u = (dgrm_t *)user_data;
+
+    IOT_UNUSED(w);
+    IOT_UNUSED(fd);
+
+    if (events & IOT_IO_EVENT_OUT)
+        flush_queue(u);
+}
 
-        if (n == (ssize_t)size)
+
+static void dgrm_flush_cb(iot_deferred_t *d, void *user_data)
+{
+    dgrm_t *u = (dgrm_t *)user_data;
+
+    iot_disable_deferred(d);
+    flush_queue(u);
+}
+
+
+static int schedule_flush(dgrm_t *u)
+{
+    if (u->flags & IOT_TRANSPORT_BATCH) {
+        if (u->flush != NULL) {
+            iot_enable_deferred(u->flush);
             return TRUE;
-        else {
-            if (n == -1 && errno == EAGAIN) {
-                iot_log_error("%s(): XXX TODO: this sucks, need to add "
-                              "output queuing for dgrm-transport.",
-                              __FUNCTION__);
-            }
+        }
+
+        u->flush = iot_add_deferred(u->ml, dgrm_flush_cb, u);
+
+        if (u->flush == NULL) {
+            iot_log_error("Failed to add output flush for transport %p.", u);
+            return FALSE;
         }
     }
+    else {
+        u->ow = iot_add_io_watch(u->ml, u->sock, IOT_IO_EVENT_OUT,
+                                 dgrm_send_cb, u);
 
-    return FALSE;
+        if (u->ow == NULL) {
+            iot_log_error("Failed to add output watch for transport %p.", u);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
 }
 
 
-static int dgrm_sendrawto(iot_transport_t *mu, void *data, size_t size,
-                          iot_sockaddr_t *addr, socklen_t addrlen)
+static int wait_queue(dgrm_t *u)
 {
-    dgrm_t  *u = (dgrm_t *)mu;
-    ssize_t  n;
+    struct pollfd pfd;
 
-    if (IOT_UNLIKELY(u->sock == -1)) {
-        if (!open_socket(u, ((struct sockaddr *)addr)->sa_family))
+    pfd.fd     = u->sock;
+    pfd.events = POLLOUT;
+
+    while (iot_outq_size(u->oq) > u->queue.lowmark) {
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
             return FALSE;
+
+        write_queue(u);
     }
 
-    n = sendto(u->sock, data, size, 0, &addr->any, addrlen);
+    return TRUE;
+}
+
+
+static int queue_overflow(dgrm_t *u)
+{
+    int n;
+
+    switch (u->queue.policy) {
+    case IOT_TRANSPORT_QUEUE_BLOCK:
+        return wait_queue(u);
+
+    case IOT_TRANSPORT_QUEUE_DROP:
+    default:
+        u->full = TRUE;
+        n = iot_outq_drop(u->oq, u->queue.highmark);
+
+        if (n > 0)
+            iot_debug("transport %p: dropped %d queued datagrams", u, n);
 
-    if (n == (ssize_t)size)
         return TRUE;
-    else {
-        if (n == -1 && errno == EAGAIN) {
-            iot_log_error("%s(): XXX TODO: dgrm-transport send failed",
-                          __FUNCTION__);
+    }
+}
+
+
+static ssize_t sendto_fds(int fd, void *data, size_t size, int *fds, int nfd)
+{
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr *cmsg;
+    char            ctrl[RECV_CTRL];
+
+    iov.iov_base = data;
+    iov.iov_len  = size;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(ctrl, 0, sizeof(ctrl));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = CMSG_SPACE(nfd * sizeof(int));
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(nfd * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, nfd * sizeof(int));
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+
+static int send_data(dgrm_t *u, void *data, size_t size,
+                     iot_sockaddr_t *addr, socklen_t addrlen,
+                     int *fds, int nfd)
+{
+    struct sockaddr *sa = addr ? &addr->any : NULL;
+    ssize_t          n;
+
+    if (!(u->flags & IOT_TRANSPORT_BATCH) && iot_outq_size(u->oq) == 0) {
+        if (nfd > 0)
+            n = sendto_fds(u->sock, data, size, fds, nfd);
+        else
+            n = sendto(u->sock, data, size, MSG_NOSIGNAL, sa, addrlen);
+
+        if (n == (ssize_t)size) {
+            u->stats.bytes_out += size;
+            return TRUE;
         }
+
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+                       errno != EINTR && errno != ENOBUFS))
+            return FALSE;
+
+        u->stats.eagain++;
     }
 
+    /*
+     * There is no connection to tear down for a datagram transport, so
+     * for the disconnect policy the best we can do is to reject the
+     * message being sent.
+     */
+    if (u->queue.policy == IOT_TRANSPORT_QUEUE_DISCONNECT &&
+        iot_outq_size(u->oq) + size > u->queue.highmark) {
+        u->full = TRUE;
+        errno   = ENOBUFS;
+        return FALSE;
+    }
+
+    if (u->oq == NULL && (u->oq = iot_outq_create(TRUE)) == NULL)
+        return FALSE;
+
+    if (iot_outq_pushfds(u->oq, data, size, 0, sa, addrlen, fds, nfd) < 0)
+        return FALSE;
+
+    if (u->ow == NULL && !schedule_flush(u))
+        return FALSE;
+
+    if (iot_outq_size(u->oq) > u->queue.highmark)
+        return queue_overflow(u);
+
+    return TRUE;
+}
+
+
+static int dgrm_getopt(iot_transport_t *mu, const char *opt, void *val,
+                       socklen_t *len)
+{
+    dgrm_t *u = (dgrm_t *)mu;
+
+    IOT_UNUSED(len);
+
+    if (!strcmp(opt, IOT_TRANSPORT_OPT_STATS)) {
+        ((iot_transport_stats_t *)val)->queued = iot_outq_size(u->oq);
+        return TRUE;
+    }
+
+    errno = EOPNOTSUPP;
     return FALSE;
 }
 
 
-static int sendjsonto(iot_transport_t *mu, iot_json_t *msg,
-                      iot_sockaddr_t *addr, socklen_t addrlen)
+static int dgrm_sendraw(iot_transport_t *mu, void *data, size_t size)
 {
-    dgrm_t       *u = (dgrm_t *)mu;
-    struct iovec  iov[2];
-    const char   *s;
-    ssize_t       size, n;
-    uint32_t      len;
+    dgrm_t *u = (dgrm_t *)mu;
+
+    if (!u->connected)
+        return FALSE;
+
+    return send_data(u, data, size, NULL, 0, NULL, 0);
+}
+
+
+static int dgrm_sendrawto(iot_transport_t *mu, void *data, size_t size,
+                          iot_sockaddr_t *addr, socklen_t addrlen)
+{
+    dgrm_t *u = (dgrm_t *)mu;
 
     if (IOT_UNLIKELY(u->sock == -1)) {
         if (!open_socket(u, ((struct sockaddr *)addr)->sa_family))
             return FALSE;
     }
 
-    if (u->connected && (s = iot_json_object_to_string(msg)) != NULL) {
-        size = strlen(s);
-        len  = htobe32(size);
+    return send_data(u, data, size, addr, addrlen, NULL, 0);
+}
 
-        iov[0].iov_base = &len;
-        iov[0].iov_len  = sizeof(len);
-        iov[1].iov_base = (char *)s;
-        iov[1].iov_len  = size;
 
-        if (u->connected)
-            n = writev(u->sock, iov, 2);
-        else {
-            struct msghdr mh;
+static int sendjsonto(iot_transport_t *mu, iot_json_t *msg,
+                      iot_sockaddr_t *addr, socklen_t addrlen,
+                      int *fds, int nfd)
+{
+    dgrm_t         *u = (dgrm_t *)mu;
+    iot_json_buf_t *b;
+    ssize_t         size;
+    uint32_t        len, flags;
+    int             success;
+
+    if (IOT_UNLIKELY(u->sock == -1)) {
+        if (!open_socket(u, ((struct sockaddr *)addr)->sa_family))
+            return FALSE;
+    }
 
-            mh.msg_name       = &addr->any;
-            mh.msg_namelen    = addrlen;
-            mh.msg_iov        = iov;
-            mh.msg_iovlen     = IOT_ARRAY_SIZE(iov);
-            mh.msg_control    = NULL;
-            mh.msg_controllen = 0;
-            mh.msg_flags      = 0;
+    /*
+     * There is no session to negotiate the encoding over, so in MessagePack
+     * mode we always send MessagePack and expect the peer to cope with it.
+     * Likewise, in compression mode we always compress large messages.
+     */
+    if (u->mode & IOT_TRANSPORT_MODE_MSGPACK)
+        size = iot_msgpack_encode(msg, &u->obuf, sizeof(len));
+    else
+        size = iot_json_serialize(msg, &u->obuf, sizeof(len));
 
-            n = sendmsg(u->sock, &mh, 0);
-        }
+    if (size < 0)
+        return FALSE;
 
-        if (n == (ssize_t)(size + sizeof(len)))
-            return TRUE;
-        else {
-            if (n == -1 && errno == EAGAIN) {
-                iot_log_error("%s(): XXX TODO: this sucks, need to add "
-                              "output queuing for dgrm-transport.",
-                              __FUNCTION__);
-            }
+    b     = &u->obuf;
+    flags = 0;
+
+    if ((u->mode & IOT_TRANSPORT_MODE_COMPRESS) &&
+        (size_t)size >= u->zthreshold) {
+        size = iot_compress(u->obuf.data + sizeof(len), size, &u->zbuf,
+                            sizeof(len));
+
+        if (size > 0) {
+            b     = &u->zbuf;
+            flags = IOT_FRAGBUF_COMPRESSED;
         }
     }
 
-    return FALSE;
+    len = htobe32((b->used - sizeof(len)) | flags);
+    memcpy(b->data, &len, sizeof(len));
+
+    if (u->connected)
+        success = send_data(u, b->data, b->used, NULL, 0, fds, nfd);
+    else
+        success = send_data(u, b->data, b->used, addr, addrlen, NULL, 0);
+
+    if (u->obuf.size > OBUF_KEEP)
+        iot_json_buf_cleanup(&u->obuf);
+    if (u->zbuf.size > OBUF_KEEP)
+        iot_json_buf_cleanup(&u->zbuf);
+
+    return success;
 }
 
 
 static int dgrm_sendjson(iot_transport_t *mu, iot_json_t *msg)
 {
     if (mu->connected)
-        return sendjsonto(mu, msg, NULL, 0);
+        return sendjsonto(mu, msg, NULL, 0, NULL, 0);
+    else
+        return FALSE;
+}
+
+
+static int dgrm_sendjsonfds(iot_transport_t *mu, iot_json_t *msg,
+                            int *fds, int nfd)
+{
+    if (mu->connected)
+        return sendjsonto(mu, msg, NULL, 0, fds, nfd);
     else
         return FALSE;
 }
@@ -614,13 +1106,13 @@ static int dgrm_sendjson(iot_transport_t *mu, iot_json_t *msg)
 static int dgrm_sendjsonto(iot_transport_t *mu, iot_json_t *msg,
                            iot_sockaddr_t *addr, socklen_t addrlen)
 {
-    return sendjsonto(mu, msg, addr, addrlen);
+    return sendjsonto(mu, msg, addr, addrlen, NULL, 0);
 }
 
 
 IOT_REGISTER_TRANSPORT(udp4, UDP4, dgrm_t, dgrm_resolve,
                        dgrm_open, dgrm_createfrom, dgrm_close,
-                       NULL, NULL,
+                       NULL, dgrm_getopt,
                        dgrm_bind, dgrm_listen, NULL,
                        dgrm_connect, dgrm_disconnect,
                        dgrm_sendraw, dgrm_sendrawto,
@@ -628,16 +1120,17 @@ IOT_REGISTER_TRANSPORT(udp4, UDP4, dgrm_t, dgrm_resolve,
 
 IOT_REGISTER_TRANSPORT(udp6, UDP6, dgrm_t, dgrm_resolve,
                        dgrm_open, dgrm_createfrom, dgrm_close,
-                       NULL, NULL,
+                       NULL, dgrm_getopt,
                        dgrm_bind, dgrm_listen, NULL,
                        dgrm_connect, dgrm_disconnect,
                        dgrm_sendraw, dgrm_sendrawto,
                        dgrm_sendjson, dgrm_sendjsonto);
 
-IOT_REGISTER_TRANSPORT(unxdgrm, UNXD, dgrm_t, dgrm_resolve,
-                       dgrm_open, dgrm_createfrom, dgrm_close,
-                       NULL, NULL,
-                       dgrm_bind, dgrm_listen, NULL,
-                       dgrm_connect, dgrm_disconnect,
-                       dgrm_sendraw, dgrm_sendrawto,
-                       dgrm_sendjson, dgrm_sendjsonto);
+IOT_REGISTER_TRANSPORT_FDS(unxdgrm, UNXD, dgrm_t,
+                           dgrm_resolve, dgrm_open, dgrm_createfrom, dgrm_close,
+                           NULL, dgrm_getopt,
+                           dgrm_bind, dgrm_listen, NULL,
+                           dgrm_connect, dgrm_disconnect,
+                           dgrm_sendraw, dgrm_sendrawto,
+                           dgrm_sendjson, dgrm_sendjsonto,
+                           dgrm_sendjsonfds);
@@ -34,56 +34,113 @@
 #include <iot/common/log.h>
 #include <iot/common/fragbuf.h>
 
+#define FRAGBUF_MIN 128                  /* min. buffer size to allocate */
+
+/*
+ * Consumed data is not moved out of the way after each pulled message.
+ * Instead we keep track of the offset of the first unconsumed byte and
+ * only compact the buffer when we run out of space at its end. For the
+ * same reason we keep track of how far we have already scanned the
+ * frames in the buffer, so that we never need to rescan the frames.
+ */
+
 struct iot_fragbuf_s {
     void *data;                          /* actual data buffer */
     int   size;                          /* size of the buffer */
-    int   used;                          /* amount of data in the bufer */
+    int   head;                          /* offset of first unconsumed byte */
+    int   used;                          /* end of data in the buffer */
+    int   scan;                          /* offset of first incomplete frame */
     int   framed : 1;                    /* whether data is framed */
 };
 
 
+static inline uint32_t frame_size(iot_fragbuf_t *buf, int offs)
+{
+    uint32_t size;
+
+    memcpy(&size, buf->data + offs, sizeof(size));
+
+    return be32toh(size) & IOT_FRAGBUF_SIZE_MASK;
+}
+
+
+static void fragbuf_compact(iot_fragbuf_t *buf)
+{
+    if (buf->head == 0)
+        return;
+
+    if (buf->used > buf->head)
+        memmove(buf->data, buf->data + buf->head, buf->used - buf->head);
+
+    buf->used -= buf->head;
+    buf->scan  = buf->scan > buf->head ? buf->scan - buf->head : 0;
+    buf->head  = 0;
+}
+
+
 static void *fragbuf_ensure(iot_fragbuf_t *buf, size_t size)
 {
-    int more;
+    int nsize;
 
     if (buf->size - buf->used < (int)size) {
-        more = size - (buf->size - buf->used);
+        if (buf->head > 0)
+            fragbuf_compact(buf);
 
-        if (iot_reallocz(buf->data, buf->size, buf->size + more) == NULL)
-            return NULL;
-        else
-            buf->size += more;
+        if (buf->size - buf->used < (int)size) {
+            nsize = buf->size ? 2 * buf->size : FRAGBUF_MIN;
+
+            if (nsize < buf->used + (int)size)
+                nsize = buf->used + (int)size;
+
+            if (iot_reallocz(buf->data, buf->size, nsize) == NULL)
+                return NULL;
+            else
+                buf->size = nsize;
+        }
     }
 
     return buf->data + buf->used;
 }
 
 
+static void fragbuf_consume(iot_fragbuf_t *buf, int offs)
+{
+    if (offs >= buf->used)
+        buf->head = buf->used = buf->scan = 0;
+    else
+        buf->head = offs;
+}
+
+
 size_t iot_fragbuf_used(iot_fragbuf_t *buf)
 {
-    return buf->used;
+    return buf->used - buf->head;
 }
 
 
 size_t iot_fragbuf_missing(iot_fragbuf_t *buf)
 {
-    void     *ptr;
-    int       offs;
-    uint32_t  size;
+    uint32_t size;
+    int      left;
 
-    if (!buf->framed || !buf->used)
+    if (!buf->framed || buf->used == buf->head)
         return 0;
 
-    /* find the last frame */
-    ptr  = buf->data;
-    offs = 0;
-    while (offs < buf->used) {
-        size  = be32toh(*(uint32_t *)ptr);
-        offs += sizeof(size) + size;
+    /* skip over the complete frames we have not scanned yet */
+    if (buf->scan < buf->head)
+        buf->scan = buf->head;
+
+    while ((left = buf->used - buf->scan) >= (int)sizeof(size)) {
+        size = frame_size(buf, buf->scan);
+
+        if ((size_t)left < sizeof(size) + (size_t)size)
+            return sizeof(size) + (size_t)size - left;
+
+        buf->scan += sizeof(size) + size;
     }
 
     /* get the amount of data missing */
-    return offs - buf->used;
+    return left > 0 ? sizeof(size) - left : 0;
 }
 
 
@@ -91,7 +148,9 @@ int fragbuf_init(iot_fragbuf_t *buf, int framed, int pre_alloc)
 {
     buf->data   = NULL;
     buf->size   = 0;
+    buf->head   = 0;
     buf->used   = 0;
+    buf->scan   = 0;
     buf->framed = framed;
 
     if (pre_alloc <= 0 || fragbuf_ensure(buf, pre_alloc))
@@ -124,7 +183,9 @@ void iot_fragbuf_reset(iot_fragbuf_t *buf)
         iot_free(buf->data);
         buf->data = NULL;
         buf->size = 0;
+        buf->head = 0;
         buf->used = 0;
+        buf->scan = 0;
     }
 }
 
@@ -159,6 +220,9 @@ int iot_fragbuf_trim(iot_fragbuf_t *buf, void *ptr, size_t osize, size_t nsize)
             diff = osize - nsize;
             buf->used -= diff;
 
+            if (buf->scan > buf->used)
+                buf->scan = buf->used;
+
             return TRUE;
         }
     }
@@ -184,16 +248,39 @@ int iot_fragbuf_push(iot_fragbuf_t *buf, void *data, size_t size)
 }
 
 
+static int pull_frame(iot_fragbuf_t *buf, void **datap, size_t *sizep)
+{
+    uint32_t size;
+    int      left;
+
+    left = buf->used - buf->head;
+
+    if (left < (int)sizeof(size))
+        return FALSE;
+
+    size = frame_size(buf, buf->head);
+
+    if ((size_t)left < sizeof(size) + (size_t)size)
+        return FALSE;
+
+    *datap = buf->data + buf->head + sizeof(size);
+    *sizep = size;
+
+    return TRUE;
+}
+
+
 int iot_fragbuf_pull(iot_fragbuf_t *buf, void **datap, size_t *sizep)
 {
     void     *data;
     uint32_t  size;
 
-    if (buf == NULL || buf->used <= 0)
+    if (buf == NULL || buf->used <= buf->head)
         return FALSE;
 
     if (IOT_UNLIKELY(*datap &&
-                     (*datap < buf->data || *datap > buf->data + buf->used))) {
+                     (*datap < buf->data + buf->head ||
+                      *datap > buf->data + buf->used))) {
         iot_log_warning("%s(): *** looks like we're called with an unreset "
                         "datap pointer... ***", __FUNCTION__);
     }
@@ -201,76 +288,59 @@ int iot_fragbuf_pull(iot_fragbuf_t *buf, void **datap, size_t *sizep)
     /* start of iteration */
     if (*datap == NULL) {
         if (!buf->framed) {
-            *datap = buf->data;
-            *sizep = buf->used;
+            *datap = buf->data + buf->head;
+            *sizep = buf->used - buf->head;
 
             return TRUE;
         }
-        else {
-            if (buf->used < (int)sizeof(size))
-                return FALSE;
-
-            size = be32toh(*(uint32_t *)buf->data);
-
-            if (buf->used >= (int)(sizeof(size) + size)) {
-                *datap = buf->data + sizeof(size);
-                *sizep = size;
-
-                return TRUE;
-            }
-            else
-                return FALSE;
-        }
+        else
+            return pull_frame(buf, datap, sizep);
     }
     /* continue iteration */
     else {
         if (!buf->framed) {
             data = *datap + *sizep;
 
-            if (buf->data <= data && data < buf->data + buf->used) {
-                memmove(buf->data, data, buf->used - (data - buf->data));
-                buf->used -= (data - buf->data);
+            if (buf->data + buf->head <= data && data < buf->data + buf->used) {
+                fragbuf_consume(buf, data - buf->data);
 
-                *datap = buf->data;
-                *sizep = buf->used;
+                *datap = data;
+                *sizep = buf->used - buf->head;
 
                 return TRUE;
             }
             else {
                 if (data == buf->data + buf->used)
-                    buf->used = 0;
+                    fragbuf_consume(buf, buf->used);
 
                 return FALSE;
             }
         }
         else {
-            if (*datap != buf->data + sizeof(size))
+            if (*datap != buf->data + buf->head + sizeof(size))
                 return FALSE;
 
-            size = be32toh(*(uint32_t *)buf->data);
+            size = frame_size(buf, buf->head);
 
-            if ((int)(size + sizeof(size)) <= buf->used) {
-                memmove(buf->data, buf->data + size + sizeof(size),
-                        buf->used - (size + sizeof(size)));
-                buf->used -= size + sizeof(size);
-            }
+            if (sizeof(size) + (size_t)size <= (size_t)(buf->used - buf->head))
+                fragbuf_consume(buf, buf->head + sizeof(size) + size);
             else
                 return FALSE;
 
-            if (buf->used <= (int)sizeof(size))
-                return FALSE;
+            return pull_frame(buf, datap, sizep);
+        }
+    }
+}
 
-            size = be32toh(*(uint32_t *)buf->data);
-            data = buf->data + sizeof(size);
 
-            if (buf->used >= (int)(size + sizeof(size))) {
-                *datap = data;
-                *sizep = size;
+uint32_t iot_fragbuf_flags(iot_fragbuf_t *buf, void *data)
+{
+    uint32_t size;
 
-                return TRUE;
-            }
+    if (buf == NULL || !buf->framed || data == NULL)
+        return 0;
 
-            return FALSE;
-        }
-    }
+    memcpy(&size, (char *)data - sizeof(size), sizeof(size));
+
+    return be32toh(size) & ~IOT_FRAGBUF_SIZE_MASK;
 }
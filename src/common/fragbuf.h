@@ -30,6 +30,8 @@
 #ifndef __IOT_FRAGBUF_H__
 #define __IOT_FRAGBUF_H__
 
+#include <stdint.h>
+
 #include <iot/common/macros.h>
 
 IOT_CDECL_BEGIN
@@ -52,11 +54,19 @@ IOT_CDECL_BEGIN
  * automatically from the collector buffer as you iterate through
  * them.
  *
+ * The topmost bits of the frame size are reserved for frame flags. The
+ * only flag currently defined marks frames with compressed message data.
+ * The flags of a frame returned by iot_fragbuf_pull can be queried using
+ * iot_fragbuf_flags.
+ *
  * You can also create a collector buffer in frameless mode. Such a
  * buffer will always return immediately all available data as you
  * iterate through it.
  */
 
+#define IOT_FRAGBUF_COMPRESSED 0x80000000U /* frame data is compressed */
+#define IOT_FRAGBUF_SIZE_MASK  0x7fffffffU /* mask of frame size bits */
+
 /** Buffer for collecting fragments of (framed or unframed) message data. */
 typedef struct iot_fragbuf_s iot_fragbuf_t;
 
@@ -90,6 +100,9 @@ int iot_fragbuf_push(iot_fragbuf_t *buf, void *data, size_t size);
 /** Iterate through the given buffer, pulling and freeing assembled messages. */
 int iot_fragbuf_pull(iot_fragbuf_t *buf, void **data, size_t *size);
 
+/** Return the flags of a frame returned by iot_fragbuf_pull. */
+uint32_t iot_fragbuf_flags(iot_fragbuf_t *buf, void *data);
+
 IOT_CDECL_END
 
 #endif /* __IOT_FRAGBUF_H__ */
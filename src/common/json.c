@@ -28,19 +28,56 @@
  */
 
 #include <errno.h>
+#include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#    include <emmintrin.h>
+#endif
 
 #include "iot/config.h"
 #include <iot/common/macros.h>
+#include <iot/common/mm.h>
 #include <iot/common/log.h>
 #include <iot/common/debug.h>
+#include <iot/common/hash-table.h>
 #include <iot/common/json.h>
 
-/** Type for a JSON parser. */
-typedef struct json_tokener iot_json_parser_t;
+#define JSON_MAX_DEPTH 128               /* max. nesting we clone/serialize */
+#define JSON_SCAN_MAX  8                 /* max. members to look up by scan */
+
+/** JSON parser context. */
+struct iot_json_parser_s {
+    json_tokener *tok;                   /* json-c tokener */
+    int           pending;               /* partial input consumed */
+};
+
+static pthread_once_t parser_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  parser_key;
+static int            parser_keyok;
+
+#ifdef HAVE_JSON_OBJECT_OBJECT_ADD_EX
+/*
+ * Member key interning.
+ *
+ * Most of the objects we build use a small set of constant keys (type,
+ * seqno, status, message, ...). Instead of letting json-c strdup every
+ * key of every member we add, we keep a bounded table of interned short
+ * keys and pass those to json-c as constant keys. Keys that are too long,
+ * or which do not fit into the table any more, are added as usual.
+ */
+
+#define INTERN_MAXLEN 32                 /* max. length of interned keys */
+#define INTERN_LIMIT  512                /* max. number of interned keys */
 
-static iot_json_parser_t *parser;
+static pthread_mutex_t  intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static iot_hashtbl_t   *intern_tbl;
+static int              intern_cnt;
+#endif
 
 iot_json_t *iot_json_create(iot_json_type_t type, ...)
 {
@@ -88,30 +125,813 @@ iot_json_t *iot_json_create(iot_json_type_t type, ...)
 }
 
 
-iot_json_t *iot_json_clone(iot_json_t *o)
+#ifdef HAVE_JSON_OBJECT_OBJECT_ADD_EX
+static const char *intern_key(const char *key)
 {
-    if (o != NULL)
-        return iot_json_string_to_object(iot_json_object_to_string(o), -1);
-    else
+    iot_hashtbl_config_t  hcfg;
+    char                 *k;
+
+    if (strnlen(key, INTERN_MAXLEN + 1) > INTERN_MAXLEN)
         return NULL;
+
+    pthread_mutex_lock(&intern_lock);
+
+    if (IOT_UNLIKELY(intern_tbl == NULL)) {
+        iot_clear(&hcfg);
+        hcfg.hash    = iot_hash_string;
+        hcfg.comp    = iot_comp_string;
+        hcfg.nbucket = INTERN_LIMIT / 4;
+
+        if ((intern_tbl = iot_hashtbl_create(&hcfg)) == NULL) {
+            k = NULL;
+            goto out;
+        }
+    }
+
+    k = iot_hashtbl_lookup(intern_tbl, key, IOT_HASH_COOKIE_NONE);
+
+    if (k == NULL && intern_cnt < INTERN_LIMIT) {
+        if ((k = iot_strdup(key)) != NULL) {
+            if (iot_hashtbl_add(intern_tbl, k, k, NULL) == 0)
+                intern_cnt++;
+            else {
+                iot_free(k);
+                k = NULL;
+            }
+        }
+    }
+
+ out:
+    pthread_mutex_unlock(&intern_lock);
+
+    return k;
 }
+#endif
 
 
-iot_json_t *iot_json_string_to_object(const char *s, int len)
+static inline void object_add(iot_json_t *o, const char *key, iot_json_t *m)
+{
+#ifdef HAVE_JSON_OBJECT_OBJECT_ADD_EX
+    const char *k;
+
+    if ((k = intern_key(key)) != NULL) {
+        json_object_object_add_ex(o, k, m, JSON_C_OBJECT_KEY_IS_CONSTANT);
+        return;
+    }
+#endif
+
+    json_object_object_add(o, key, m);
+}
+
+
+static iot_json_t *clone_object(iot_json_t *o, int depth)
 {
-    if (parser == NULL) {
-        parser = json_tokener_new();
+    struct lh_entry *e;
+    iot_json_t      *c, *v, *m;
+    int              i, n;
+
+    if (o == NULL)
+        return NULL;
+
+    if (depth > JSON_MAX_DEPTH) {
+        errno = EINVAL;
+        return NULL;
+    }
 
-        if (parser == NULL)
+    switch (json_object_get_type(o)) {
+    case json_type_boolean:
+        return json_object_new_boolean(json_object_get_boolean(o));
+    case json_type_int:
+        return json_object_new_int64(json_object_get_int64(o));
+    case json_type_double:
+        return json_object_new_double(json_object_get_double(o));
+    case json_type_string:
+        return json_object_new_string_len(json_object_get_string(o),
+                                          json_object_get_string_len(o));
+
+    case json_type_object:
+        if ((c = json_object_new_object()) == NULL)
             return NULL;
+        for (e = json_object_get_object(o)->head; e != NULL; e = e->next) {
+            m = (iot_json_t *)e->v;
+            if ((v = clone_object(m, depth + 1)) == NULL && m != NULL)
+                goto fail;
+            object_add(c, e->k, v);
+        }
+        return c;
+
+    case json_type_array:
+        if ((c = json_object_new_array()) == NULL)
+            return NULL;
+        n = json_object_array_length(o);
+        for (i = 0; i < n; i++) {
+            m = json_object_array_get_idx(o, i);
+            if ((v = clone_object(m, depth + 1)) == NULL && m != NULL)
+                goto fail;
+            if (json_object_array_put_idx(c, i, v) != 0) {
+                json_object_put(v);
+                goto fail;
+            }
+        }
+        return c;
+
+    default:
+        return NULL;
+    }
+
+ fail:
+    json_object_put(c);
+    return NULL;
+}
+
+
+iot_json_t *iot_json_clone(iot_json_t *o)
+{
+    return clone_object(o, 0);
+}
+
+
+static void free_thread_tokener(void *tok)
+{
+    json_tokener_free(tok);
+}
+
+
+static void create_parser_key(void)
+{
+    parser_keyok = (pthread_key_create(&parser_key, free_thread_tokener) == 0);
+}
+
+
+static json_tokener *get_thread_tokener(void)
+{
+    json_tokener *tok;
+
+    pthread_once(&parser_once, create_parser_key);
+
+    if (IOT_UNLIKELY(!parser_keyok)) {
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    if ((tok = pthread_getspecific(parser_key)) != NULL) {
+        json_tokener_reset(tok);
+        return tok;
+    }
+
+    if ((tok = json_tokener_new()) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (pthread_setspecific(parser_key, tok) != 0) {
+        json_tokener_free(tok);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return tok;
+}
+
+
+static inline enum json_tokener_error tokener_error(json_tokener *tok)
+{
+#ifdef HAVE_JSON_TOKENER_GET_ERROR
+    return json_tokener_get_error(tok);
+#else
+    return tok->err;
+#endif
+}
+
+
+/*
+ * fast path parser
+ *
+ * Our messages are almost always plain, strict JSON objects which consist
+ * mostly of short keys and string values. The fast path parses these in
+ * a single pass directly into json-c objects, without going through the
+ * byte-by-byte state machine and intermediate printbuf of json_tokener.
+ * String bodies are scanned for their terminating quote 16 bytes at a time
+ * using SSE2 when available, and 8 bytes at a time otherwise.
+ *
+ * Anything the fast path does not handle (malformed input, top-level
+ * scalars, comments and other json-c extensions, unescaped control
+ * characters, integer overflow, lone surrogates, excessive nesting) makes
+ * it bail out and leave the input to json_tokener, so the results and
+ * error semantics stay those of json-c.
+ */
+
+#define FAST_MAX_DEPTH 16                /* max. nesting, json-c allows 32 */
+#define FAST_KEY_MAX   64                /* max. key length kept on stack */
+
+typedef struct {
+    const char *p;                       /* parsing position */
+    const char *end;                     /* end of input */
+    char       *buf;                     /* scratch buffer for unescaping */
+    size_t      size;                    /* size of scratch buffer */
+    char        sbuf[256];               /* initial scratch buffer */
+} fast_t;
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define HAS_LESS(w, n) (((w) - ONES * (n)) & ~(w) & HIGHS)
+#define HAS_BYTE(w, b) HAS_LESS((w) ^ (ONES * (b)), 1)
+
+static inline const char *scan_string(const char *p, const char *end)
+{
+    int c;
+
+#ifdef __SSE2__
+    const __m128i quote  = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl   = _mm_set1_epi8(0x1f);
+    __m128i       v, m;
+    int           mask;
+
+    while (end - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *)p);
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+
+        if ((mask = _mm_movemask_epi8(m)) != 0)
+            return p + __builtin_ctz(mask);
+
+        p += 16;
+    }
+#else
+    uint64_t w;
+
+    while (end - p >= 8) {
+        memcpy(&w, p, sizeof(w));
+
+        if (HAS_BYTE(w, '"') | HAS_BYTE(w, '\\') | HAS_LESS(w, 0x20))
+            break;
+
+        p += 8;
+    }
+#endif
+
+    while (p < end) {
+        c = *(unsigned char *)p;
+        if (c == '"' || c == '\\' || c < 0x20)
+            return p;
+        p++;
+    }
+
+    return end;
+}
+
+
+static inline void fast_skip_ws(fast_t *f)
+{
+    while (f->p < f->end &&
+           (*f->p == ' ' || *f->p == '\n' || *f->p == '\t' || *f->p == '\r'))
+        f->p++;
+}
+
+
+static int fast_scratch(fast_t *f, size_t size)
+{
+    char *buf;
+
+    if (size <= f->size)
+        return 0;
+
+    size = (size + 1023) & ~1023;
+
+    if (f->buf == f->sbuf) {
+        if ((buf = iot_alloc(size)) != NULL)
+            memcpy(buf, f->buf, f->size);
     }
     else
-        json_tokener_reset(parser);
+        buf = iot_realloc(f->buf, size);
+
+    if (buf == NULL)
+        return -1;
+
+    f->buf  = buf;
+    f->size = size;
+
+    return 0;
+}
+
+
+static int fast_hex4(const char *p, uint32_t *up)
+{
+    uint32_t u;
+    int      c, i;
+
+    for (i = 0, u = 0; i < 4; i++) {
+        c = p[i];
+
+        if      (c >= '0' && c <= '9') c -= '0';
+        else if (c >= 'a' && c <= 'f') c -= 'a' - 10;
+        else if (c >= 'A' && c <= 'F') c -= 'A' - 10;
+        else
+            return -1;
+
+        u = (u << 4) | c;
+    }
+
+    *up = u;
+
+    return 0;
+}
+
+
+static int fast_string(fast_t *f, const char **sp, size_t *lp)
+{
+    const char *s, *p, *end;
+    uint32_t    u, l;
+    size_t      n;
+    char       *d;
+
+    s   = f->p;
+    end = f->end;
+    p   = scan_string(s, end);
+
+    if (IOT_LIKELY(p < end && *p == '"')) {
+        *sp  = s;
+        *lp  = p - s;
+        f->p = p + 1;
+
+        return 0;
+    }
+
+    n = 0;
+
+    for (;;) {
+        if (p >= end || (*p != '"' && *p != '\\'))
+            return -1;
+
+        if (fast_scratch(f, n + (p - s) + 4) < 0)
+            return -1;
+
+        memcpy(f->buf + n, s, p - s);
+        n += p - s;
+
+        if (*p == '"')
+            break;
+
+        if (++p >= end)
+            return -1;
+
+        d = f->buf + n;
+
+        switch (*p++) {
+        case '"':  *d = '"';  n++; break;
+        case '\\': *d = '\\'; n++; break;
+        case '/':  *d = '/';  n++; break;
+        case 'b':  *d = '\b'; n++; break;
+        case 'f':  *d = '\f'; n++; break;
+        case 'n':  *d = '\n'; n++; break;
+        case 'r':  *d = '\r'; n++; break;
+        case 't':  *d = '\t'; n++; break;
+        case 'u':
+            if (end - p < 4 || fast_hex4(p, &u) < 0)
+                return -1;
+            p += 4;
+
+            if (u >= 0xdc00 && u <= 0xdfff)
+                return -1;
+
+            if (u >= 0xd800 && u <= 0xdbff) {
+                if (end - p < 6 || p[0] != '\\' || p[1] != 'u' ||
+                    fast_hex4(p + 2, &l) < 0 || l < 0xdc00 || l > 0xdfff)
+                    return -1;
+                p += 6;
+                u  = 0x10000 + ((u - 0xd800) << 10) + (l - 0xdc00);
+            }
+
+            if (u < 0x80) {
+                d[0] = u;
+                n += 1;
+            }
+            else if (u < 0x800) {
+                d[0] = 0xc0 | (u >> 6);
+                d[1] = 0x80 | (u & 0x3f);
+                n += 2;
+            }
+            else if (u < 0x10000) {
+                d[0] = 0xe0 | (u >> 12);
+                d[1] = 0x80 | ((u >> 6) & 0x3f);
+                d[2] = 0x80 | (u & 0x3f);
+                n += 3;
+            }
+            else {
+                d[0] = 0xf0 | (u >> 18);
+                d[1] = 0x80 | ((u >> 12) & 0x3f);
+                d[2] = 0x80 | ((u >> 6) & 0x3f);
+                d[3] = 0x80 | (u & 0x3f);
+                n += 4;
+            }
+            break;
+        default:
+            return -1;
+        }
+
+        s = p;
+        p = scan_string(p, end);
+    }
+
+    *sp  = f->buf;
+    *lp  = n;
+    f->p = p + 1;
+
+    return 0;
+}
+
+
+static int fast_number(fast_t *f, iot_json_t **op)
+{
+    const char *p, *s, *end;
+    uint64_t    u, d;
+    int         neg, dbl;
+    char        buf[64];
+
+    s   = f->p;
+    p   = s;
+    end = f->end;
+    neg = (*p == '-');
+    dbl = FALSE;
+
+    if (neg)
+        p++;
+
+    if (p >= end || *p < '0' || *p > '9')
+        return -1;
+
+    if (*p == '0' && p + 1 < end && p[1] >= '0' && p[1] <= '9')
+        return -1;
+
+    for (u = 0; p < end && *p >= '0' && *p <= '9'; p++) {
+        d = *p - '0';
+        if (u > (UINT64_MAX - d) / 10)
+            return -1;
+        u = u * 10 + d;
+    }
+
+    if (p < end && *p == '.') {
+        dbl = TRUE;
+        if (++p >= end || *p < '0' || *p > '9')
+            return -1;
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        dbl = TRUE;
+        if (++p < end && (*p == '+' || *p == '-'))
+            p++;
+        if (p >= end || *p < '0' || *p > '9')
+            return -1;
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+    }
+
+    if (!dbl) {
+        if (neg ? u > (uint64_t)INT64_MAX + 1 : u > (uint64_t)INT64_MAX)
+            return -1;
+        *op = json_object_new_int64(neg ? (int64_t)(0 - u) : (int64_t)u);
+    }
+    else {
+        if (p - s >= (int)sizeof(buf))
+            return -1;
+        memcpy(buf, s, p - s);
+        buf[p - s] = '\0';
+        *op = json_object_new_double(strtod(buf, NULL));
+    }
+
+    f->p = p;
+
+    return *op != NULL ? 0 : -1;
+}
+
+
+static int fast_value(fast_t *f, iot_json_t **op, int depth);
+
+static int fast_object(fast_t *f, iot_json_t **op, int depth)
+{
+    iot_json_t *o, *v;
+    const char *k;
+    size_t      l;
+    char        kbuf[FAST_KEY_MAX], *key;
+
+    if ((o = json_object_new_object()) == NULL)
+        return -1;
+
+    fast_skip_ws(f);
+
+    if (f->p < f->end && *f->p == '}') {
+        f->p++;
+        *op = o;
+        return 0;
+    }
+
+    for (;;) {
+        if (f->p >= f->end || *f->p != '"')
+            goto fail;
+
+        f->p++;
+
+        if (fast_string(f, &k, &l) < 0 || memchr(k, '\0', l) != NULL)
+            goto fail;
+
+        if (l < sizeof(kbuf))
+            key = kbuf;
+        else if ((key = iot_alloc(l + 1)) == NULL)
+            goto fail;
+
+        memcpy(key, k, l);
+        key[l] = '\0';
+
+        fast_skip_ws(f);
+
+        if (f->p >= f->end || *f->p != ':') {
+        fail_key:
+            if (key != kbuf)
+                iot_free(key);
+            goto fail;
+        }
+
+        f->p++;
+        fast_skip_ws(f);
+
+        if (fast_value(f, &v, depth) < 0)
+            goto fail_key;
+
+        object_add(o, key, v);
+
+        if (key != kbuf)
+            iot_free(key);
+
+        fast_skip_ws(f);
+
+        if (f->p >= f->end)
+            goto fail;
+
+        if (*f->p == ',') {
+            f->p++;
+            fast_skip_ws(f);
+            continue;
+        }
+
+        if (*f->p == '}') {
+            f->p++;
+            break;
+        }
+
+        goto fail;
+    }
+
+    *op = o;
+    return 0;
+
+ fail:
+    json_object_put(o);
+    return -1;
+}
+
+
+static int fast_array(fast_t *f, iot_json_t **op, int depth)
+{
+    iot_json_t *a, *v;
+
+    if ((a = json_object_new_array()) == NULL)
+        return -1;
+
+    fast_skip_ws(f);
+
+    if (f->p < f->end && *f->p == ']') {
+        f->p++;
+        *op = a;
+        return 0;
+    }
+
+    for (;;) {
+        if (fast_value(f, &v, depth) < 0)
+            goto fail;
+
+        if (json_object_array_add(a, v) != 0) {
+            json_object_put(v);
+            goto fail;
+        }
+
+        fast_skip_ws(f);
+
+        if (f->p >= f->end)
+            goto fail;
+
+        if (*f->p == ',') {
+            f->p++;
+            fast_skip_ws(f);
+            continue;
+        }
+
+        if (*f->p == ']') {
+            f->p++;
+            break;
+        }
+
+        goto fail;
+    }
+
+    *op = a;
+    return 0;
+
+ fail:
+    json_object_put(a);
+    return -1;
+}
+
+
+static inline int fast_literal(fast_t *f, const char *lit, size_t len)
+{
+    if ((size_t)(f->end - f->p) < len || memcmp(f->p, lit, len) != 0)
+        return -1;
+
+    f->p += len;
+
+    return 0;
+}
+
+
+static int fast_value(fast_t *f, iot_json_t **op, int depth)
+{
+    const char *s;
+    size_t      l;
+
+    if (f->p >= f->end)
+        return -1;
+
+    switch (*f->p) {
+    case '{':
+    case '[':
+        if (depth >= FAST_MAX_DEPTH)
+            return -1;
+        return *f->p++ == '{' ?
+            fast_object(f, op, depth + 1) : fast_array(f, op, depth + 1);
+
+    case '"':
+        f->p++;
+        if (fast_string(f, &s, &l) < 0)
+            return -1;
+        *op = json_object_new_string_len(s, l);
+        return *op != NULL ? 0 : -1;
+
+    case 't':
+        *op = json_object_new_boolean(TRUE);
+        if (fast_literal(f, "true", 4) == 0)
+            return 0;
+        json_object_put(*op);
+        return -1;
+
+    case 'f':
+        *op = json_object_new_boolean(FALSE);
+        if (fast_literal(f, "false", 5) == 0)
+            return 0;
+        json_object_put(*op);
+        return -1;
+
+    case 'n':
+        *op = NULL;
+        return fast_literal(f, "null", 4);
+
+    default:
+        return fast_number(f, op);
+    }
+}
+
+
+static int fast_parse(const char *str, int len, iot_json_t **op)
+{
+    fast_t f;
+    int    r;
+
+    f.p    = str;
+    f.end  = str + len;
+    f.buf  = f.sbuf;
+    f.size = sizeof(f.sbuf);
+
+    fast_skip_ws(&f);
+
+    if (f.p >= f.end || (*f.p != '{' && *f.p != '['))
+        return -1;
+
+    *op = NULL;
+    r   = fast_value(&f, op, 0);
+
+    fast_skip_ws(&f);                    /* json_tokener eats it, too */
+
+    if (f.buf != f.sbuf)
+        iot_free(f.buf);
+
+    return r < 0 ? -1 : (int)(f.p - str);
+}
+
+
+iot_json_t *iot_json_string_to_object(const char *s, int len)
+{
+    json_tokener *tok;
+    iot_json_t   *o;
 
     if (len < 0)
         len = strlen(s);
 
-    return json_tokener_parse_ex(parser, s, len);
+    if (fast_parse(s, len, &o) >= 0)
+        return o;
+
+    if ((tok = get_thread_tokener()) == NULL)
+        return NULL;
+
+    return json_tokener_parse_ex(tok, s, len);
+}
+
+
+iot_json_parser_t *iot_json_parser_create(void)
+{
+    iot_json_parser_t *p;
+
+    if ((p = iot_allocz(sizeof(*p))) == NULL)
+        return NULL;
+
+    if ((p->tok = json_tokener_new()) == NULL) {
+        iot_free(p);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return p;
+}
+
+
+void iot_json_parser_destroy(iot_json_parser_t *p)
+{
+    if (p == NULL)
+        return;
+
+    json_tokener_free(p->tok);
+    iot_free(p);
+}
+
+
+void iot_json_parser_reset(iot_json_parser_t *p)
+{
+    json_tokener_reset(p->tok);
+    p->pending = FALSE;
+}
+
+
+int iot_json_parser_feed(iot_json_parser_t *p, const char *str, int len,
+                         iot_json_t **op)
+{
+    iot_json_t *o;
+    int         n;
+
+    *op = NULL;
+
+    if (len < 0)
+        len = strlen(str);
+
+    if (len == 0)
+        return 0;
+
+    /* try the fast path if the input looks like a complete object */
+    if (!p->pending) {
+        for (n = len - 1; n > 0 && isspace((unsigned char)str[n]); n--)
+            ;
+
+        if ((str[n] == '}' || str[n] == ']') &&
+            (n = fast_parse(str, len, op)) >= 0)
+            return n;
+    }
+
+    o = json_tokener_parse_ex(p->tok, str, len);
+
+    if (o != NULL) {
+        n = p->tok->char_offset;
+        iot_json_parser_reset(p);
+        *op = o;
+
+        return n;
+    }
+
+    if (tokener_error(p->tok) != json_tokener_continue) {
+        iot_json_parser_reset(p);
+        errno = EINVAL;
+
+        return -1;
+    }
+
+    p->pending = TRUE;
+
+    return len;
+}
+
+
+int iot_json_parser_pending(iot_json_parser_t *p)
+{
+    return p->pending;
 }
 
 
@@ -124,6 +944,264 @@ const char *iot_json_object_to_string(iot_json_t *o)
 }
 
 
+/*
+ * streaming serializer
+ */
+
+#define JSON_BUF_MIN   256               /* minimum output buffer size */
+
+int iot_json_buf_reserve(iot_json_buf_t *b, size_t n)
+{
+    size_t  size;
+    char   *data;
+
+    if (IOT_LIKELY(b->used + n < b->size))      /* keep room for '\0' */
+        return 0;
+
+    size = b->size ? b->size : JSON_BUF_MIN;
+
+    while (size <= b->used + n)
+        size *= 2;
+
+    if ((data = iot_realloc(b->data, size)) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    b->data = data;
+    b->size = size;
+
+    return 0;
+}
+
+
+static inline int buf_append(iot_json_buf_t *b, const char *s, size_t n)
+{
+    if (iot_json_buf_reserve(b, n) < 0)
+        return -1;
+
+    memcpy(b->data + b->used, s, n);
+    b->used += n;
+
+    return 0;
+}
+
+
+static inline int buf_putc(iot_json_buf_t *b, char c)
+{
+    if (iot_json_buf_reserve(b, 1) < 0)
+        return -1;
+
+    b->data[b->used++] = c;
+
+    return 0;
+}
+
+
+static int serialize_string(iot_json_buf_t *b, const char *s, int len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *p, *end;
+    char        esc[6];
+    int         c, n;
+
+    if (buf_putc(b, '"') < 0)
+        return -1;
+
+    p   = s;
+    end = s + len;
+
+    while (p < end) {
+        for (s = p; p < end; p++) {
+            c = *(unsigned char *)p;
+            if (c < 0x20 || c == '"' || c == '\\')
+                break;
+        }
+
+        if (p > s && buf_append(b, s, p - s) < 0)
+            return -1;
+
+        if (p >= end)
+            break;
+
+        esc[0] = '\\';
+        n      = 2;
+
+        switch ((c = *(unsigned char *)p++)) {
+        case '"':  esc[1] = '"';  break;
+        case '\\': esc[1] = '\\'; break;
+        case '\b': esc[1] = 'b';  break;
+        case '\f': esc[1] = 'f';  break;
+        case '\n': esc[1] = 'n';  break;
+        case '\r': esc[1] = 'r';  break;
+        case '\t': esc[1] = 't';  break;
+        default:
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xf];
+            n      = 6;
+        }
+
+        if (buf_append(b, esc, n) < 0)
+            return -1;
+    }
+
+    return buf_putc(b, '"');
+}
+
+
+static int serialize_integer(iot_json_buf_t *b, int64_t i)
+{
+    char     digits[24], *p;
+    uint64_t u;
+
+    p = digits + sizeof(digits);
+    u = i < 0 ? -(uint64_t)i : (uint64_t)i;
+
+    do {
+        *--p = '0' + u % 10;
+        u   /= 10;
+    } while (u != 0);
+
+    if (i < 0)
+        *--p = '-';
+
+    return buf_append(b, p, digits + sizeof(digits) - p);
+}
+
+
+static int serialize_double(iot_json_buf_t *b, double d)
+{
+    char *p;
+    int   n;
+
+    if (isnan(d))
+        return buf_append(b, "NaN", 3);
+    if (isinf(d))
+        return d < 0 ? buf_append(b, "-Infinity", 9) :
+            buf_append(b, "Infinity", 8);
+
+    if (iot_json_buf_reserve(b, 32) < 0)
+        return -1;
+
+    p = b->data + b->used;
+    n = snprintf(p, 32, "%.17g", d);
+
+    if (n < 0 || n >= 30)
+        return -1;
+
+    if (strpbrk(p, ".eE") == NULL) {
+        p[n++] = '.';
+        p[n++] = '0';
+    }
+
+    b->used += n;
+
+    return 0;
+}
+
+
+static int serialize_value(iot_json_buf_t *b, iot_json_t *o, int depth)
+{
+    struct lh_entry *e;
+    iot_json_t      *v;
+    int              i, n;
+
+    if (o == NULL)
+        return buf_append(b, "null", 4);
+
+    if (depth > JSON_MAX_DEPTH) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (json_object_get_type(o)) {
+    case json_type_null:
+        return buf_append(b, "null", 4);
+
+    case json_type_boolean:
+        return json_object_get_boolean(o) ?
+            buf_append(b, "true", 4) : buf_append(b, "false", 5);
+
+    case json_type_int:
+        return serialize_integer(b, json_object_get_int64(o));
+
+    case json_type_double:
+        return serialize_double(b, json_object_get_double(o));
+
+    case json_type_string:
+        return serialize_string(b, json_object_get_string(o),
+                                json_object_get_string_len(o));
+
+    case json_type_object:
+        if (buf_putc(b, '{') < 0)
+            return -1;
+        for (e = json_object_get_object(o)->head; e != NULL; e = e->next) {
+            if (e != json_object_get_object(o)->head && buf_putc(b, ',') < 0)
+                return -1;
+            if (serialize_string(b, e->k, strlen(e->k)) < 0 ||
+                buf_putc(b, ':') < 0 ||
+                serialize_value(b, (iot_json_t *)e->v, depth + 1) < 0)
+                return -1;
+        }
+        return buf_putc(b, '}');
+
+    case json_type_array:
+        if (buf_putc(b, '[') < 0)
+            return -1;
+        n = json_object_array_length(o);
+        for (i = 0; i < n; i++) {
+            v = json_object_array_get_idx(o, i);
+            if ((i > 0 && buf_putc(b, ',') < 0) ||
+                serialize_value(b, v, depth + 1) < 0)
+                return -1;
+        }
+        return buf_putc(b, ']');
+
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+
+ssize_t iot_json_serialize(iot_json_t *o, iot_json_buf_t *b, size_t hdr)
+{
+    b->used = 0;
+
+    if (iot_json_buf_reserve(b, hdr) < 0)
+        return -1;
+
+    b->used = hdr;
+
+    if (o == NULL) {
+        if (buf_append(b, "{}", 2) < 0)
+            return -1;
+    }
+    else {
+        if (serialize_value(b, o, 0) < 0) {
+            b->used = 0;
+            return -1;
+        }
+    }
+
+    b->data[b->used] = '\0';
+
+    return (ssize_t)(b->used - hdr);
+}
+
+
+void iot_json_buf_cleanup(iot_json_buf_t *b)
+{
+    iot_free(b->data);
+    b->data = NULL;
+    b->size = 0;
+    b->used = 0;
+}
+
+
 iot_json_t *iot_json_ref(iot_json_t *o)
 {
     return json_object_get(o);
@@ -150,7 +1228,7 @@ int iot_json_is_type(iot_json_t *o, iot_json_type_t type)
 
 void iot_json_add(iot_json_t *o, const char *key, iot_json_t *m)
 {
-    json_object_object_add(o, key, m);
+    object_add(o, key, m);
 }
 
 
@@ -199,7 +1277,7 @@ iot_json_t *iot_json_add_member(iot_json_t *o, const char *key,
     va_end(ap);
 
     if (m != NULL)
-        json_object_object_add(o, key, m);
+        object_add(o, key, m);
 
     return m;
 }
@@ -270,16 +1348,28 @@ iot_json_t *iot_json_add_array(iot_json_t *o, const char *key,
 
 iot_json_t *iot_json_get(iot_json_t *o, const char *key)
 {
-    iot_json_iter_t  it;
-    const char      *k;
+    struct lh_table *t;
+    struct lh_entry *e;
     iot_json_t      *v;
 
-    iot_json_foreach_member(o, k, v, it) {
-        if (!strcmp(k, key))
-            return v;
+    if (!json_object_is_type(o, json_type_object))
+        return NULL;
+
+    /* scanning small objects is cheaper than hashing the key */
+    t = json_object_get_object(o);
+
+    if (t->count <= JSON_SCAN_MAX) {
+        for (e = t->head; e != NULL; e = e->next)
+            if (!strcmp(e->k, key))
+                return (iot_json_t *)e->v;
+
+        return NULL;
     }
 
-    return NULL;
+    if (json_object_object_get_ex(o, key, &v))
+        return v;
+    else
+        return NULL;
 }
 
 
@@ -557,7 +1647,7 @@ int iot_json_array_get_item(iot_json_t *a, int idx, iot_json_type_t type, ...)
 int iot_json_parse_object(char **strp, int *lenp, iot_json_t **op)
 {
     char         *str;
-    int           len;
+    int           len, n;
     iot_json_t   *o   = NULL;
     json_tokener *tok = NULL;
     int           res = -1;
@@ -576,7 +1666,16 @@ int iot_json_parse_object(char **strp, int *lenp, iot_json_t **op)
     if (len <= 0)
         len = strlen(str);
 
-    tok = json_tokener_new();
+    if ((n = fast_parse(str, len, &o)) >= 0) {
+        *strp += n;
+        if (lenp != NULL)
+            *lenp -= n;
+
+        *op = o;
+        return 0;
+    }
+
+    tok = get_thread_tokener();
 
     if (tok != NULL) {
         o = json_tokener_parse_ex(tok, str, len);
@@ -589,21 +1688,12 @@ int iot_json_parse_object(char **strp, int *lenp, iot_json_t **op)
             res = 0;
         }
         else {
-#ifdef HAVE_JSON_TOKENER_GET_ERROR
-            if (json_tokener_get_error(tok) != json_tokener_success)
+            if (tokener_error(tok) != json_tokener_success)
                 errno = EINVAL;
-#else
-            if (tok->err != json_tokener_success)
-                errno = EINVAL;
-#endif
             else
                 res = 0;
         }
-
-        json_tokener_free(tok);
     }
-    else
-        errno = ENOMEM;
 
     *op = o;
     return res;
@@ -32,6 +32,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 #include "iot/config.h"
 
@@ -87,6 +88,64 @@ iot_json_t *iot_json_string_to_object(const char *str, int len);
 /** Serialize a JSON object to a string. */
 const char *iot_json_object_to_string(iot_json_t *o);
 
+/*
+ * Reusable JSON parser contexts.
+ *
+ * A parser context can be fed input in arbitrary pieces, for instance
+ * as it arrives from a socket. Once a full object has been parsed it is
+ * returned and the context is reset, ready to parse the next object. A
+ * context must not be used from several threads simultaneously. The
+ * one-shot parsing functions (iot_json_string_to_object, and
+ * iot_json_parse_object) use a cached per-thread context and are safe
+ * to call from multiple threads.
+ */
+
+/** Type for a JSON parser context. */
+typedef struct iot_json_parser_s iot_json_parser_t;
+
+/** Create a new JSON parser context. */
+iot_json_parser_t *iot_json_parser_create(void);
+
+/** Destroy the given JSON parser context. */
+void iot_json_parser_destroy(iot_json_parser_t *p);
+
+/** Reset the given parser context, discarding any partial input. */
+void iot_json_parser_reset(iot_json_parser_t *p);
+
+/** Feed input to a parser, returning the amount of consumed input. */
+int iot_json_parser_feed(iot_json_parser_t *p, const char *str, int len,
+                         iot_json_t **op);
+
+/** Check if the parser has consumed partial input for an object. */
+int iot_json_parser_pending(iot_json_parser_t *p);
+
+/*
+ * Output buffer for serializing JSON objects.
+ *
+ * iot_json_serialize writes the compact textual representation of an
+ * object directly into a caller-provided buffer, growing it as necessary.
+ * A number of bytes can be reserved in front of the serialized object,
+ * for instance to fill in a frame header in place before handing the
+ * buffer to a single write(2). The buffer is reused by subsequent calls
+ * so a single buffer per transport (or per thread) avoids reallocation
+ * once it has grown to the typical message size. A zeroed buffer is
+ * ready for use.
+ */
+typedef struct {
+    char   *data;                        /* buffer, NULL until first used */
+    size_t  size;                        /* allocated buffer size */
+    size_t  used;                        /* amount of data, with header */
+} iot_json_buf_t;
+
+/** Serialize a JSON object into the buffer after hdr bytes of headroom. */
+ssize_t iot_json_serialize(iot_json_t *o, iot_json_buf_t *b, size_t hdr);
+
+/** Make sure the buffer has room for at least n more bytes of data. */
+int iot_json_buf_reserve(iot_json_buf_t *b, size_t n);
+
+/** Free the memory allocated for the given JSON output buffer. */
+void iot_json_buf_cleanup(iot_json_buf_t *b);
+
 /** Add a reference to the given JSON object. */
 iot_json_t *iot_json_ref(iot_json_t *o);
 
@@ -344,9 +344,9 @@ void iot_log_msgv(iot_log_level_t level, const char *file,
                   int line, const char *func, const char *format,
                   va_list ap)
 {
-    static int    busy   = 0;
-    iot_logger_t  logger = log_target->logger;
-    void         *data   = log_target->data;
+    static __thread int  busy   = 0;    /* per-thread reentrancy guard */
+    iot_logger_t         logger = log_target->logger;
+    void                *data   = log_target->data;
 
     if (IOT_UNLIKELY(busy != 0))
         return;
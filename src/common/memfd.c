@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/log.h>
+#include <iot/common/memfd.h>
+
+#ifndef MFD_CLOEXEC
+#    define MFD_CLOEXEC       0x0001U
+#    define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#    define F_ADD_SEALS   (1024 + 9)
+#    define F_GET_SEALS   (1024 + 10)
+#    define F_SEAL_SEAL   0x0001
+#    define F_SEAL_SHRINK 0x0002
+#    define F_SEAL_GROW   0x0004
+#    define F_SEAL_WRITE  0x0008
+#endif
+
+#define SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+#define SIZE_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW)
+
+
+static int memfd_create_fd(const char *name, unsigned int flags)
+{
+#ifdef __NR_memfd_create
+    return syscall(__NR_memfd_create, name, flags);
+#else
+    IOT_UNUSED(name);
+    IOT_UNUSED(flags);
+
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+int iot_memfd_create(const char *name, size_t size, void **ptrp)
+{
+    void *ptr;
+    int   fd;
+
+    fd = memfd_create_fd(name ? name : "iot-payload",
+                         MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, size) < 0)
+        goto fail;
+
+    if (ptrp != NULL) {
+        if (size > 0) {
+            ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (ptr == MAP_FAILED)
+                goto fail;
+        }
+        else
+            ptr = NULL;
+
+        *ptrp = ptr;
+    }
+
+    return fd;
+
+ fail:
+    close(fd);
+    return -1;
+}
+
+
+int iot_memfd_seal(int fd, void *ptr, size_t size)
+{
+    /* writable shared mappings prevent sealing for writes */
+    if (ptr != NULL && size > 0)
+        munmap(ptr, size);
+
+    return fcntl(fd, F_ADD_SEALS, SEALS);
+}
+
+
+int iot_memfd_create_sealed(const char *name, const void *data, size_t size)
+{
+    void *ptr;
+    int   fd;
+
+    if ((fd = iot_memfd_create(name, size, &ptr)) < 0)
+        return -1;
+
+    if (size > 0)
+        memcpy(ptr, data, size);
+
+    if (iot_memfd_seal(fd, ptr, size) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+void *iot_memfd_map(int fd, size_t *sizep)
+{
+    struct stat  st;
+    void        *ptr;
+    int          seals;
+
+    /*
+     * Without the write and shrink seals the sender could still change
+     * the content underneath us, or truncate the file and have us take
+     * a SIGBUS while accessing the mapping.
+     */
+
+    seals = fcntl(fd, F_GET_SEALS);
+
+    if (seals < 0 ||
+        (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) !=
+        (F_SEAL_SHRINK | F_SEAL_WRITE)) {
+        if (seals >= 0)
+            errno = EPERM;
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0)
+        return NULL;
+
+    if (st.st_size == 0) {
+        errno = ENODATA;
+        return NULL;
+    }
+
+    ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    if (sizep != NULL)
+        *sizep = st.st_size;
+
+    return ptr;
+}
+
+
+void iot_memfd_unmap(void *ptr, size_t size)
+{
+    if (ptr != NULL)
+        munmap(ptr, size);
+}
+
+
+int iot_memfd_seal_size(int fd)
+{
+    return fcntl(fd, F_ADD_SEALS, SIZE_SEALS);
+}
+
+
+ssize_t iot_memfd_sealed_size(int fd)
+{
+    struct stat st;
+    int         seals;
+
+    /*
+     * A memory file shared writable with another process is safe to map
+     * only if that process can no longer shrink it underneath us.
+     */
+
+    seals = fcntl(fd, F_GET_SEALS);
+
+    if (seals < 0)
+        return -1;
+
+    if ((seals & SIZE_SEALS) != SIZE_SEALS) {
+        errno = EPERM;
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0)
+        return -1;
+
+    return st.st_size;
+}
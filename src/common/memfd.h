@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IOT_MEMFD_H__
+#define __IOT_MEMFD_H__
+
+#include <sys/types.h>
+
+#include <iot/common/macros.h>
+
+IOT_CDECL_BEGIN
+
+/*
+ * Sealed memory file payloads.
+ *
+ * These helpers can be used to pass large payloads between processes
+ * without copying them through the transport. The sender creates an
+ * anonymous memory file, fills it in through a writable mapping, then
+ * seals it, which prevents any further modification of its size or
+ * content. The resulting file descriptor can be passed to the receiver
+ * (for instance with iot_transport_sendjsonfds), which can then map it
+ * read-only and trust that the content does not change underneath it.
+ */
+
+/** Create a memory file of the given size, optionally mapping it writable. */
+int iot_memfd_create(const char *name, size_t size, void **ptrp);
+
+/** Unmap the writable mapping of a memory file and seal the file. */
+int iot_memfd_seal(int fd, void *ptr, size_t size);
+
+/** Create a sealed memory file with a copy of the given data. */
+int iot_memfd_create_sealed(const char *name, const void *data, size_t size);
+
+/** Map a sealed memory file read-only, returning its size in *sizep. */
+void *iot_memfd_map(int fd, size_t *sizep);
+
+/** Unmap a memory file mapped with iot_memfd_map. */
+void iot_memfd_unmap(void *ptr, size_t size);
+
+/** Seal the size of a memory file, leaving its content writable. */
+int iot_memfd_seal_size(int fd);
+
+/** Get the size of a memory file, failing unless its size is sealed. */
+ssize_t iot_memfd_sealed_size(int fd);
+
+IOT_CDECL_END
+
+#endif /* __IOT_MEMFD_H__ */
@@ -0,0 +1,534 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <endian.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/json.h>
+#include <iot/common/msgpack.h>
+
+#define MSGPACK_MAX_DEPTH 32             /* max. nesting we en/decode */
+#define MSGPACK_KEY_MAX   64             /* max. key length kept on stack */
+
+/*
+ * encoding
+ */
+
+static inline int put_bytes(iot_json_buf_t *b, const void *data, size_t size)
+{
+    if (iot_json_buf_reserve(b, size) < 0)
+        return -1;
+
+    memcpy(b->data + b->used, data, size);
+    b->used += size;
+
+    return 0;
+}
+
+
+static inline int put_byte(iot_json_buf_t *b, uint8_t v)
+{
+    return put_bytes(b, &v, 1);
+}
+
+
+static inline int put_tagged(iot_json_buf_t *b, uint8_t tag, uint64_t v,
+                             int size)
+{
+    uint8_t  buf[9];
+    uint16_t v16;
+    uint32_t v32;
+
+    buf[0] = tag;
+
+    switch (size) {
+    case 1:
+        buf[1] = (uint8_t)v;
+        break;
+    case 2:
+        v16 = htobe16((uint16_t)v);
+        memcpy(buf + 1, &v16, 2);
+        break;
+    case 4:
+        v32 = htobe32((uint32_t)v);
+        memcpy(buf + 1, &v32, 4);
+        break;
+    case 8:
+        v = htobe64(v);
+        memcpy(buf + 1, &v, 8);
+        break;
+    }
+
+    return put_bytes(b, buf, 1 + size);
+}
+
+
+static int encode_integer(iot_json_buf_t *b, int64_t i)
+{
+    if (i >= 0) {
+        if (i < 0x80)
+            return put_byte(b, (uint8_t)i);
+        if (i <= UINT8_MAX)
+            return put_tagged(b, 0xcc, i, 1);
+        if (i <= UINT16_MAX)
+            return put_tagged(b, 0xcd, i, 2);
+        if (i <= UINT32_MAX)
+            return put_tagged(b, 0xce, i, 4);
+        return put_tagged(b, 0xcf, i, 8);
+    }
+    else {
+        if (i >= -32)
+            return put_byte(b, (uint8_t)(0xe0 | (i + 32)));
+        if (i >= INT8_MIN)
+            return put_tagged(b, 0xd0, (uint8_t)i, 1);
+        if (i >= INT16_MIN)
+            return put_tagged(b, 0xd1, (uint16_t)i, 2);
+        if (i >= INT32_MIN)
+            return put_tagged(b, 0xd2, (uint32_t)i, 4);
+        return put_tagged(b, 0xd3, (uint64_t)i, 8);
+    }
+}
+
+
+static int encode_double(iot_json_buf_t *b, double d)
+{
+    uint64_t v;
+
+    memcpy(&v, &d, sizeof(v));
+
+    return put_tagged(b, 0xcb, v, 8);
+}
+
+
+static int encode_string(iot_json_buf_t *b, const char *s, size_t len)
+{
+    int r;
+
+    if (len < 32)
+        r = put_byte(b, 0xa0 | len);
+    else if (len <= UINT8_MAX)
+        r = put_tagged(b, 0xd9, len, 1);
+    else if (len <= UINT16_MAX)
+        r = put_tagged(b, 0xda, len, 2);
+    else
+        r = put_tagged(b, 0xdb, len, 4);
+
+    return r < 0 ? -1 : put_bytes(b, s, len);
+}
+
+
+static int encode_container(iot_json_buf_t *b, uint8_t fix, uint8_t tag16,
+                            size_t n)
+{
+    if (n < 16)
+        return put_byte(b, fix | n);
+    else if (n <= UINT16_MAX)
+        return put_tagged(b, tag16, n, 2);
+    else
+        return put_tagged(b, tag16 + 1, n, 4);
+}
+
+
+static int encode_value(iot_json_buf_t *b, iot_json_t *o, int depth)
+{
+    struct lh_entry *e;
+    int              i, n;
+
+    if (o == NULL)
+        return put_byte(b, 0xc0);
+
+    if (depth > MSGPACK_MAX_DEPTH) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (json_object_get_type(o)) {
+    case json_type_null:
+        return put_byte(b, 0xc0);
+
+    case json_type_boolean:
+        return put_byte(b, json_object_get_boolean(o) ? 0xc3 : 0xc2);
+
+    case json_type_int:
+        return encode_integer(b, json_object_get_int64(o));
+
+    case json_type_double:
+        return encode_double(b, json_object_get_double(o));
+
+    case json_type_string:
+        return encode_string(b, json_object_get_string(o),
+                             json_object_get_string_len(o));
+
+    case json_type_object:
+        n = json_object_object_length(o);
+        if (encode_container(b, 0x80, 0xde, n) < 0)
+            return -1;
+        for (e = json_object_get_object(o)->head; e != NULL; e = e->next) {
+            if (encode_string(b, e->k, strlen(e->k)) < 0 ||
+                encode_value(b, (iot_json_t *)e->v, depth + 1) < 0)
+                return -1;
+        }
+        return 0;
+
+    case json_type_array:
+        n = json_object_array_length(o);
+        if (encode_container(b, 0x90, 0xdc, n) < 0)
+            return -1;
+        for (i = 0; i < n; i++)
+            if (encode_value(b, json_object_array_get_idx(o, i), depth + 1) < 0)
+                return -1;
+        return 0;
+
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+
+ssize_t iot_msgpack_encode(iot_json_t *o, iot_json_buf_t *b, size_t hdr)
+{
+    b->used = 0;
+
+    if (iot_json_buf_reserve(b, hdr) < 0)
+        return -1;
+
+    b->used = hdr;
+
+    if (o == NULL) {
+        if (put_byte(b, 0x80) < 0)
+            return -1;
+    }
+    else {
+        if (encode_value(b, o, 0) < 0) {
+            b->used = 0;
+            return -1;
+        }
+    }
+
+    return (ssize_t)(b->used - hdr);
+}
+
+
+/*
+ * decoding
+ */
+
+typedef struct {
+    const uint8_t *p;                    /* decoding position */
+    const uint8_t *end;                  /* end of input */
+} dec_t;
+
+
+static inline int get_uint(dec_t *d, int size, uint64_t *vp)
+{
+    uint16_t v16;
+    uint32_t v32;
+    uint64_t v64;
+
+    if (d->end - d->p < size)
+        return -1;
+
+    switch (size) {
+    case 1:
+        *vp = *d->p;
+        break;
+    case 2:
+        memcpy(&v16, d->p, 2);
+        *vp = be16toh(v16);
+        break;
+    case 4:
+        memcpy(&v32, d->p, 4);
+        *vp = be32toh(v32);
+        break;
+    case 8:
+        memcpy(&v64, d->p, 8);
+        *vp = be64toh(v64);
+        break;
+    default:
+        return -1;
+    }
+
+    d->p += size;
+
+    return 0;
+}
+
+
+static int decode_value(dec_t *d, iot_json_t **op, int depth);
+
+static int decode_string(dec_t *d, uint64_t len, iot_json_t **op)
+{
+    if ((uint64_t)(d->end - d->p) < len || len > INT32_MAX)
+        return -1;
+
+    *op = json_object_new_string_len((const char *)d->p, (int)len);
+    d->p += len;
+
+    return *op != NULL ? 0 : -1;
+}
+
+
+static int decode_key(dec_t *d, const uint8_t **kp, uint64_t *lenp)
+{
+    uint8_t b;
+
+    if (d->p >= d->end)
+        return -1;
+
+    b = *d->p++;
+
+    if ((b & 0xe0) == 0xa0)
+        *lenp = b & 0x1f;
+    else if (b == 0xd9 || b == 0xc4) {
+        if (get_uint(d, 1, lenp) < 0)
+            return -1;
+    }
+    else if (b == 0xda || b == 0xc5) {
+        if (get_uint(d, 2, lenp) < 0)
+            return -1;
+    }
+    else if (b == 0xdb || b == 0xc6) {
+        if (get_uint(d, 4, lenp) < 0)
+            return -1;
+    }
+    else
+        return -1;
+
+    if ((uint64_t)(d->end - d->p) < *lenp)
+        return -1;
+
+    *kp   = d->p;
+    d->p += *lenp;
+
+    return 0;
+}
+
+
+static int decode_map(dec_t *d, uint64_t n, iot_json_t **op, int depth)
+{
+    iot_json_t    *o, *v;
+    const uint8_t *k;
+    char           kbuf[MSGPACK_KEY_MAX], *key;
+    uint64_t       i, l;
+
+    if ((uint64_t)(d->end - d->p) < 2 * n)
+        return -1;
+
+    if ((o = iot_json_create(IOT_JSON_OBJECT)) == NULL)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (decode_key(d, &k, &l) < 0)
+            goto fail;
+
+        if (l < sizeof(kbuf))
+            key = kbuf;
+        else if ((key = iot_alloc(l + 1)) == NULL)
+            goto fail;
+
+        memcpy(key, k, l);
+        key[l] = '\0';
+
+        if (decode_value(d, &v, depth + 1) < 0) {
+            if (key != kbuf)
+                iot_free(key);
+            goto fail;
+        }
+
+        iot_json_add(o, key, v);
+
+        if (key != kbuf)
+            iot_free(key);
+    }
+
+    *op = o;
+    return 0;
+
+ fail:
+    iot_json_unref(o);
+    return -1;
+}
+
+
+static int decode_array(dec_t *d, uint64_t n, iot_json_t **op, int depth)
+{
+    iot_json_t *a, *v;
+    uint64_t    i;
+
+    if ((uint64_t)(d->end - d->p) < n)
+        return -1;
+
+    if ((a = iot_json_create(IOT_JSON_ARRAY)) == NULL)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (decode_value(d, &v, depth + 1) < 0)
+            goto fail;
+
+        if (!iot_json_array_append(a, v)) {
+            iot_json_unref(v);
+            goto fail;
+        }
+    }
+
+    *op = a;
+    return 0;
+
+ fail:
+    iot_json_unref(a);
+    return -1;
+}
+
+
+static int decode_value(dec_t *d, iot_json_t **op, int depth)
+{
+    uint64_t u;
+    uint32_t f32;
+    uint8_t  b;
+    float    f;
+    double   dbl;
+
+    *op = NULL;
+
+    if (d->p >= d->end || depth > MSGPACK_MAX_DEPTH)
+        return -1;
+
+    b = *d->p++;
+
+    if (b < 0x80) {
+        *op = json_object_new_int64(b);
+        goto out;
+    }
+    if (b >= 0xe0) {
+        *op = json_object_new_int64((int8_t)b);
+        goto out;
+    }
+    if ((b & 0xf0) == 0x80)
+        return decode_map(d, b & 0x0f, op, depth);
+    if ((b & 0xf0) == 0x90)
+        return decode_array(d, b & 0x0f, op, depth);
+    if ((b & 0xe0) == 0xa0)
+        return decode_string(d, b & 0x1f, op);
+
+    switch (b) {
+    case 0xc0:
+        return 0;
+    case 0xc2:
+    case 0xc3:
+        *op = json_object_new_boolean(b == 0xc3);
+        goto out;
+
+    case 0xc4: case 0xd9:
+        return get_uint(d, 1, &u) < 0 ? -1 : decode_string(d, u, op);
+    case 0xc5: case 0xda:
+        return get_uint(d, 2, &u) < 0 ? -1 : decode_string(d, u, op);
+    case 0xc6: case 0xdb:
+        return get_uint(d, 4, &u) < 0 ? -1 : decode_string(d, u, op);
+
+    case 0xca:
+        if (get_uint(d, 4, &u) < 0)
+            return -1;
+        f32 = (uint32_t)u;
+        memcpy(&f, &f32, sizeof(f));
+        *op = json_object_new_double(f);
+        goto out;
+    case 0xcb:
+        if (get_uint(d, 8, &u) < 0)
+            return -1;
+        memcpy(&dbl, &u, sizeof(dbl));
+        *op = json_object_new_double(dbl);
+        goto out;
+
+    case 0xcc: case 0xcd: case 0xce: case 0xcf:
+        if (get_uint(d, 1 << (b - 0xcc), &u) < 0)
+            return -1;
+        if (u > INT64_MAX)
+            *op = json_object_new_double((double)u);
+        else
+            *op = json_object_new_int64((int64_t)u);
+        goto out;
+
+    case 0xd0:
+        if (get_uint(d, 1, &u) < 0)
+            return -1;
+        *op = json_object_new_int64((int8_t)u);
+        goto out;
+    case 0xd1:
+        if (get_uint(d, 2, &u) < 0)
+            return -1;
+        *op = json_object_new_int64((int16_t)u);
+        goto out;
+    case 0xd2:
+        if (get_uint(d, 4, &u) < 0)
+            return -1;
+        *op = json_object_new_int64((int32_t)u);
+        goto out;
+    case 0xd3:
+        if (get_uint(d, 8, &u) < 0)
+            return -1;
+        *op = json_object_new_int64((int64_t)u);
+        goto out;
+
+    case 0xdc:
+        return get_uint(d, 2, &u) < 0 ? -1 : decode_array(d, u, op, depth);
+    case 0xdd:
+        return get_uint(d, 4, &u) < 0 ? -1 : decode_array(d, u, op, depth);
+    case 0xde:
+        return get_uint(d, 2, &u) < 0 ? -1 : decode_map(d, u, op, depth);
+    case 0xdf:
+        return get_uint(d, 4, &u) < 0 ? -1 : decode_map(d, u, op, depth);
+
+    default:                             /* ext types and reserved */
+        return -1;
+    }
+
+ out:
+    return *op != NULL ? 0 : -1;
+}
+
+
+iot_json_t *iot_msgpack_decode(const void *data, size_t size)
+{
+    iot_json_t *o;
+    dec_t       d;
+
+    d.p   = data;
+    d.end = d.p + size;
+
+    if (!iot_msgpack_detect(data, size) || decode_value(&d, &o, 0) < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return o;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IOT_MSGPACK_H__
+#define __IOT_MSGPACK_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/json.h>
+
+IOT_CDECL_BEGIN
+
+/*
+ * MessagePack encoding of JSON messages.
+ *
+ * Transports can exchange messages encoded in MessagePack instead of
+ * textual JSON. This is both more compact on the wire and considerably
+ * cheaper to produce and consume. The encoding is lossless for all JSON
+ * objects we can represent. A top-level message is always a map or an
+ * array, so the first byte of an encoded message tells it apart from a
+ * textual one (which always starts with '{', '[' or whitespace).
+ */
+
+/** Encode a JSON object into the buffer after hdr bytes of headroom. */
+ssize_t iot_msgpack_encode(iot_json_t *o, iot_json_buf_t *b, size_t hdr);
+
+/** Decode a MessagePack-encoded message into a JSON object. */
+iot_json_t *iot_msgpack_decode(const void *data, size_t size);
+
+/** Check if the given message is MessagePack-encoded. */
+static inline int iot_msgpack_detect(const void *data, size_t size)
+{
+    uint8_t b;
+
+    if (size < 1)
+        return FALSE;
+
+    b = *(const uint8_t *)data;
+
+    return (b >= 0x80 && b <= 0x9f) || (b >= 0xdc && b <= 0xdf);
+}
+
+IOT_CDECL_END
+
+#endif /* __IOT_MSGPACK_H__ */
@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/list.h>
+#include <iot/common/log.h>
+#include <iot/common/outq.h>
+
+#define OUTQ_BATCH_MAX 64                /* max. frames to write at once */
+
+typedef struct {
+    iot_list_hook_t  hook;               /* to list of queued frames */
+    size_t           size;               /* amount of frame data */
+    size_t           offs;               /* amount already written */
+    struct sockaddr *addr;               /* destination address, if any */
+    socklen_t        addrlen;            /* destination address length */
+    struct cmsghdr  *ctrl;               /* SCM_RIGHTS message, if any */
+    size_t           ctrllen;            /* control message length */
+    char            *data;               /* frame data */
+    void           (*unref)(void *ref);  /* release shared frame data */
+    void            *ref;                /* reference to shared data */
+} frame_t;
+
+struct iot_outq_s {
+    iot_list_hook_t frames;              /* queued frames */
+    size_t          size;                /* amount of unwritten data */
+    int             length;              /* number of queued frames */
+    int             datagram : 1;        /* whether for a datagram socket */
+};
+
+
+iot_outq_t *iot_outq_create(int datagram)
+{
+    iot_outq_t *q;
+
+    if ((q = iot_allocz(sizeof(*q))) == NULL)
+        return NULL;
+
+    iot_list_init(&q->frames);
+    q->datagram = datagram ? 1 : 0;
+
+    return q;
+}
+
+
+static void frame_release_fds(frame_t *f)
+{
+    int *fds, nfd, i;
+
+    if (f->ctrl == NULL)
+        return;
+
+    fds = (int *)CMSG_DATA(f->ctrl);
+    nfd = (f->ctrl->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+    for (i = 0; i < nfd; i++)
+        close(fds[i]);
+
+    f->ctrl    = NULL;
+    f->ctrllen = 0;
+}
+
+
+static void frame_free(iot_outq_t *q, frame_t *f)
+{
+    frame_release_fds(f);
+    iot_list_delete(&f->hook);
+    q->size -= f->size - f->offs;
+    q->length--;
+
+    if (f->unref != NULL)
+        f->unref(f->ref);
+
+    iot_free(f);
+}
+
+
+void iot_outq_reset(iot_outq_t *q)
+{
+    iot_list_hook_t *p, *n;
+
+    if (q == NULL)
+        return;
+
+    iot_list_foreach(&q->frames, p, n) {
+        frame_free(q, iot_list_entry(p, frame_t, hook));
+    }
+}
+
+
+void iot_outq_destroy(iot_outq_t *q)
+{
+    iot_outq_reset(q);
+    iot_free(q);
+}
+
+
+size_t iot_outq_size(iot_outq_t *q)
+{
+    return q != NULL ? q->size : 0;
+}
+
+
+int iot_outq_length(iot_outq_t *q)
+{
+    return q != NULL ? q->length : 0;
+}
+
+
+int iot_outq_push(iot_outq_t *q, const void *data, size_t size, size_t offs,
+                  const struct sockaddr *addr, socklen_t addrlen)
+{
+    return iot_outq_pushfds(q, data, size, offs, addr, addrlen, NULL, 0);
+}
+
+
+int iot_outq_pushfds(iot_outq_t *q, const void *data, size_t size, size_t offs,
+                     const struct sockaddr *addr, socklen_t addrlen,
+                     const int *fds, int nfd)
+{
+    frame_t *f;
+    size_t   ctrllen;
+    int     *dup, i;
+
+    if (addr == NULL)
+        addrlen = 0;
+
+    if (fds == NULL || offs > 0)         /* fds went out with the 1st byte */
+        nfd = 0;
+
+    ctrllen = nfd > 0 ? CMSG_SPACE(nfd * sizeof(int)) : 0;
+
+    if ((f = iot_alloc(sizeof(*f) + ctrllen + addrlen + size)) == NULL)
+        return -1;
+
+    iot_list_init(&f->hook);
+    f->size    = size;
+    f->offs    = offs;
+    f->addrlen = addrlen;
+    f->ctrllen = ctrllen;
+
+    if (ctrllen > 0) {
+        f->ctrl = (struct cmsghdr *)(f + 1);
+        memset(f->ctrl, 0, ctrllen);
+        f->ctrl->cmsg_level = SOL_SOCKET;
+        f->ctrl->cmsg_type  = SCM_RIGHTS;
+        f->ctrl->cmsg_len   = CMSG_LEN(nfd * sizeof(int));
+
+        dup = (int *)CMSG_DATA(f->ctrl);
+
+        for (i = 0; i < nfd; i++) {
+            if ((dup[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, 0)) < 0) {
+                f->ctrl->cmsg_len = CMSG_LEN(i * sizeof(int));
+                frame_release_fds(f);
+                iot_free(f);
+                return -1;
+            }
+        }
+    }
+    else
+        f->ctrl = NULL;
+
+    if (addrlen > 0) {
+        f->addr = (struct sockaddr *)((char *)(f + 1) + ctrllen);
+        memcpy(f->addr, addr, addrlen);
+    }
+    else
+        f->addr = NULL;
+
+    f->data  = (char *)(f + 1) + ctrllen + addrlen;
+    f->unref = NULL;
+    f->ref   = NULL;
+    memcpy(f->data, data, size);
+
+    iot_list_append(&q->frames, &f->hook);
+    q->size += size - offs;
+    q->length++;
+
+    return 0;
+}
+
+
+int iot_outq_pushref(iot_outq_t *q, const void *data, size_t size, size_t offs,
+                     void (*unref)(void *ref), void *ref)
+{
+    frame_t *f;
+
+    if ((f = iot_allocz(sizeof(*f))) == NULL)
+        return -1;
+
+    iot_list_init(&f->hook);
+    f->size  = size;
+    f->offs  = offs;
+    f->data  = (char *)data;
+    f->unref = unref;
+    f->ref   = ref;
+
+    iot_list_append(&q->frames, &f->hook);
+    q->size += size - offs;
+    q->length++;
+
+    return 0;
+}
+
+
+int iot_outq_drop(iot_outq_t *q, size_t limit)
+{
+    iot_list_hook_t *p, *n;
+    frame_t         *f;
+    int              cnt;
+
+    cnt = 0;
+
+    iot_list_foreach(&q->frames, p, n) {
+        if (q->size <= limit || p == q->frames.prev)
+            break;
+
+        f = iot_list_entry(p, frame_t, hook);
+
+        if (f->offs > 0)                 /* can't drop a partial frame */
+            continue;
+
+        frame_free(q, f);
+        cnt++;
+    }
+
+    return cnt;
+}
+
+
+int iot_outq_iov(iot_outq_t *q, struct iovec *iov, int max)
+{
+    iot_list_hook_t *p, *n;
+    frame_t         *f;
+    int              cnt;
+
+    cnt = 0;
+
+    iot_list_foreach(&q->frames, p, n) {
+        if (cnt >= max)
+            break;
+
+        f = iot_list_entry(p, frame_t, hook);
+
+        if (f->ctrl != NULL)
+            break;
+
+        iov[cnt].iov_base = f->data + f->offs;
+        iov[cnt].iov_len  = f->size - f->offs;
+        cnt++;
+    }
+
+    return cnt;
+}
+
+
+void iot_outq_consume(iot_outq_t *q, size_t size)
+{
+    iot_list_hook_t *p, *n;
+    frame_t         *f;
+
+    iot_list_foreach(&q->frames, p, n) {
+        if (size == 0)
+            break;
+
+        f = iot_list_entry(p, frame_t, hook);
+
+        if (size < f->size - f->offs) {
+            f->offs += size;
+            q->size -= size;
+            return;
+        }
+
+        size -= f->size - f->offs;
+        frame_free(q, f);
+    }
+}
+
+
+/*
+ * A frame carrying file descriptors is written with its own sendmsg(2),
+ * so that the descriptors get attached to the first byte of the frame.
+ * Other frames are batched together and written with writev(2).
+ */
+
+static int flush_stream(iot_outq_t *q, int fd)
+{
+    struct iovec     iov[OUTQ_BATCH_MAX];
+    struct msghdr    msg;
+    frame_t         *f;
+    ssize_t          l;
+    size_t           total;
+    int              cnt, i;
+
+    while (q->length > 0) {
+        total = 0;
+        f     = iot_list_entry(q->frames.next, frame_t, hook);
+
+        if (f->ctrl != NULL) {
+            iov[0].iov_base = f->data + f->offs;
+            iov[0].iov_len  = f->size - f->offs;
+            total = iov[0].iov_len;
+
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov        = iov;
+            msg.msg_iovlen     = 1;
+            msg.msg_control    = f->ctrl;
+            msg.msg_controllen = f->ctrllen;
+
+            l = sendmsg(fd, &msg, MSG_NOSIGNAL);
+
+            if (l > 0)
+                frame_release_fds(f);
+        }
+        else {
+            cnt = iot_outq_iov(q, iov, OUTQ_BATCH_MAX);
+
+            for (i = 0; i < cnt; i++)
+                total += iov[i].iov_len;
+
+            l = writev(fd, iov, cnt);
+        }
+
+        if (l < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return 0;
+            else
+                return -1;
+        }
+
+        iot_outq_consume(q, l);
+
+        if ((size_t)l < total)           /* short write, stop here */
+            return 0;
+    }
+
+    return 0;
+}
+
+
+static int flush_datagram(iot_outq_t *q, int fd)
+{
+    struct mmsghdr   msg[OUTQ_BATCH_MAX];
+    struct iovec     iov[OUTQ_BATCH_MAX];
+    iot_list_hook_t *p, *n;
+    frame_t         *f;
+    int              cnt, sent, error;
+
+    error = 0;
+
+    while (q->length > 0) {
+        cnt = 0;
+
+        iot_list_foreach(&q->frames, p, n) {
+            if (cnt >= OUTQ_BATCH_MAX)
+                break;
+
+            f = iot_list_entry(p, frame_t, hook);
+            iov[cnt].iov_base = f->data;
+            iov[cnt].iov_len  = f->size;
+
+            memset(&msg[cnt], 0, sizeof(msg[cnt]));
+            msg[cnt].msg_hdr.msg_name       = f->addr;
+            msg[cnt].msg_hdr.msg_namelen    = f->addrlen;
+            msg[cnt].msg_hdr.msg_iov        = iov + cnt;
+            msg[cnt].msg_hdr.msg_iovlen     = 1;
+            msg[cnt].msg_hdr.msg_control    = f->ctrl;
+            msg[cnt].msg_hdr.msg_controllen = f->ctrllen;
+            cnt++;
+        }
+
+        sent = sendmmsg(fd, msg, cnt, MSG_NOSIGNAL);
+
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                break;
+
+            /* a datagram failing to one peer must not block the others */
+            sent  = 1;
+            error = errno;
+            iot_debug("dropping undeliverable datagram (%d: %s)",
+                      errno, strerror(errno));
+        }
+
+        while (sent-- > 0)
+            frame_free(q, iot_list_entry(q->frames.next, frame_t, hook));
+    }
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int iot_outq_flush(iot_outq_t *q, int fd)
+{
+    if (q == NULL)
+        return 0;
+
+    if (q->datagram)
+        return flush_datagram(q, fd);
+    else
+        return flush_stream(q, fd);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IOT_OUTQ_H__
+#define __IOT_OUTQ_H__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <iot/common/macros.h>
+
+IOT_CDECL_BEGIN
+
+/*
+ * Output queues.
+ *
+ * An output queue can be used to hold on to data that could not be
+ * written to a non-blocking socket without blocking, until the socket
+ * becomes writable again. Each queued chunk of data is kept as a single
+ * unit (a frame), together with an optional destination address for
+ * unconnected datagram sockets. Frames are written out in the order they
+ * were queued. For stream sockets a frame can be written partially, in
+ * which case the rest of it is written out during the next flush. Frames
+ * that have not been started can be dropped to limit the amount of data
+ * queued. Flushing writes out several frames at once, using writev(2)
+ * for stream and sendmmsg(2) for datagram sockets. A frame can also carry
+ * file descriptors, which are passed (as SCM_RIGHTS) along with its data.
+ * The queue holds on to duplicates of these until the frame is sent.
+ * Data shared by several queues can be queued without copying it, with
+ * the queue holding on to a reference which is released once the frame
+ * has been sent or dropped.
+ */
+
+/** Queue of data waiting to be written to a socket. */
+typedef struct iot_outq_s iot_outq_t;
+
+/** Create an output queue for a stream or a datagram socket. */
+iot_outq_t *iot_outq_create(int datagram);
+
+/** Destroy the given output queue, freeing all queued data. */
+void iot_outq_destroy(iot_outq_t *q);
+
+/** Drop all data from the given output queue. */
+void iot_outq_reset(iot_outq_t *q);
+
+/** Return the amount of data waiting in the queue. */
+size_t iot_outq_size(iot_outq_t *q);
+
+/** Return the number of frames waiting in the queue. */
+int iot_outq_length(iot_outq_t *q);
+
+/** Append data, of which offs bytes have already been written, to the queue. */
+int iot_outq_push(iot_outq_t *q, const void *data, size_t size, size_t offs,
+                  const struct sockaddr *addr, socklen_t addrlen);
+
+/** Append data together with (duplicates of) file descriptors to pass. */
+int iot_outq_pushfds(iot_outq_t *q, const void *data, size_t size, size_t offs,
+                     const struct sockaddr *addr, socklen_t addrlen,
+                     const int *fds, int nfd);
+
+/** Append shared data without copying it, calling unref(ref) when done. */
+int iot_outq_pushref(iot_outq_t *q, const void *data, size_t size, size_t offs,
+                     void (*unref)(void *ref), void *ref);
+
+/** Drop oldest unstarted frames, but never the last one, down to limit. */
+int iot_outq_drop(iot_outq_t *q, size_t limit);
+
+/** Write as much of the queue to the given socket as possible. */
+int iot_outq_flush(iot_outq_t *q, int fd);
+
+/** Collect (at most max) leading unsent chunks without descriptors. */
+int iot_outq_iov(iot_outq_t *q, struct iovec *iov, int max);
+
+/** Remove the given amount of data from the head of the queue as sent. */
+void iot_outq_consume(iot_outq_t *q, size_t size);
+
+IOT_CDECL_END
+
+#endif /* __IOT_OUTQ_H__ */
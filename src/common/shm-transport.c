@@ -0,0 +1,1381 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/log.h>
+#include <iot/common/msgpack.h>
+#include <iot/common/outq.h>
+#include <iot/common/memfd.h>
+#include <iot/common/socket-utils.h>
+#include <iot/common/transport.h>
+
+/*
+ * Shared memory transport.
+ *
+ * A shm transport connects two processes on the same host through a pair
+ * of single-producer single-consumer rings in a shared memory file, one
+ * ring for each direction. Connections are set up over a unix domain
+ * stream socket: the connecting side creates the memory file and two
+ * eventfds, one to wake up either end, and passes them to the accepting
+ * side in a hello message. The socket is then kept open for the lifetime
+ * of the connection to notice the peer going away, and to query its
+ * credentials.
+ *
+ * An end going to sleep in its mainloop announces it in the header of
+ * the ring it consumes, and the producer only signals the eventfd when
+ * it finds such an announcement. Busy connections thus pass messages
+ * without any system calls. The data area of each ring is mapped twice,
+ * back to back, so that frames wrapping around the end of the ring can
+ * be accessed as if they were contiguous.
+ *
+ * Frames are copied out of the ring before being decoded and passed on,
+ * since the peer can still write to the shared memory. Frames larger
+ * than the ring cannot be sent. File descriptor passing and connecting
+ * a transport created from an existing socket are not supported.
+ */
+
+#ifndef UNIX_PATH_MAX
+#    define UNIX_PATH_MAX sizeof(((struct sockaddr_un *)NULL)->sun_path)
+#endif
+
+#define SHM  "shm"
+#define SHML 3
+
+#define SHM_MAGIC    0x696f7472          /* hello and header magic */
+#define SHM_VERSION  1                   /* shared memory layout version */
+#define RING_SIZE    (1024 * 1024)       /* default ring size */
+#define RING_MAX     (64 * 1024 * 1024)  /* max. accepted ring size */
+#define CACHELINE    64
+#define OUTQ_IOV     64                  /* frames moved from queue at once */
+#define OBUF_KEEP    (16 * 1024)         /* max. idle buffer to keep */
+
+#define FRAME_SIZE(size) IOT_ALIGN(sizeof(uint32_t) + (size), sizeof(uint32_t))
+
+/*
+ * Ring header. The producer owns head and blocked, the consumer owns tail
+ * and idle. Either end clears the other one's flag when it wakes it up.
+ */
+typedef struct {
+    uint32_t head;                       /* producer offset, free running */
+    uint32_t blocked;                    /* producer waits for space */
+    char     pad0[CACHELINE - 2 * sizeof(uint32_t)];
+    uint32_t tail;                       /* consumer offset, free running */
+    uint32_t idle;                       /* consumer waits for data */
+    char     pad1[CACHELINE - 2 * sizeof(uint32_t)];
+} ring_hdr_t;
+
+/*
+ * Shared memory file header, followed by the data area of the client to
+ * server ring, then that of the server to client ring, starting at the
+ * next page boundary.
+ */
+typedef struct {
+    uint32_t   magic;                    /* SHM_MAGIC */
+    uint32_t   version;                  /* SHM_VERSION */
+    uint32_t   size;                     /* ring data size */
+    uint32_t   unused;
+    ring_hdr_t ring[2];                  /* client->server, server->client */
+} shm_hdr_t;
+
+typedef struct {
+    uint32_t magic;                      /* SHM_MAGIC */
+    uint32_t version;                    /* SHM_VERSION */
+    uint32_t size;                       /* ring data size */
+} hello_t;
+
+typedef struct {
+    ring_hdr_t *hdr;                     /* shared ring header */
+    char       *data;                    /* doubly mapped data area */
+    uint32_t    size;                    /* data area size */
+    uint32_t    pos;                     /* our head or tail */
+} ring_t;
+
+typedef struct {
+    IOT_TRANSPORT_PUBLIC_FIELDS;         /* common transport fields */
+    int             sock;                /* connection socket */
+    iot_io_watch_t *iow;                 /* socket I/O watch */
+    int             efd;                 /* our eventfd */
+    int             peer;                /* peer's eventfd */
+    iot_io_watch_t *ew;                  /* eventfd I/O watch */
+    shm_hdr_t      *hdr;                 /* shared memory header */
+    size_t          hdrsize;             /* mapped header size */
+    ring_t          rx;                  /* ring we consume */
+    ring_t          tx;                  /* ring we produce */
+    iot_deferred_t *more;                /* input left over budget */
+    iot_deferred_t *flush;               /* batched publishing */
+    char           *ibuf;                /* input frame buffer */
+    size_t          isize;               /* input frame buffer size */
+    iot_json_buf_t  obuf;                /* JSON output buffer */
+    iot_outq_t     *oq;                  /* output queue */
+    int             full;                /* queue over high watermark */
+    int             overflow;            /* disconnected for overflow */
+} shm_t;
+
+
+static void shmt_sock_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                         void *user_data);
+static int shmt_disconnect(iot_transport_t *mt);
+
+
+static socklen_t shmt_resolve(const char *str, iot_sockaddr_t *addr,
+                              socklen_t size, const char **typep)
+{
+    struct sockaddr_un *un;
+    const char         *path;
+    socklen_t           len;
+
+    if (strncmp(str, SHM":", SHML + 1))
+        return 0;
+
+    path = str + SHML + 1;
+    len  = IOT_OFFSET(typeof(*un), sun_path) + strlen(path);
+
+    if (!*path || strlen(path) >= UNIX_PATH_MAX) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    if (size < len + 1) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    un = &addr->unx;
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, path);
+    if (un->sun_path[0] == '@')
+        un->sun_path[0] = '\0';
+
+    if (typep != NULL)
+        *typep = SHM;
+
+    return len;
+}
+
+
+static int shmt_open(iot_transport_t *mt)
+{
+    shm_t *t = (shm_t *)mt;
+
+    t->sock = -1;
+    t->efd  = -1;
+    t->peer = -1;
+
+    return TRUE;
+}
+
+
+static int check_ring_size(uint32_t size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    return size >= (uint32_t)page && size <= RING_MAX &&
+        (size & (size - 1)) == 0;
+}
+
+
+static int map_ring(ring_t *r, ring_hdr_t *hdr, int fd, off_t offs,
+                    uint32_t size)
+{
+    char *area;
+    int   prot, flags;
+
+    /*
+     * Reserve twice the size of the ring, then map the data area of the
+     * ring into both halves of the reservation.
+     */
+
+    area = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (area == MAP_FAILED)
+        return FALSE;
+
+    prot  = PROT_READ | PROT_WRITE;
+    flags = MAP_SHARED | MAP_FIXED;
+
+    if (mmap(area, size, prot, flags, fd, offs) == MAP_FAILED ||
+        mmap(area + size, size, prot, flags, fd, offs) == MAP_FAILED) {
+        munmap(area, 2 * size);
+        return FALSE;
+    }
+
+    r->hdr  = hdr;
+    r->data = area;
+    r->size = size;
+    r->pos  = 0;
+
+    return TRUE;
+}
+
+
+static void unmap_shm(shm_t *t)
+{
+    if (t->rx.data != NULL)
+        munmap(t->rx.data, 2 * t->rx.size);
+    if (t->tx.data != NULL)
+        munmap(t->tx.data, 2 * t->tx.size);
+    if (t->hdr != NULL)
+        munmap(t->hdr, t->hdrsize);
+
+    iot_clear(&t->rx);
+    iot_clear(&t->tx);
+    t->hdr = NULL;
+}
+
+
+static int map_shm(shm_t *t, int fd, uint32_t size, int client)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    int  rx   = client ? 1 : 0;
+    int  tx   = client ? 0 : 1;
+
+    t->hdrsize = IOT_ALIGN(sizeof(shm_hdr_t), (size_t)page);
+    t->hdr     = mmap(NULL, t->hdrsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+
+    if (t->hdr == MAP_FAILED) {
+        t->hdr = NULL;
+        return FALSE;
+    }
+
+    if (!map_ring(&t->rx, t->hdr->ring + rx, fd, t->hdrsize + rx * size, size) ||
+        !map_ring(&t->tx, t->hdr->ring + tx, fd, t->hdrsize + tx * size, size)) {
+        unmap_shm(t);
+        return FALSE;
+    }
+
+    /* pick up where the peer might have already got to */
+    t->rx.pos = __atomic_load_n(&t->rx.hdr->tail, __ATOMIC_RELAXED);
+    t->tx.pos = __atomic_load_n(&t->tx.hdr->head, __ATOMIC_RELAXED);
+
+    return TRUE;
+}
+
+
+static void wake_peer(shm_t *t)
+{
+    uint64_t one = 1;
+
+    if (write(t->peer, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        iot_debug("transport %p: failed to wake up peer (%d: %s)", t,
+                  errno, strerror(errno));
+}
+
+
+static void publish(shm_t *t)
+{
+    ring_hdr_t *h = t->tx.hdr;
+
+    /*
+     * Make the written frames visible, then check if the consumer went
+     * to sleep before it could see them. Pairs with consume_idle().
+     */
+
+    __atomic_store_n(&h->head, t->tx.pos, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&h->idle, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&h->idle, 0, __ATOMIC_ACQ_REL))
+        wake_peer(t);
+}
+
+
+static int consume_idle(shm_t *t)
+{
+    ring_hdr_t *h = t->rx.hdr;
+
+    __atomic_store_n(&h->idle, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&h->head, __ATOMIC_ACQUIRE) == t->rx.pos)
+        return TRUE;
+
+    __atomic_store_n(&h->idle, 0, __ATOMIC_RELAXED);
+
+    return FALSE;
+}
+
+
+static void consumed(shm_t *t)
+{
+    ring_hdr_t *h = t->rx.hdr;
+
+    __atomic_store_n(&h->tail, t->rx.pos, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&h->blocked, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&h->blocked, 0, __ATOMIC_ACQ_REL))
+        wake_peer(t);
+}
+
+
+static int ring_space(shm_t *t, uint32_t need)
+{
+    ring_hdr_t *h = t->tx.hdr;
+    uint32_t    used;
+
+    used = t->tx.pos - __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+
+    if (used > t->tx.size) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    if (t->tx.size - used >= need)
+        return 1;
+
+    /* ask to be woken up once there is space, then check again */
+    __atomic_store_n(&h->blocked, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    used = t->tx.pos - __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+
+    if (used > t->tx.size || t->tx.size - used < need)
+        return 0;
+
+    __atomic_store_n(&h->blocked, 0, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+
+static int ring_write(shm_t *t, const void *data, size_t size)
+{
+    uint32_t  len = size;
+    char     *p;
+    int       space;
+
+    if ((space = ring_space(t, FRAME_SIZE(size))) <= 0)
+        return space;
+
+    p = t->tx.data + (t->tx.pos & (t->tx.size - 1));
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), data, size);
+
+    t->tx.pos += FRAME_SIZE(size);
+
+    return 1;
+}
+
+
+/*
+ * Copy the next frame out of the ring, returning its size, 0 if the ring
+ * is empty, or -1 if the peer has put garbage into the ring.
+ */
+static ssize_t ring_read(shm_t *t)
+{
+    uint32_t  used, size;
+    char     *p, *buf;
+
+    used = __atomic_load_n(&t->rx.hdr->head, __ATOMIC_ACQUIRE) - t->rx.pos;
+
+    if (used == 0)
+        return 0;
+
+    if (used > t->rx.size || used < sizeof(size))
+        goto invalid;
+
+    p = t->rx.data + (t->rx.pos & (t->rx.size - 1));
+    memcpy(&size, p, sizeof(size));
+
+    if (FRAME_SIZE((size_t)size) > used)
+        goto invalid;
+
+    if (size > t->input.maxframe) {
+        iot_log_error("Transport %p: frame of %u bytes exceeds the limit "
+                      "(%zu bytes), closing.", t, size, t->input.maxframe);
+        t->stats.errors++;
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (size + 1 > t->isize) {
+        if ((buf = iot_realloc(t->ibuf, size + 1)) == NULL)
+            return -1;
+
+        t->ibuf  = buf;
+        t->isize = size + 1;
+    }
+
+    memcpy(t->ibuf, p + sizeof(size), size);
+    t->ibuf[size] = '\0';
+
+    t->rx.pos += FRAME_SIZE(size);
+    t->stats.bytes_in += FRAME_SIZE(size);
+    consumed(t);
+
+    return size;
+
+ invalid:
+    iot_log_error("Transport %p: corrupt shared memory ring, closing.", t);
+    t->stats.errors++;
+    errno = EPROTO;
+    return -1;
+}
+
+
+static int deliver(shm_t *t, size_t size)
+{
+    iot_transport_t *mt = (iot_transport_t *)t;
+    iot_json_t      *msg;
+    int              error;
+
+    if (!(t->mode & IOT_TRANSPORT_MODE_JSON))
+        error = t->recv_data(mt, t->ibuf, size, NULL, 0);
+    else {
+        if (iot_msgpack_detect(t->ibuf, size))
+            msg = iot_msgpack_decode(t->ibuf, size);
+        else
+            msg = iot_json_string_to_object(t->ibuf, size);
+
+        if (msg == NULL) {
+            t->stats.errors++;
+            return EILSEQ;
+        }
+
+        error = t->recv_data(mt, msg, 0, NULL, 0);
+        iot_json_unref(msg);
+    }
+
+    if (error)
+        return error;
+
+    if (t->check_destroy(mt))
+        return -1;
+
+    return 0;
+}
+
+
+static void recv_closed(shm_t *t, int error)
+{
+    iot_transport_t *mt = (iot_transport_t *)t;
+
+    shmt_disconnect(mt);
+
+    if (t->evt.closed != NULL)
+        IOT_TRANSPORT_BUSY(mt, {
+                mt->evt.closed(mt, error, mt->user_data);
+            });
+
+    t->check_destroy(mt);
+}
+
+
+/*
+ * Pass on received messages until the ring is empty or the read budget
+ * of this mainloop iteration has been used up. In the latter case carry
+ * on during the next iteration. Returns FALSE if the transport has been
+ * closed or destroyed in the meantime.
+ */
+static int pull_msgs(shm_t *t)
+{
+    size_t  budget;
+    ssize_t n;
+    int     error;
+
+    budget = t->input.budget;
+
+    while (t->hdr != NULL) {
+        n = ring_read(t);
+
+        if (n < 0) {
+            error = errno == EMSGSIZE || errno == ENOMEM ? errno : EPROTO;
+            goto fatal_error;
+        }
+
+        if (n == 0) {
+            if (consume_idle(t))
+                break;
+            continue;
+        }
+
+        if ((error = deliver(t, n)) != 0) {
+            if (error < 0)
+                return FALSE;
+            goto fatal_error;
+        }
+
+        if (t->isize > OBUF_KEEP) {
+            iot_free(t->ibuf);
+            t->ibuf  = NULL;
+            t->isize = 0;
+        }
+
+        if ((size_t)n >= budget) {
+            iot_enable_deferred(t->more);
+            break;
+        }
+
+        budget -= n;
+    }
+
+    return t->hdr != NULL;
+
+ fatal_error:
+    iot_debug("transport %p closed with error %d", t, error);
+    recv_closed(t, error);
+    return FALSE;
+}
+
+
+static int write_queue(shm_t *t)
+{
+    struct iovec iov[OUTQ_IOV];
+    int          cnt, i, written;
+
+    if (t->hdr == NULL || iot_outq_size(t->oq) == 0)
+        return 0;
+
+    written = 1;
+
+    do {
+        cnt = iot_outq_iov(t->oq, iov, OUTQ_IOV);
+
+        for (i = 0; i < cnt; i++) {
+            /* queued before we knew the ring size */
+            if (FRAME_SIZE(iov[i].iov_len) > t->tx.size) {
+                iot_log_error("Transport %p: dropping message of %zu bytes, "
+                              "too large for the ring.", t, iov[i].iov_len);
+                iot_outq_consume(t->oq, iov[i].iov_len);
+                continue;
+            }
+
+            if ((written = ring_write(t, iov[i].iov_base, iov[i].iov_len)) <= 0)
+                break;
+
+            iot_outq_consume(t->oq, iov[i].iov_len);
+            t->stats.bytes_out += FRAME_SIZE(iov[i].iov_len);
+        }
+
+        publish(t);
+    } while (cnt == OUTQ_IOV && i == cnt);
+
+    return i < cnt && written < 0 ? -1 : 0;
+}
+
+
+static void check_writable(shm_t *t)
+{
+    iot_transport_t *mt = (iot_transport_t *)t;
+
+    if (!t->full || iot_outq_size(t->oq) > t->queue.lowmark)
+        return;
+
+    t->full = FALSE;
+
+    if (t->evt.writable != NULL) {
+        IOT_TRANSPORT_BUSY(mt, {
+                mt->evt.writable(mt, mt->user_data);
+            });
+
+        t->check_destroy(mt);
+    }
+}
+
+
+static void flush_queue(shm_t *t)
+{
+    if (write_queue(t) < 0) {
+        iot_debug("transport %p: failed to flush output (%d: %s)", t,
+                  errno, strerror(errno));
+        iot_outq_reset(t->oq);
+    }
+
+    check_writable(t);
+}
+
+
+static void shmt_wakeup_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                           void *user_data)
+{
+    shm_t    *t = (shm_t *)user_data;
+    uint64_t  cnt;
+
+    IOT_UNUSED(w);
+    IOT_UNUSED(events);
+
+    if (read(fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        iot_debug("transport %p: failed to read eventfd (%d: %s)", t,
+                  errno, strerror(errno));
+
+    if (!pull_msgs(t))
+        return;
+
+    if (iot_outq_size(t->oq) > 0)
+        flush_queue(t);
+}
+
+
+static void shmt_more_cb(iot_deferred_t *d, void *user_data)
+{
+    shm_t *t = (shm_t *)user_data;
+
+    iot_disable_deferred(d);
+    pull_msgs(t);
+}
+
+
+static void shmt_flush_cb(iot_deferred_t *d, void *user_data)
+{
+    shm_t *t = (shm_t *)user_data;
+
+    iot_disable_deferred(d);
+
+    if (t->hdr != NULL)
+        publish(t);
+}
+
+
+static int start_shm(shm_t *t)
+{
+    iot_io_event_t events = IOT_IO_EVENT_IN;
+
+    /*
+     * The deferred is created enabled, so it picks up anything the peer
+     * has sent so far during the next mainloop iteration.
+     */
+
+    t->ew   = iot_add_io_watch(t->ml, t->efd, events, shmt_wakeup_cb, t);
+    t->more = iot_add_deferred(t->ml, shmt_more_cb, t);
+
+    if (t->ew == NULL || t->more == NULL)
+        return FALSE;
+
+    if (iot_outq_size(t->oq) > 0 && write_queue(t) < 0)
+        return FALSE;
+
+    return TRUE;
+}
+
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0)
+        return -1;
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+static int send_hello(shm_t *t, int mfd)
+{
+    hello_t         hello;
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr *cmsg;
+    char            ctrl[CMSG_SPACE(3 * sizeof(int))];
+    int             fds[3];
+
+    hello.magic   = SHM_MAGIC;
+    hello.version = SHM_VERSION;
+    hello.size    = t->rx.size;
+
+    fds[0] = mfd;                        /* shared memory */
+    fds[1] = t->peer;                    /* server's eventfd */
+    fds[2] = t->efd;                     /* client's eventfd */
+
+    iov.iov_base = &hello;
+    iov.iov_len  = sizeof(hello);
+
+    memset(&msg, 0, sizeof(msg));
+    memset(ctrl, 0, sizeof(ctrl));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    return sendmsg(t->sock, &msg, MSG_NOSIGNAL) == sizeof(hello);
+}
+
+
+/*
+ * Receive the hello message of a connecting client. Returns 1 once the
+ * shared memory has been set up, 0 if the hello is still to come, and -1
+ * on errors.
+ */
+static int recv_hello(shm_t *t)
+{
+    hello_t         hello;
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr *cmsg;
+    char            ctrl[CMSG_SPACE(3 * sizeof(int))];
+    int             fds[3], nfd, i, n;
+    ssize_t         size;
+
+    iov.iov_base = &hello;
+    iov.iov_len  = sizeof(hello);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    if ((size = recvmsg(t->sock, &msg, MSG_CMSG_CLOEXEC)) < 0)
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+    if (size == 0) {
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    nfd = 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        for (i = 0; i < n; i++) {
+            if (nfd < 3)
+                memcpy(fds + nfd++, CMSG_DATA(cmsg) + i * sizeof(int),
+                       sizeof(int));
+            else
+                close(((int *)CMSG_DATA(cmsg))[i]);
+        }
+    }
+
+    errno = EPROTO;
+
+    if (size != sizeof(hello) || nfd != 3 || (msg.msg_flags & MSG_CTRUNC) ||
+        hello.magic != SHM_MAGIC || hello.version != SHM_VERSION ||
+        !check_ring_size(hello.size))
+        goto fail;
+
+    if ((size = iot_memfd_sealed_size(fds[0])) < 0)
+        goto fail;
+
+    if ((size_t)size != IOT_ALIGN(sizeof(shm_hdr_t),
+                                  (size_t)sysconf(_SC_PAGESIZE)) +
+        2 * (size_t)hello.size) {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    /* never let a peer block us with something else than an eventfd */
+    if (set_nonblocking(fds[1]) < 0 || set_nonblocking(fds[2]) < 0)
+        goto fail;
+
+    if (!map_shm(t, fds[0], hello.size, FALSE))
+        goto fail;
+
+    close(fds[0]);
+    t->efd  = fds[1];
+    t->peer = fds[2];
+
+    return 1;
+
+ fail:
+    iot_log_error("Transport %p: invalid shm hello (%d: %s).", t,
+                  errno, strerror(errno));
+    while (nfd-- > 0)
+        close(fds[nfd]);
+    return -1;
+}
+
+
+static int shmt_createfrom(iot_transport_t *mt, void *conn)
+{
+    shm_t          *t = (shm_t *)mt;
+    iot_io_event_t  events;
+
+    /* we can only take over sockets to listen on */
+    if (!t->listened) {
+        errno = EOPNOTSUPP;
+        return FALSE;
+    }
+
+    t->sock = *(int *)conn;
+
+    if (t->sock < 0 || set_nonblocking(t->sock) < 0)
+        return FALSE;
+
+    events = IOT_IO_EVENT_IN | IOT_IO_EVENT_HUP;
+    t->iow = iot_add_io_watch(t->ml, t->sock, events, shmt_sock_cb, t);
+
+    return t->iow != NULL;
+}
+
+
+static void shmt_close(iot_transport_t *mt)
+{
+    shm_t *t = (shm_t *)mt;
+
+    iot_debug("closing transport %p", mt);
+
+    iot_del_io_watch(t->iow);
+    t->iow = NULL;
+    iot_del_io_watch(t->ew);
+    t->ew = NULL;
+    iot_del_deferred(t->more);
+    t->more = NULL;
+    iot_del_deferred(t->flush);
+    t->flush = NULL;
+
+    unmap_shm(t);
+
+    iot_free(t->ibuf);
+    t->ibuf  = NULL;
+    t->isize = 0;
+
+    iot_json_buf_cleanup(&t->obuf);
+
+    iot_outq_destroy(t->oq);
+    t->oq = NULL;
+
+    if (t->efd >= 0) {
+        close(t->efd);
+        t->efd = -1;
+    }
+
+    if (t->peer >= 0) {
+        close(t->peer);
+        t->peer = -1;
+    }
+
+    if (t->sock >= 0) {
+        close(t->sock);
+        t->sock = -1;
+    }
+}
+
+
+static int shmt_bind(iot_transport_t *mt, iot_sockaddr_t *addr,
+                     socklen_t addrlen)
+{
+    shm_t          *t = (shm_t *)mt;
+    iot_io_event_t  events;
+
+    if (t->sock == -1) {
+        t->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (t->sock < 0)
+            goto fail;
+
+        events = IOT_IO_EVENT_IN | IOT_IO_EVENT_HUP;
+        t->iow = iot_add_io_watch(t->ml, t->sock, events, shmt_sock_cb, t);
+
+        if (t->iow == NULL)
+            goto fail;
+    }
+
+    if (bind(t->sock, &addr->any, addrlen) == 0) {
+        iot_debug("transport %p bound", mt);
+        return TRUE;
+    }
+
+ fail:
+    iot_debug("failed to bind transport %p", mt);
+    return FALSE;
+}
+
+
+static int shmt_listen(iot_transport_t *mt, int backlog)
+{
+    shm_t *t = (shm_t *)mt;
+
+    if (t->sock != -1 && t->iow != NULL && t->evt.connection != NULL) {
+        if (set_nonblocking(t->sock) < 0)
+            return FALSE;
+
+        if (listen(t->sock, backlog) == 0) {
+            iot_debug("transport %p listening", mt);
+            t->listened = TRUE;
+            return TRUE;
+        }
+    }
+
+    iot_debug("transport %p failed to listen", mt);
+    return FALSE;
+}
+
+
+static int shmt_accept(iot_transport_t *mt, iot_transport_t *mlt)
+{
+    shm_t          *t  = (shm_t *)mt;
+    shm_t          *lt = (shm_t *)mlt;
+    iot_io_event_t  events;
+
+    if (lt->sock < 0) {
+        errno = EBADF;
+        return FALSE;
+    }
+
+    t->sock = accept4(lt->sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (t->sock < 0) {
+        if (iot_reject_connection(lt->sock, NULL, 0) < 0)
+            iot_log_error("%s(): accept failed on transport %p (%d: %s).",
+                          __FUNCTION__, mlt, errno, strerror(errno));
+        return FALSE;
+    }
+
+    /*
+     * The client sends its hello right after connecting. If it is not
+     * here yet, we finish setting up once it arrives. Until then any
+     * messages we send get queued.
+     */
+
+    events = IOT_IO_EVENT_IN | IOT_IO_EVENT_HUP;
+    t->iow = iot_add_io_watch(t->ml, t->sock, events, shmt_sock_cb, t);
+
+    if (t->iow != NULL) {
+        switch (recv_hello(t)) {
+        case 1:
+            if (!start_shm(t))
+                break;
+            /* fall through */
+        case 0:
+            iot_debug("accepted connection on transport %p/%p", mlt, mt);
+            return TRUE;
+        default:
+            break;
+        }
+    }
+
+    shmt_close(mt);
+
+    return FALSE;
+}
+
+
+static int shmt_connect(iot_transport_t *mt, iot_sockaddr_t *addr,
+                        socklen_t addrlen)
+{
+    shm_t          *t = (shm_t *)mt;
+    iot_io_event_t  events;
+    size_t          size;
+    int             mfd;
+
+    mfd = -1;
+
+    t->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (t->sock < 0 || connect(t->sock, &addr->any, addrlen) < 0)
+        goto fail;
+
+    size = IOT_ALIGN(sizeof(shm_hdr_t), (size_t)sysconf(_SC_PAGESIZE)) +
+        2 * RING_SIZE;
+
+    if ((mfd = iot_memfd_create("iot-shm-transport", size, NULL)) < 0 ||
+        iot_memfd_seal_size(mfd) < 0)
+        goto fail;
+
+    t->efd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    t->peer = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (t->efd < 0 || t->peer < 0)
+        goto fail;
+
+    if (!map_shm(t, mfd, RING_SIZE, TRUE))
+        goto fail;
+
+    t->hdr->magic   = SHM_MAGIC;
+    t->hdr->version = SHM_VERSION;
+    t->hdr->size    = RING_SIZE;
+
+    /* the server is not listening to its ring yet, wake it up on data */
+    t->tx.hdr->idle = 1;
+
+    if (!send_hello(t, mfd) || set_nonblocking(t->sock) < 0)
+        goto fail;
+
+    close(mfd);
+    mfd = -1;
+
+    events = IOT_IO_EVENT_IN | IOT_IO_EVENT_HUP;
+    t->iow = iot_add_io_watch(t->ml, t->sock, events, shmt_sock_cb, t);
+
+    if (t->iow == NULL || !start_shm(t))
+        goto fail;
+
+    iot_debug("connected transport %p", mt);
+
+    return TRUE;
+
+ fail:
+    iot_debug("failed to connect transport %p", mt);
+
+    if (mfd >= 0)
+        close(mfd);
+    shmt_close(mt);
+
+    return FALSE;
+}
+
+
+static int hangup_error(shm_t *t)
+{
+    if (t->overflow) {
+        iot_debug("transport %p closed for output queue overflow", t);
+        return ENOBUFS;
+    }
+    else {
+        iot_debug("transport %p closed by peer", t);
+        return 0;
+    }
+}
+
+
+static void shmt_sock_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                         void *user_data)
+{
+    shm_t           *t  = (shm_t *)user_data;
+    iot_transport_t *mt = (iot_transport_t *)t;
+    char             buf[64];
+    ssize_t          n;
+
+    IOT_UNUSED(w);
+
+    iot_debug("event 0x%x for transport %p", events, t);
+
+    if (IOT_UNLIKELY(mt->listened != 0)) {
+        if (events & IOT_IO_EVENT_IN) {
+            IOT_TRANSPORT_BUSY(mt, {
+                    iot_debug("connection event on transport %p", mt);
+                    mt->evt.connection(mt, mt->user_data);
+                });
+
+            t->check_destroy(mt);
+        }
+        return;
+    }
+
+    if (t->hdr == NULL) {
+        if (!(events & IOT_IO_EVENT_IN))
+            goto hangup;
+
+        switch (recv_hello(t)) {
+        case 0:
+            return;
+        case 1:
+            if (start_shm(t))
+                return;
+            /* fall through */
+        default:
+            recv_closed(t, errno == ECONNRESET ? 0 : EPROTO);
+            return;
+        }
+    }
+
+    /* the socket carries no data once set up, only the hangup */
+    n = read(fd, buf, sizeof(buf));
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR) &&
+        !(events & IOT_IO_EVENT_HUP))
+        return;
+
+    if (n > 0) {
+        recv_closed(t, EPROTO);
+        return;
+    }
+
+    /* pass on whatever the peer managed to send before going away */
+    if (!pull_msgs(t))
+        return;
+
+ hangup:
+    recv_closed(t, hangup_error(t));
+}
+
+
+static int shmt_disconnect(iot_transport_t *mt)
+{
+    shm_t *t = (shm_t *)mt;
+
+    if (t->connected) {
+        iot_del_io_watch(t->iow);
+        t->iow = NULL;
+        iot_del_io_watch(t->ew);
+        t->ew = NULL;
+        iot_del_deferred(t->more);
+        t->more = NULL;
+        iot_del_deferred(t->flush);
+        t->flush = NULL;
+
+        if (!t->overflow && t->hdr != NULL) { /* best effort for output */
+            write_queue(t);
+            publish(t);
+        }
+        iot_outq_reset(t->oq);
+
+        shutdown(t->sock, SHUT_RDWR);
+
+        unmap_shm(t);
+
+        iot_debug("disconnected transport %p", mt);
+
+        return TRUE;
+    }
+    else
+        return FALSE;
+}
+
+
+static int shmt_getopt(iot_transport_t *mt, const char *opt, void *val,
+                       socklen_t *len)
+{
+    shm_t *t = (shm_t *)mt;
+
+    if (!strcmp(opt, IOT_TRANSPORT_OPT_STATS)) {
+        ((iot_transport_stats_t *)val)->queued = iot_outq_size(t->oq);
+        return TRUE;
+    }
+
+    if (!t->connected) {
+        errno = ENOTCONN;
+        return FALSE;
+    }
+
+    if (!strcmp(opt, IOT_TRANSPORT_OPT_PEERCRED)) {
+        if (getsockopt(t->sock, SOL_SOCKET, SO_PEERCRED, val, len) < 0)
+            return FALSE;
+        else
+            return TRUE;
+    }
+
+    if (!strcmp(opt, IOT_TRANSPORT_OPT_PEERSEC)) {
+        if (getsockopt(t->sock, SOL_SOCKET, SO_PEERSEC, val, len) < 0)
+            return FALSE;
+        else
+            return TRUE;
+    }
+
+    errno = EOPNOTSUPP;
+    return FALSE;
+}
+
+
+static int wait_queue(shm_t *t)
+{
+    struct pollfd pfd[2];
+    uint64_t      cnt;
+
+    pfd[0].fd     = t->efd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd     = t->sock;
+    pfd[1].events = POLLIN;
+
+    while (iot_outq_size(t->oq) > t->queue.lowmark) {
+        if (t->hdr == NULL) {
+            errno = ENOTCONN;
+            return FALSE;
+        }
+
+        if (poll(pfd, 2, -1) < 0 && errno != EINTR)
+            return FALSE;
+
+        if (pfd[1].revents) {
+            errno = ECONNRESET;
+            return FALSE;
+        }
+
+        if (pfd[0].revents && read(t->efd, &cnt, sizeof(cnt)) < 0 &&
+            errno != EAGAIN)
+            return FALSE;
+
+        if (write_queue(t) < 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static int queue_overflow(shm_t *t)
+{
+    int n;
+
+    switch (t->queue.policy) {
+    case IOT_TRANSPORT_QUEUE_DISCONNECT:
+        iot_log_error("Output queue of transport %p overflowed (%zu bytes), "
+                      "disconnecting.", t, iot_outq_size(t->oq));
+        t->overflow = TRUE;
+        iot_outq_reset(t->oq);
+        shutdown(t->sock, SHUT_RDWR);
+        errno = ENOBUFS;
+        return FALSE;
+
+    case IOT_TRANSPORT_QUEUE_BLOCK:
+        return wait_queue(t);
+
+    case IOT_TRANSPORT_QUEUE_DROP:
+    default:
+        t->full = TRUE;
+        n = iot_outq_drop(t->oq, t->queue.highmark);
+
+        if (n > 0)
+            iot_debug("transport %p: dropped %d queued messages", t, n);
+
+        return TRUE;
+    }
+}
+
+
+static int schedule_publish(shm_t *t)
+{
+    if (t->flush == NULL) {
+        t->flush = iot_add_deferred(t->ml, shmt_flush_cb, t);
+
+        if (t->flush == NULL) {
+            iot_log_error("Failed to add output flush for transport %p.", t);
+            return FALSE;
+        }
+    }
+    else
+        iot_enable_deferred(t->flush);
+
+    return TRUE;
+}
+
+
+static int send_data(shm_t *t, void *data, size_t size)
+{
+    int written;
+
+    if (t->overflow) {
+        errno = ENOBUFS;
+        return FALSE;
+    }
+
+    if (t->hdr != NULL && FRAME_SIZE(size) > t->tx.size) {
+        errno = EMSGSIZE;
+        return FALSE;
+    }
+
+    /*
+     * Write straight into the ring if we can. Transports created with
+     * IOT_TRANSPORT_BATCH make the frames visible to the peer once per
+     * mainloop iteration, so that it gets woken up at most once.
+     */
+
+    if (t->hdr != NULL && iot_outq_size(t->oq) == 0) {
+        if ((written = ring_write(t, data, size)) < 0)
+            return FALSE;
+
+        if (written) {
+            t->stats.bytes_out += FRAME_SIZE(size);
+
+            if (!(t->flags & IOT_TRANSPORT_BATCH)) {
+                publish(t);
+                return TRUE;
+            }
+            else
+                return schedule_publish(t);
+        }
+
+        t->stats.eagain++;
+    }
+
+    if (t->oq == NULL && (t->oq = iot_outq_create(FALSE)) == NULL)
+        return FALSE;
+
+    if (iot_outq_push(t->oq, data, size, 0, NULL, 0) < 0)
+        return FALSE;
+
+    if (iot_outq_size(t->oq) > t->queue.highmark)
+        return queue_overflow(t);
+
+    return TRUE;
+}
+
+
+static int shmt_sendraw(iot_transport_t *mt, void *data, size_t size)
+{
+    shm_t *t = (shm_t *)mt;
+
+    if (!t->connected)
+        return FALSE;
+
+    return send_data(t, data, size);
+}
+
+
+static int shmt_sendjson(iot_transport_t *mt, iot_json_t *msg)
+{
+    shm_t   *t = (shm_t *)mt;
+    ssize_t  size;
+    int      success;
+
+    if (!t->connected)
+        return FALSE;
+
+    /*
+     * Both ends of a shm connection autodetect the encoding of incoming
+     * messages, so unlike stream transports we need no negotiation.
+     */
+
+    if (t->mode & IOT_TRANSPORT_MODE_MSGPACK)
+        size = iot_msgpack_encode(msg, &t->obuf, 0);
+    else
+        size = iot_json_serialize(msg, &t->obuf, 0);
+
+    if (size < 0)
+        return FALSE;
+
+    success = send_data(t, t->obuf.data, t->obuf.used);
+
+    if (t->obuf.size > OBUF_KEEP)
+        iot_json_buf_cleanup(&t->obuf);
+
+    return success;
+}
+
+
+IOT_REGISTER_TRANSPORT(shm, SHM, shm_t, shmt_resolve,
+                       shmt_open, shmt_createfrom, shmt_close,
+                       NULL, shmt_getopt,
+                       shmt_bind, shmt_listen, shmt_accept,
+                       shmt_connect, shmt_disconnect,
+                       shmt_sendraw, NULL,
+                       shmt_sendjson, NULL);
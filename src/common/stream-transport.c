@@ -35,15 +35,19 @@
 #define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/ioctl.h>
 #include <netinet/in.h>
 #include <sys/un.h>
 #include <sys/uio.h>
+#include <poll.h>
 
 #include <iot/common/macros.h>
 #include <iot/common/mm.h>
 #include <iot/common/log.h>
 #include <iot/common/fragbuf.h>
+#include <iot/common/msgpack.h>
+#include <iot/common/compress.h>
+#include <iot/common/outq.h>
+#include <iot/common/uring.h>
 #include <iot/common/socket-utils.h>
 #include <iot/common/transport.h>
 
@@ -58,20 +62,88 @@
 #define UNXS  "unxs"
 #define UNXSL 4
 
-#define DEFAULT_SIZE 128                 /* default input buffer size */
+#define READ_CHUNK   (16 * 1024)         /* default input read size */
+#define RXFDS_MAX    4                   /* max. pending received fd sets */
+#define OBUF_KEEP    (16 * 1024)         /* max. idle output buffer to keep */
+
+#define ENCODING        "iot-transport"  /* encoding negotiation message */
+#define ENCODING_MSGPACK "msgpack"       /* MessagePack encoding */
+#define ENCODING_JSON    "json"          /* textual JSON encoding */
+#define COMPRESSION_LZ4  "lz4"           /* LZ4 frame compression */
+#define COMPRESSION_NONE "none"          /* no frame compression */
+
+/*
+ * encoding negotiation states
+ *
+ * A client transport in MessagePack mode offers the encoding to the
+ * server after connecting. If the server is in MessagePack mode, too,
+ * it acknowledges the offer and both ends switch their sending side to
+ * MessagePack. Otherwise the server declines the offer and we stick to
+ * textual JSON. An older server simply ignores the offer as an unknown
+ * request. On the receiving side we always autodetect the encoding.
+ *
+ * A client transport in compression mode similarly offers LZ4 compression
+ * in the same message. If the server is in compression mode, too, both
+ * ends start compressing messages above their threshold. Compressed frames
+ * are flagged in the frame header, so they are always detected and
+ * decompressed on the receiving side.
+ */
+typedef enum {
+    NEGO_NONE = 0,                       /* no negotiation in progress */
+    NEGO_OFFERED,                        /* offer sent, waiting for reply */
+    NEGO_WAITING,                        /* waiting for a possible offer */
+} nego_t;
+
+/*
+ * Received file descriptors are attached to the stream offset of the last
+ * byte of the read they arrived with. Since the sender passes descriptors
+ * with the first byte of a frame and the kernel never merges data with
+ * descriptors into a preceding read, they belong to the frame which that
+ * last byte is part of.
+ */
+
+typedef struct {
+    uint64_t        offs;                /* stream offset fds arrived at */
+    int             fds[IOT_TRANSPORT_MAXFDS]; /* received descriptors */
+    int             nfd;                 /* number of descriptors */
+} rxfds_t;
 
 typedef struct {
     IOT_TRANSPORT_PUBLIC_FIELDS;         /* common transport fields */
     int             sock;                /* TCP socket */
     iot_io_watch_t *iow;                 /* socket I/O watch */
     iot_fragbuf_t  *buf;                 /* fragment buffer */
+    iot_json_buf_t  obuf;                /* JSON output buffer */
+    nego_t          nego;                /* encoding negotiation state */
+    int             msgpack;             /* whether to send MessagePack */
+    int             compress;            /* whether to compress output */
+    iot_json_buf_t  zbuf;                /* (de)compression buffer */
+    iot_outq_t     *oq;                  /* output queue */
+    iot_io_watch_t *ow;                  /* output queue I/O watch */
+    iot_deferred_t *flush;               /* batched output flush */
+    int             full;                /* queue over high watermark */
+    int             overflow;            /* disconnected for overflow */
+    uint64_t        rxoff;               /* amount of data received */
+    uint64_t        rxframe;             /* stream offset of next frame */
+    rxfds_t         rxfds[RXFDS_MAX];    /* received fds pending delivery */
+    int             nrxfds;              /* number of pending fd sets */
+    iot_uring_t    *ring;                /* io_uring, if we use one */
+    iot_uring_in_t *rin;                 /* io_uring input */
+    iot_uring_out_t *rout;               /* io_uring batched output */
 } strm_t;
 
 
 static void strm_recv_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
                          void *user_data);
+static void strm_uring_cb(iot_uring_in_t *in, void *data, ssize_t n,
+                          void *user_data);
 static int strm_disconnect(iot_transport_t *mt);
+static int write_queue(strm_t *t);
 static int open_socket(strm_t *t, int family);
+static int send_msg(strm_t *t, iot_json_t *msg, int *fds, int nfd);
+static int send_data(strm_t *t, void *data, size_t size, int *fds, int nfd,
+                     iot_transport_msg_t *m);
+static void drop_rxfds(strm_t *t);
 
 
 
@@ -286,6 +358,48 @@ static int set_reuseaddr(int sock, int reuseaddr)
 }
 
 
+/*
+ * Start receiving on a connected socket, through the io_uring of our
+ * mainloop if we have one, or with an I/O watch otherwise. Transports
+ * which want to receive file descriptors always use an I/O watch.
+ */
+static int watch_input(strm_t *t)
+{
+    iot_io_event_t events;
+
+    if (t->evt.recvjsonfds == NULL && t->ring == NULL)
+        t->ring = iot_uring_get(t->ml);
+
+    if (t->ring != NULL && t->evt.recvjsonfds == NULL) {
+        t->rin = iot_uring_in_add(t->ring, t->sock, strm_uring_cb, t);
+
+        if (t->rin != NULL)
+            return TRUE;
+
+        iot_log_warning("Failed to add io_uring input for transport %p, "
+                        "using epoll.", t);
+    }
+
+    events = IOT_IO_EVENT_IN | IOT_IO_EVENT_HUP;
+    t->iow = iot_add_io_watch(t->ml, t->sock, events, strm_recv_cb, t);
+
+    return t->iow != NULL;
+}
+
+
+static void unwatch_input(strm_t *t)
+{
+    iot_del_io_watch(t->iow);
+    t->iow = NULL;
+
+    iot_uring_in_del(t->rin);
+    t->rin = NULL;
+
+    iot_uring_out_del(t->rout);
+    t->rout = NULL;
+}
+
+
 static int strm_createfrom(iot_transport_t *mt, void *conn)
 {
     strm_t           *t = (strm_t *)mt;
@@ -302,20 +416,23 @@ static int strm_createfrom(iot_transport_t *mt, void *conn)
             if (set_nonblocking(t->sock, true) < 0)
                 return FALSE;
 
-        if (t->connected || t->listened) {
-            if (!t->connected ||
-                (t->buf = iot_fragbuf_create(TRUE, 0)) != NULL) {
-                events = IOT_IO_EVENT_IN | IOT_IO_EVENT_HUP;
-                t->iow = iot_add_io_watch(t->ml, t->sock, events,
-                                          strm_recv_cb, t);
-
-                if (t->iow != NULL)
+        if (t->connected) {
+            if ((t->buf = iot_fragbuf_create(TRUE, 0)) != NULL) {
+                if (watch_input(t))
                     return TRUE;
 
                 iot_fragbuf_destroy(t->buf);
                 t->buf = NULL;
             }
         }
+        else if (t->listened) {
+            events = IOT_IO_EVENT_IN | IOT_IO_EVENT_HUP;
+            t->iow = iot_add_io_watch(t->ml, t->sock, events,
+                                      strm_recv_cb, t);
+
+            if (t->iow != NULL)
+                return TRUE;
+        }
     }
 
     return FALSE;
@@ -328,12 +445,28 @@ static void strm_close(iot_transport_t *mt)
 
     iot_debug("closing transport %p", mt);
 
-    iot_del_io_watch(t->iow);
-    t->iow = NULL;
+    unwatch_input(t);
 
     iot_fragbuf_destroy(t->buf);
     t->buf = NULL;
 
+    drop_rxfds(t);
+
+    iot_json_buf_cleanup(&t->obuf);
+    iot_json_buf_cleanup(&t->zbuf);
+
+    iot_del_io_watch(t->ow);
+    t->ow = NULL;
+
+    iot_del_deferred(t->flush);
+    t->flush = NULL;
+
+    iot_outq_destroy(t->oq);
+    t->oq = NULL;
+
+    iot_uring_put(t->ring);
+    t->ring = NULL;
+
     if (t->sock >= 0){
         close(t->sock);
         t->sock = -1;
@@ -383,7 +516,6 @@ static int strm_accept(iot_transport_t *mt, iot_transport_t *mlt)
     strm_t         *t, *lt;
     iot_sockaddr_t  addr;
     socklen_t       addrlen;
-    iot_io_event_t  events;
 
     t  = (strm_t *)mt;
     lt = (strm_t *)mlt;
@@ -411,11 +543,13 @@ static int strm_accept(iot_transport_t *mt, iot_transport_t *mlt)
                 goto reject;
 
         t->buf = iot_fragbuf_create(TRUE, 0);
-        events = IOT_IO_EVENT_IN | IOT_IO_EVENT_HUP;
-        t->iow = iot_add_io_watch(t->ml, t->sock, events, strm_recv_cb, t);
 
-        if (t->iow != NULL && t->buf != NULL) {
+        if (t->buf != NULL && watch_input(t)) {
             iot_debug("accepted connection on transport %p/%p", mlt, mt);
+
+            if (t->mode & IOT_TRANSPORT_MODE_JSON)
+                t->nego = NEGO_WAITING;
+
             return TRUE;
         }
         else {
@@ -452,16 +586,429 @@ static int strm_accept(iot_transport_t *mt, iot_transport_t *mlt)
 }
 
 
+static iot_json_t *encoding_msg(iot_json_t *enc)
+{
+    iot_json_t *msg;
+
+    if (enc == NULL)
+        return NULL;
+
+    if ((msg = iot_json_create(IOT_JSON_OBJECT)) == NULL) {
+        iot_json_unref(enc);
+        return NULL;
+    }
+
+    iot_json_add_string (msg, "type" , ENCODING);
+    iot_json_add_integer(msg, "seqno", 0);
+    iot_json_add        (msg, ENCODING, enc);
+
+    return msg;
+}
+
+
+static int offer_array(iot_json_t *enc, const char *key, const char *value)
+{
+    iot_json_t *a;
+
+    if ((a = iot_json_create(IOT_JSON_ARRAY)) == NULL)
+        return FALSE;
+
+    iot_json_array_append_string(a, value);
+    iot_json_add(enc, key, a);
+
+    return TRUE;
+}
+
+
+static int offers(iot_json_t *enc, const char *key, const char *value)
+{
+    iot_json_t *a;
+    const char *e;
+    int         i, n;
+
+    if (!iot_json_get_array(enc, key, &a))
+        return FALSE;
+
+    n = iot_json_array_length(a);
+
+    for (i = 0; i < n; i++)
+        if (iot_json_array_get_string(a, i, &e) && !strcmp(e, value))
+            return TRUE;
+
+    return FALSE;
+}
+
+
+static int compress_mode(strm_t *t)
+{
+    return (t->mode & IOT_TRANSPORT_MODE_COMPRESS) && iot_compress_available();
+}
+
+
+static int offer_encoding(strm_t *t)
+{
+    iot_json_t *msg, *enc;
+    int         success;
+
+    if ((enc = iot_json_create(IOT_JSON_OBJECT)) == NULL)
+        return FALSE;
+
+    if (((t->mode & IOT_TRANSPORT_MODE_MSGPACK) &&
+         !offer_array(enc, "encodings", ENCODING_MSGPACK)) ||
+        (compress_mode(t) &&
+         !offer_array(enc, "compression", COMPRESSION_LZ4))) {
+        iot_json_unref(enc);
+        return FALSE;
+    }
+
+    if ((msg = encoding_msg(enc)) == NULL)
+        return FALSE;
+
+    success = send_msg(t, msg, NULL, 0);
+    iot_json_unref(msg);
+
+    if (success)
+        t->nego = NEGO_OFFERED;
+
+    return success;
+}
+
+
+static int negotiate(strm_t *t, iot_json_t *msg)
+{
+    iot_json_t *enc, *reply;
+    const char *type, *e, *z;
+    int         accept, zaccept;
+
+    type = NULL;
+    enc  = NULL;
+
+    if (!iot_json_get_string(msg, "type", &type) || strcmp(type, ENCODING) ||
+        !iot_json_get_object(msg, ENCODING, &enc)) {
+        t->nego = NEGO_NONE;
+        return FALSE;
+    }
+
+    switch (t->nego) {
+    case NEGO_WAITING:
+        accept  = (t->mode & IOT_TRANSPORT_MODE_MSGPACK) &&
+            offers(enc, "encodings", ENCODING_MSGPACK);
+        zaccept = compress_mode(t) &&
+            offers(enc, "compression", COMPRESSION_LZ4);
+
+        e     = accept  ? ENCODING_MSGPACK : ENCODING_JSON;
+        z     = zaccept ? COMPRESSION_LZ4  : COMPRESSION_NONE;
+        reply = iot_json_create(IOT_JSON_OBJECT);
+
+        if (reply != NULL) {
+            iot_json_add_string(reply, "encoding"   , e);
+            iot_json_add_string(reply, "compression", z);
+        }
+
+        if ((reply = encoding_msg(reply)) != NULL) {
+            send_msg(t, reply, NULL, 0);
+            iot_json_unref(reply);
+        }
+
+        t->msgpack  = accept;
+        t->compress = zaccept;
+        break;
+
+    case NEGO_OFFERED:
+        if (iot_json_get_string(enc, "encoding", &e))
+            t->msgpack = !strcmp(e, ENCODING_MSGPACK);
+        if (iot_json_get_string(enc, "compression", &z))
+            t->compress = compress_mode(t) && !strcmp(z, COMPRESSION_LZ4);
+        break;
+
+    default:
+        break;
+    }
+
+    iot_debug("transport %p using %s encoding, %s compression", t,
+              t->msgpack ? ENCODING_MSGPACK : ENCODING_JSON,
+              t->compress ? COMPRESSION_LZ4 : COMPRESSION_NONE);
+
+    t->nego = NEGO_NONE;
+
+    return TRUE;
+}
+
+
+static void close_fds(int *fds, int nfd)
+{
+    while (nfd-- > 0)
+        close(fds[nfd]);
+}
+
+
+static void drop_rxfds(strm_t *t)
+{
+    while (t->nrxfds > 0) {
+        t->nrxfds--;
+        close_fds(t->rxfds[t->nrxfds].fds, t->rxfds[t->nrxfds].nfd);
+    }
+
+    t->rxoff   = 0;
+    t->rxframe = 0;
+}
+
+
+static int take_fds(strm_t *t, size_t size, rxfds_t *rx)
+{
+    uint64_t start, end;
+
+    if (t->nrxfds == 0)
+        return FALSE;
+
+    start = t->rxframe;
+    end   = start + sizeof(uint32_t) + size;
+
+    while (t->nrxfds > 0 && t->rxfds[0].offs < end) {
+        *rx = t->rxfds[0];
+        memmove(t->rxfds, t->rxfds + 1, --t->nrxfds * sizeof(t->rxfds[0]));
+
+        if (rx->offs >= start)
+            return TRUE;
+
+        close_fds(rx->fds, rx->nfd);     /* should not happen, but... */
+    }
+
+    return FALSE;
+}
+
+
+static iot_json_t *decode_msg(strm_t *t, void *data, size_t size, int *error)
+{
+    iot_json_t *msg;
+    ssize_t     n;
+
+    if (iot_fragbuf_flags(t->buf, data) & IOT_FRAGBUF_COMPRESSED) {
+        n = iot_decompress(data, size, &t->zbuf, t->input.maxframe);
+
+        if (n < 0) {
+            t->stats.errors++;
+            *error = (errno == EMSGSIZE ? EMSGSIZE : EILSEQ);
+            return NULL;
+        }
+
+        data = t->zbuf.data;
+        size = (size_t)n;
+    }
+
+    if (iot_msgpack_detect(data, size))
+        msg = iot_msgpack_decode(data, size);
+    else
+        msg = iot_json_string_to_object(data, size);
+
+    if (t->zbuf.size > OBUF_KEEP)
+        iot_json_buf_cleanup(&t->zbuf);
+
+    if (msg == NULL) {
+        t->stats.errors++;
+        *error = EILSEQ;
+    }
+    else
+        *error = 0;
+
+    return msg;
+}
+
+
+static int pull_msgs(strm_t *t)
+{
+    iot_transport_t *mt = (iot_transport_t *)t;
+    void            *data;
+    size_t           size;
+    rxfds_t          rx;
+    int              fds, error;
+
+    data = NULL;
+    size = 0;
+    while (iot_fragbuf_pull(t->buf, &data, &size)) {
+        /* a whole oversized frame may arrive within a single read */
+        if (size > t->input.maxframe) {
+            iot_log_error("Transport %p: frame of %zu bytes exceeds the "
+                          "limit (%zu bytes), closing.", t, size,
+                          t->input.maxframe);
+            t->stats.errors++;
+            return EMSGSIZE;
+        }
+
+        fds = take_fds(t, size, &rx);
+        t->rxframe += sizeof(uint32_t) + size;
+
+        if (!(t->mode & IOT_TRANSPORT_MODE_JSON)) {
+            if (fds)
+                close_fds(rx.fds, rx.nfd);
+            error = t->recv_data(mt, data, size, NULL, 0);
+        }
+        else {
+            iot_json_t *msg;
+
+            if ((msg = decode_msg(t, data, size, &error)) != NULL) {
+                if (t->nego != NEGO_NONE && negotiate(t, msg)) {
+                    if (fds)
+                        close_fds(rx.fds, rx.nfd);
+                    error = 0;
+                }
+                else if (fds)
+                    error = t->recv_fds(mt, msg, rx.fds, rx.nfd);
+                else
+                    error = t->recv_data(mt, msg, 0, NULL, 0);
+                iot_json_unref(msg);
+            }
+            else {
+                if (fds)
+                    close_fds(rx.fds, rx.nfd);
+            }
+        }
+
+        if (error)
+            return error;
+
+        if (t->check_destroy(mt))
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static ssize_t read_chunk(strm_t *t, int fd, void *buf, size_t size)
+{
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr *cmsg;
+    char            ctrl[CMSG_SPACE(IOT_TRANSPORT_MAXFDS * sizeof(int))];
+    rxfds_t        *rx;
+    ssize_t         n;
+    int             nfd, error;
+
+    /*
+     * Only bother with ancillary data if we have someone to pass received
+     * descriptors to. Otherwise a plain read(2) lets the kernel discard
+     * any descriptors sent to us.
+     */
+
+    if (t->evt.recvjsonfds == NULL) {
+        if ((n = read(fd, buf, size)) > 0) {
+            t->rxoff += n;
+            t->stats.bytes_in += n;
+        }
+
+        return n;
+    }
+
+    iov.iov_base = buf;
+    iov.iov_len  = size;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    if ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+        return n;
+
+    error = (msg.msg_flags & MSG_CTRUNC) ? EPROTO : 0;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        nfd = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        if (error || t->nrxfds >= RXFDS_MAX) {
+            close_fds((int *)CMSG_DATA(cmsg), nfd);
+            error = EPROTO;
+            continue;
+        }
+
+        rx = t->rxfds + t->nrxfds++;
+        rx->offs = t->rxoff + n - 1;
+        rx->nfd  = nfd;
+        memcpy(rx->fds, CMSG_DATA(cmsg), nfd * sizeof(int));
+    }
+
+    t->rxoff += n;
+    t->stats.bytes_in += n;
+
+    if (error) {
+        iot_log_error("Transport %p: too many file descriptors passed.", t);
+        errno = error;
+        return -1;
+    }
+
+    return n;
+}
+
+
+static int check_frame(strm_t *t)
+{
+    size_t used, missing;
+
+    /*
+     * Once all complete messages have been pulled, whatever is left in
+     * the buffer is the beginning of a single incomplete frame. If its
+     * header is already in, we know how big the whole frame is going to
+     * be and can reject it before reading (and buffering) any more of it.
+     */
+
+    used    = iot_fragbuf_used(t->buf);
+    missing = iot_fragbuf_missing(t->buf);
+
+    if (used >= sizeof(uint32_t) &&
+        used + missing - sizeof(uint32_t) > t->input.maxframe) {
+        iot_log_error("Transport %p: frame of %zu bytes exceeds the limit "
+                      "(%zu bytes), closing.", t,
+                      used + missing - sizeof(uint32_t), t->input.maxframe);
+        t->stats.errors++;
+        return EMSGSIZE;
+    }
+
+    return 0;
+}
+
+
+static void recv_closed(strm_t *t, int error)
+{
+    iot_transport_t *mt = (iot_transport_t *)t;
+
+    strm_disconnect(mt);
+
+    if (t->evt.closed != NULL)
+        IOT_TRANSPORT_BUSY(mt, {
+                mt->evt.closed(mt, error, mt->user_data);
+            });
+
+    t->check_destroy(mt);
+}
+
+
+static int hangup_error(strm_t *t)
+{
+    if (t->overflow) {
+        iot_debug("transport %p closed for output queue overflow", t);
+        return ENOBUFS;
+    }
+    else {
+        iot_debug("transport %p closed by peer", t);
+        return 0;
+    }
+}
+
+
 static void strm_recv_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
                          void *user_data)
 {
     strm_t          *t  = (strm_t *)user_data;
     iot_transport_t *mt = (iot_transport_t *)t;
-    void            *data, *buf;
-    uint32_t         pending;
-    size_t           size;
+    void            *buf;
+    size_t           size, budget;
     ssize_t          n;
-    int              error;
+    int              nrxfds, error;
 
     IOT_UNUSED(w);
 
@@ -478,67 +1025,132 @@ static void strm_recv_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
             return;
         }
 
-        while (ioctl(fd, FIONREAD, &pending) == 0 && pending > 0) {
-            buf = iot_fragbuf_alloc(t->buf, pending);
+        /*
+         * Read in chunks straight into the reassembly buffer, passing on
+         * complete messages after each chunk. Stop once the socket has
+         * been drained (a short read) or the read budget of this
+         * iteration has been used up. In the latter case we get called
+         * again during the next mainloop iteration.
+         */
+
+        budget = t->input.budget;
+
+        while (budget > 0) {
+            size = iot_fragbuf_missing(t->buf);
+
+            if (size < READ_CHUNK)
+                size = READ_CHUNK;
+            if (size > budget)
+                size = budget;
+
+            buf = iot_fragbuf_alloc(t->buf, size);
 
             if (buf == NULL) {
                 error = ENOMEM;
             fatal_error:
                 iot_debug("transport %p closed with error %d", mt, error);
-            closed:
-                strm_disconnect(mt);
-
-                if (t->evt.closed != NULL)
-                    IOT_TRANSPORT_BUSY(mt, {
-                            mt->evt.closed(mt, error, mt->user_data);
-                        });
-
-                t->check_destroy(mt);
+                recv_closed(t, error);
                 return;
             }
 
-            n = read(fd, buf, pending);
+            nrxfds = t->nrxfds;
+            n = read_chunk(t, fd, buf, size);
 
-            if (n >= 0) {
-                if (n < (ssize_t)pending)
-                    iot_fragbuf_trim(t->buf, buf, pending, n);
-            }
+            if (n <= 0) {
+                iot_fragbuf_trim(t->buf, buf, size, 0);
+
+                if (n == 0)
+                    goto hangup;
+
+                if (errno == EAGAIN || errno == EINTR)
+                    break;
 
-            if (n < 0 && errno != EAGAIN) {
-                error = EIO;
+                error = errno == EPROTO ? EPROTO : EIO;
                 goto fatal_error;
             }
-        }
 
-        data = NULL;
-        size = 0;
-        while (iot_fragbuf_pull(t->buf, &data, &size)) {
-            if (t->mode != IOT_TRANSPORT_MODE_JSON)
-                error = t->recv_data(mt, data, size, NULL, 0);
-            else {
-                iot_json_t *msg = iot_json_string_to_object(data, size);
+            if (n < (ssize_t)size)
+                iot_fragbuf_trim(t->buf, buf, size, n);
 
-                if (msg != NULL) {
-                    error = t->recv_data((iot_transport_t *)t, msg, 0, NULL, 0);
-                    iot_json_unref(msg);
-                }
+            if ((error = pull_msgs(t)) != 0) {
+                if (error < 0)
+                    return;
                 else
-                    error = EILSEQ;
+                    goto fatal_error;
             }
 
-            if (error)
+            if (t->buf == NULL)          /* disconnected by a callback */
+                return;
+
+            if ((error = check_frame(t)) != 0)
                 goto fatal_error;
 
-            if (t->check_destroy(mt))
-                return;
+            /* reads with descriptors are cut short by the kernel */
+            if (n < (ssize_t)size && t->nrxfds == nrxfds)
+                break;
+
+            /*
+             * Once our peer has hung up, the mainloop stops polling the
+             * socket after this round. Drain it regardless of the budget
+             * so we don't throw away what was sent before closing. The
+             * amount left is bounded by the socket buffer.
+             */
+            if (!(events & IOT_IO_EVENT_HUP))
+                budget -= n;
         }
     }
 
     if (events & IOT_IO_EVENT_HUP) {
-        iot_debug("transport %p closed by peer", mt);
-        error = 0;
-        goto closed;
+    hangup:
+        recv_closed(t, hangup_error(t));
+    }
+}
+
+
+static void strm_uring_cb(iot_uring_in_t *in, void *data, ssize_t n,
+                          void *user_data)
+{
+    strm_t *t = (strm_t *)user_data;
+    void   *buf;
+    int     error;
+
+    IOT_UNUSED(in);
+
+    if (n == 0) {
+        recv_closed(t, hangup_error(t));
+        return;
+    }
+
+    if (n < 0) {
+        error = EIO;
+        goto fatal_error;
+    }
+
+    if ((buf = iot_fragbuf_alloc(t->buf, n)) == NULL) {
+        error = ENOMEM;
+        goto fatal_error;
     }
+
+    memcpy(buf, data, n);
+    t->rxoff += n;
+    t->stats.bytes_in += n;
+
+    if ((error = pull_msgs(t)) != 0) {
+        if (error < 0)
+            return;
+        else
+            goto fatal_error;
+    }
+
+    if (t->buf == NULL)                  /* disconnected by a callback */
+        return;
+
+    if ((error = check_frame(t)) == 0)
+        return;
+
+ fatal_error:
+    iot_debug("transport %p closed with error %d", t, error);
+    recv_closed(t, error);
 }
 
 
@@ -581,7 +1193,6 @@ static int strm_connect(iot_transport_t *mt, iot_sockaddr_t *addr,
                         socklen_t addrlen)
 {
     strm_t         *t    = (strm_t *)mt;
-    iot_io_event_t  events;
 
     t->sock = socket(addr->any.sa_family, SOCK_STREAM, 0);
 
@@ -596,12 +1207,13 @@ static int strm_connect(iot_transport_t *mt, iot_sockaddr_t *addr,
         t->buf = iot_fragbuf_create(TRUE, 0);
 
         if (t->buf != NULL) {
-            events = IOT_IO_EVENT_IN | IOT_IO_EVENT_HUP;
-            t->iow = iot_add_io_watch(t->ml, t->sock, events, strm_recv_cb, t);
-
-            if (t->iow != NULL) {
+            if (watch_input(t)) {
                 iot_debug("connected transport %p", mt);
 
+                if (t->mode & (IOT_TRANSPORT_MODE_MSGPACK |
+                               IOT_TRANSPORT_MODE_COMPRESS))
+                    offer_encoding(t);
+
                 return TRUE;
             }
 
@@ -628,14 +1240,25 @@ static int strm_disconnect(iot_transport_t *mt)
     strm_t *t = (strm_t *)mt;
 
     if (t->connected/* || t->iow != NULL*/) {
-        iot_del_io_watch(t->iow);
-        t->iow = NULL;
+        unwatch_input(t);
+
+        iot_del_io_watch(t->ow);
+        t->ow = NULL;
+
+        iot_del_deferred(t->flush);
+        t->flush = NULL;
+
+        if (!t->overflow)                /* best effort for pending output */
+            write_queue(t);
+        iot_outq_reset(t->oq);
 
         shutdown(t->sock, SHUT_RDWR);
 
         iot_fragbuf_destroy(t->buf);
         t->buf = NULL;
 
+        drop_rxfds(t);
+
         iot_debug("disconnected transport %p", mt);
 
         return TRUE;
@@ -650,6 +1273,11 @@ static int strm_getopt(iot_transport_t *mt, const char *opt, void *val,
 {
     strm_t *t = (strm_t *)mt;
 
+    if (!strcmp(opt, IOT_TRANSPORT_OPT_STATS)) {
+        ((iot_transport_stats_t *)val)->queued = iot_outq_size(t->oq);
+        return TRUE;
+    }
+
     if (!t->connected) {
         errno = ENOTCONN;
         return FALSE;
@@ -674,82 +1302,455 @@ static int strm_getopt(iot_transport_t *mt, const char *opt, void *val,
 }
 
 
-static int strm_sendraw(iot_transport_t *mt, void *data, size_t size)
+static int tcp_getopt(iot_transport_t *mt, const char *opt, void *val,
+                      socklen_t *len)
+{
+    /* peer credentials and labels only make sense for local sockets */
+    if (!strcmp(opt, IOT_TRANSPORT_OPT_PEERCRED) ||
+        !strcmp(opt, IOT_TRANSPORT_OPT_PEERSEC)) {
+        errno = EOPNOTSUPP;
+        return FALSE;
+    }
+
+    return strm_getopt(mt, opt, val, len);
+}
+
+
+static void check_writable(strm_t *t)
+{
+    iot_transport_t *mt = (iot_transport_t *)t;
+
+    if (!t->full || iot_outq_size(t->oq) > t->queue.lowmark)
+        return;
+
+    t->full = FALSE;
+
+    if (t->evt.writable != NULL) {
+        IOT_TRANSPORT_BUSY(mt, {
+                mt->evt.writable(mt, mt->user_data);
+            });
+
+        t->check_destroy(mt);
+    }
+}
+
+
+static void strm_send_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                         void *user_data);
+
+static void update_output(strm_t *t)
+{
+    if (iot_outq_size(t->oq) == 0) {
+        iot_del_io_watch(t->ow);
+        t->ow = NULL;
+    }
+    else if (t->ow == NULL) {
+        t->ow = iot_add_io_watch(t->ml, t->sock, IOT_IO_EVENT_OUT,
+                                 strm_send_cb, t);
+
+        if (t->ow == NULL)
+            iot_log_error("Failed to add output watch for transport %p.", t);
+    }
+
+    check_writable(t);
+}
+
+
+static int write_queue(strm_t *t)
+{
+    size_t size = iot_outq_size(t->oq);
+    int    r;
+
+    r = iot_outq_flush(t->oq, t->sock);
+    t->stats.bytes_out += size - iot_outq_size(t->oq);
+
+    return r;
+}
+
+
+static void flush_queue(strm_t *t)
+{
+    if (write_queue(t) < 0) {
+        iot_debug("transport %p: failed to flush output (%d: %s)", t,
+                  errno, strerror(errno));
+        iot_outq_reset(t->oq);
+    }
+
+    update_output(t);
+}
+
+
+static int strm_uring_fill(iot_uring_out_t *out, struct iovec *iov, int max,
+                           void *user_data)
+{
+    strm_t *t = (strm_t *)user_data;
+    int     cnt;
+
+    IOT_UNUSED(out);
+
+    cnt = iot_outq_iov(t->oq, iov, max);
+
+    /* frames with file descriptors are written out synchronously */
+    if (cnt == 0 && iot_outq_size(t->oq) > 0) {
+        if (write_queue(t) < 0) {
+            iot_debug("transport %p: failed to flush output (%d: %s)", t,
+                      errno, strerror(errno));
+            iot_outq_reset(t->oq);
+        }
+    }
+
+    return cnt;
+}
+
+
+static void strm_uring_done(iot_uring_out_t *out, ssize_t n, void *user_data)
+{
+    strm_t *t = (strm_t *)user_data;
+
+    if (n < 0 && n != -EAGAIN && n != -EINTR) {
+        iot_debug("transport %p: failed to flush output (%d: %s)", t,
+                  (int)-n, strerror(-n));
+        iot_outq_reset(t->oq);
+    }
+
+    if (n > 0) {
+        iot_outq_consume(t->oq, n);
+        t->stats.bytes_out += n;
+    }
+
+    /*
+     * If we got something written but have more left, try again with the
+     * next batch. Once the socket is full that fails with EAGAIN and we
+     * wait for it to become writable again.
+     */
+
+    if (n > 0 && iot_outq_size(t->oq) > 0 && t->ow == NULL) {
+        iot_uring_out_schedule(out);
+        check_writable(t);
+    }
+    else
+        update_output(t);
+}
+
+
+static void strm_send_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                         void *user_data)
+{
+    strm_t *t = (strm_t *)user_data;
+
+    IOT_UNUSED(w);
+    IOT_UNUSED(fd);
+
+    if (events & IOT_IO_EVENT_OUT)
+        flush_queue(t);
+}
+
+
+static void strm_flush_cb(iot_deferred_t *d, void *user_data)
 {
-    strm_t  *t = (strm_t *)mt;
-    ssize_t  n;
+    strm_t *t = (strm_t *)user_data;
+
+    iot_disable_deferred(d);
+    flush_queue(t);
+}
 
-    if (t->connected) {
-        n = write(t->sock, data, size);
 
-        if (n == (ssize_t)size)
+static int wait_queue(strm_t *t)
+{
+    struct pollfd pfd;
+
+    pfd.fd     = t->sock;
+    pfd.events = POLLOUT;
+
+    while (iot_outq_size(t->oq) > t->queue.lowmark) {
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return FALSE;
+
+        if (write_queue(t) < 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static int queue_overflow(strm_t *t)
+{
+    int n;
+
+    switch (t->queue.policy) {
+    case IOT_TRANSPORT_QUEUE_DISCONNECT:
+        iot_log_error("Output queue of transport %p overflowed (%zu bytes), "
+                      "disconnecting.", t, iot_outq_size(t->oq));
+        t->overflow = TRUE;
+        iot_outq_reset(t->oq);
+        shutdown(t->sock, SHUT_RDWR);
+        errno = ENOBUFS;
+        return FALSE;
+
+    case IOT_TRANSPORT_QUEUE_BLOCK:
+        return wait_queue(t);
+
+    case IOT_TRANSPORT_QUEUE_DROP:
+    default:
+        t->full = TRUE;
+        n = iot_outq_drop(t->oq, t->queue.highmark);
+
+        if (n > 0)
+            iot_debug("transport %p: dropped %d queued messages", t, n);
+
+        return TRUE;
+    }
+}
+
+
+static int schedule_flush(strm_t *t)
+{
+    if (t->flags & IOT_TRANSPORT_BATCH) {
+        if (t->ring != NULL && t->rout == NULL)
+            t->rout = iot_uring_out_add(t->ring, t->sock, strm_uring_fill,
+                                        strm_uring_done, t);
+
+        if (t->rout != NULL)
+            return iot_uring_out_schedule(t->rout);
+
+        if (t->flush != NULL) {
+            iot_enable_deferred(t->flush);
             return TRUE;
-        else {
-            if (n == -1 && errno == EAGAIN) {
-                iot_log_error("%s(): XXX TODO: this sucks, need to add "
-                              "output queuing for strm-transport.",
-                              __FUNCTION__);
-            }
+        }
+
+        t->flush = iot_add_deferred(t->ml, strm_flush_cb, t);
+
+        if (t->flush == NULL) {
+            iot_log_error("Failed to add output flush for transport %p.", t);
+            return FALSE;
         }
     }
+    else {
+        t->ow = iot_add_io_watch(t->ml, t->sock, IOT_IO_EVENT_OUT,
+                                 strm_send_cb, t);
 
-    return FALSE;
+        if (t->ow == NULL) {
+            iot_log_error("Failed to add output watch for transport %p.", t);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
 }
 
 
-static int strm_sendjson(iot_transport_t *mt, iot_json_t *msg)
+static ssize_t write_fds(int fd, void *data, size_t size, int *fds, int nfd)
 {
-    strm_t       *t = (strm_t *)mt;
-    struct iovec  iov[2];
-    const char   *s;
-    ssize_t       size, n;
-    uint32_t      len;
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr *cmsg;
+    char            ctrl[CMSG_SPACE(IOT_TRANSPORT_MAXFDS * sizeof(int))];
+
+    iov.iov_base = data;
+    iov.iov_len  = size;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(ctrl, 0, sizeof(ctrl));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = CMSG_SPACE(nfd * sizeof(int));
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(nfd * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, nfd * sizeof(int));
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+
+static void unref_msg(void *m)
+{
+    iot_transport_msg_unref(m);
+}
+
+
+static int send_data(strm_t *t, void *data, size_t size, int *fds, int nfd,
+                     iot_transport_msg_t *m)
+{
+    ssize_t n;
+    int     r;
+
+    if (t->overflow) {
+        errno = ENOBUFS;
+        return FALSE;
+    }
 
-    if (t->connected && (s = iot_json_object_to_string(msg)) != NULL) {
-        size = strlen(s);
-        len  = htobe32(size);
-        iov[0].iov_base = &len;
-        iov[0].iov_len  = sizeof(len);
-        iov[1].iov_base = (void *)s;
-        iov[1].iov_len  = size;
+    n = 0;
 
-        n = writev(t->sock, iov, 2);
+    if (!(t->flags & IOT_TRANSPORT_BATCH) && iot_outq_size(t->oq) == 0) {
+        if (nfd > 0)
+            n = write_fds(t->sock, data, size, fds, nfd);
+        else
+            n = write(t->sock, data, size);
 
-        if (n == (ssize_t)(size + sizeof(len)))
+        if (n == (ssize_t)size) {
+            t->stats.bytes_out += size;
             return TRUE;
-        else {
-            if (n == -1 && errno == EAGAIN) {
-                iot_log_error("%s(): XXX TODO: this sucks, need to add "
-                              "output queuing for strm-transport.",
-                              __FUNCTION__);
-            }
         }
+
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return FALSE;
+            n = 0;
+        }
+
+        t->stats.bytes_out += n;
+        t->stats.eagain++;
     }
 
-    return FALSE;
+    if (t->oq == NULL && (t->oq = iot_outq_create(FALSE)) == NULL)
+        return FALSE;
+
+    if (m != NULL) {
+        r = iot_outq_pushref(t->oq, data, size, n, unref_msg,
+                             iot_transport_msg_ref(m));
+
+        if (r < 0)
+            iot_transport_msg_unref(m);
+    }
+    else
+        r = iot_outq_pushfds(t->oq, data, size, n, NULL, 0, fds, nfd);
+
+    if (r < 0)
+        return FALSE;
+
+    if (t->ow == NULL && !schedule_flush(t))
+        return FALSE;
+
+    if (iot_outq_size(t->oq) > t->queue.highmark)
+        return queue_overflow(t);
+
+    return TRUE;
+}
+
+
+static int strm_sendraw(iot_transport_t *mt, void *data, size_t size)
+{
+    strm_t *t = (strm_t *)mt;
+
+    if (!t->connected)
+        return FALSE;
+
+    return send_data(t, data, size, NULL, 0, NULL);
+}
+
+
+static int send_msg(strm_t *t, iot_json_t *msg, int *fds, int nfd)
+{
+    iot_json_buf_t *b;
+    ssize_t         size;
+    uint32_t        len, flags;
+    int             success;
+
+    if (t->msgpack)
+        size = iot_msgpack_encode(msg, &t->obuf, sizeof(len));
+    else
+        size = iot_json_serialize(msg, &t->obuf, sizeof(len));
+
+    if (size < 0)
+        return FALSE;
+
+    b     = &t->obuf;
+    flags = 0;
+
+    if (t->compress && (size_t)size >= t->zthreshold) {
+        size = iot_compress(t->obuf.data + sizeof(len), size, &t->zbuf,
+                            sizeof(len));
+
+        if (size > 0) {
+            b     = &t->zbuf;
+            flags = IOT_FRAGBUF_COMPRESSED;
+        }
+    }
+
+    len = htobe32((b->used - sizeof(len)) | flags);
+    memcpy(b->data, &len, sizeof(len));
+
+    success = send_data(t, b->data, b->used, fds, nfd, NULL);
+
+    if (t->obuf.size > OBUF_KEEP)
+        iot_json_buf_cleanup(&t->obuf);
+    if (t->zbuf.size > OBUF_KEEP)
+        iot_json_buf_cleanup(&t->zbuf);
+
+    return success;
+}
+
+
+static int strm_sendjson(iot_transport_t *mt, iot_json_t *msg)
+{
+    strm_t *t = (strm_t *)mt;
+
+    if (!t->connected)
+        return FALSE;
+
+    return send_msg(t, msg, NULL, 0);
+}
+
+
+static int strm_sendjsonfds(iot_transport_t *mt, iot_json_t *msg,
+                            int *fds, int nfd)
+{
+    strm_t *t = (strm_t *)mt;
+
+    if (!t->connected)
+        return FALSE;
+
+    return send_msg(t, msg, fds, nfd);
+}
+
+
+static int strm_sendmsg(iot_transport_t *mt, iot_transport_msg_t *m)
+{
+    strm_t     *t = (strm_t *)mt;
+    const void *data;
+    size_t      size;
+
+    if (!t->connected)
+        return FALSE;
+
+    data = iot_transport_msg_frame(m, t->msgpack,
+                                   t->compress ? t->zthreshold : 0, &size);
+
+    if (data == NULL)
+        return FALSE;
+
+    return send_data(t, (void *)data, size, NULL, 0, m);
 }
 
 
-IOT_REGISTER_TRANSPORT(tcp4, TCP4, strm_t, strm_resolve,
-                       strm_open, strm_createfrom, strm_close,
-                       NULL, NULL,
-                       strm_bind, strm_listen, strm_accept,
-                       strm_connect, strm_disconnect,
-                       strm_sendraw, NULL,
-                       strm_sendjson, NULL);
-
-IOT_REGISTER_TRANSPORT(tcp6, TCP6, strm_t, strm_resolve,
-                       strm_open, strm_createfrom, strm_close,
-                       NULL, NULL,
-                       strm_bind, strm_listen, strm_accept,
-                       strm_connect, strm_disconnect,
-                       strm_sendraw, NULL,
-                       strm_sendjson, NULL);
-
-IOT_REGISTER_TRANSPORT(unxstrm, UNXS, strm_t, strm_resolve,
-                       strm_open, strm_createfrom, strm_close,
-                       NULL, strm_getopt,
-                       strm_bind, strm_listen, strm_accept,
-                       strm_connect, strm_disconnect,
-                       strm_sendraw, NULL,
-                       strm_sendjson, NULL);
+IOT_REGISTER_TRANSPORT_MSG(tcp4, TCP4, strm_t,
+                           strm_resolve, strm_open, strm_createfrom, strm_close,
+                           NULL, tcp_getopt,
+                           strm_bind, strm_listen, strm_accept,
+                           strm_connect, strm_disconnect,
+                           strm_sendraw, NULL,
+                           strm_sendjson, NULL,
+                           NULL, strm_sendmsg);
+
+IOT_REGISTER_TRANSPORT_MSG(tcp6, TCP6, strm_t,
+                           strm_resolve, strm_open, strm_createfrom, strm_close,
+                           NULL, tcp_getopt,
+                           strm_bind, strm_listen, strm_accept,
+                           strm_connect, strm_disconnect,
+                           strm_sendraw, NULL,
+                           strm_sendjson, NULL,
+                           NULL, strm_sendmsg);
+
+IOT_REGISTER_TRANSPORT_MSG(unxstrm, UNXS, strm_t,
+                           strm_resolve, strm_open, strm_createfrom, strm_close,
+                           NULL, strm_getopt,
+                           strm_bind, strm_listen, strm_accept,
+                           strm_connect, strm_disconnect,
+                           strm_sendraw, NULL,
+                           strm_sendjson, NULL,
+                           strm_sendjsonfds, strm_sendmsg);
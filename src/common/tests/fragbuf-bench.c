@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/log.h>
+#include <iot/common/fragbuf.h>
+
+#define bench_fail(...) do {                            \
+        iot_log_error("fatal error: "__VA_ARGS__);      \
+        exit(1);                                        \
+    } while (0)
+
+/*
+ * Simulate a stream transport receiving bursts of small framed messages.
+ * The stream is fed to a fragment buffer in reads of a fixed size, so
+ * that each read carries many frames and usually ends with a partial
+ * frame that gets completed by the next read.
+ */
+
+typedef struct {
+    int     iterations;                  /* number of passes over stream */
+    int     nframe;                      /* number of frames in stream */
+    int     fsize;                       /* frame payload size */
+    int     rsize;                       /* read size */
+    char   *stream;                      /* framed message stream */
+    size_t  length;                      /* stream length */
+} bench_t;
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static void setup(bench_t *b)
+{
+    uint32_t size;
+    char    *p;
+    int      i;
+
+    b->length = b->nframe * (sizeof(size) + b->fsize);
+    b->stream = iot_allocz(b->length);
+
+    if (b->stream == NULL)
+        bench_fail("failed to allocate message stream");
+
+    for (i = 0, p = b->stream; i < b->nframe; i++) {
+        size = htobe32(b->fsize);
+        memcpy(p, &size, sizeof(size));
+        p += sizeof(size);
+        memset(p, 'a' + i % 26, b->fsize);
+        p += b->fsize;
+    }
+}
+
+
+static void bench_pull(bench_t *b)
+{
+    iot_fragbuf_t *buf;
+    void          *data;
+    size_t         size, n;
+    double         start, t;
+    int            i, nframe, nread;
+
+    if ((buf = iot_fragbuf_create(TRUE, 0)) == NULL)
+        bench_fail("failed to create fragment buffer");
+
+    nframe = 0;
+    nread  = 0;
+    start  = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        for (n = 0; n < b->length; n += b->rsize) {
+            size = b->length - n;
+
+            if (size > (size_t)b->rsize)
+                size = b->rsize;
+
+            if (!iot_fragbuf_push(buf, b->stream + n, size))
+                bench_fail("failed to push data to fragment buffer");
+
+            nread++;
+
+            data = NULL;
+            while (iot_fragbuf_pull(buf, &data, &size)) {
+                if (size != (size_t)b->fsize)
+                    bench_fail("frame #%d corrupted", nframe);
+                nframe++;
+            }
+
+            if (iot_fragbuf_missing(buf) > sizeof(uint32_t) + b->fsize)
+                bench_fail("invalid partial frame after read #%d", nread);
+        }
+    }
+
+    t = now() - start;
+
+    if (nframe != b->iterations * b->nframe || iot_fragbuf_used(buf) != 0)
+        bench_fail("lost frames (%d != %d)", nframe,
+                   b->iterations * b->nframe);
+
+    printf("  %-24s %9.0f frames/s %8.3f us/frame %8.3f us/read\n",
+           "push + pull", nframe / t, 1000000.0 * t / nframe,
+           1000000.0 * t / nread);
+
+    iot_fragbuf_destroy(buf);
+}
+
+
+static void check_oversized(void)
+{
+    iot_fragbuf_t *buf;
+    char           frame[64];
+    uint32_t       size;
+    void          *data;
+    size_t         missing;
+
+    /*
+     * Make sure a (hostile) frame header close to the maximum frame size
+     * is not mistaken for a complete frame by size arithmetic wrapping
+     * around.
+     */
+
+    if ((buf = iot_fragbuf_create(TRUE, 0)) == NULL)
+        bench_fail("failed to create fragment buffer");
+
+    size = htobe32(IOT_FRAGBUF_SIZE_MASK);
+    memcpy(frame, &size, sizeof(size));
+    memset(frame + sizeof(size), 'x', sizeof(frame) - sizeof(size));
+
+    if (!iot_fragbuf_push(buf, frame, sizeof(frame)))
+        bench_fail("failed to push data to fragment buffer");
+
+    data = NULL;
+    if (iot_fragbuf_pull(buf, &data, &missing))
+        bench_fail("partial frame of %u bytes pulled as complete",
+                   IOT_FRAGBUF_SIZE_MASK);
+
+    missing = iot_fragbuf_missing(buf);
+    size    = IOT_FRAGBUF_SIZE_MASK;
+
+    if (missing != sizeof(size) + (size_t)size - sizeof(frame))
+        bench_fail("invalid missing size %zu for partial frame", missing);
+
+    if (iot_fragbuf_used(buf) != sizeof(frame))
+        bench_fail("invalid used size %zu for partial frame",
+                   iot_fragbuf_used(buf));
+
+    iot_fragbuf_destroy(buf);
+}
+
+
+static void print_usage(const char *argv0, int exit_code)
+{
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -n, --iterations=<n>           passes over the message stream\n"
+           "  -f, --frames=<n>               frames in the message stream\n"
+           "  -s, --size=<n>                 frame payload size\n"
+           "  -r, --read=<n>                 read size\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    exit(exit_code);
+}
+
+
+static void parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "n:f:s:r:h"
+    struct option options[] = {
+        { "iterations", required_argument, NULL, 'n' },
+        { "frames"    , required_argument, NULL, 'f' },
+        { "size"      , required_argument, NULL, 's' },
+        { "read"      , required_argument, NULL, 'r' },
+        { "help"      , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+
+    b->iterations = 100;
+    b->nframe     = 10000;
+    b->fsize      = 48;
+    b->rsize      = 64 * 1024;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            b->iterations = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'f':
+            b->nframe = (int)strtol(optarg, NULL, 10);
+            break;
+        case 's':
+            b->fsize = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'r':
+            b->rsize = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'h':
+            print_usage(argv[0], 0);
+            break;
+        default:
+            print_usage(argv[0], EINVAL);
+        }
+    }
+
+    if (b->iterations <= 0 || b->nframe <= 0 || b->fsize < 0 || b->rsize <= 0)
+        print_usage(argv[0], EINVAL);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static bench_t b;
+
+    iot_log_set_mask(IOT_LOG_UPTO(IOT_LOG_WARNING));
+    iot_log_set_target(IOT_LOG_TO_STDERR);
+
+    parse_cmdline(&b, argc, argv);
+    check_oversized();
+    setup(&b);
+
+    printf("fragment buffer, %d frames of %d bytes, %d byte reads, "
+           "%d passes:\n", b.nframe, b.fsize, b.rsize, b.iterations);
+    bench_pull(&b);
+
+    iot_free(b.stream);
+
+    return 0;
+}
@@ -0,0 +1,711 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/log.h>
+#include <iot/common/json.h>
+#include <iot/common/msgpack.h>
+
+#define bench_fail(...) do {                            \
+        iot_log_error("fatal error: "__VA_ARGS__);      \
+        exit(1);                                        \
+    } while (0)
+
+typedef struct {
+    int  iterations;                     /* number of rounds per benchmark */
+    int  napps;                          /* number of apps in list reply */
+    int  sock[2];                        /* socket pair to send through */
+    char rbuf[256 * 1024];               /* buffer for draining sockets */
+} bench_t;
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static void report(const char *name, int iterations, size_t bytes,
+                   double start, double end)
+{
+    double t = end - start;
+
+    printf("  %-28s %8.0f msgs/s %8.1f MB/s %8.3f us/msg\n", name,
+           iterations / t, bytes / t / (1024.0 * 1024.0),
+           1000000.0 * t / iterations);
+}
+
+
+static iot_json_t *status_reply(int seqno)
+{
+    iot_json_t *rpl, *s, *data;
+
+    rpl = iot_json_create(IOT_JSON_OBJECT);
+    iot_json_add_string (rpl, "type" , "status");
+    iot_json_add_integer(rpl, "seqno", seqno);
+
+    s = iot_json_create(IOT_JSON_OBJECT);
+    iot_json_add_object (rpl, "status" , s);
+    iot_json_add_integer(s  , "status" , 0);
+    iot_json_add_string (s  , "message", "OK");
+
+    data = iot_json_create(IOT_JSON_OBJECT);
+    iot_json_add_object (s   , "data" , data);
+    iot_json_add_string (data, "appid", "org.example.sensor:reader");
+    iot_json_add_integer(data, "pid"  , 4242);
+
+    return rpl;
+}
+
+
+static iot_json_t *sensor_event(int nsamples)
+{
+    iot_json_t *msg, *e, *data, *samples;
+    int         i;
+
+    msg = iot_json_create(IOT_JSON_OBJECT);
+    iot_json_add_string (msg, "type" , "event");
+    iot_json_add_integer(msg, "seqno", 0);
+
+    e = iot_json_create(IOT_JSON_OBJECT);
+    iot_json_add_object(msg, "event", e);
+    iot_json_add_string(e  , "event", "sensor-data");
+
+    data = iot_json_create(IOT_JSON_OBJECT);
+    iot_json_add_object (e   , "data"  , data);
+    iot_json_add_string (data, "sensor", "accelerometer");
+    iot_json_add_integer(data, "stamp" , 1476788400);
+
+    samples = iot_json_create(IOT_JSON_ARRAY);
+    iot_json_add_object(data, "samples", samples);
+
+    for (i = 0; i < nsamples; i++)
+        iot_json_array_append_double(samples, 0.25 * i - 9.81);
+
+    return msg;
+}
+
+
+static iot_json_t *app_list(int napps)
+{
+    const char *argv[] = { "/usr/bin/reader", "--verbose", "--rate=10",
+                           "--device=\"/dev/iio:device0\"" };
+    iot_json_t *rpl, *s, *apps, *app;
+    char        appid[64], descr[128];
+    int         i;
+
+    rpl = iot_json_create(IOT_JSON_OBJECT);
+    iot_json_add_string (rpl, "type" , "status");
+    iot_json_add_integer(rpl, "seqno", 1);
+
+    s = iot_json_create(IOT_JSON_OBJECT);
+    iot_json_add_object (rpl, "status" , s);
+    iot_json_add_integer(s  , "status" , 0);
+    iot_json_add_string (s  , "message", "OK");
+
+    apps = iot_json_create(IOT_JSON_ARRAY);
+    iot_json_add_object(s, "data", apps);
+
+    for (i = 0; i < napps; i++) {
+        snprintf(appid, sizeof(appid), "org.example.pkg%d:app%d", i, i);
+        snprintf(descr, sizeof(descr), "Example application #%d\twith "
+                 "a \"quoted\" description", i);
+
+        app = iot_json_create(IOT_JSON_OBJECT);
+        iot_json_add_string (app, "app"        , appid);
+        iot_json_add_string (app, "description", descr);
+        iot_json_add_string (app, "desktop"    , "");
+        iot_json_add_integer(app, "user"       , 1000 + i);
+        iot_json_add_string_array(app, "argv", argv, IOT_ARRAY_SIZE(argv));
+        iot_json_array_append(apps, app);
+    }
+
+    return rpl;
+}
+
+
+static void drain(bench_t *b)
+{
+    while (read(b->sock[1], b->rbuf, sizeof(b->rbuf)) > 0)
+        ;
+}
+
+
+static void bench_to_string(bench_t *b, const char *name, iot_json_t *o)
+{
+    struct iovec  iov[2];
+    const char   *s;
+    uint32_t      len;
+    size_t        size, total;
+    double        start;
+    int           i;
+
+    total = 0;
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        s    = iot_json_object_to_string(o);
+        size = strlen(s);
+        len  = htobe32(size);
+
+        iov[0].iov_base = &len;
+        iov[0].iov_len  = sizeof(len);
+        iov[1].iov_base = (void *)s;
+        iov[1].iov_len  = size;
+
+        if (writev(b->sock[0], iov, 2) != (ssize_t)(sizeof(len) + size))
+            bench_fail("writev failed (%d: %s)", errno, strerror(errno));
+
+        total += sizeof(len) + size;
+        drain(b);
+    }
+
+    report(name, b->iterations, total, start, now());
+}
+
+
+static void bench_serialize(bench_t *b, const char *name, iot_json_t *o)
+{
+    iot_json_buf_t buf = { NULL, 0, 0 };
+    ssize_t        size;
+    uint32_t       len;
+    size_t         total;
+    double         start;
+    int            i;
+
+    total = 0;
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        if ((size = iot_json_serialize(o, &buf, sizeof(len))) < 0)
+            bench_fail("serialization failed (%d: %s)", errno, strerror(errno));
+
+        len = htobe32(size);
+        memcpy(buf.data, &len, sizeof(len));
+
+        if (write(b->sock[0], buf.data, buf.used) != (ssize_t)buf.used)
+            bench_fail("write failed (%d: %s)", errno, strerror(errno));
+
+        total += buf.used;
+        drain(b);
+    }
+
+    report(name, b->iterations, total, start, now());
+
+    iot_json_buf_cleanup(&buf);
+}
+
+
+static void check_serialize(iot_json_t *o)
+{
+    iot_json_buf_t  buf = { NULL, 0, 0 };
+    iot_json_t     *c;
+    const char     *s;
+    char           *orig;
+
+    if (iot_json_serialize(o, &buf, 0) < 0)
+        bench_fail("serialization failed (%d: %s)", errno, strerror(errno));
+
+    orig = strdup(iot_json_object_to_string(o));
+    c    = iot_json_string_to_object(buf.data, buf.used);
+
+    if (c == NULL)
+        bench_fail("failed to parse serialized object '%s'", buf.data);
+
+    if (strcmp(orig, (s = iot_json_object_to_string(c))))
+        bench_fail("serialized object mismatch: '%s' vs. '%s'", orig, s);
+
+    iot_json_unref(c);
+    iot_json_buf_cleanup(&buf);
+    free(orig);
+}
+
+
+static void bench_parse_tokener(bench_t *b, const char *name, const char *str)
+{
+    json_tokener *tok;
+    iot_json_t   *o;
+    size_t        len;
+    double        start;
+    int           i;
+
+    if ((tok = json_tokener_new()) == NULL)
+        bench_fail("failed to create json-c tokener");
+
+    len   = strlen(str);
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        json_tokener_reset(tok);
+        if ((o = json_tokener_parse_ex(tok, str, len)) == NULL)
+            bench_fail("failed to parse '%s'", str);
+        iot_json_unref(o);
+    }
+
+    report(name, b->iterations, b->iterations * len, start, now());
+
+    json_tokener_free(tok);
+}
+
+
+static void bench_parse_string(bench_t *b, const char *name, const char *str)
+{
+    iot_json_t *o;
+    size_t      len;
+    double      start;
+    int         i;
+
+    len   = strlen(str);
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        if ((o = iot_json_string_to_object(str, len)) == NULL)
+            bench_fail("failed to parse '%s'", str);
+        iot_json_unref(o);
+    }
+
+    report(name, b->iterations, b->iterations * len, start, now());
+}
+
+
+static void bench_parse_object(bench_t *b, const char *name, const char *str)
+{
+    iot_json_t *o;
+    char       *p;
+    int         len, l;
+    double      start;
+    int         i;
+
+    len   = strlen(str);
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        p = (char *)str;
+        l = len;
+        if (iot_json_parse_object(&p, &l, &o) < 0 || o == NULL)
+            bench_fail("failed to parse '%s'", str);
+        iot_json_unref(o);
+    }
+
+    report(name, b->iterations, b->iterations * len, start, now());
+}
+
+
+static void bench_parse_feed(bench_t *b, const char *name, const char *str,
+                             int chunk)
+{
+    iot_json_parser_t *p;
+    iot_json_t        *o;
+    int                len, n, i, l;
+    double             start;
+
+    if ((p = iot_json_parser_create()) == NULL)
+        bench_fail("failed to create parser context");
+
+    len   = strlen(str);
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        o = NULL;
+        for (n = 0; n < len && o == NULL; n += l) {
+            l = chunk && len - n > chunk ? chunk : len - n;
+            if ((l = iot_json_parser_feed(p, str + n, l, &o)) < 0)
+                bench_fail("failed to parse '%s'", str);
+        }
+
+        if (o == NULL)
+            bench_fail("incomplete object after feeding '%s'", str);
+
+        iot_json_unref(o);
+    }
+
+    report(name, b->iterations, b->iterations * len, start, now());
+
+    iot_json_parser_destroy(p);
+}
+
+
+static void bench_parse(bench_t *b, const char *what, iot_json_t *o)
+{
+    char *str = strdup(iot_json_object_to_string(o));
+
+    printf("parse, %s (%d rounds, %zu bytes):\n", what, b->iterations,
+           strlen(str));
+    bench_parse_tokener(b, "json-c json_tokener_parse_ex", str);
+    bench_parse_string(b, "iot_json_string_to_object", str);
+    bench_parse_object(b, "iot_json_parse_object", str);
+    bench_parse_feed(b, "iot_json_parser_feed", str, 0);
+    bench_parse_feed(b, "iot_json_parser_feed/64", str, 64);
+
+    free(str);
+}
+
+
+static void bench_build(bench_t *b, const char *what, int napps)
+{
+    iot_json_t *o;
+    double      start;
+    int         i;
+
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        o = napps < 0 ? status_reply(i) : app_list(napps);
+        iot_json_unref(o);
+    }
+
+    report(what, b->iterations, 0, start, now());
+}
+
+
+static void bench_clone(bench_t *b, iot_json_t *o)
+{
+    iot_json_t *c;
+    double      start;
+    int         i;
+
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        c = iot_json_string_to_object(iot_json_object_to_string(o), -1);
+        iot_json_unref(c);
+    }
+
+    report("clone via string", b->iterations, 0, start, now());
+
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        c = iot_json_clone(o);
+        iot_json_unref(c);
+    }
+
+    report("iot_json_clone", b->iterations, 0, start, now());
+
+    c = iot_json_clone(o);
+
+    if (strcmp(iot_json_object_to_string(c), iot_json_object_to_string(o)))
+        bench_fail("cloned object mismatch");
+
+    iot_json_unref(c);
+}
+
+
+static iot_json_t *scan_member(iot_json_t *o, const char *key)
+{
+    iot_json_iter_t  it;
+    const char      *k;
+    iot_json_t      *v;
+
+    iot_json_foreach_member(o, k, v, it) {
+        if (!strcmp(k, key))
+            return v;
+    }
+
+    return NULL;
+}
+
+
+static void bench_lookup(bench_t *b, iot_json_t *o)
+{
+    const char *keys[] = { "app", "description", "desktop", "user", "argv",
+                           "missing" };
+    double      start;
+    int         i, j, n;
+
+    n     = IOT_ARRAY_SIZE(keys);
+    start = now();
+
+    for (i = 0; i < b->iterations; i++)
+        for (j = 0; j < n; j++)
+            if ((scan_member(o, keys[j]) == NULL) != (j == n - 1))
+                bench_fail("lookup of '%s' failed", keys[j]);
+
+    report("member lookup by scanning", b->iterations * n, 0, start, now());
+
+    start = now();
+
+    for (i = 0; i < b->iterations; i++)
+        for (j = 0; j < n; j++)
+            if ((iot_json_get(o, keys[j]) == NULL) != (j == n - 1))
+                bench_fail("lookup of '%s' failed", keys[j]);
+
+    report("iot_json_get", b->iterations * n, 0, start, now());
+}
+
+
+static void bench_dom(bench_t *b, iot_json_t *list)
+{
+    iot_json_t *s, *apps, *app;
+
+    printf("build, clone and look up (%d rounds):\n", b->iterations);
+    bench_build(b, "build status reply", -1);
+    bench_build(b, "build 5 app list reply", 5);
+    bench_clone(b, list);
+
+    if (!iot_json_get_object(list, "status", &s) ||
+        !iot_json_get_array(s, "data", &apps) ||
+        !iot_json_array_get_object(apps, 0, &app))
+        bench_fail("failed to find app in list reply");
+
+    bench_lookup(b, app);
+}
+
+
+static void check_msgpack(iot_json_t *o)
+{
+    iot_json_buf_t  buf = { NULL, 0, 0 };
+    iot_json_t     *c;
+    const char     *s;
+    char           *orig;
+
+    if (iot_msgpack_encode(o, &buf, 0) < 0)
+        bench_fail("MessagePack encoding failed (%d: %s)", errno,
+                   strerror(errno));
+
+    orig = strdup(iot_json_object_to_string(o));
+
+    if ((c = iot_msgpack_decode(buf.data, buf.used)) == NULL)
+        bench_fail("failed to decode MessagePack-encoded '%s'", orig);
+
+    if (strcmp(orig, (s = iot_json_object_to_string(c))))
+        bench_fail("MessagePack object mismatch: '%s' vs. '%s'", orig, s);
+
+    iot_json_unref(c);
+    iot_json_buf_cleanup(&buf);
+    free(orig);
+}
+
+
+static void bench_encode(bench_t *b, const char *name, iot_json_t *o,
+                         int msgpack)
+{
+    iot_json_buf_t buf = { NULL, 0, 0 };
+    ssize_t        size;
+    double         start;
+    int            i;
+
+    size  = 0;
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        if (msgpack)
+            size = iot_msgpack_encode(o, &buf, 0);
+        else
+            size = iot_json_serialize(o, &buf, 0);
+
+        if (size < 0)
+            bench_fail("encoding failed (%d: %s)", errno, strerror(errno));
+    }
+
+    report(name, b->iterations, b->iterations * size, start, now());
+
+    iot_json_buf_cleanup(&buf);
+}
+
+
+static void bench_decode(bench_t *b, const char *name, iot_json_t *o,
+                         int msgpack)
+{
+    iot_json_buf_t  buf = { NULL, 0, 0 };
+    iot_json_t     *c;
+    double          start;
+    int             i;
+
+    if (msgpack)
+        iot_msgpack_encode(o, &buf, 0);
+    else
+        iot_json_serialize(o, &buf, 0);
+
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        if (msgpack)
+            c = iot_msgpack_decode(buf.data, buf.used);
+        else
+            c = iot_json_string_to_object(buf.data, buf.used);
+
+        if (c == NULL)
+            bench_fail("decoding failed");
+
+        iot_json_unref(c);
+    }
+
+    report(name, b->iterations, b->iterations * buf.used, start, now());
+
+    iot_json_buf_cleanup(&buf);
+}
+
+
+static void bench_codec(bench_t *b, const char *what, iot_json_t *o)
+{
+    iot_json_buf_t jbuf = { NULL, 0, 0 }, mbuf = { NULL, 0, 0 };
+
+    iot_json_serialize(o, &jbuf, 0);
+    iot_msgpack_encode(o, &mbuf, 0);
+
+    printf("JSON vs. MessagePack, %s (%d rounds, %zu vs. %zu bytes):\n",
+           what, b->iterations, jbuf.used, mbuf.used);
+    bench_encode(b, "iot_json_serialize", o, FALSE);
+    bench_encode(b, "iot_msgpack_encode", o, TRUE);
+    bench_decode(b, "iot_json_string_to_object", o, FALSE);
+    bench_decode(b, "iot_msgpack_decode", o, TRUE);
+
+    iot_json_buf_cleanup(&jbuf);
+    iot_json_buf_cleanup(&mbuf);
+}
+
+
+static void print_usage(const char *argv0, int exit_code)
+{
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -n, --iterations=<n>           rounds per benchmark\n"
+           "  -a, --apps=<n>                 number of apps in list replies\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    exit(exit_code);
+}
+
+
+static void parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "n:a:h"
+    struct option options[] = {
+        { "iterations", required_argument, NULL, 'n' },
+        { "apps"      , required_argument, NULL, 'a' },
+        { "help"      , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+
+    b->iterations = 100000;
+    b->napps      = 50;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            b->iterations = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'a':
+            b->napps = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'h':
+            print_usage(argv[0], 0);
+            break;
+        default:
+            print_usage(argv[0], EINVAL);
+        }
+    }
+
+    if (b->iterations <= 0 || b->napps < 0)
+        print_usage(argv[0], EINVAL);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static bench_t  b;
+    iot_json_t     *status, *event, *list;
+    int             size;
+
+    iot_log_set_mask(IOT_LOG_UPTO(IOT_LOG_WARNING));
+    iot_log_set_target(IOT_LOG_TO_STDERR);
+
+    parse_cmdline(&b, argc, argv);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, b.sock) < 0)
+        bench_fail("failed to create socket pair (%d: %s)",
+                   errno, strerror(errno));
+
+    size = 1024 * 1024;
+    setsockopt(b.sock[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(b.sock[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    status = status_reply(1);
+    event  = sensor_event(32);
+    list   = app_list(b.napps);
+
+    check_serialize(status);
+    check_serialize(list);
+    check_msgpack(status);
+    check_msgpack(event);
+    check_msgpack(list);
+
+    printf("serialize+send, status reply (%d rounds):\n", b.iterations);
+    bench_to_string(&b, "json-c to_string+writev", status);
+    bench_serialize(&b, "iot_json_serialize+write", status);
+    bench_parse(&b, "status reply", status);
+    bench_parse(&b, "sensor event", event);
+    bench_codec(&b, "status reply", status);
+    bench_codec(&b, "sensor event", event);
+
+    b.iterations /= 10;
+
+    if (b.iterations == 0)
+        b.iterations = 1;
+
+    printf("serialize+send, %d app list reply (%d rounds):\n", b.napps,
+           b.iterations);
+    bench_to_string(&b, "json-c to_string+writev", list);
+    bench_serialize(&b, "iot_json_serialize+write", list);
+    bench_parse(&b, "app list reply", list);
+    bench_codec(&b, "app list reply", list);
+
+    bench_dom(&b, list);
+
+    iot_json_unref(status);
+    iot_json_unref(event);
+    iot_json_unref(list);
+
+    close(b.sock[0]);
+    close(b.sock[1]);
+
+    return 0;
+}
@@ -0,0 +1,1180 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/log.h>
+#include <iot/common/mainloop.h>
+#include <iot/common/json.h>
+#include <iot/common/transport.h>
+#include <iot/common/memfd.h>
+#include <iot/common/uring.h>
+
+#define bench_fail(...) do {                            \
+        iot_log_error("fatal error: "__VA_ARGS__);      \
+        exit(1);                                        \
+    } while (0)
+
+#define MAX_CLIENTS 256
+
+/*
+ * Simulate a daemon fanning events out to a number of clients. Each
+ * round sends a burst of events to every client, then runs a single
+ * mainloop iteration and drains the peer sockets, much like an event
+ * storm being routed by the launcher daemon. Events are either sent
+ * as JSON to each client, or pre-encoded once per event and then sent
+ * to all clients.
+ */
+
+typedef struct {
+    int              iterations;         /* number of rounds */
+    int              nclient;            /* number of clients */
+    int              burst;              /* events per client per round */
+    iot_mainloop_t  *ml;                 /* mainloop */
+    iot_transport_t *t[MAX_CLIENTS];     /* transports to clients */
+    int              peer[MAX_CLIENTS];  /* client ends of the sockets */
+    int              received;           /* messages received */
+    int              nconn;              /* connections for backends */
+    char             rbuf[256 * 1024];   /* buffer for draining sockets */
+} bench_t;
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+/*
+ * Read the number of read(2)- or write(2)-family system calls (read,
+ * readv, write, writev) made by us so far. sendmsg(2), recvmsg(2), and
+ * friends are not accounted for here.
+ */
+static long io_syscalls(const char *key)
+{
+    FILE *fp;
+    char  line[128];
+    long  cnt;
+    int   len;
+
+    if ((fp = fopen("/proc/self/io", "r")) == NULL)
+        return -1;
+
+    cnt = -1;
+    len = strlen(key);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (!strncmp(line, key, len) && line[len] == ':') {
+            cnt = strtol(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    return cnt;
+}
+
+
+static long write_syscalls(void)
+{
+    return io_syscalls("syscw");
+}
+
+
+static long read_syscalls(void)
+{
+    return io_syscalls("syscr");
+}
+
+
+static long uring_syscalls(void)
+{
+    iot_uring_stats_t stats;
+
+    iot_uring_get_stats(&stats);
+
+    return (long)stats.enter;
+}
+
+
+static double cpu_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static iot_json_t *event_msg(void)
+{
+    iot_json_t *msg, *evt, *data;
+
+    msg  = iot_json_create(IOT_JSON_OBJECT);
+    evt  = iot_json_create(IOT_JSON_OBJECT);
+    data = iot_json_create(IOT_JSON_OBJECT);
+
+    if (msg == NULL || evt == NULL || data == NULL)
+        bench_fail("failed to create event message");
+
+    iot_json_add_string (data, "sensor", "temperature");
+    iot_json_add_double (data, "value" , 21.5);
+    iot_json_add_string (evt , "event" , "sensor-changed");
+    iot_json_add        (evt , "data"  , data);
+    iot_json_add_string (msg , "type"  , "event");
+    iot_json_add_integer(msg , "seqno" , 0);
+    iot_json_add        (msg , "event" , evt);
+
+    return msg;
+}
+
+
+static void recv_cb(iot_transport_t *t, iot_json_t *msg, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+
+    IOT_UNUSED(t);
+    IOT_UNUSED(msg);
+
+    b->received++;
+}
+
+
+static void closed_cb(iot_transport_t *t, int error, void *user_data)
+{
+    IOT_UNUSED(t);
+    IOT_UNUSED(user_data);
+
+    bench_fail("transport closed (%d: %s)", error, strerror(error));
+}
+
+
+static int udp_pair(int sock[2])
+{
+    struct sockaddr_in addr[2];
+    socklen_t          len;
+    int                i;
+
+    for (i = 0; i < 2; i++) {
+        sock[i] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+        if (sock[i] < 0)
+            return -1;
+
+        memset(addr + i, 0, sizeof(addr[i]));
+        addr[i].sin_family      = AF_INET;
+        addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        len = sizeof(addr[i]);
+
+        if (bind(sock[i], (struct sockaddr *)&addr[i], len) < 0 ||
+            getsockname(sock[i], (struct sockaddr *)&addr[i], &len) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < 2; i++)
+        if (connect(sock[i], (struct sockaddr *)&addr[!i], len) < 0)
+            return -1;
+
+    return 0;
+}
+
+
+static void setup(bench_t *b, const char *type, int family, int socktype,
+                  int flags)
+{
+    static iot_transport_evt_t evt = {
+        { .recvjson     = recv_cb },
+        { .recvjsonfrom = NULL    },
+          .closed       = closed_cb,
+    };
+
+    int sock[2], i, size;
+
+    b->ml = iot_mainloop_create();
+
+    if (b->ml == NULL)
+        bench_fail("failed to create mainloop");
+
+    flags |= IOT_TRANSPORT_MODE_JSON | IOT_TRANSPORT_NONBLOCK;
+
+    for (i = 0; i < b->nclient; i++) {
+        if (family == AF_INET) {
+            if (udp_pair(sock) < 0)
+                bench_fail("failed to create UDP socket pair (%d: %s)",
+                           errno, strerror(errno));
+        }
+        else {
+            if (socketpair(AF_UNIX, socktype | SOCK_NONBLOCK, 0, sock) < 0)
+                bench_fail("failed to create socket pair (%d: %s)",
+                           errno, strerror(errno));
+        }
+
+        size = 1024 * 1024;
+        setsockopt(sock[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(sock[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(sock[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(sock[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+        b->t[i] = iot_transport_create_from(b->ml, type, &sock[0], &evt, b,
+                                            flags, IOT_TRANSPORT_CONNECTED);
+
+        if (b->t[i] == NULL)
+            bench_fail("failed to create transport");
+
+        b->peer[i] = sock[1];
+    }
+}
+
+
+static void cleanup(bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < b->nclient; i++) {
+        iot_transport_destroy(b->t[i]);
+        close(b->peer[i]);
+    }
+
+    iot_mainloop_destroy(b->ml);
+    b->ml = NULL;
+}
+
+
+static void drain(bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < b->nclient; i++)
+        while (read(b->peer[i], b->rbuf, sizeof(b->rbuf)) > 0)
+            ;
+}
+
+
+static void bench_fanout(bench_t *b, const char *name, const char *type,
+                         int socktype, int flags, int encoded)
+{
+    iot_json_t          *msg = event_msg();
+    iot_transport_msg_t *m;
+    double               start, t;
+    long                 nsys;
+    int                  i, j, k, nmsg;
+
+    setup(b, type, AF_UNIX, socktype, flags);
+
+    nsys  = write_syscalls();
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        for (j = 0; j < b->burst; j++) {
+            if (encoded) {
+                if ((m = iot_transport_msg_create(msg)) == NULL)
+                    bench_fail("failed to create pre-encoded message");
+
+                for (k = 0; k < b->nclient; k++)
+                    if (!iot_transport_sendmsg(b->t[k], m))
+                        bench_fail("failed to send message");
+
+                iot_transport_msg_unref(m);
+            }
+            else {
+                for (k = 0; k < b->nclient; k++)
+                    if (!iot_transport_sendjson(b->t[k], msg))
+                        bench_fail("failed to send message");
+            }
+        }
+
+        iot_mainloop_prepare(b->ml);
+        iot_mainloop_poll(b->ml, FALSE);
+        iot_mainloop_dispatch(b->ml);
+        drain(b);
+    }
+
+    t    = now() - start;
+    nsys = write_syscalls() - nsys;
+    nmsg = b->iterations * b->burst * b->nclient;
+
+    if (socktype == SOCK_STREAM)
+        printf("  %-24s %9.0f msgs/s %8.3f us/msg %6.3f writes/msg\n", name,
+               nmsg / t, 1000000.0 * t / nmsg, (double)nsys / nmsg);
+    else
+        printf("  %-24s %9.0f msgs/s %8.3f us/msg\n", name,
+               nmsg / t, 1000000.0 * t / nmsg);
+
+    cleanup(b);
+    iot_json_unref(msg);
+}
+
+
+/*
+ * Simulate a daemon receiving requests from a number of clients. Each
+ * round every client sends a burst of requests, after which we run a
+ * single mainloop iteration to receive them. Only the receiving side is
+ * timed. Report the per message cost, and the share of a CPU it takes
+ * to keep up with a steady stream of 10k messages per second.
+ */
+static char *burst_frames(bench_t *b, iot_json_t *msg, size_t *totalp)
+{
+    const char *str;
+    char       *frames, *p;
+    uint32_t    size;
+    size_t      len, total;
+    int         j;
+
+    str   = iot_json_object_to_string(msg);
+    len   = strlen(str);
+    total = b->burst * (sizeof(size) + len);
+
+    if ((frames = iot_allocz(total)) == NULL)
+        bench_fail("failed to allocate message frames");
+
+    for (j = 0, p = frames; j < b->burst; j++) {
+        size = htobe32(len);
+        memcpy(p, &size, sizeof(size));
+        memcpy(p + sizeof(size), str, len);
+        p += sizeof(size) + len;
+    }
+
+    *totalp = total;
+
+    return frames;
+}
+
+
+static void bench_receive(bench_t *b, const char *name, const char *type,
+                          int family, int socktype)
+{
+    iot_json_t *msg = event_msg();
+    char       *frames, *p;
+    size_t      len, total;
+    double      start, t;
+    long        nsys;
+    int         i, j, k, nmsg;
+
+    setup(b, type, family, socktype, 0);
+
+    frames = burst_frames(b, msg, &total);
+
+    b->received = 0;
+    nsys = read_syscalls();
+    t    = 0;
+
+    for (i = 0; i < b->iterations; i++) {
+        for (k = 0; k < b->nclient; k++) {
+            if (socktype == SOCK_STREAM) {
+                if (write(b->peer[k], frames, total) != (ssize_t)total)
+                    bench_fail("failed to send message burst");
+            }
+            else {
+                len = total / b->burst;
+                for (j = 0, p = frames; j < b->burst; j++, p += len)
+                    if (write(b->peer[k], p, len) != (ssize_t)len)
+                        bench_fail("failed to send message");
+            }
+        }
+
+        start = now();
+
+        iot_mainloop_prepare(b->ml);
+        iot_mainloop_poll(b->ml, FALSE);
+        iot_mainloop_dispatch(b->ml);
+
+        t += now() - start;
+    }
+
+    nsys = read_syscalls() - nsys;
+    nmsg = b->iterations * b->burst * b->nclient;
+
+    if (b->received != nmsg)
+        bench_fail("lost messages (%d != %d)", b->received, nmsg);
+
+    if (socktype == SOCK_STREAM)
+        printf("  %-24s %9.0f msgs/s %8.3f us/msg %6.3f reads/msg, "
+               "%.2f%% CPU at 10k msgs/s\n", name, nmsg / t,
+               1000000.0 * t / nmsg, (double)nsys / nmsg,
+               100.0 * 10000 * t / nmsg);
+    else
+        printf("  %-24s %9.0f msgs/s %8.3f us/msg, "
+               "%.2f%% CPU at 10k msgs/s\n", name, nmsg / t,
+               1000000.0 * t / nmsg, 100.0 * 10000 * t / nmsg);
+
+    iot_free(frames);
+    cleanup(b);
+    iot_json_unref(msg);
+}
+
+
+/*
+ * Compare the epoll and io_uring backends with a larger number of
+ * connections. When receiving, the clients run in a child process, so
+ * that only the work done on our behalf (including any by the kernel on
+ * completing io_uring requests) is accounted to us. Syscalls per message
+ * include mainloop polls, reads or writes, and io_uring_enter(2) calls.
+ */
+static void bench_backend_receive(bench_t *b, const char *name, int uring)
+{
+    iot_json_t *msg = event_msg();
+    char       *frames;
+    size_t      total;
+    double      start, cpu, t;
+    long        nsys, npoll;
+    int         nclient, rounds, i, k, nmsg, status;
+    pid_t       pid;
+
+    iot_uring_enable(uring);
+
+    nclient    = b->nclient;
+    b->nclient = b->nconn;
+    rounds     = b->iterations / 100 > 0 ? b->iterations / 100 : 1;
+
+    setup(b, "unxs", AF_UNIX, SOCK_STREAM, 0);
+    frames = burst_frames(b, msg, &total);
+
+    b->received = 0;
+    nmsg  = rounds * b->burst * b->nclient;
+    npoll = 0;
+    nsys  = read_syscalls() + uring_syscalls();
+    start = now();
+    cpu   = cpu_time();
+
+    if ((pid = fork()) < 0)
+        bench_fail("failed to fork client process");
+
+    if (pid == 0) {
+        for (k = 0; k < b->nclient; k++)
+            fcntl(b->peer[k], F_SETFL, 0);
+
+        for (i = 0; i < rounds; i++)
+            for (k = 0; k < b->nclient; k++)
+                if (write(b->peer[k], frames, total) != (ssize_t)total)
+                    _exit(1);
+
+        _exit(0);
+    }
+
+    while (b->received < nmsg) {
+        iot_mainloop_prepare(b->ml);
+        iot_mainloop_poll(b->ml, TRUE);
+        iot_mainloop_dispatch(b->ml);
+        npoll++;
+    }
+
+    cpu  = cpu_time() - cpu;
+    t    = now() - start;
+    nsys = read_syscalls() + uring_syscalls() - nsys + npoll;
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0)
+        bench_fail("client process failed");
+
+    printf("  %-24s %9.0f msgs/s %8.3f us CPU/msg %7.4f syscalls/msg\n",
+           name, nmsg / t, 1000000.0 * cpu / nmsg, (double)nsys / nmsg);
+
+    iot_free(frames);
+    cleanup(b);
+    iot_json_unref(msg);
+
+    b->nclient = nclient;
+    iot_uring_enable(FALSE);
+}
+
+
+static void bench_backend_send(bench_t *b, const char *name, int uring)
+{
+    iot_json_t *msg = event_msg();
+    double      start, cpu, t;
+    long        nsys;
+    int         nclient, rounds, i, j, k, nmsg;
+
+    iot_uring_enable(uring);
+
+    nclient    = b->nclient;
+    b->nclient = b->nconn;
+    rounds     = b->iterations / 100 > 0 ? b->iterations / 100 : 1;
+
+    setup(b, "unxs", AF_UNIX, SOCK_STREAM, IOT_TRANSPORT_BATCH);
+
+    nmsg  = rounds * b->burst * b->nclient;
+    nsys  = write_syscalls() + uring_syscalls();
+    start = now();
+    cpu   = cpu_time();
+
+    for (i = 0; i < rounds; i++) {
+        for (j = 0; j < b->burst; j++)
+            for (k = 0; k < b->nclient; k++)
+                if (!iot_transport_sendjson(b->t[k], msg))
+                    bench_fail("failed to send message");
+
+        iot_mainloop_prepare(b->ml);
+        iot_mainloop_poll(b->ml, FALSE);
+        iot_mainloop_dispatch(b->ml);
+        drain(b);
+    }
+
+    cpu  = cpu_time() - cpu;
+    t    = now() - start;
+    nsys = write_syscalls() + uring_syscalls() - nsys + rounds;
+
+    printf("  %-24s %9.0f msgs/s %8.3f us CPU/msg %7.4f syscalls/msg\n",
+           name, nmsg / t, 1000000.0 * cpu / nmsg, (double)nsys / nmsg);
+
+    cleanup(b);
+    iot_json_unref(msg);
+
+    b->nclient = nclient;
+    iot_uring_enable(FALSE);
+}
+
+
+/*
+ * Pass a large payload between two transports, either inline as a JSON
+ * string or out of band as a sealed memfd. Both the sending and the
+ * receiving side are timed, up to the point where the receiver has the
+ * payload at hand.
+ */
+static void payload_cb(iot_transport_t *t, iot_json_t *msg, void *user_data)
+{
+    bench_t    *b = (bench_t *)user_data;
+    const char *data;
+
+    IOT_UNUSED(t);
+
+    if (!iot_json_get_string(msg, "payload", &data))
+        bench_fail("message without payload");
+
+    b->received++;
+}
+
+
+static void blob_cb(iot_transport_t *t, iot_json_t *msg, int *fds, int nfd,
+                    void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+    void    *data;
+    size_t   size;
+
+    IOT_UNUSED(t);
+    IOT_UNUSED(msg);
+
+    if ((data = iot_memfd_map(fds[0], &size)) == NULL)
+        bench_fail("failed to map payload (%d: %s)", errno, strerror(errno));
+
+    iot_memfd_unmap(data, size);
+
+    while (nfd-- > 0)
+        close(fds[nfd]);
+
+    b->received++;
+}
+
+
+static void bench_payload(bench_t *b, const char *name, size_t size,
+                          int blob)
+{
+    static iot_transport_evt_t evt = {
+        { .recvjson     = payload_cb },
+        { .recvjsonfrom = NULL       },
+          .closed       = closed_cb,
+          .recvjsonfds  = blob_cb,
+    };
+
+    iot_transport_t *tx, *rx;
+    iot_json_t      *msg;
+    char            *data;
+    double           start, t;
+    int              sock[2], flags, i, n;
+
+    if ((b->ml = iot_mainloop_create()) == NULL)
+        bench_fail("failed to create mainloop");
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sock) < 0)
+        bench_fail("failed to create socket pair (%d: %s)",
+                   errno, strerror(errno));
+
+    flags = IOT_TRANSPORT_MODE_JSON | IOT_TRANSPORT_NONBLOCK;
+    tx = iot_transport_create_from(b->ml, "unxs", &sock[0], &evt, b,
+                                   flags, IOT_TRANSPORT_CONNECTED);
+    rx = iot_transport_create_from(b->ml, "unxs", &sock[1], &evt, b,
+                                   flags, IOT_TRANSPORT_CONNECTED);
+
+    if (tx == NULL || rx == NULL)
+        bench_fail("failed to create transports");
+
+    iot_transport_set_input(rx, 2 * size, IOT_TRANSPORT_INPUT_BUDGET);
+
+    if ((data = iot_alloc(size + 1)) == NULL)
+        bench_fail("failed to allocate payload");
+
+    memset(data, 'x', size);
+    data[size] = '\0';
+
+    msg = iot_json_create(IOT_JSON_OBJECT);
+    iot_json_add_string(msg, "type", "payload");
+
+    if (!blob)
+        iot_json_add_string(msg, "payload", data);
+
+    n = b->iterations / 100 > 0 ? b->iterations / 100 : 1;
+    b->received = 0;
+    start = now();
+
+    for (i = 0; i < n; i++) {
+        if (blob) {
+            if (!iot_transport_sendjsonblob(tx, msg, data, size))
+                bench_fail("failed to send payload (%d: %s)",
+                           errno, strerror(errno));
+        }
+        else {
+            if (!iot_transport_sendjson(tx, msg))
+                bench_fail("failed to send payload");
+        }
+
+        while (b->received <= i) {
+            iot_mainloop_prepare(b->ml);
+            iot_mainloop_poll(b->ml, TRUE);
+            iot_mainloop_dispatch(b->ml);
+        }
+    }
+
+    t = now() - start;
+
+    printf("  %-24s %9.0f msgs/s %8.3f us/msg\n", name, n / t,
+           1000000.0 * t / n);
+
+    iot_json_unref(msg);
+    iot_free(data);
+    iot_transport_destroy(tx);
+    iot_transport_destroy(rx);
+    iot_mainloop_destroy(b->ml);
+    b->ml = NULL;
+}
+
+
+/*
+ * Exchange messages with an echo server running in a child process,
+ * first one message at a time to measure the round trip latency, then
+ * in bursts to measure throughput. Only the client side is timed.
+ */
+static void echo_cb(iot_transport_t *t, iot_json_t *msg, void *user_data)
+{
+    IOT_UNUSED(user_data);
+
+    if (!iot_transport_sendjson(t, msg))
+        bench_fail("failed to echo message");
+}
+
+
+static void echo_closed_cb(iot_transport_t *t, int error, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+
+    IOT_UNUSED(error);
+
+    iot_transport_destroy(t);
+    iot_mainloop_quit(b->ml, 0);
+}
+
+
+static void echo_connection_cb(iot_transport_t *lt, void *user_data)
+{
+    if (iot_transport_accept(lt, user_data, 0) == NULL)
+        bench_fail("failed to accept connection (%d: %s)",
+                   errno, strerror(errno));
+}
+
+
+static void echo_server(bench_t *b, const char *addrstr, int ready)
+{
+    static iot_transport_evt_t evt = {
+        { .recvjson     = echo_cb },
+        { .recvjsonfrom = NULL    },
+          .closed       = echo_closed_cb,
+          .connection   = echo_connection_cb,
+    };
+
+    iot_transport_t *lt;
+    iot_sockaddr_t   addr;
+    socklen_t        alen;
+    const char      *type;
+    int              flags;
+
+    if ((b->ml = iot_mainloop_create()) == NULL)
+        bench_fail("failed to create mainloop");
+
+    alen  = iot_transport_resolve(NULL, addrstr, &addr, sizeof(addr), &type);
+    flags = IOT_TRANSPORT_MODE_JSON | IOT_TRANSPORT_NONBLOCK;
+
+    if (alen <= 0 ||
+        (lt = iot_transport_create(b->ml, type, &evt, b, flags)) == NULL ||
+        !iot_transport_bind(lt, &addr, alen) || !iot_transport_listen(lt, 1))
+        bench_fail("failed to set up echo server on '%s'", addrstr);
+
+    if (write(ready, "", 1) != 1)
+        bench_fail("failed to notify about echo server");
+    close(ready);
+
+    iot_mainloop_run(b->ml);
+
+    iot_transport_destroy(lt);
+    iot_mainloop_destroy(b->ml);
+
+    exit(0);
+}
+
+
+static void bench_ipc(bench_t *b, const char *name, const char *type)
+{
+    static iot_transport_evt_t evt = {
+        { .recvjson     = recv_cb },
+        { .recvjsonfrom = NULL    },
+          .closed       = closed_cb,
+    };
+
+    iot_transport_t *t;
+    iot_sockaddr_t   addr;
+    socklen_t        alen;
+    const char      *atype;
+    iot_json_t      *msg;
+    char             addrstr[64], c;
+    double           start, rtt, tput;
+    long             nsys;
+    int              ready[2], status, flags, i, j, nmsg;
+    pid_t            pid;
+
+    snprintf(addrstr, sizeof(addrstr), "%s:@iot-transport-bench-%d",
+             type, getpid());
+
+    if (pipe(ready) < 0)
+        bench_fail("failed to create pipe (%d: %s)", errno, strerror(errno));
+
+    if ((pid = fork()) < 0)
+        bench_fail("failed to fork (%d: %s)", errno, strerror(errno));
+
+    if (pid == 0) {
+        close(ready[0]);
+        echo_server(b, addrstr, ready[1]);
+    }
+
+    close(ready[1]);
+
+    if (read(ready[0], &c, 1) != 1)
+        bench_fail("echo server failed to start");
+    close(ready[0]);
+
+    if ((b->ml = iot_mainloop_create()) == NULL)
+        bench_fail("failed to create mainloop");
+
+    alen  = iot_transport_resolve(NULL, addrstr, &addr, sizeof(addr), &atype);
+    flags = IOT_TRANSPORT_MODE_JSON | IOT_TRANSPORT_NONBLOCK;
+
+    if (alen <= 0 ||
+        (t = iot_transport_create(b->ml, atype, &evt, b, flags)) == NULL ||
+        !iot_transport_connect(t, &addr, alen))
+        bench_fail("failed to connect to '%s'", addrstr);
+
+    msg = event_msg();
+
+    b->received = 0;
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        if (!iot_transport_sendjson(t, msg))
+            bench_fail("failed to send message");
+
+        while (b->received <= i) {
+            iot_mainloop_prepare(b->ml);
+            iot_mainloop_poll(b->ml, TRUE);
+            iot_mainloop_dispatch(b->ml);
+        }
+    }
+
+    rtt = now() - start;
+
+    b->received = 0;
+    nsys  = read_syscalls() + write_syscalls();
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        for (j = 0; j < b->burst; j++)
+            if (!iot_transport_sendjson(t, msg))
+                bench_fail("failed to send message");
+
+        while (b->received < (i + 1) * b->burst) {
+            iot_mainloop_prepare(b->ml);
+            iot_mainloop_poll(b->ml, TRUE);
+            iot_mainloop_dispatch(b->ml);
+        }
+    }
+
+    tput = now() - start;
+    nsys = read_syscalls() + write_syscalls() - nsys;
+    nmsg = b->iterations * b->burst;
+
+    printf("  %-24s %8.3f us/rtt %9.0f msgs/s %6.3f rw/msg\n", name,
+           1000000.0 * rtt / b->iterations, nmsg / tput,
+           (double)nsys / nmsg);
+
+    iot_json_unref(msg);
+    iot_transport_destroy(t);
+    iot_mainloop_destroy(b->ml);
+    b->ml = NULL;
+
+    waitpid(pid, &status, 0);
+}
+
+
+/*
+ * Send typical large messages over a stream connection with and without
+ * frame compression. The connection is set up through a listening
+ * transport, so compression gets negotiated as it would in real life.
+ * Both ends run in this process, so the CPU time covers compressing and
+ * decompressing alike.
+ */
+static iot_json_t *applist_msg(void)
+{
+    iot_json_t *msg, *apps, *app;
+    const char *argv[] = { "/usr/bin/example", "--fullscreen", "--quiet" };
+    char        appid[64], descr[128];
+    int         i;
+
+    msg  = iot_json_create(IOT_JSON_OBJECT);
+    apps = iot_json_create(IOT_JSON_ARRAY);
+
+    if (msg == NULL || apps == NULL)
+        bench_fail("failed to create application list message");
+
+    for (i = 0; i < 64; i++) {
+        snprintf(appid, sizeof(appid), "org.example.provider%d:app%d",
+                 i % 8, i);
+        snprintf(descr, sizeof(descr), "Example application #%d", i);
+
+        if ((app = iot_json_create(IOT_JSON_OBJECT)) == NULL)
+            bench_fail("failed to create application list message");
+
+        iot_json_add_string (app, "app"        , appid);
+        iot_json_add_string (app, "description", descr);
+        iot_json_add_string (app, "desktop"    , "");
+        iot_json_add_integer(app, "user"       , 1000 + i % 4);
+        iot_json_add_string_array(app, "argv", (char **)argv, 3);
+        iot_json_array_append(apps, app);
+    }
+
+    iot_json_add_string (msg, "type"  , "status");
+    iot_json_add_integer(msg, "seqno" , 1);
+    iot_json_add_integer(msg, "status", 0);
+    iot_json_add        (msg, "apps"  , apps);
+
+    return msg;
+}
+
+
+static iot_json_t *sensors_msg(void)
+{
+    iot_json_t *msg, *evt, *data, *s;
+    char        name[32];
+    int         i;
+
+    msg  = iot_json_create(IOT_JSON_OBJECT);
+    evt  = iot_json_create(IOT_JSON_OBJECT);
+    data = iot_json_create(IOT_JSON_ARRAY);
+
+    if (msg == NULL || evt == NULL || data == NULL)
+        bench_fail("failed to create sensor array message");
+
+    for (i = 0; i < 128; i++) {
+        snprintf(name, sizeof(name), "temperature-%d", i);
+
+        if ((s = iot_json_create(IOT_JSON_OBJECT)) == NULL)
+            bench_fail("failed to create sensor array message");
+
+        iot_json_add_string (s, "sensor"   , name);
+        iot_json_add_double (s, "value"    , 20.0 + (i % 16) * 0.125);
+        iot_json_add_integer(s, "timestamp", 1476780000 + i / 8);
+        iot_json_array_append(data, s);
+    }
+
+    iot_json_add_string (evt, "event", "sensors-changed");
+    iot_json_add        (evt, "data" , data);
+    iot_json_add_string (msg, "type" , "event");
+    iot_json_add_integer(msg, "seqno", 0);
+    iot_json_add        (msg, "event", evt);
+
+    return msg;
+}
+
+
+static void zconnection_cb(iot_transport_t *lt, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+
+    if ((b->t[0] = iot_transport_accept(lt, b, 0)) == NULL)
+        bench_fail("failed to accept connection (%d: %s)",
+                   errno, strerror(errno));
+}
+
+
+static void bench_compress(bench_t *b, const char *name, iot_json_t *msg,
+                           int compress)
+{
+    static iot_transport_evt_t evt = {
+        { .recvjson     = recv_cb },
+        { .recvjsonfrom = NULL    },
+          .closed       = closed_cb,
+          .connection   = zconnection_cb,
+    };
+
+    iot_transport_t *lt, *t;
+    iot_sockaddr_t   addr;
+    socklen_t        alen;
+    const char      *type;
+    char             addrstr[64];
+    double           start, cpu;
+    long             bytes;
+    int              flags, i, n;
+
+    if ((b->ml = iot_mainloop_create()) == NULL)
+        bench_fail("failed to create mainloop");
+
+    snprintf(addrstr, sizeof(addrstr), "unxs:@iot-transport-bench-z-%d",
+             getpid());
+
+    alen  = iot_transport_resolve(NULL, addrstr, &addr, sizeof(addr), &type);
+    flags = IOT_TRANSPORT_MODE_JSON | IOT_TRANSPORT_NONBLOCK |
+        (compress ? IOT_TRANSPORT_MODE_COMPRESS : 0);
+
+    if (alen <= 0 ||
+        (lt = iot_transport_create(b->ml, type, &evt, b, flags)) == NULL ||
+        !iot_transport_bind(lt, &addr, alen) || !iot_transport_listen(lt, 1))
+        bench_fail("failed to set up listening transport '%s'", addrstr);
+
+    if ((t = iot_transport_create(b->ml, type, &evt, b, flags)) == NULL ||
+        !iot_transport_connect(t, &addr, alen))
+        bench_fail("failed to connect to '%s'", addrstr);
+
+    /* the server end is done negotiating once it sees our first message */
+    b->t[0] = NULL;
+    b->received = 0;
+
+    if (!iot_transport_sendjson(t, msg))
+        bench_fail("failed to send message");
+
+    while (b->received < 1) {
+        iot_mainloop_prepare(b->ml);
+        iot_mainloop_poll(b->ml, TRUE);
+        iot_mainloop_dispatch(b->ml);
+    }
+
+    n = b->iterations / 10 > 0 ? b->iterations / 10 : 1;
+    b->received = 0;
+    bytes = io_syscalls("wchar");
+    cpu   = cpu_time();
+    start = now();
+
+    for (i = 0; i < n; i++) {
+        if (!iot_transport_sendjson(b->t[0], msg))
+            bench_fail("failed to send message");
+
+        while (b->received <= i) {
+            iot_mainloop_prepare(b->ml);
+            iot_mainloop_poll(b->ml, TRUE);
+            iot_mainloop_dispatch(b->ml);
+        }
+    }
+
+    start = now() - start;
+    cpu   = cpu_time() - cpu;
+    bytes = io_syscalls("wchar") - bytes;
+
+    printf("  %-24s %8ld bytes/msg %8.3f us/msg %8.3f cpu-us/msg\n", name,
+           bytes / n, 1000000.0 * start / n, 1000000.0 * cpu / n);
+
+    iot_transport_destroy(b->t[0]);
+    iot_transport_destroy(t);
+    iot_transport_destroy(lt);
+    iot_mainloop_destroy(b->ml);
+    b->ml = NULL;
+}
+
+
+static void print_usage(const char *argv0, int exit_code)
+{
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -n, --iterations=<n>           rounds per benchmark\n"
+           "  -c, --clients=<n>              number of clients to send to\n"
+           "  -b, --burst=<n>                messages per client per round\n"
+           "  -C, --connections=<n>          connections for backend comparison\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    exit(exit_code);
+}
+
+
+static void parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "n:c:b:C:h"
+    struct option options[] = {
+        { "iterations" , required_argument, NULL, 'n' },
+        { "clients"    , required_argument, NULL, 'c' },
+        { "burst"      , required_argument, NULL, 'b' },
+        { "connections", required_argument, NULL, 'C' },
+        { "help"       , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+
+    b->iterations = 10000;
+    b->nclient    = 8;
+    b->burst      = 8;
+    b->nconn      = MAX_CLIENTS;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            b->iterations = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            b->nclient = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'b':
+            b->burst = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'C':
+            b->nconn = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'h':
+            print_usage(argv[0], 0);
+            break;
+        default:
+            print_usage(argv[0], EINVAL);
+        }
+    }
+
+    if (b->iterations <= 0 || b->burst <= 0 ||
+        b->nclient <= 0 || b->nclient > MAX_CLIENTS ||
+        b->nconn <= 0 || b->nconn > MAX_CLIENTS)
+        print_usage(argv[0], EINVAL);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static bench_t b;
+    iot_json_t    *msg;
+
+    iot_log_set_mask(IOT_LOG_UPTO(IOT_LOG_WARNING));
+    iot_log_set_target(IOT_LOG_TO_STDERR);
+
+    parse_cmdline(&b, argc, argv);
+
+    printf("stream fan-out, %d clients, %d messages/client/round, "
+           "%d rounds:\n", b.nclient, b.burst, b.iterations);
+    bench_fanout(&b, "unbatched", "unxs", SOCK_STREAM, 0, FALSE);
+    bench_fanout(&b, "unbatched, pre-encoded", "unxs", SOCK_STREAM, 0, TRUE);
+    bench_fanout(&b, "IOT_TRANSPORT_BATCH", "unxs", SOCK_STREAM,
+                 IOT_TRANSPORT_BATCH, FALSE);
+    bench_fanout(&b, "BATCH, pre-encoded", "unxs", SOCK_STREAM,
+                 IOT_TRANSPORT_BATCH, TRUE);
+
+    printf("datagram fan-out, %d clients, %d messages/client/round, "
+           "%d rounds:\n", b.nclient, b.burst, b.iterations);
+    bench_fanout(&b, "unbatched", "unxd", SOCK_DGRAM, 0, FALSE);
+    bench_fanout(&b, "IOT_TRANSPORT_BATCH", "unxd", SOCK_DGRAM,
+                 IOT_TRANSPORT_BATCH, FALSE);
+
+    printf("stream receive, %d clients, %d messages/client/round, "
+           "%d rounds:\n", b.nclient, b.burst, b.iterations);
+    bench_receive(&b, "unix stream", "unxs", AF_UNIX, SOCK_STREAM);
+
+    printf("datagram receive, %d clients, %d messages/client/round, "
+           "%d rounds:\n", b.nclient, b.burst, b.iterations);
+    bench_receive(&b, "unix datagram", "unxd", AF_UNIX, SOCK_DGRAM);
+    bench_receive(&b, "UDP", "udp4", AF_INET, SOCK_DGRAM);
+
+    printf("stream receive, %d connections, %d messages/connection/round, "
+           "%d rounds:\n", b.nconn, b.burst,
+           b.iterations / 100 > 0 ? b.iterations / 100 : 1);
+    bench_backend_receive(&b, "epoll", FALSE);
+    bench_backend_receive(&b, "io_uring", TRUE);
+
+    printf("stream fan-out, %d connections, %d messages/connection/round, "
+           "%d rounds:\n", b.nconn, b.burst,
+           b.iterations / 100 > 0 ? b.iterations / 100 : 1);
+    bench_backend_send(&b, "epoll", FALSE);
+    bench_backend_send(&b, "io_uring", TRUE);
+
+    printf("same-host IPC with an echo server, %d rounds, "
+           "%d messages/burst:\n", b.iterations, b.burst);
+    bench_ipc(&b, "unix stream", "unxs");
+    bench_ipc(&b, "shared memory rings", "shm");
+
+    printf("frame compression, %d rounds:\n",
+           b.iterations / 10 > 0 ? b.iterations / 10 : 1);
+    msg = applist_msg();
+    bench_compress(&b, "application list", msg, FALSE);
+    bench_compress(&b, "application list, LZ4", msg, TRUE);
+    iot_json_unref(msg);
+    msg = sensors_msg();
+    bench_compress(&b, "sensor array", msg, FALSE);
+    bench_compress(&b, "sensor array, LZ4", msg, TRUE);
+    iot_json_unref(msg);
+
+    printf("payload passing, %d rounds:\n",
+           b.iterations / 100 > 0 ? b.iterations / 100 : 1);
+    bench_payload(&b, "64k inline JSON", 64 * 1024, FALSE);
+    bench_payload(&b, "64k sealed memfd", 64 * 1024, TRUE);
+    bench_payload(&b, "1M inline JSON", 1024 * 1024, FALSE);
+    bench_payload(&b, "1M sealed memfd", 1024 * 1024, TRUE);
+
+    return 0;
+}
@@ -27,24 +27,59 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
+#include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <endian.h>
 
 #include <iot/common/mm.h>
 #include <iot/common/list.h>
 #include <iot/common/log.h>
+#include <iot/common/memfd.h>
+#include <iot/common/fragbuf.h>
+#include <iot/common/compress.h>
+#include <iot/common/msgpack.h>
 #include <iot/common/transport.h>
 
 static int check_destroy(iot_transport_t *t);
 static int recv_data(iot_transport_t *t, void *data, size_t size,
                      iot_sockaddr_t *addr, socklen_t addrlen);
+static int recv_fds(iot_transport_t *t, void *data, int *fds, int nfd);
 static inline int purge_destroyed(iot_transport_t *t);
 
 
 static IOT_LIST_HOOK(transports);
+static IOT_LIST_HOOK(instances);
 static iot_sighandler_t *pipe_handler;
 
 
+static inline uint64_t stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static inline void msg_sent(iot_transport_t *t)
+{
+    t->stats.msgs_out++;
+    t->stats.last_out = stats_now();
+}
+
+
+static inline void msg_received(iot_transport_t *t)
+{
+    t->stats.msgs_in++;
+    t->stats.last_in = stats_now();
+}
+
+
 static int check_request_callbacks(iot_transport_req_t *req)
 {
     /* XXX TODO: hmm... this probably needs more thought/work */
@@ -164,13 +199,27 @@ iot_transport_t *iot_transport_create(iot_mainloop_t *ml, const char *type,
 
             t->check_destroy = check_destroy;
             t->recv_data     = recv_data;
+            t->recv_fds      = recv_fds;
             t->flags         = flags & ~IOT_TRANSPORT_MODE_MASK;
             t->mode          = flags &  IOT_TRANSPORT_MODE_MASK;
 
+            t->queue.lowmark  = IOT_TRANSPORT_QUEUE_LOWMARK;
+            t->queue.highmark = IOT_TRANSPORT_QUEUE_HIGHMARK;
+            t->queue.policy   = IOT_TRANSPORT_QUEUE_DROP;
+
+            t->input.maxframe = IOT_TRANSPORT_INPUT_MAXFRAME;
+            t->input.budget   = IOT_TRANSPORT_INPUT_BUDGET;
+
+            t->zthreshold = IOT_TRANSPORT_COMPRESS_THRESHOLD;
+
+            iot_list_init(&t->hook);
+
             if (!t->descr->req.open(t)) {
                 iot_free(t);
                 t = NULL;
             }
+            else
+                iot_list_append(&instances, &t->hook);
         }
     }
     else
@@ -205,9 +254,19 @@ iot_transport_t *iot_transport_create_from(iot_mainloop_t *ml, const char *type,
 
             t->check_destroy = check_destroy;
             t->recv_data     = recv_data;
+            t->recv_fds      = recv_fds;
             t->flags         = flags & ~IOT_TRANSPORT_MODE_MASK;
             t->mode          = flags &  IOT_TRANSPORT_MODE_MASK;
 
+            t->queue.lowmark  = IOT_TRANSPORT_QUEUE_LOWMARK;
+            t->queue.highmark = IOT_TRANSPORT_QUEUE_HIGHMARK;
+            t->queue.policy   = IOT_TRANSPORT_QUEUE_DROP;
+
+            t->input.maxframe = IOT_TRANSPORT_INPUT_MAXFRAME;
+            t->input.budget   = IOT_TRANSPORT_INPUT_BUDGET;
+
+            t->zthreshold = IOT_TRANSPORT_COMPRESS_THRESHOLD;
+
             t->connected = !!(state & IOT_TRANSPORT_CONNECTED);
             t->listened  = !!(state & IOT_TRANSPORT_LISTENED);
 
@@ -216,10 +275,14 @@ iot_transport_t *iot_transport_create_from(iot_mainloop_t *ml, const char *type,
                 return NULL;
             }
 
+            iot_list_init(&t->hook);
+
             if (!t->descr->req.createfrom(t, conn)) {
                 iot_free(t);
                 t = NULL;
             }
+            else
+                iot_list_append(&instances, &t->hook);
         }
     }
     else
@@ -240,9 +303,37 @@ int iot_transport_setopt(iot_transport_t *t, const char *opt, const void *val)
 }
 
 
+static int get_stats(iot_transport_t *t, void *val, socklen_t *len)
+{
+    iot_transport_stats_t *st = (iot_transport_stats_t *)val;
+    socklen_t              l;
+
+    if (st == NULL || len == NULL || *len < sizeof(*st)) {
+        errno = EINVAL;
+        return FALSE;
+    }
+
+    *st = t->stats;
+    st->queued = 0;
+
+    /* let the backend fill in what it keeps track of itself */
+    if (t->descr->req.getopt != NULL) {
+        l = *len;
+        t->descr->req.getopt(t, IOT_TRANSPORT_OPT_STATS, st, &l);
+    }
+
+    *len = sizeof(*st);
+
+    return TRUE;
+}
+
+
 int iot_transport_getopt(iot_transport_t *t, const char *opt, void *val,
                          socklen_t *len)
 {
+    if (t != NULL && !strcmp(opt, IOT_TRANSPORT_OPT_STATS))
+        return get_stats(t, val, len);
+
     if (t != NULL && t->descr->req.getopt != NULL) {
         return t->descr->req.getopt(t, opt, val, len);
     }
@@ -251,6 +342,106 @@ int iot_transport_getopt(iot_transport_t *t, const char *opt, void *val,
 }
 
 
+static const char *idle_time(char *buf, size_t size, uint64_t now,
+                             uint64_t last)
+{
+    if (last == 0)
+        return "never";
+
+    snprintf(buf, size, "%.1fs ago", (now - last) / 1000000.0);
+
+    return buf;
+}
+
+
+static void dump_stats(void (*emit)(const char *line, void *user_data),
+                       void *user_data)
+{
+    iot_transport_t       *t;
+    iot_transport_stats_t  st;
+    struct ucred           cred;
+    iot_list_hook_t       *p, *n;
+    socklen_t              len;
+    uint64_t               now;
+    char                   peer[32], in[32], out[32], line[256];
+    int                    cnt;
+
+    now = stats_now();
+    cnt = 0;
+
+    emit("transport statistics:", user_data);
+
+    iot_list_foreach(&instances, p, n) {
+        t   = iot_list_entry(p, typeof(*t), hook);
+        len = sizeof(st);
+
+        if (!get_stats(t, &st, &len))
+            continue;
+
+        len = sizeof(cred);
+
+        if (t->connected &&
+            iot_transport_getopt(t, IOT_TRANSPORT_OPT_PEERCRED, &cred, &len))
+            snprintf(peer, sizeof(peer), "pid %d", cred.pid);
+        else
+            snprintf(peer, sizeof(peer), "%s",
+                     t->listened ? "listening" :
+                     t->connected ? "connected" : "unconnected");
+
+        snprintf(line, sizeof(line), "  %p %s (%s):",
+                 t, t->descr->type, peer);
+        emit(line, user_data);
+
+        snprintf(line, sizeof(line), "    in:  %llu messages, %llu bytes, "
+                 "%llu errors, last %s",
+                 (unsigned long long)st.msgs_in,
+                 (unsigned long long)st.bytes_in,
+                 (unsigned long long)st.errors,
+                 idle_time(in, sizeof(in), now, st.last_in));
+        emit(line, user_data);
+
+        snprintf(line, sizeof(line), "    out: %llu messages, %llu bytes, "
+                 "%zu queued, %llu EAGAINs, last %s",
+                 (unsigned long long)st.msgs_out,
+                 (unsigned long long)st.bytes_out, st.queued,
+                 (unsigned long long)st.eagain,
+                 idle_time(out, sizeof(out), now, st.last_out));
+        emit(line, user_data);
+
+        cnt++;
+    }
+
+    snprintf(line, sizeof(line), "%d live transports", cnt);
+    emit(line, user_data);
+}
+
+
+static void print_line(const char *line, void *user_data)
+{
+    fprintf((FILE *)user_data, "%s\n", line);
+}
+
+
+static void log_line(const char *line, void *user_data)
+{
+    IOT_UNUSED(user_data);
+
+    iot_log_info("%s", line);
+}
+
+
+void iot_transport_dump_stats(FILE *fp)
+{
+    dump_stats(print_line, fp);
+}
+
+
+void iot_transport_log_stats(void)
+{
+    dump_stats(log_line, NULL);
+}
+
+
 static inline int type_matches(const char *type, const char *addr)
 {
     while (*type == *addr)
@@ -332,9 +523,15 @@ iot_transport_t *iot_transport_accept(iot_transport_t *lt,
 
         t->check_destroy = check_destroy;
         t->recv_data     = recv_data;
+        t->recv_fds      = recv_fds;
         t->flags         = (lt->flags & IOT_TRANSPORT_INHERIT) | flags;
         t->flags         = t->flags & ~IOT_TRANSPORT_MODE_MASK;
         t->mode          = lt->mode;
+        t->queue         = lt->queue;
+        t->input         = lt->input;
+        t->zthreshold    = lt->zthreshold;
+
+        iot_list_init(&t->hook);
 
         IOT_TRANSPORT_BUSY(t, {
                 if (!t->descr->req.accept(t, lt)) {
@@ -349,6 +546,8 @@ iot_transport_t *iot_transport_accept(iot_transport_t *lt,
             iot_free(t);
             t = NULL;
         }
+        else
+            iot_list_append(&instances, &t->hook);
     }
 
     return t;
@@ -359,6 +558,7 @@ static inline int purge_destroyed(iot_transport_t *t)
 {
     if (t->destroyed && !t->busy) {
         iot_debug("destroying transport %p...", t);
+        iot_list_delete(&t->hook);
         iot_free(t);
         return TRUE;
     }
@@ -371,6 +571,7 @@ void iot_transport_destroy(iot_transport_t *t)
 {
     if (t != NULL) {
         t->destroyed = TRUE;
+        iot_list_delete(&t->hook);
 
         IOT_TRANSPORT_BUSY(t, {
                 t->descr->req.disconnect(t);
@@ -454,6 +655,9 @@ int iot_transport_sendraw(iot_transport_t *t, void *data, size_t size)
                 result = t->descr->req.sendraw(t, data, size);
             });
 
+        if (result)
+            msg_sent(t);
+
         purge_destroyed(t);
     }
     else
@@ -473,6 +677,9 @@ int iot_transport_sendrawto(iot_transport_t *t, void *data, size_t size,
                 result = t->descr->req.sendrawto(t, data, size, addr, addrlen);
             });
 
+        if (result)
+            msg_sent(t);
+
         purge_destroyed(t);
     }
     else
@@ -482,15 +689,64 @@ int iot_transport_sendrawto(iot_transport_t *t, void *data, size_t size,
 }
 
 
+int iot_transport_set_queue(iot_transport_t *t, size_t lowmark,
+                            size_t highmark, iot_transport_qpolicy_t policy)
+{
+    if (lowmark > highmark || policy < IOT_TRANSPORT_QUEUE_DROP ||
+        policy > IOT_TRANSPORT_QUEUE_BLOCK) {
+        errno = EINVAL;
+        return FALSE;
+    }
+
+    t->queue.lowmark  = lowmark;
+    t->queue.highmark = highmark;
+    t->queue.policy   = policy;
+
+    return TRUE;
+}
+
+
+int iot_transport_set_input(iot_transport_t *t, size_t maxframe,
+                            size_t budget)
+{
+    if (maxframe == 0 || maxframe > IOT_FRAGBUF_SIZE_MASK || budget == 0) {
+        errno = EINVAL;
+        return FALSE;
+    }
+
+    t->input.maxframe = maxframe;
+    t->input.budget   = budget;
+
+    return TRUE;
+}
+
+
+int iot_transport_set_compression(iot_transport_t *t, size_t threshold)
+{
+    if (!(t->mode & IOT_TRANSPORT_MODE_COMPRESS) ||
+        !iot_compress_available()) {
+        errno = EOPNOTSUPP;
+        return FALSE;
+    }
+
+    t->zthreshold = threshold;
+
+    return TRUE;
+}
+
+
 int iot_transport_sendjson(iot_transport_t *t, iot_json_t *msg)
 {
     int result;
 
-    if (t->mode == IOT_TRANSPORT_MODE_JSON && t->descr->req.sendjson) {
+    if ((t->mode & IOT_TRANSPORT_MODE_JSON) && t->descr->req.sendjson) {
         IOT_TRANSPORT_BUSY(t, {
                 result = t->descr->req.sendjson(t, msg);
             });
 
+        if (result)
+            msg_sent(t);
+
         purge_destroyed(t);
     }
     else
@@ -505,11 +761,14 @@ int iot_transport_sendjsonto(iot_transport_t *t, iot_json_t *msg,
 {
     int result;
 
-    if (t->mode == IOT_TRANSPORT_MODE_JSON && t->descr->req.sendjsonto) {
+    if ((t->mode & IOT_TRANSPORT_MODE_JSON) && t->descr->req.sendjsonto) {
         IOT_TRANSPORT_BUSY(t, {
                 result = t->descr->req.sendjsonto(t, msg, addr, addrlen);
             });
 
+        if (result)
+            msg_sent(t);
+
         purge_destroyed(t);
     }
     else
@@ -519,10 +778,198 @@ int iot_transport_sendjsonto(iot_transport_t *t, iot_json_t *msg,
 }
 
 
+int iot_transport_sendjsonfds(iot_transport_t *t, iot_json_t *msg,
+                              int *fds, int nfd)
+{
+    int result;
+
+    if (nfd < 0 || nfd > IOT_TRANSPORT_MAXFDS || (nfd > 0 && fds == NULL)) {
+        errno = EINVAL;
+        return FALSE;
+    }
+
+    if (nfd == 0)
+        return iot_transport_sendjson(t, msg);
+
+    if ((t->mode & IOT_TRANSPORT_MODE_JSON) && t->descr->req.sendjsonfds) {
+        IOT_TRANSPORT_BUSY(t, {
+                result = t->descr->req.sendjsonfds(t, msg, fds, nfd);
+            });
+
+        if (result)
+            msg_sent(t);
+
+        purge_destroyed(t);
+    }
+    else {
+        errno  = EOPNOTSUPP;
+        result = FALSE;
+    }
+
+    return result;
+}
+
+
+int iot_transport_sendjsonblob(iot_transport_t *t, iot_json_t *msg,
+                               const void *data, size_t size)
+{
+    int fd, result;
+
+    if ((fd = iot_memfd_create_sealed("iot-transport", data, size)) < 0)
+        return FALSE;
+
+    result = iot_transport_sendjsonfds(t, msg, &fd, 1);
+    close(fd);
+
+    return result;
+}
+
+
+/*
+ * A pre-encoded message keeps one frame per wire encoding, indexed by
+ * MSG_MSGPACK and MSG_COMPRESS. Encodings which turn out not to shrink
+ * when compressed are remembered, so that we don't try them again.
+ */
+
+#define MSG_MSGPACK  0x1                 /* MessagePack encoding */
+#define MSG_COMPRESS 0x2                 /* compressed encoding */
+
+struct iot_transport_msg_s {
+    iot_json_t     *json;                /* wrapped JSON message */
+    int             refcnt;              /* reference count */
+    int             nozip;               /* encodings not worth compressing */
+    iot_json_buf_t  frames[4];           /* frames by encoding */
+};
+
+
+iot_transport_msg_t *iot_transport_msg_create(iot_json_t *msg)
+{
+    iot_transport_msg_t *m;
+
+    if (msg == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ((m = iot_allocz(sizeof(*m))) == NULL)
+        return NULL;
+
+    m->json   = iot_json_ref(msg);
+    m->refcnt = 1;
+
+    return m;
+}
+
+
+iot_transport_msg_t *iot_transport_msg_ref(iot_transport_msg_t *m)
+{
+    if (m != NULL)
+        m->refcnt++;
+
+    return m;
+}
+
+
+void iot_transport_msg_unref(iot_transport_msg_t *m)
+{
+    size_t i;
+
+    if (m == NULL || --m->refcnt > 0)
+        return;
+
+    for (i = 0; i < IOT_ARRAY_SIZE(m->frames); i++)
+        iot_json_buf_cleanup(m->frames + i);
+
+    iot_json_unref(m->json);
+    iot_free(m);
+}
+
+
+iot_json_t *iot_transport_msg_json(iot_transport_msg_t *m)
+{
+    return m->json;
+}
+
+
+const void *iot_transport_msg_frame(iot_transport_msg_t *m, int msgpack,
+                                    size_t zthreshold, size_t *sizep)
+{
+    int             enc = msgpack ? MSG_MSGPACK : 0;
+    iot_json_buf_t *b   = m->frames + enc;
+    iot_json_buf_t *z   = m->frames + (enc | MSG_COMPRESS);
+    ssize_t         size;
+    uint32_t        len;
+
+    if (b->used == 0) {
+        if (msgpack)
+            size = iot_msgpack_encode(m->json, b, sizeof(len));
+        else
+            size = iot_json_serialize(m->json, b, sizeof(len));
+
+        if (size < 0)
+            return NULL;
+
+        len = htobe32(b->used - sizeof(len));
+        memcpy(b->data, &len, sizeof(len));
+    }
+
+    if (zthreshold > 0 && b->used - sizeof(len) >= zthreshold &&
+        !(m->nozip & (1 << enc))) {
+        if (z->used == 0) {
+            size = iot_compress(b->data + sizeof(len), b->used - sizeof(len),
+                                z, sizeof(len));
+
+            if (size > 0) {
+                len = (z->used - sizeof(len)) | IOT_FRAGBUF_COMPRESSED;
+                len = htobe32(len);
+                memcpy(z->data, &len, sizeof(len));
+            }
+            else {
+                iot_json_buf_cleanup(z);
+                m->nozip |= (1 << enc);
+            }
+        }
+
+        if (z->used > 0)
+            b = z;
+    }
+
+    *sizep = b->used;
+
+    return b->data;
+}
+
+
+int iot_transport_sendmsg(iot_transport_t *t, iot_transport_msg_t *m)
+{
+    int result;
+
+    if (!(t->mode & IOT_TRANSPORT_MODE_JSON))
+        return FALSE;
+
+    if (t->descr->req.sendmsg == NULL)
+        return iot_transport_sendjson(t, m->json);
+
+    IOT_TRANSPORT_BUSY(t, {
+            result = t->descr->req.sendmsg(t, m);
+        });
+
+    if (result)
+        msg_sent(t);
+
+    purge_destroyed(t);
+
+    return result;
+}
+
+
 static int recv_data(iot_transport_t *t, void *data, size_t size,
                      iot_sockaddr_t *addr, socklen_t addrlen)
 {
-    switch (t->mode) {
+    msg_received(t);
+
+    switch (t->mode & ~(IOT_TRANSPORT_MODE_MSGPACK |
+                       IOT_TRANSPORT_MODE_COMPRESS)) {
     case IOT_TRANSPORT_MODE_RAW:
         if (t->connected) {
             IOT_TRANSPORT_BUSY(t, {
@@ -560,3 +1007,25 @@ static int recv_data(iot_transport_t *t, void *data, size_t size,
     }
 }
 
+
+static int recv_fds(iot_transport_t *t, void *data, int *fds, int nfd)
+{
+    int i;
+
+    if ((t->mode & IOT_TRANSPORT_MODE_JSON) && t->connected &&
+        t->evt.recvjsonfds != NULL) {
+        msg_received(t);
+
+        IOT_TRANSPORT_BUSY(t, {
+                t->evt.recvjsonfds(t, data, fds, nfd, t->user_data);
+            });
+
+        return 0;
+    }
+
+    for (i = 0; i < nfd; i++)
+        close(fds[i]);
+
+    return recv_data(t, data, 0, NULL, 0);
+}
+
@@ -30,6 +30,8 @@
 #ifndef __IOT_TRANSPORT_H__
 #define __IOT_TRANSPORT_H__
 
+#include <stdio.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <sys/un.h>
@@ -99,6 +101,8 @@ static inline iot_sockaddr_t *iot_sockaddr_cpy(iot_sockaddr_t *d,
 typedef enum {
     IOT_TRANSPORT_MODE_RAW    = 0x00,    /* uses bitpipe mode */
     IOT_TRANSPORT_MODE_JSON   = 0x01,    /* uses JSON messages */
+    IOT_TRANSPORT_MODE_MSGPACK = 0x02,   /* JSON, MessagePack if possible */
+    IOT_TRANSPORT_MODE_COMPRESS = 0x04,  /* JSON, compressed if possible */
 } iot_transport_mode_t;
 
 typedef enum {
@@ -109,15 +113,144 @@ typedef enum {
     IOT_TRANSPORT_NONBLOCK  = 0x020,
     IOT_TRANSPORT_CLOEXEC   = 0x040,
     IOT_TRANSPORT_CONNECTED = 0x080,
+    IOT_TRANSPORT_BATCH     = 0x100,     /* batch sends per mainloop cycle */
     IOT_TRANSPORT_LISTENED  = 0x001,
 } iot_transport_flag_t;
 
 #define IOT_TRANSPORT_MODE(t) ((t)->flags & IOT_TRANSPORT_MODE_MASK)
 
 
+/*
+ * output queueing
+ *
+ * Messages which cannot be written to the underlying socket without
+ * blocking are queued and written out once the socket becomes writable
+ * again. Once the amount of queued data exceeds the high watermark, the
+ * configured policy is applied to deal with the slow consumer. Once the
+ * queue has drained below the low watermark again, the writable event
+ * callback is called, if one has been set.
+ *
+ * Transports created with IOT_TRANSPORT_BATCH always queue messages and
+ * flush the queue once per mainloop iteration, writing all messages sent
+ * during the iteration with a single writev(2) (or sendmmsg(2) for
+ * datagram transports).
+ */
+
+typedef enum {
+    IOT_TRANSPORT_QUEUE_DROP = 0,        /* drop oldest queued messages */
+    IOT_TRANSPORT_QUEUE_DISCONNECT,      /* disconnect the slow peer */
+    IOT_TRANSPORT_QUEUE_BLOCK,           /* block until the queue drains */
+} iot_transport_qpolicy_t;
+
+#define IOT_TRANSPORT_QUEUE_LOWMARK  (64 * 1024)
+#define IOT_TRANSPORT_QUEUE_HIGHMARK (1024 * 1024)
+
+typedef struct {
+    size_t                  lowmark;     /* writable again below this */
+    size_t                  highmark;    /* apply policy above this */
+    iot_transport_qpolicy_t policy;      /* slow consumer policy */
+} iot_transport_queue_t;
+
+
+/*
+ * input limits
+ *
+ * Stream transports read incoming data in bounded chunks straight into
+ * their reassembly buffer. A frame announcing a size above the maximum
+ * frame size is rejected, closing the transport with EMSGSIZE. At most
+ * the read budget worth of data is read in a single mainloop iteration,
+ * so a single flooding peer cannot starve other event sources.
+ */
+
+#define IOT_TRANSPORT_INPUT_MAXFRAME (4 * 1024 * 1024)
+#define IOT_TRANSPORT_INPUT_BUDGET   (256 * 1024)
+
+typedef struct {
+    size_t                  maxframe;    /* max. accepted frame size */
+    size_t                  budget;      /* max. bytes read per iteration */
+} iot_transport_input_t;
+
+
+/*
+ * frame compression
+ *
+ * Transports in IOT_TRANSPORT_MODE_COMPRESS mode compress messages of at
+ * least the threshold size with LZ4, if that makes them smaller. Stream
+ * transports negotiate compression after connecting and only compress if
+ * the peer has agreed to it. Datagram transports have no session to
+ * negotiate over, so they compress whenever in this mode and expect their
+ * peers to cope with it. Compression is only available if the library has
+ * been built with LZ4 support. Compressed frames are always accepted by
+ * transports that support compression, regardless of their mode.
+ */
+
+#define IOT_TRANSPORT_COMPRESS_THRESHOLD 1024
+
+
+/*
+ * file descriptor passing
+ *
+ * Connected unix domain transports in JSON mode can pass file descriptors
+ * along with messages. The sender keeps ownership of the descriptors it
+ * passes. The receiver gets them through the recvjsonfds event callback,
+ * and is responsible for closing them. If the receiver has no recvjsonfds
+ * callback set, the descriptors are discarded and the message is delivered
+ * as any other one.
+ */
+
+#define IOT_TRANSPORT_MAXFDS 16          /* max. descriptors per message */
+
 #define IOT_TRANSPORT_OPT_PEERCRED "peer-cred"
 #define IOT_TRANSPORT_OPT_PEERSEC  "peer-sec"
 
+
+/*
+ * transport statistics
+ *
+ * Every transport counts the traffic passing through it. The counters
+ * of a single transport can be queried with iot_transport_getopt using
+ * IOT_TRANSPORT_OPT_STATS and an iot_transport_stats_t as the value.
+ * iot_transport_dump_stats dumps the counters of all live transports
+ * to a file, iot_transport_log_stats logs them. This is handy for
+ * spotting peers that flood us or fail to keep up with what we send
+ * them. Bytes are counted as they are handed to or received from the
+ * underlying socket (or ring), including framing. Output dropped from
+ * a queue before being written is not counted. Timestamps are in
+ * microseconds of CLOCK_MONOTONIC, 0 meaning never.
+ */
+
+#define IOT_TRANSPORT_OPT_STATS "stats"
+
+typedef struct {
+    uint64_t bytes_in;                   /* bytes received */
+    uint64_t bytes_out;                  /* bytes sent */
+    uint64_t msgs_in;                    /* messages delivered */
+    uint64_t msgs_out;                   /* messages sent */
+    uint64_t eagain;                     /* sends that would have blocked */
+    uint64_t errors;                     /* malformed input received */
+    size_t   queued;                     /* bytes queued, filled in on query */
+    uint64_t last_in;                    /* time of last message received */
+    uint64_t last_out;                   /* time of last message sent */
+} iot_transport_stats_t;
+
+
+/*
+ * pre-encoded messages
+ *
+ * Sending the same JSON message to many transports, for instance when
+ * broadcasting an event to all of its subscribers, would normally encode
+ * the message once for every receiver. Instead the message can be wrapped
+ * in a reference-counted iot_transport_msg_t and sent to any number of
+ * transports with iot_transport_sendmsg. Each wire encoding of the message
+ * (JSON or MessagePack, compressed or not) is created, together with its
+ * frame header, the first time a transport needs it and is then shared by
+ * all transports. Stream transports also queue the shared frame without
+ * copying it, holding on to a reference until the frame has been written.
+ * Other transports fall back to sending the wrapped JSON message as such.
+ */
+
+typedef struct iot_transport_msg_s iot_transport_msg_t;
+
 /*
  * transport requests
  *
@@ -161,6 +294,10 @@ typedef struct {
     /** Send a JSON messgae over a(n unconnected) transport. */
     int (*sendjsonto)(iot_transport_t *t, iot_json_t *msg, iot_sockaddr_t *addr,
                       socklen_t addrlen);
+    /** Send a JSON message with file descriptors over a connected transport. */
+    int (*sendjsonfds)(iot_transport_t *t, iot_json_t *msg, int *fds, int nfd);
+    /** Send a pre-encoded message over a connected transport. */
+    int (*sendmsg)(iot_transport_t *t, iot_transport_msg_t *msg);
 } iot_transport_req_t;
 
 
@@ -199,6 +336,11 @@ typedef struct {
     void (*closed)(iot_transport_t *t, int error, void *user_data);
     /** Connection attempt on a socket being listened on. */
     void (*connection)(iot_transport_t *t, void *user_data);
+    /** Output queue drained below the low watermark after an overflow. */
+    void (*writable)(iot_transport_t *t, void *user_data);
+    /** JSON message with file descriptors received on a connected transport. */
+    void (*recvjsonfds)(iot_transport_t *t, iot_json_t *msg, int *fds, int nfd,
+                        void *user_data);
 } iot_transport_evt_t;
 
 
@@ -229,9 +371,16 @@ typedef struct {
                                         size_t size,                      \
                                         iot_sockaddr_t *addr,             \
                                         socklen_t addrlen);               \
+    int                    (*recv_fds)(iot_transport_t *t, void *data,    \
+                                       int *fds, int nfd);                \
     void                    *user_data;                                   \
     int                      flags;                                       \
     int                      mode;                                        \
+    iot_transport_queue_t    queue;                                       \
+    iot_transport_input_t    input;                                       \
+    size_t                   zthreshold;                                  \
+    iot_transport_stats_t    stats;                                       \
+    iot_list_hook_t          hook;                                        \
     int                      busy;                                        \
     int                      connected : 1;                               \
     int                      listened : 1;                                \
@@ -363,13 +512,14 @@ struct iot_transport_s {
 
 
 /** Automatically register a transport on startup. */
-#define IOT_REGISTER_TRANSPORT(_prfx, _typename, _structtype, _resolve,   \
-                               _open, _createfrom, _close,                \
-                               _setopt, _getopt,                          \
-                               _bind, _listen, _accept,                   \
-                               _connect, _disconnect,                     \
-                               _sendraw, _sendrawto,                      \
-                               _sendjson, _sendjsonto)                    \
+#define IOT_REGISTER_TRANSPORT_MSG(_prfx, _typename, _structtype,         \
+                                   _resolve, _open, _createfrom, _close,  \
+                                   _setopt, _getopt,                      \
+                                   _bind, _listen, _accept,               \
+                                   _connect, _disconnect,                 \
+                                   _sendraw, _sendrawto,                  \
+                                   _sendjson, _sendjsonto,                \
+                                   _sendjsonfds, _sendmsg)                \
     static void _prfx##_register_transport(void)                          \
          __attribute__((constructor));                                    \
                                                                           \
@@ -393,6 +543,8 @@ struct iot_transport_s {
                 .sendrawto    = _sendrawto,                               \
                 .sendjson     = _sendjson,                                \
                 .sendjsonto   = _sendjsonto,                              \
+                .sendjsonfds  = _sendjsonfds,                             \
+                .sendmsg      = _sendmsg,                                 \
             },                                                            \
         };                                                                \
                                                                           \
@@ -404,6 +556,41 @@ struct iot_transport_s {
     }                                                                     \
     struct iot_allow_trailing_semicolon
 
+/** Automatically register a transport without pre-encoded messages. */
+#define IOT_REGISTER_TRANSPORT_FDS(_prfx, _typename, _structtype,         \
+                                   _resolve, _open, _createfrom, _close,  \
+                                   _setopt, _getopt,                      \
+                                   _bind, _listen, _accept,               \
+                                   _connect, _disconnect,                 \
+                                   _sendraw, _sendrawto,                  \
+                                   _sendjson, _sendjsonto,                \
+                                   _sendjsonfds)                          \
+    IOT_REGISTER_TRANSPORT_MSG(_prfx, _typename, _structtype,             \
+                               _resolve, _open, _createfrom, _close,      \
+                               _setopt, _getopt,                          \
+                               _bind, _listen, _accept,                   \
+                               _connect, _disconnect,                     \
+                               _sendraw, _sendrawto,                      \
+                               _sendjson, _sendjsonto,                    \
+                               _sendjsonfds, NULL)
+
+/** Automatically register a transport without descriptor passing. */
+#define IOT_REGISTER_TRANSPORT(_prfx, _typename, _structtype, _resolve,   \
+                               _open, _createfrom, _close,                \
+                               _setopt, _getopt,                          \
+                               _bind, _listen, _accept,                   \
+                               _connect, _disconnect,                     \
+                               _sendraw, _sendrawto,                      \
+                               _sendjson, _sendjsonto)                    \
+    IOT_REGISTER_TRANSPORT_FDS(_prfx, _typename, _structtype,             \
+                               _resolve, _open, _createfrom, _close,      \
+                               _setopt, _getopt,                          \
+                               _bind, _listen, _accept,                   \
+                               _connect, _disconnect,                     \
+                               _sendraw, _sendrawto,                      \
+                               _sendjson, _sendjsonto,                    \
+                               NULL)
+
 
 
 /** Register a new transport type. */
@@ -463,12 +650,56 @@ int iot_transport_sendraw(iot_transport_t *t, void *data, size_t size);
 int iot_transport_sendrawto(iot_transport_t *t, void *data, size_t size,
                             iot_sockaddr_t *addr, socklen_t addrlen);
 
+/** Dump the statistics of all live transports. */
+void iot_transport_dump_stats(FILE *fp);
+
+/** Log the statistics of all live transports, one line per message. */
+void iot_transport_log_stats(void);
+
+/** Set output queue watermarks and slow consumer policy for a transport. */
+int iot_transport_set_queue(iot_transport_t *t, size_t lowmark,
+                            size_t highmark, iot_transport_qpolicy_t policy);
+
+/** Set the maximum accepted frame size and per-iteration read budget. */
+int iot_transport_set_input(iot_transport_t *t, size_t maxframe,
+                            size_t budget);
+
+/** Set the minimum size of messages to compress. */
+int iot_transport_set_compression(iot_transport_t *t, size_t threshold);
+
 /** Send a JSON message through the given (connected) transport. */
 int iot_transport_sendjson(iot_transport_t *t, iot_json_t *msg);
 
 /** Send a JSON message through the given transport to the remote address. */
 int iot_transport_sendjsonto(iot_transport_t *t, iot_json_t *msg,
                              iot_sockaddr_t *addr, socklen_t addrlen);
+
+/** Send a JSON message and pass the given file descriptors along with it. */
+int iot_transport_sendjsonfds(iot_transport_t *t, iot_json_t *msg,
+                              int *fds, int nfd);
+
+/** Send a JSON message, passing data along with it in a sealed memfd. */
+int iot_transport_sendjsonblob(iot_transport_t *t, iot_json_t *msg,
+                               const void *data, size_t size);
+
+/** Wrap a JSON message for sending it to several transports. */
+iot_transport_msg_t *iot_transport_msg_create(iot_json_t *msg);
+
+/** Add a reference to a pre-encoded message. */
+iot_transport_msg_t *iot_transport_msg_ref(iot_transport_msg_t *m);
+
+/** Remove a reference from a pre-encoded message, freeing it if unused. */
+void iot_transport_msg_unref(iot_transport_msg_t *m);
+
+/** Get the JSON message wrapped by a pre-encoded message. */
+iot_json_t *iot_transport_msg_json(iot_transport_msg_t *m);
+
+/** Get (encoding it if necessary) the length-prefixed frame of a message. */
+const void *iot_transport_msg_frame(iot_transport_msg_t *m, int msgpack,
+                                    size_t zthreshold, size_t *sizep);
+
+/** Send a pre-encoded message through the given (connected) transport. */
+int iot_transport_sendmsg(iot_transport_t *t, iot_transport_msg_t *m);
 IOT_CDECL_END
 
 #endif /* __IOT_TRANSPORT_H__ */
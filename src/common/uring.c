@@ -0,0 +1,859 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <iot/config.h>
+
+#ifdef IO_URING_ENABLED
+#  include <stdio.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/utsname.h>
+#  include <linux/io_uring.h>
+#endif
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/list.h>
+#include <iot/common/log.h>
+#include <iot/common/debug.h>
+#include <iot/common/mainloop.h>
+#include <iot/common/uring.h>
+
+static int enabled = -1;                 /* -1: check the environment */
+static iot_uring_stats_t stats;
+
+
+void iot_uring_enable(int enable)
+{
+    enabled = !!enable;
+}
+
+
+int iot_uring_enabled(void)
+{
+    const char *backend;
+
+    if (enabled < 0) {
+        backend = getenv(IOT_URING_ENVVAR);
+        enabled = backend != NULL && !strcmp(backend, "io_uring");
+    }
+
+    return enabled;
+}
+
+
+void iot_uring_get_stats(iot_uring_stats_t *st)
+{
+    *st = stats;
+}
+
+
+#ifdef IO_URING_ENABLED
+
+#define IN_ENTRIES   64                  /* input submission queue size */
+#define IN_CQSIZE    4096                /* input completion queue size */
+#define OUT_ENTRIES  256                 /* output queue size */
+#define OUT_IOV      64                  /* max. vectors per write */
+#define BUF_COUNT    256                 /* number of receive buffers */
+#define BUF_SIZE     4096                /* receive buffer size */
+#define BUF_GROUP    0                   /* receive buffer group id */
+
+typedef struct {
+    int                  fd;             /* io_uring descriptor */
+    void                *rings;          /* mapped SQ and CQ rings */
+    size_t               size;           /* mapped ring size */
+    struct io_uring_sqe *sqes;           /* mapped submission entries */
+    size_t               sqesize;        /* mapped submission entry size */
+    unsigned            *sqhead;         /* submission queue head */
+    unsigned            *sqtail;         /* submission queue tail */
+    unsigned             sqmask;         /* submission queue index mask */
+    unsigned             sqentries;      /* submission queue size */
+    unsigned            *cqhead;         /* completion queue head */
+    unsigned            *cqtail;         /* completion queue tail */
+    unsigned             cqmask;         /* completion queue index mask */
+    struct io_uring_cqe *cqes;           /* completion queue entries */
+    unsigned             queued;         /* entries not submitted yet */
+} ring_t;
+
+struct iot_uring_s {
+    iot_list_hook_t           hook;      /* to list of rings */
+    iot_mainloop_t           *ml;        /* mainloop we're used with */
+    int                       refcnt;    /* reference count */
+    ring_t                    in;        /* ring for receiving */
+    ring_t                    out;       /* ring for batched sending */
+    struct io_uring_buf_ring *br;        /* provided receive buffer ring */
+    size_t                    brsize;    /* buffer ring size */
+    char                     *bufs;      /* receive buffers */
+    uint16_t                  brtail;    /* buffer ring tail */
+    iot_io_watch_t           *iow;       /* input ring watch */
+    iot_list_hook_t           inputs;    /* active and cancelled receives */
+    iot_list_hook_t           outputs;   /* outputs scheduled for flushing */
+    iot_deferred_t           *flush;     /* output flush */
+};
+
+struct iot_uring_in_s {
+    iot_list_hook_t     hook;            /* to list of receives */
+    iot_uring_t        *u;               /* ring we're on */
+    int                 fd;              /* socket to receive from */
+    iot_uring_recv_cb_t cb;              /* callback, NULL once cancelled */
+    void               *user_data;       /* opaque callback data */
+    int                 armed;           /* whether a receive is pending */
+    int                 busy;            /* whether in a callback */
+};
+
+struct iot_uring_out_s {
+    iot_list_hook_t     hook;            /* to list of scheduled outputs */
+    iot_uring_t        *u;               /* ring we're on */
+    int                 fd;              /* socket to write to */
+    iot_uring_fill_cb_t fill;            /* callback to collect data */
+    iot_uring_done_cb_t done;            /* callback to report results */
+    void               *user_data;       /* opaque callback data */
+    struct iovec        iov[OUT_IOV];    /* data being written */
+    struct msghdr       msg;             /* message being sent */
+    ssize_t             result;          /* result of the write */
+    int                 queued;          /* whether a send is queued */
+};
+
+static IOT_LIST_HOOK(rings);
+
+
+static int check_kernel(void)
+{
+    static int      checked = -1;
+    struct utsname  u;
+    int             major, minor;
+
+    /*
+     * Multishot receive, which we depend on, first appeared in Linux 6.0.
+     * Older kernels would fail those requests only once they are issued,
+     * so we check the kernel version upfront instead.
+     */
+
+    if (checked < 0) {
+        if (uname(&u) == 0 && sscanf(u.release, "%d.%d", &major, &minor) == 2)
+            checked = major >= 6;
+        else
+            checked = FALSE;
+    }
+
+    return checked;
+}
+
+
+static int ring_enter(ring_t *r, unsigned submit, unsigned wait)
+{
+    int flags, n;
+
+    flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    do {
+        n = syscall(__NR_io_uring_enter, r->fd, submit, wait, flags, NULL, 0);
+    } while (n < 0 && errno == EINTR);
+
+    stats.enter++;
+
+    if (n > 0) {
+        stats.sqe += n;
+        r->queued -= n < (int)r->queued ? (unsigned)n : r->queued;
+    }
+
+    return n;
+}
+
+
+static void ring_drop(ring_t *r)
+{
+    unsigned head;
+
+    /* drop all queued entries the kernel has not consumed yet */
+    head = __atomic_load_n(r->sqhead, __ATOMIC_ACQUIRE);
+    __atomic_store_n(r->sqtail, head, __ATOMIC_RELEASE);
+    r->queued = 0;
+}
+
+
+static void ring_exit(ring_t *r)
+{
+    if (r->sqes != NULL && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqesize);
+    if (r->rings != NULL && r->rings != MAP_FAILED)
+        munmap(r->rings, r->size);
+    if (r->fd >= 0)
+        close(r->fd);
+
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+
+static int ring_init(ring_t *r, unsigned entries, unsigned cqsize)
+{
+    struct io_uring_params  p;
+    unsigned               *array, i;
+    size_t                  sqsize;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+
+    p.flags = IORING_SETUP_CLAMP;
+
+    if (cqsize > 0) {
+        p.flags     |= IORING_SETUP_CQSIZE;
+        p.cq_entries = cqsize;
+    }
+
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+
+    if (r->fd < 0)
+        return -1;
+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(p.features & IORING_FEAT_NODROP)) {
+        errno = EOPNOTSUPP;
+        goto fail;
+    }
+
+    sqsize  = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (r->size < sqsize)
+        r->size = sqsize;
+
+    r->rings = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+
+    if (r->rings == MAP_FAILED)
+        goto fail;
+
+    r->sqesize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes    = mmap(NULL, r->sqesize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    r->sqhead    = r->rings + p.sq_off.head;
+    r->sqtail    = r->rings + p.sq_off.tail;
+    r->sqmask    = *(unsigned *)(r->rings + p.sq_off.ring_mask);
+    r->sqentries = p.sq_entries;
+    r->cqhead    = r->rings + p.cq_off.head;
+    r->cqtail    = r->rings + p.cq_off.tail;
+    r->cqmask    = *(unsigned *)(r->rings + p.cq_off.ring_mask);
+    r->cqes      = r->rings + p.cq_off.cqes;
+
+    array = r->rings + p.sq_off.array;
+
+    for (i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+
+    return 0;
+
+ fail:
+    ring_exit(r);
+    return -1;
+}
+
+
+static struct io_uring_sqe *ring_sqe(ring_t *r)
+{
+    struct io_uring_sqe *sqe;
+    unsigned             head, tail;
+
+    head = __atomic_load_n(r->sqhead, __ATOMIC_ACQUIRE);
+    tail = *r->sqtail;
+
+    if (tail - head >= r->sqentries) {
+        if (ring_enter(r, r->queued, 0) < 0)
+            return NULL;
+
+        head = __atomic_load_n(r->sqhead, __ATOMIC_ACQUIRE);
+
+        if (tail - head >= r->sqentries) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+
+    sqe = r->sqes + (tail & r->sqmask);
+    memset(sqe, 0, sizeof(*sqe));
+
+    __atomic_store_n(r->sqtail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+
+    return sqe;
+}
+
+
+static void recycle_buffer(iot_uring_t *u, int bid)
+{
+    struct io_uring_buf *b;
+
+    b = u->br->bufs + (u->brtail & (BUF_COUNT - 1));
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + bid * BUF_SIZE);
+    b->len  = BUF_SIZE;
+    b->bid  = bid;
+
+    u->brtail++;
+    __atomic_store_n(&u->br->tail, u->brtail, __ATOMIC_RELEASE);
+}
+
+
+static int setup_buffers(iot_uring_t *u)
+{
+    struct io_uring_buf_reg reg;
+    int                     i;
+
+    u->brsize = BUF_COUNT * sizeof(struct io_uring_buf);
+    u->br     = mmap(NULL, u->brsize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (u->br == MAP_FAILED) {
+        u->br = NULL;
+        return -1;
+    }
+
+    if ((u->bufs = iot_alloc(BUF_COUNT * BUF_SIZE)) == NULL)
+        return -1;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid         = BUF_GROUP;
+
+    if (syscall(__NR_io_uring_register, u->in.fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0)
+        return -1;
+
+    for (i = 0; i < BUF_COUNT; i++)
+        recycle_buffer(u, i);
+
+    return 0;
+}
+
+
+static int arm_input(iot_uring_in_t *in)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = ring_sqe(&in->u->in)) == NULL)
+        return -1;
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = in->fd;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = (uint64_t)(uintptr_t)in;
+
+    in->armed = TRUE;
+
+    return 0;
+}
+
+
+static int cancel_input(iot_uring_in_t *in)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = ring_sqe(&in->u->in)) == NULL)
+        return -1;
+
+    sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+    sqe->fd        = -1;
+    sqe->addr      = (uint64_t)(uintptr_t)in;
+    sqe->user_data = 0;
+
+    return 0;
+}
+
+
+static void free_input(iot_uring_in_t *in)
+{
+    iot_list_delete(&in->hook);
+    iot_free(in);
+}
+
+
+static void reap_inputs(iot_uring_t *u)
+{
+    struct io_uring_cqe *cqe;
+    iot_uring_in_t      *in;
+    unsigned             head, tail;
+    void                *data;
+    int                  res, flags, bid;
+
+    head = *u->in.cqhead;
+    tail = __atomic_load_n(u->in.cqtail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        cqe   = u->in.cqes + (head & u->in.cqmask);
+        in    = (iot_uring_in_t *)(uintptr_t)cqe->user_data;
+        res   = cqe->res;
+        flags = cqe->flags;
+
+        head++;
+        __atomic_store_n(u->in.cqhead, head, __ATOMIC_RELEASE);
+        stats.cqe++;
+
+        if (in == NULL)                  /* a cancellation request */
+            continue;
+
+        if (flags & IORING_CQE_F_BUFFER) {
+            bid  = flags >> IORING_CQE_BUFFER_SHIFT;
+            data = u->bufs + bid * BUF_SIZE;
+        }
+        else {
+            bid  = -1;
+            data = NULL;
+        }
+
+        if (!(flags & IORING_CQE_F_MORE))
+            in->armed = FALSE;
+
+        if (res != -ENOBUFS && in->cb != NULL) {
+            in->busy++;
+            in->cb(in, data, res, in->user_data);
+            in->busy--;
+        }
+
+        if (bid >= 0)
+            recycle_buffer(u, bid);
+
+        if (in->armed || in->busy)
+            continue;
+
+        /*
+         * A multishot receive also terminates if we run out of buffers or
+         * completion queue space. Rearm it if the socket is still open.
+         */
+
+        if (in->cb == NULL)
+            free_input(in);
+        else if (res > 0 || res == -ENOBUFS)
+            if (arm_input(in) < 0)
+                in->cb(in, NULL, -errno, in->user_data);
+    }
+
+    if (u->in.queued > 0)
+        ring_enter(&u->in, u->in.queued, 0);
+}
+
+
+static void input_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                     void *user_data)
+{
+    iot_uring_t *u = (iot_uring_t *)user_data;
+
+    IOT_UNUSED(w);
+    IOT_UNUSED(fd);
+    IOT_UNUSED(events);
+
+    u->refcnt++;
+    reap_inputs(u);
+    iot_uring_put(u);
+}
+
+
+static void flush_cb(iot_deferred_t *d, void *user_data);
+
+static void destroy_ring(iot_uring_t *u)
+{
+    iot_list_hook_t *p, *n;
+    iot_uring_in_t  *in;
+
+    iot_list_delete(&u->hook);
+
+    iot_del_io_watch(u->iow);
+    iot_del_deferred(u->flush);
+
+    /*
+     * Wait for any cancelled receives to finish before letting go of the
+     * buffers they might still be using.
+     */
+
+    iot_list_foreach(&u->inputs, p, n) {
+        in = iot_list_entry(p, typeof(*in), hook);
+        in->cb = NULL;
+
+        if (in->armed)
+            cancel_input(in);
+        else
+            free_input(in);
+    }
+
+    while (!iot_list_empty(&u->inputs) && u->in.fd >= 0) {
+        if (ring_enter(&u->in, u->in.queued, 1) < 0)
+            break;
+        reap_inputs(u);
+    }
+
+    iot_list_foreach(&u->inputs, p, n)
+        free_input(iot_list_entry(p, iot_uring_in_t, hook));
+
+    ring_exit(&u->in);
+    ring_exit(&u->out);
+
+    if (u->br != NULL)
+        munmap(u->br, u->brsize);
+    iot_free(u->bufs);
+
+    iot_free(u);
+}
+
+
+iot_uring_t *iot_uring_get(iot_mainloop_t *ml)
+{
+    iot_list_hook_t *p, *n;
+    iot_uring_t     *u;
+
+    if (!iot_uring_enabled()) {
+        errno = EOPNOTSUPP;
+        return NULL;
+    }
+
+    iot_list_foreach(&rings, p, n) {
+        u = iot_list_entry(p, typeof(*u), hook);
+
+        if (u->ml == ml) {
+            u->refcnt++;
+            return u;
+        }
+    }
+
+    if (!check_kernel()) {
+        errno = EOPNOTSUPP;
+        return NULL;
+    }
+
+    if ((u = iot_allocz(sizeof(*u))) == NULL)
+        return NULL;
+
+    iot_list_init(&u->hook);
+    iot_list_init(&u->inputs);
+    iot_list_init(&u->outputs);
+    u->ml     = ml;
+    u->refcnt = 1;
+    u->in.fd  = -1;
+    u->out.fd = -1;
+
+    if (ring_init(&u->in, IN_ENTRIES, IN_CQSIZE) < 0 ||
+        ring_init(&u->out, OUT_ENTRIES, 0) < 0 ||
+        setup_buffers(u) < 0)
+        goto fail;
+
+    u->iow = iot_add_io_watch(ml, u->in.fd, IOT_IO_EVENT_IN, input_cb, u);
+    u->flush = iot_add_deferred(ml, flush_cb, u);
+
+    if (u->iow == NULL || u->flush == NULL)
+        goto fail;
+
+    iot_disable_deferred(u->flush);
+    iot_list_append(&rings, &u->hook);
+
+    iot_debug("created io_uring %p for mainloop %p", u, ml);
+
+    return u;
+
+ fail:
+    iot_log_warning("Failed to set up io_uring (%d: %s), using epoll.",
+                    errno, strerror(errno));
+    destroy_ring(u);
+    errno = EOPNOTSUPP;
+    return NULL;
+}
+
+
+void iot_uring_put(iot_uring_t *u)
+{
+    if (u != NULL && --u->refcnt <= 0)
+        destroy_ring(u);
+}
+
+
+iot_uring_in_t *iot_uring_in_add(iot_uring_t *u, int fd,
+                                 iot_uring_recv_cb_t cb, void *user_data)
+{
+    iot_uring_in_t *in;
+
+    if ((in = iot_allocz(sizeof(*in))) == NULL)
+        return NULL;
+
+    iot_list_init(&in->hook);
+    in->u         = u;
+    in->fd        = fd;
+    in->cb        = cb;
+    in->user_data = user_data;
+
+    if (arm_input(in) < 0 || ring_enter(&u->in, u->in.queued, 0) < 0) {
+        iot_free(in);
+        return NULL;
+    }
+
+    iot_list_append(&u->inputs, &in->hook);
+
+    return in;
+}
+
+
+void iot_uring_in_del(iot_uring_in_t *in)
+{
+    if (in == NULL || in->cb == NULL)
+        return;
+
+    in->cb = NULL;
+
+    if (in->armed) {
+        if (cancel_input(in) == 0)
+            ring_enter(&in->u->in, in->u->in.queued, 0);
+    }
+    else if (!in->busy)
+        free_input(in);
+}
+
+
+iot_uring_out_t *iot_uring_out_add(iot_uring_t *u, int fd,
+                                   iot_uring_fill_cb_t fill,
+                                   iot_uring_done_cb_t done, void *user_data)
+{
+    iot_uring_out_t *out;
+
+    if ((out = iot_allocz(sizeof(*out))) == NULL)
+        return NULL;
+
+    iot_list_init(&out->hook);
+    out->u         = u;
+    out->fd        = fd;
+    out->fill      = fill;
+    out->done      = done;
+    out->user_data = user_data;
+
+    return out;
+}
+
+
+int iot_uring_out_schedule(iot_uring_out_t *out)
+{
+    if (iot_list_empty(&out->hook)) {
+        iot_list_append(&out->u->outputs, &out->hook);
+        iot_enable_deferred(out->u->flush);
+    }
+
+    return TRUE;
+}
+
+
+void iot_uring_out_del(iot_uring_out_t *out)
+{
+    if (out == NULL)
+        return;
+
+    iot_list_delete(&out->hook);
+    iot_free(out);
+}
+
+
+static void flush_cb(iot_deferred_t *d, void *user_data)
+{
+    iot_uring_t         *u = (iot_uring_t *)user_data;
+    iot_list_hook_t      pending, written;
+    iot_uring_out_t     *out;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    unsigned             head, tail, nsqe;
+    int                  cnt, error;
+
+    iot_disable_deferred(d);
+
+    iot_list_init(&pending);
+    iot_list_init(&written);
+    iot_list_join(&pending, &u->outputs);
+
+    u->refcnt++;
+
+    /*
+     * Collect the data of all scheduled outputs, submit them in a single
+     * batch and wait for all of them to complete. Sends don't wait for
+     * buffer space (MSG_DONTWAIT), so this never blocks. Only once all
+     * results are in do we report them, since that can trigger arbitrary
+     * callbacks, including ones that delete outputs of this batch.
+     *
+     * If the submission fails, we drop the whole batch from the ring,
+     * since its entries point to data owned by the outputs, and fail all
+     * of its outputs with the error.
+     */
+
+    while (!iot_list_empty(&pending)) {
+        nsqe  = 0;
+        error = 0;
+
+        while (!iot_list_empty(&pending) && nsqe < u->out.sqentries) {
+            out = iot_list_entry(pending.next, typeof(*out), hook);
+            iot_list_delete(&out->hook);
+            iot_list_append(&written, &out->hook);
+
+            out->result = 0;
+            out->queued = 0;
+            cnt = out->fill(out, out->iov, OUT_IOV, out->user_data);
+
+            if (cnt <= 0)
+                continue;
+
+            if ((sqe = ring_sqe(&u->out)) == NULL) {
+                out->result = -errno;
+                continue;
+            }
+
+            memset(&out->msg, 0, sizeof(out->msg));
+            out->msg.msg_iov    = out->iov;
+            out->msg.msg_iovlen = cnt;
+
+            sqe->opcode    = IORING_OP_SENDMSG;
+            sqe->fd        = out->fd;
+            sqe->addr      = (uint64_t)(uintptr_t)&out->msg;
+            sqe->len       = 1;
+            sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+            sqe->user_data = (uint64_t)(uintptr_t)out;
+            out->queued    = 1;
+            nsqe++;
+        }
+
+        if (nsqe > 0 && ring_enter(&u->out, u->out.queued, nsqe) < 0) {
+            error = errno;
+            iot_log_error("Failed to submit output batch (%d: %s).",
+                          error, strerror(error));
+            ring_drop(&u->out);
+        }
+
+        head = *u->out.cqhead;
+        tail = __atomic_load_n(u->out.cqtail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            cqe = u->out.cqes + (head & u->out.cqmask);
+            out = (iot_uring_out_t *)(uintptr_t)cqe->user_data;
+            out->result = cqe->res;
+            out->queued = 0;
+            head++;
+            stats.cqe++;
+        }
+
+        __atomic_store_n(u->out.cqhead, head, __ATOMIC_RELEASE);
+
+        while (!iot_list_empty(&written)) {
+            out = iot_list_entry(written.next, typeof(*out), hook);
+            iot_list_delete(&out->hook);
+
+            if (out->queued) {
+                out->queued = 0;
+                out->result = -error;
+            }
+
+            out->done(out, out->result, out->user_data);
+        }
+    }
+
+    iot_uring_put(u);
+}
+
+
+#else /* !IO_URING_ENABLED */
+
+
+iot_uring_t *iot_uring_get(iot_mainloop_t *ml)
+{
+    IOT_UNUSED(ml);
+
+    errno = EOPNOTSUPP;
+    return NULL;
+}
+
+
+void iot_uring_put(iot_uring_t *u)
+{
+    IOT_UNUSED(u);
+}
+
+
+iot_uring_in_t *iot_uring_in_add(iot_uring_t *u, int fd,
+                                 iot_uring_recv_cb_t cb, void *user_data)
+{
+    IOT_UNUSED(u);
+    IOT_UNUSED(fd);
+    IOT_UNUSED(cb);
+    IOT_UNUSED(user_data);
+
+    errno = EOPNOTSUPP;
+    return NULL;
+}
+
+
+void iot_uring_in_del(iot_uring_in_t *in)
+{
+    IOT_UNUSED(in);
+}
+
+
+iot_uring_out_t *iot_uring_out_add(iot_uring_t *u, int fd,
+                                   iot_uring_fill_cb_t fill,
+                                   iot_uring_done_cb_t done, void *user_data)
+{
+    IOT_UNUSED(u);
+    IOT_UNUSED(fd);
+    IOT_UNUSED(fill);
+    IOT_UNUSED(done);
+    IOT_UNUSED(user_data);
+
+    errno = EOPNOTSUPP;
+    return NULL;
+}
+
+
+int iot_uring_out_schedule(iot_uring_out_t *out)
+{
+    IOT_UNUSED(out);
+
+    errno = EOPNOTSUPP;
+    return FALSE;
+}
+
+
+void iot_uring_out_del(iot_uring_out_t *out)
+{
+    IOT_UNUSED(out);
+}
+
+
+#endif /* !IO_URING_ENABLED */
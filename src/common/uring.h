@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IOT_URING_H__
+#define __IOT_URING_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mainloop.h>
+
+IOT_CDECL_BEGIN
+
+/*
+ * io_uring based transport I/O.
+ *
+ * Transports can use an io_uring shared by all transports of a mainloop
+ * instead of reading and writing their sockets one syscall at a time.
+ * Input is received with multishot receive requests into a pool of
+ * buffers provided to the kernel, so a single epoll event on the ring
+ * delivers the data of any number of connections without further
+ * syscalls. Output scheduled for the same mainloop iteration is written
+ * out with a single batch of send requests, submitted and waited for
+ * with a single io_uring_enter(2).
+ *
+ * io_uring is disabled by default. It can be enabled at runtime either
+ * with iot_uring_enable() or by setting IOT_IO_BACKEND to io_uring in
+ * the environment. If it is disabled or not supported by the kernel,
+ * iot_uring_get() fails and transports fall back to plain epoll.
+ */
+
+/** Environment variable used to select the I/O backend. */
+#define IOT_URING_ENVVAR "IOT_IO_BACKEND"
+
+/** An io_uring shared by the transports of a mainloop. */
+typedef struct iot_uring_s iot_uring_t;
+
+/** A multishot receive on a socket. */
+typedef struct iot_uring_in_s iot_uring_in_t;
+
+/** A socket with output to write in batches. */
+typedef struct iot_uring_out_s iot_uring_out_t;
+
+/**
+ * Receive callback. Called with n > 0 bytes of received data, with n == 0
+ * once the peer has closed the connection, and with -errno on errors.
+ */
+typedef void (*iot_uring_recv_cb_t)(iot_uring_in_t *in, void *data, ssize_t n,
+                                    void *user_data);
+
+/** Output callback, fill in (at most max) vectors of data to write. */
+typedef int (*iot_uring_fill_cb_t)(iot_uring_out_t *out, struct iovec *iov,
+                                   int max, void *user_data);
+
+/** Output callback, n bytes of the filled in data written, or -errno. */
+typedef void (*iot_uring_done_cb_t)(iot_uring_out_t *out, ssize_t n,
+                                    void *user_data);
+
+/** io_uring usage statistics. */
+typedef struct {
+    uint64_t enter;                      /* io_uring_enter(2) calls */
+    uint64_t sqe;                        /* requests submitted */
+    uint64_t cqe;                        /* completions processed */
+} iot_uring_stats_t;
+
+/** Enable or disable the use of io_uring by transports. */
+void iot_uring_enable(int enable);
+
+/** Check whether the use of io_uring is enabled. */
+int iot_uring_enabled(void);
+
+/** Get (a reference to) the ring of the given mainloop, creating it if necessary. */
+iot_uring_t *iot_uring_get(iot_mainloop_t *ml);
+
+/** Release a reference to the given ring. */
+void iot_uring_put(iot_uring_t *u);
+
+/** Start receiving from the given socket. */
+iot_uring_in_t *iot_uring_in_add(iot_uring_t *u, int fd,
+                                 iot_uring_recv_cb_t cb, void *user_data);
+
+/** Stop receiving from the given socket. */
+void iot_uring_in_del(iot_uring_in_t *in);
+
+/** Set up batched output for the given socket. */
+iot_uring_out_t *iot_uring_out_add(iot_uring_t *u, int fd,
+                                   iot_uring_fill_cb_t fill,
+                                   iot_uring_done_cb_t done, void *user_data);
+
+/** Schedule output to be written in the batch of this mainloop iteration. */
+int iot_uring_out_schedule(iot_uring_out_t *out);
+
+/** Cancel any scheduled output and free the given output. */
+void iot_uring_out_del(iot_uring_out_t *out);
+
+/** Get process-wide io_uring usage statistics. */
+void iot_uring_get_stats(iot_uring_stats_t *stats);
+
+IOT_CDECL_END
+
+#endif /* __IOT_URING_H__ */
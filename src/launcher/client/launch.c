@@ -34,8 +34,14 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <grp.h>
+#include <signal.h>
+#include <dirent.h>
+#include <dlfcn.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/capability.h>
 
 #define _GNU_SOURCE
@@ -45,6 +51,7 @@
 #include <iot/common/macros.h>
 #include <iot/common/mm.h>
 #include <iot/common/log.h>
+#include <iot/common/list.h>
 #include <iot/common/debug.h>
 #include <iot/common/mainloop.h>
 #include <iot/common/transport.h>
@@ -97,9 +104,62 @@ typedef enum {
     LAUNCHER_CLEANUP,                    /* cleanup after application */
     LAUNCHER_LIST_INSTALLED,             /* list installed applications */
     LAUNCHER_LIST_RUNNING,               /* list running applications */
+    LAUNCHER_ZYGOTE,                     /* serve as a zygote for a runtime */
 } launcher_mode_t;
 
 
+/*
+ * zygote runtimes
+ *
+ * A zygote is a long-running iot-launch with the launcher libraries and
+ * a language runtime already loaded, linked and, if the runtime allows it,
+ * initialized. Instead of executing an application from scratch, it is
+ * launched by forking the zygote, setting up the identity, cgroup and SMACK
+ * label of the application in the child the usual way, then running the
+ * application in the runtime (or, for native applications, calling the
+ * entry point declared in the manifest) directly.
+ */
+
+#ifndef PYTHON_LIBRARY
+#    define PYTHON_LIBRARY "libpython3.so"
+#endif
+
+#ifndef NODE_LIBRARY
+#    define NODE_LIBRARY "libnode.so"
+#endif
+
+typedef int (*zygote_entry_t)(int argc, char **argv);
+
+typedef struct {
+    const char      *name;               /* runtime name */
+    const char      *library;            /* runtime library to preload */
+    const char      *entry;              /* runtime entry point, or */
+    int            (*init)(void *h);     /* runtime initializer */
+    zygote_entry_t   run;                /* and application runner */
+} zygote_runtime_t;
+
+static int python_init(void *h);
+static int python_run(int argc, char **argv);
+
+static zygote_runtime_t runtimes[] = {
+    { "native", NULL          , NULL                 , NULL       , NULL       },
+    { "python", PYTHON_LIBRARY, NULL                 , python_init, python_run },
+    { "node"  , NODE_LIBRARY  , "_ZN4node5StartEiPPc", NULL       , NULL       },
+    { NULL    , NULL          , NULL                 , NULL       , NULL       }
+};
+
+
+/*
+ * an application started or stopped in bulk
+ */
+
+typedef struct {
+    const char        *appid;            /* application id */
+    pid_t              pid;              /* child waiting to exec it */
+    int                fd;               /* pipe to release the child */
+} bulk_app_t;
+
+
 /*
  * launcher runtime context
  */
@@ -145,9 +205,37 @@ typedef struct {
 
     iot_sighandler_t  *sig_int;          /* SIGINT handler */
     iot_sighandler_t  *sig_term;         /* SIGHUP handler */
+
+    /* zygote options */
+    const char        *zygote;           /* zygote runtime[:library] */
+    bool               cold;             /* don't launch through a zygote */
+    zygote_entry_t     entry;            /* preloaded runtime entry point */
+    const char        *library;          /* native application library */
+    const char        *symbol;           /* native application entry point */
+    iot_transport_t   *zt;               /* zygote transport */
+    iot_list_hook_t    children;         /* applications we have forked */
+    pid_t              pid;              /* application forked for us */
+    iot_sighandler_t  *sig_chld;         /* SIGCHLD handler */
+
+    /* bulk options */
+    bool               bulk;             /* start/stop several applications */
+    bulk_app_t        *apps;             /* applications to start/stop */
+    int                napp;             /* number of applications */
+    int                nstop;            /* stops we're waiting for */
 } launcher_t;
 
 
+/*
+ * an application forked by a zygote
+ */
+
+typedef struct {
+    iot_list_hook_t    hook;             /* to list of children */
+    pid_t              pid;              /* application process */
+    iot_transport_t   *t;                /* launcher to notify about exit */
+} zygote_child_t;
+
+
 static bool iot_development_mode(void)
 {
 #ifdef DEVEL_MODE_ENABLED
@@ -227,10 +315,19 @@ static void print_usage(launcher_t *l, int exit_code, const char *fmt, ...)
     printf("To stop an application:\n");
     printf("  %s [options] --stop <pkg>[:<app>]\n", base);
     printf("To clean up after an application has exited:\n");
-    printf("  %s [options] [--cleanup] <cgroup-path>\n\n", base);
+    printf("  %s [options] [--cleanup] <cgroup-path>\n", base);
+    printf("To start or stop several applications at once:\n");
+    printf("  %s [options] --bulk [--stop] <pkg>[:<app>] ...\n", base);
+    printf("To serve as a zygote for a runtime:\n");
+    printf("  %s [options] --zygote <runtime>[:<library>]\n\n", base);
     printf("The possible options are:\n"
            "  -s, --server=<SERVER>        server transport address\n"
            "  -F, --fork                   fork before execing\n"
+           "  -b, --bulk                   bulk start/stop applications\n"
+           "  -C, --cold                   don't launch through a zygote\n"
+           "  -Z, --zygote=<RUNTIME>       serve as a zygote for RUNTIME\n"
+           "    RUNTIME is one of native, python, or node, optionally\n"
+           "    followed by :<library> to override the runtime library\n"
            "  -l, --log-level=<LEVELS>     what messages to log\n"
            "    LEVELS is a comma-separated list of info, error and warning\n"
            "  -t, --log-target=<TARGET>    where to log messages\n"
@@ -295,14 +392,17 @@ static void config_set_defaults(launcher_t *l, const char *argv0)
 static void get_valid_options(launcher_t *l, const char **optstr,
                               struct option **options)
 {
-#   define STDOPTS "s:Fk:cQ::l:t:v::d:h"
+#   define STDOPTS "s:Fbk:cQ::CZ:l:t:v::d:h"
 #   define DEVOPTS "SUBL:U:G:P:M:"
 #   define STDOPTIONS                                                   \
         { "server"           , required_argument, NULL, 's' },          \
         { "fork"             , no_argument      , NULL, 'F' },          \
+        { "bulk"             , no_argument      , NULL, 'b' },          \
         { "stop"             , no_argument      , NULL, 'k' },          \
         { "cleanup"          , no_argument      , NULL, 'c' },          \
         { "list"             , optional_argument, NULL, 'Q' },          \
+        { "cold"             , no_argument      , NULL, 'C' },          \
+        { "zygote"           , required_argument, NULL, 'Z' },          \
         { "log-level"        , required_argument, NULL, 'l' },          \
         { "log-target"       , required_argument, NULL, 't' },          \
         { "verbose"          , optional_argument, NULL, 'v' },          \
@@ -347,7 +447,7 @@ static void parse_cmdline(launcher_t *l, int argc, char **argv, char **envp)
     const char    *OPTIONS;
     struct option *options;
 
-    int opt, help;
+    int opt, help, i;
 
     IOT_UNUSED(envp);
     IOT_UNUSED(iot_development_mode);
@@ -366,6 +466,10 @@ static void parse_cmdline(launcher_t *l, int argc, char **argv, char **envp)
             l->foreground = false;
             break;
 
+        case 'b':
+            l->bulk = true;
+            break;
+
         case 'k':
             l->mode = LAUNCHER_STOP;
             break;
@@ -389,6 +493,15 @@ static void parse_cmdline(launcher_t *l, int argc, char **argv, char **envp)
             }
             break;
 
+        case 'C':
+            l->cold = true;
+            break;
+
+        case 'Z':
+            l->mode   = LAUNCHER_ZYGOTE;
+            l->zygote = optarg;
+            break;
+
             /*
              * logging, debugging and help
              */
@@ -471,10 +584,28 @@ static void parse_cmdline(launcher_t *l, int argc, char **argv, char **envp)
         l->argc  = argc - (optind + 1);
         l->argv  = argv + (optind + 1);
     }
+    else if (l->bulk)
+        launch_usage(l, EINVAL, "error: --bulk is only valid for start/stop");
     else if (l->mode == LAUNCHER_CLEANUP) {
         l->argc = argc - optind;
         l->argv = argv + optind;
     }
+
+    if (l->bulk) {
+        l->napp = argc - optind;
+        l->apps = iot_allocz_array(bulk_app_t, l->napp);
+
+        if (l->apps == NULL)
+            launch_fail(l, ENOMEM, "Failed to allocate bulk applications.");
+
+        for (i = 0; i < l->napp; i++) {
+            l->apps[i].appid = argv[optind + i];
+            l->apps[i].fd    = -1;
+        }
+
+        l->argc = 0;
+        l->argv = NULL;
+    }
 }
 
 
@@ -517,7 +648,12 @@ static void signal_handler(iot_sighandler_t *h, int signum, void *user_data)
     iot_mainloop_t *ml = iot_get_sighandler_mainloop(h);
     launcher_t     *l  = (launcher_t *)user_data;
 
-    IOT_UNUSED(l);
+    if (l->pid > 0 && (signum == SIGINT || signum == SIGTERM)) {
+        iot_log_info("Forwarding signal %d to application %u...",
+                     signum, l->pid);
+        kill(l->pid, signum);
+        return;
+    }
 
     switch (signum) {
     case SIGINT:
@@ -688,6 +824,43 @@ static void security_setup(launcher_t *l)
 
 #endif /* !ENABLE_SECURITY_MANAGER */
 
+static int zygote_exec(launcher_t *l, char **argv)
+{
+    zygote_entry_t  entry = l->entry;
+    void           *h;
+    sigset_t        mask;
+
+    /*
+     * Notes:
+     *   Call the entry point of a zygote-launched application.
+     *
+     *   This is what we do instead of execv() in a process forked by a
+     *   zygote. For interpreted runtimes we run the application in the
+     *   preloaded runtime. For native applications we load the library
+     *   declared in the manifest and call its entry point. This is done
+     *   only here, after we have dropped our privileges, so that we don't
+     *   run any of the code of the application with elevated privileges.
+     */
+
+    iot_transport_disconnect(l->t);
+
+    if (entry == NULL) {
+        if ((h = dlopen(l->library, RTLD_NOW | RTLD_GLOBAL)) == NULL)
+            launch_fail(l, ELIBACC, "Failed to load library '%s' (%s).",
+                        l->library, dlerror());
+
+        if ((entry = (zygote_entry_t)dlsym(h, l->symbol)) == NULL)
+            launch_fail(l, ELIBACC, "Failed to find entry point '%s' (%s).",
+                        l->symbol, dlerror());
+    }
+
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    return entry(l->app_argc, argv);
+}
+
+
 static int launch_process(launcher_t *l)
 {
     char *argv[l->app_argc + 1];
@@ -720,6 +893,9 @@ static int launch_process(launcher_t *l)
         }
     }
 
+    if (l->zygote != NULL && !l->shell)
+        return zygote_exec(l, argv);
+
     return execv(argv[0], argv);
 }
 
@@ -741,13 +917,109 @@ static void stop_app_check(launcher_t *l, const char *message, iot_json_t *data)
 }
 
 
+static int bulk_status(iot_json_t *data, int idx, const char **message)
+{
+    iot_json_t *s;
+    int         status;
+
+    if (!iot_json_array_get_object(data, idx, &s) ||
+        !iot_json_get_integer(s, "status", &status)) {
+        *message = "missing reply";
+        return EINVAL;
+    }
+
+    if (!iot_json_get_string(s, "message", message))
+        *message = "unknown error";
+
+    return status;
+}
+
+
+static void bulk_setup_check(launcher_t *l, iot_json_t *data)
+{
+    bulk_app_t *a;
+    const char *message;
+    int         i, status, failed;
+
+    /*
+     * Notes:
+     *   Release the children the daemon has set up an application for,
+     *   and tell the rest to exit by closing their pipe without writing
+     *   to it. The reply carries a status for each application, in the
+     *   same order as in our request.
+     */
+
+    for (i = failed = 0; i < l->napp; i++) {
+        a      = l->apps + i;
+        status = bulk_status(data, i, &message);
+
+        if (status == 0 && write(a->fd, "y", 1) != 1) {
+            status  = errno;
+            message = strerror(errno);
+        }
+
+        close(a->fd);
+        a->fd = -1;
+
+        if (status == 0)
+            printf("Application %s started (pid %u).\n", a->appid, a->pid);
+        else {
+            printf("Application %s failed to start (%d: %s).\n", a->appid,
+                   status, message);
+            failed++;
+        }
+    }
+
+    exit(failed ? 1 : 0);
+}
+
+
+static void bulk_stop_check(launcher_t *l, iot_json_t *data)
+{
+    const char *message;
+    int         i, status, failed;
+
+    for (i = failed = 0; i < l->napp; i++) {
+        status = bulk_status(data, i, &message);
+
+        if (status == 0) {
+            printf("Application %s signalled.\n", l->apps[i].appid);
+            l->nstop++;
+        }
+        else {
+            printf("Application %s failed to stop (%d: %s).\n",
+                   l->apps[i].appid, status, message);
+            failed++;
+        }
+    }
+
+    if (l->nstop == 0)
+        exit(failed ? 1 : 0);
+}
+
+
+static void bulk_stopped(launcher_t *l, iot_json_t *data)
+{
+    const char *appid;
+
+    if (!iot_json_get_string(data, "appid", &appid))
+        appid = "?";
+
+    printf("Application %s stopped.\n", appid);
+
+    if (--l->nstop <= 0)
+        exit(0);
+}
+
+
 static void list_apps(launcher_t *l, iot_json_t *data)
 {
-    iot_json_t *a, *argv;
-    int         i;
+    iot_json_t *a, *argv, *usage;
+    int         i, rss, rd, wr;
     const char *app, *descr, *desktop;
     char        user[64], *argv0;
     uid_t       uid;
+    double      cpu;
 
     IOT_UNUSED(l);
 
@@ -768,6 +1040,19 @@ static void list_apps(launcher_t *l, iot_json_t *data)
         printf("    user id: %d (%s)\n", uid,
                iot_get_username(uid, user, sizeof(user)));
         printf("    argv[0]: '%s'\n", argv0);
+
+        if (iot_json_get_object(a, "usage", &usage)) {
+            cpu = 0.0;
+            rss = rd = wr = 0;
+
+            iot_json_get_double (usage, "cpu-time"   , &cpu);
+            iot_json_get_integer(usage, "rss-kb"     , &rss);
+            iot_json_get_integer(usage, "io-read-kb" , &rd);
+            iot_json_get_integer(usage, "io-write-kb", &wr);
+
+            printf("    usage: cpu %.2f s, rss %d kB, io %d/%d kB read/written\n",
+                   cpu, rss, rd, wr);
+        }
     }
 }
 
@@ -823,12 +1108,17 @@ static void recv_cb(iot_transport_t *t, iot_json_t *msg, void *user_data)
 
         switch (l->mode) {
         case LAUNCHER_SETUP:
+            if (l->bulk)
+                bulk_setup_check(l, data);
             security_setup(l);
             exit(launch_process(l));
             break;
 
         case LAUNCHER_STOP:
-            stop_app_check(l, message, data);
+            if (l->bulk)
+                bulk_stop_check(l, data);
+            else
+                stop_app_check(l, message, data);
             break;
 
         case LAUNCHER_CLEANUP:
@@ -855,6 +1145,11 @@ static void recv_cb(iot_transport_t *t, iot_json_t *msg, void *user_data)
             return;
 
         if (!strcmp(event, "stopped")) {
+            if (l->mode == LAUNCHER_STOP && l->bulk) {
+                bulk_stopped(l, data);
+                return;
+            }
+
             if (l->mode == LAUNCHER_STOP) {
                 printf("Application stopped.\n");
                 exit(0);
@@ -1074,6 +1369,7 @@ static void launcher_init(launcher_t *l, const char *argv0, char **envp)
         launch_fail(l, EINVAL, "Failed to create launcher mainloop.");
 
     l->seqno = 1;
+    iot_list_init(&l->children);
 
     install_signal_handlers(l);
     config_set_defaults(l, argv0);
@@ -1136,12 +1432,11 @@ static iot_json_t *create_request(launcher_t *l, const char *type, iot_json_t *r
 }
 
 
-static iot_json_t *create_setup_request(launcher_t *l)
+static void setup_arguments(launcher_t *l)
 {
     static const char *argv[128];
     int          argc, i;
     size_t       size;
-    iot_json_t  *req, *dbg;
 
     size = IOT_ARRAY_SIZE(argv);
     argc = iot_manifest_arguments(l->m, l->app, argv, size);
@@ -1158,6 +1453,14 @@ static iot_json_t *create_setup_request(launcher_t *l)
 
     for (i = 0; i < l->argc; i++)
         argv[argc + i] = l->argv[i];
+}
+
+
+static iot_json_t *create_setup_request(launcher_t *l)
+{
+    iot_json_t *req, *dbg;
+
+    setup_arguments(l);
 
     req = iot_json_create(IOT_JSON_OBJECT);
 
@@ -1198,6 +1501,150 @@ static iot_json_t *create_stop_request(launcher_t *l)
 }
 
 
+static void bulk_child(launcher_t *l, int fd)
+{
+    sigset_t mask;
+    char     c;
+    int      i, n;
+
+    /*
+     * Notes:
+     *   Wait in a child forked for a bulk-started application until our
+     *   parent gets the reply to its bulk setup request. The daemon moves
+     *   us into the cgroup of the application meanwhile, then our parent
+     *   either releases us to exec the application or tells us to exit.
+     */
+
+    for (i = 0; i < l->napp; i++)
+        if (l->apps[i].fd >= 0)
+            close(l->apps[i].fd);
+
+    remove_signal_handlers(l);
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    do {
+        n = read(fd, &c, 1);
+    } while (n < 0 && errno == EINTR);
+
+    if (n != 1 || c != 'y')
+        _exit(1);
+
+    close(fd);
+
+    security_setup(l);
+    exit(launch_process(l));
+}
+
+
+static iot_json_t *create_bulk_setup_request(launcher_t *l)
+{
+    iot_json_t *req, *apps, *app;
+    bulk_app_t *a;
+    int         i, fds[2];
+
+    /*
+     * Notes:
+     *   Resolve each application and fork a child for it, which will
+     *   wait for the daemon to set up the application for it, then exec
+     *   it. The children inherit the resolved state of their application,
+     *   so we only need to send their pids along with the usual setup
+     *   information in a single request.
+     */
+
+    req  = iot_json_create(IOT_JSON_OBJECT);
+    apps = iot_json_create(IOT_JSON_ARRAY);
+
+    if (req == NULL || apps == NULL)
+        launch_fail(l, ENOMEM, "Failed to create bulk setup request.");
+
+    iot_json_add_integer(req, "user" , l->uid);
+    iot_json_add_integer(req, "group", l->gids[0]);
+    iot_json_add        (req, "apps" , apps);
+
+    for (i = 0; i < l->napp; i++) {
+        a        = l->apps + i;
+        l->appid = a->appid;
+
+        if (l->manifest == NULL)
+            resolve_manifest(l);
+        else
+            override_manifest(l);
+
+        resolve_appid(l);
+        setup_arguments(l);
+
+        if (pipe2(fds, O_CLOEXEC) < 0)
+            launch_fail(l, errno, "Failed to create pipe (%d: %s).",
+                        errno, strerror(errno));
+
+        fflush(stdout);
+
+        switch ((a->pid = fork())) {
+        case -1:
+            launch_fail(l, errno, "fork() failed (%d: %s).",
+                        errno, strerror(errno));
+            break;
+        case 0:
+            close(fds[1]);
+            bulk_child(l, fds[0]);
+            break;
+        default:
+            close(fds[0]);
+            a->fd = fds[1];
+        }
+
+        if ((app = iot_json_create(IOT_JSON_OBJECT)) == NULL)
+            launch_fail(l, ENOMEM, "Failed to create bulk setup request.");
+
+        iot_json_add_string (app, "manifest", iot_manifest_path(l->m));
+        iot_json_add_string (app, "app"     , l->app);
+        iot_json_add_integer(app, "pid"     , a->pid);
+        iot_json_add_string_array(app, "exec", l->app_argv, l->app_argc);
+
+        iot_json_array_append(apps, app);
+    }
+
+    return create_request(l, "setup-bulk", req);
+}
+
+
+static iot_json_t *create_bulk_stop_request(launcher_t *l)
+{
+    iot_json_t *req, *apps;
+    char        appid[512];
+    int         i, n;
+
+    req  = iot_json_create(IOT_JSON_OBJECT);
+    apps = iot_json_create(IOT_JSON_ARRAY);
+
+    if (req == NULL || apps == NULL)
+        launch_fail(l, ENOMEM, "Failed to create bulk stop request.");
+
+    iot_json_add(req, "apps", apps);
+
+    for (i = 0; i < l->napp; i++) {
+        l->appid = l->apps[i].appid;
+
+        if (l->manifest == NULL)
+            resolve_manifest(l);
+        else
+            override_manifest(l);
+
+        resolve_appid(l);
+
+        n = snprintf(appid, sizeof(appid), "%s:%s", l->pkg, l->app);
+
+        if (n < 0 || n >= (int)sizeof(appid))
+            launch_fail(l, EINVAL, "Failed to create appid.");
+
+        iot_json_array_append_string(apps, appid);
+    }
+
+    return create_request(l, "stop-bulk", req);
+}
+
+
 static iot_json_t *create_cleanup_request(launcher_t *l)
 {
     iot_json_t *req = iot_json_create(IOT_JSON_OBJECT);
@@ -1227,6 +1674,740 @@ static iot_json_t *create_list_request(launcher_t *l)
 }
 
 
+/*
+ * zygote mode
+ */
+
+static void close_descriptors(int first)
+{
+    DIR           *dp;
+    struct dirent *de;
+    int            fd;
+
+    /*
+     * Notes:
+     *   Close all file descriptors starting from first.
+     *
+     *   We do this in processes forked by a zygote, so that applications
+     *   don't inherit any of the zygote connections. If close_range(2) is
+     *   not available, we fall back to scanning /proc/self/fd.
+     */
+
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, first, ~0U, 0) == 0)
+        return;
+#endif
+
+    if ((dp = opendir("/proc/self/fd")) == NULL)
+        return;
+
+    while ((de = readdir(dp)) != NULL) {
+        fd = (int)strtol(de->d_name, NULL, 10);
+
+        if (fd >= first && fd != dirfd(dp))
+            close(fd);
+    }
+
+    closedir(dp);
+}
+
+
+/*
+ * Python runtime
+ *
+ * We initialize the interpreter in the zygote and define a runner there,
+ * which then runs applications in the forked children the same way the
+ * python executable would: the given script, module (-m) or command (-c)
+ * as __main__. The modules runpy needs for this, and a few commonly used
+ * ones, are imported in the zygote. Arguments and the environment of the
+ * application are passed to the runner hex-encoded, which spares us from
+ * quoting them. Once the application is done, the runner runs the exit
+ * handlers and flushes the standard streams, then exits without tearing
+ * down the interpreter.
+ */
+
+static int (*py_run)(const char *cmd);
+
+static const char python_runner[] =
+    "import sys, os, runpy, pkgutil, atexit, traceback\n"
+    "import json, logging, socket\n"
+    "def _iot_zygote_run(argv, env):\n"
+    "    argv = [bytes.fromhex(a).decode('utf-8', 'surrogateescape')\n"
+    "            for a in argv]\n"
+    "    os.environ.clear()\n"
+    "    for e in env:\n"
+    "        k, _, v = bytes.fromhex(e).decode('utf-8', 'surrogateescape')"
+    ".partition('=')\n"
+    "        os.environ[k] = v\n"
+    "    status = 0\n"
+    "    try:\n"
+    "        if len(argv) > 2 and argv[1] == '-c':\n"
+    "            sys.argv = ['-c'] + argv[3:]\n"
+    "            sys.path.insert(0, '')\n"
+    "            exec(compile(argv[2], '<string>', 'exec'),\n"
+    "                 { '__name__': '__main__', '__builtins__': __builtins__ })\n"
+    "        elif len(argv) > 2 and argv[1] == '-m':\n"
+    "            sys.argv = argv[2:]\n"
+    "            sys.path.insert(0, os.getcwd())\n"
+    "            runpy.run_module(argv[2], run_name='__main__', alter_sys=True)\n"
+    "        elif len(argv) > 1:\n"
+    "            sys.argv = argv[1:]\n"
+    "            sys.path.insert(0, os.path.dirname(os.path.abspath(argv[1])))\n"
+    "            runpy.run_path(argv[1], run_name='__main__')\n"
+    "        else:\n"
+    "            raise SystemExit('no script to run')\n"
+    "    except SystemExit as e:\n"
+    "        if e.code is None:\n"
+    "            status = 0\n"
+    "        elif isinstance(e.code, int):\n"
+    "            status = e.code\n"
+    "        else:\n"
+    "            print(e.code, file=sys.stderr)\n"
+    "            status = 1\n"
+    "    except BaseException:\n"
+    "        traceback.print_exc()\n"
+    "        status = 1\n"
+    "    try:\n"
+    "        atexit._run_exitfuncs()\n"
+    "        sys.stdout.flush()\n"
+    "        sys.stderr.flush()\n"
+    "    except BaseException:\n"
+    "        pass\n"
+    "    os._exit(status & 0xff)\n";
+
+
+static int python_init(void *h)
+{
+    void (*py_init)(int initsigs);
+
+    py_init = (void (*)(int))dlsym(h, "Py_InitializeEx");
+    py_run  = (int (*)(const char *))dlsym(h, "PyRun_SimpleString");
+
+    if (py_init == NULL || py_run == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    setenv("PYTHONNOUSERSITE", "1", 1);
+    py_init(1);
+
+    return py_run(python_runner);
+}
+
+
+static char *hex_list(char *p, char **strs, int n)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *s;
+    int                  i;
+
+    *p++ = '[';
+
+    for (i = 0; i < n; i++) {
+        *p++ = '\'';
+        for (s = (const unsigned char *)strs[i]; *s; s++) {
+            *p++ = hex[*s >> 4];
+            *p++ = hex[*s & 0xf];
+        }
+        *p++ = '\'';
+        *p++ = ',';
+    }
+
+    *p++ = ']';
+
+    return p;
+}
+
+
+static int python_run(int argc, char **argv)
+{
+    static const char prefix[] = "_iot_zygote_run(", suffix[] = ")";
+    char   *cmd, *p;
+    size_t  size;
+    int     nenv, i;
+
+    size = sizeof(prefix) + sizeof(suffix) + 5;
+
+    for (i = 0; i < argc; i++)
+        size += 2 * strlen(argv[i]) + 3;
+
+    for (nenv = 0; environ[nenv] != NULL; nenv++)
+        size += 2 * strlen(environ[nenv]) + 3;
+
+    if ((cmd = iot_alloc(size)) == NULL)
+        return ENOMEM;
+
+    p = cmd;
+    p = stpcpy(p, prefix);
+    p = hex_list(p, argv, argc);
+    *p++ = ',';
+    p = hex_list(p, environ, nenv);
+    p = stpcpy(p, suffix);
+
+    /* the runner exits the process, so we only get here upon failure */
+    py_run(cmd);
+
+    return 1;
+}
+
+
+static void zygote_preload(launcher_t *l)
+{
+    zygote_runtime_t *r;
+    const char       *library;
+    char              name[64], *p;
+    void             *h;
+    int               n;
+
+    if ((p = strchr(l->zygote, ':')) != NULL) {
+        n       = p - l->zygote;
+        library = p + 1;
+    }
+    else {
+        n       = strlen(l->zygote);
+        library = NULL;
+    }
+
+    snprintf(name, sizeof(name), "%.*s", n, l->zygote);
+
+    for (r = runtimes; r->name != NULL; r++)
+        if (!strcmp(r->name, name))
+            break;
+
+    if (r->name == NULL)
+        launch_usage(l, EINVAL, "unknown zygote runtime '%s'", name);
+
+    l->zygote = r->name;
+
+    if (r->library == NULL)
+        return;
+
+    if (library == NULL)
+        library = r->library;
+
+    if ((h = dlopen(library, RTLD_NOW | RTLD_GLOBAL)) == NULL)
+        launch_fail(l, ELIBACC, "Failed to load runtime library '%s' (%s).",
+                    library, dlerror());
+
+    if (r->init != NULL) {
+        if (r->init(h) < 0)
+            launch_fail(l, ELIBACC, "Failed to initialize %s runtime.",
+                        r->name);
+        l->entry = r->run;
+    }
+    else {
+        l->entry = (zygote_entry_t)dlsym(h, r->entry);
+
+        if (l->entry == NULL)
+            launch_fail(l, ELIBACC,
+                        "Failed to find runtime entry point '%s' (%s).",
+                        r->entry, dlerror());
+    }
+
+    launch_info("Preloaded %s runtime from '%s'.", r->name, library);
+}
+
+
+static void zygote_child(launcher_t *l, struct ucred *cred, iot_json_t *req,
+                         int *fds)
+{
+    static char  *argv[128];
+    const char   *appid, *cwd, *runtime, *library, *symbol, *arg;
+    iot_json_t   *args, *env;
+    sigset_t      mask;
+    int           argc, i;
+
+    /*
+     * Notes:
+     *   Set up a newly forked process for launching an application.
+     *
+     *   We take on the standard input, output and error, the environment
+     *   and the working directory of the launcher that sent us the request,
+     *   close everything else we inherited from the zygote and assume the
+     *   identity of the user who made the request.
+     *   From here on we launch the application just like a launcher which
+     *   was started by that user would do, except that we call the entry
+     *   point of the application instead of executing it.
+     */
+
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    signal(SIGCHLD, SIG_DFL);
+
+    for (i = 0; i < 3; i++)
+        if (dup2(fds[i], i) < 0)
+            _exit(EIO);
+
+    close_descriptors(3);
+
+    if (!iot_json_get_string(req, "app", &appid))
+        launch_fail(l, EINVAL, "Launch request without application.");
+
+    if (!iot_json_get_array(req, "args", &args))
+        args = NULL;
+    if (!iot_json_get_array(req, "env", &env))
+        env = NULL;
+    if (!iot_json_get_string(req, "cwd", &cwd))
+        cwd = NULL;
+
+    appid = iot_strdup(appid);
+    argc  = 0;
+
+    for (i = 0; iot_json_array_get_string(args, i, &arg); i++) {
+        if (argc >= (int)IOT_ARRAY_SIZE(argv) - 1)
+            launch_fail(l, EINVAL, "Too many launch arguments.");
+        argv[argc++] = iot_strdup(arg);
+    }
+
+    l->ml = iot_mainloop_create();
+
+    if (l->ml == NULL)
+        launch_fail(l, EINVAL, "Failed to create launcher mainloop.");
+
+    l->sig_chld = NULL;
+    l->pid      = 0;
+    l->seqno    = 1;
+
+    install_signal_handlers(l);
+
+    if (iot_assume_userid(cred->uid, cred->gid) < 0 ||
+        iot_switch_userid(IOT_USERID_REAL) < 0)
+        launch_fail(l, errno, "Failed to assume user id %u (%d: %s).",
+                    cred->uid, errno, strerror(errno));
+
+    if (env != NULL) {
+        clearenv();
+
+        for (i = 0; iot_json_array_get_string(env, i, &arg); i++)
+            putenv(iot_strdup(arg));
+    }
+
+    if (cwd != NULL && chdir(cwd) < 0)
+        launch_warn("Failed to change directory to '%s' (%d: %s).",
+                    cwd, errno, strerror(errno));
+
+    l->mode       = LAUNCHER_SETUP;
+    l->foreground = true;
+    l->appid      = appid;
+    l->argc       = argc;
+    l->argv       = argv;
+
+    resolve_identities(l);
+    resolve_manifest(l);
+    resolve_appid(l);
+
+    if (iot_manifest_zygote(l->m, l->app, &runtime, &library, &symbol) != 1 ||
+        strcmp(runtime, l->zygote))
+        launch_fail(l, EINVAL, "Application %s can't be launched by a %s zygote.",
+                    l->fqai, l->zygote);
+
+    l->library = library;
+    l->symbol  = symbol;
+
+    setup_transport(l);
+    send_request(l, create_setup_request(l));
+
+    run_mainloop(l);
+
+    exit(0);
+}
+
+
+static void zygote_reply(iot_transport_t *t, int seqno, iot_json_t *status)
+{
+    iot_json_t *rpl = msg_reply_create(seqno, status);
+
+    if (rpl == NULL)
+        return;
+
+    iot_transport_sendjson(t, rpl);
+    iot_json_unref(rpl);
+}
+
+
+static void zygote_request_cb(iot_transport_t *t, iot_json_t *msg,
+                              int *fds, int nfd, void *user_data)
+{
+    launcher_t     *l = (launcher_t *)user_data;
+    const char     *type, *appid;
+    iot_json_t     *req, *data;
+    zygote_child_t *c;
+    struct ucred    cred;
+    socklen_t       len;
+    int             seqno, i;
+    pid_t           pid;
+
+    launch_debug("received request: %s", iot_json_object_to_string(msg));
+
+    c = NULL;
+
+    if (msg_request_parse(msg, &type, &seqno, &req) < 0 ||
+        strcmp(type, "launch") || !iot_json_get_string(req, "app", &appid)) {
+        zygote_reply(t, 0, msg_status_error(EINVAL, "malformed request"));
+        goto out;
+    }
+
+    if (nfd != 3) {
+        zygote_reply(t, seqno, msg_status_error(EINVAL,
+                             "expecting standard input, output and error"));
+        goto out;
+    }
+
+    len = sizeof(cred);
+
+    if (!iot_transport_getopt(t, IOT_TRANSPORT_OPT_PEERCRED, &cred, &len)) {
+        zygote_reply(t, seqno, msg_status_error(errno,
+                             "failed to get peer credentials"));
+        goto out;
+    }
+
+    if ((c = iot_allocz(sizeof(*c))) == NULL) {
+        zygote_reply(t, seqno, msg_status_error(ENOMEM, "out of memory"));
+        goto out;
+    }
+
+    switch ((pid = fork())) {
+    case -1:
+        zygote_reply(t, seqno, msg_status_error(errno, "fork failed"));
+        iot_free(c);
+        goto out;
+
+    case 0:
+        zygote_child(l, &cred, req, fds);
+        _exit(0);
+
+    default:
+        break;
+    }
+
+    launch_info("Launched %s for user %u as process %u.", appid, cred.uid, pid);
+
+    iot_list_init(&c->hook);
+    c->pid = pid;
+    c->t   = t;
+    iot_list_append(&l->children, &c->hook);
+
+    data = iot_json_create(IOT_JSON_OBJECT);
+    iot_json_add_integer(data, "pid", pid);
+
+    zygote_reply(t, seqno, msg_status_ok(data));
+
+ out:
+    for (i = 0; i < nfd; i++)
+        close(fds[i]);
+}
+
+
+static void zygote_invalid_cb(iot_transport_t *t, iot_json_t *msg,
+                              void *user_data)
+{
+    int seqno;
+
+    IOT_UNUSED(user_data);
+
+    if (!iot_json_get_integer(msg, "seqno", &seqno))
+        seqno = 0;
+
+    zygote_reply(t, seqno, msg_status_error(EINVAL,
+                         "expecting standard input, output and error"));
+}
+
+
+static void zygote_closed_cb(iot_transport_t *t, int error, void *user_data)
+{
+    launcher_t      *l = (launcher_t *)user_data;
+    iot_list_hook_t *p, *n;
+    zygote_child_t  *c;
+
+    IOT_UNUSED(error);
+
+    iot_list_foreach(&l->children, p, n) {
+        c = iot_list_entry(p, typeof(*c), hook);
+
+        if (c->t == t)
+            c->t = NULL;
+    }
+
+    iot_transport_disconnect(t);
+    iot_transport_destroy(t);
+}
+
+
+static void zygote_connection_cb(iot_transport_t *lt, void *user_data)
+{
+    launcher_t      *l = (launcher_t *)user_data;
+    iot_transport_t *t;
+    int              flags;
+
+    flags = IOT_TRANSPORT_REUSEADDR | IOT_TRANSPORT_NONBLOCK |
+        IOT_TRANSPORT_CLOEXEC;
+
+    if ((t = iot_transport_accept(lt, l, flags)) == NULL)
+        launch_error("Failed to accept zygote connection (%d: %s).",
+                     errno, strerror(errno));
+}
+
+
+static void zygote_reap(iot_sighandler_t *h, int signum, void *user_data)
+{
+    launcher_t      *l = (launcher_t *)user_data;
+    iot_list_hook_t *p, *n;
+    zygote_child_t  *c;
+    iot_json_t      *data, *evt;
+    pid_t            pid;
+    int              status;
+
+    IOT_UNUSED(h);
+    IOT_UNUSED(signum);
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        status = WIFEXITED(status) ?
+            WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+        launch_info("Process %u exited with status %d.", pid, status);
+
+        iot_list_foreach(&l->children, p, n) {
+            c = iot_list_entry(p, typeof(*c), hook);
+
+            if (c->pid != pid)
+                continue;
+
+            if (c->t != NULL && (data = iot_json_create(IOT_JSON_OBJECT))) {
+                iot_json_add_integer(data, "pid"   , pid);
+                iot_json_add_integer(data, "status", status);
+
+                if ((evt = msg_event_create("exited", data)) != NULL) {
+                    iot_transport_sendjson(c->t, evt);
+                    iot_json_unref(evt);
+                }
+            }
+
+            iot_list_delete(&c->hook);
+            iot_free(c);
+            break;
+        }
+    }
+}
+
+
+static void zygote_serve(launcher_t *l)
+{
+    static iot_transport_evt_t evt = {
+        { .recvjson     = zygote_invalid_cb    },
+        { .recvjsonfrom = NULL                 },
+          .closed       = zygote_closed_cb,
+          .connection   = zygote_connection_cb,
+          .recvjsonfds  = zygote_request_cb,
+    };
+
+    iot_sockaddr_t  addr;
+    socklen_t       len;
+    const char     *type;
+    char            zaddr[256];
+    int             flags;
+
+    if (getuid() != 0)
+        launch_fail(l, EPERM, "Zygotes need to be started as root.");
+
+    zygote_preload(l);
+
+    snprintf(zaddr, sizeof(zaddr), IOT_ZYGOTE_ADDRESS, l->zygote);
+
+    len = iot_transport_resolve(NULL, zaddr, &addr, sizeof(addr), &type);
+
+    if (len <= 0)
+        launch_fail(l, EINVAL, "Failed to resolve zygote address '%s'.", zaddr);
+
+    flags = IOT_TRANSPORT_REUSEADDR | IOT_TRANSPORT_NONBLOCK |
+        IOT_TRANSPORT_CLOEXEC | IOT_TRANSPORT_MODE_JSON;
+    l->zt = iot_transport_create(l->ml, type, &evt, l, flags);
+
+    if (l->zt == NULL)
+        launch_fail(l, EINVAL, "Failed to create zygote transport.");
+
+    if (!iot_transport_bind(l->zt, &addr, len) ||
+        !iot_transport_listen(l->zt, 0))
+        launch_fail(l, errno, "Failed to listen on '%s' (%d: %s).",
+                    zaddr, errno, strerror(errno));
+
+    l->sig_chld = iot_add_sighandler(l->ml, SIGCHLD, zygote_reap, l);
+
+    if (l->sig_chld == NULL)
+        launch_fail(l, EINVAL, "Failed to install SIGCHLD handler.");
+
+    launch_info("Serving as a %s zygote on '%s'.", l->zygote, zaddr);
+
+    run_mainloop(l);
+}
+
+
+static void zygote_recv_cb(iot_transport_t *t, iot_json_t *msg,
+                           void *user_data)
+{
+    launcher_t *l = (launcher_t *)user_data;
+    int         seqno, status, pid;
+    const char *message, *type, *event;
+    iot_json_t *data;
+
+    IOT_UNUSED(t);
+
+    launch_debug("received message: %s", iot_json_object_to_string(msg));
+
+    if ((type = msg_type(msg)) == NULL)
+        return;
+
+    if (!strcmp(type, "status")) {
+        status = msg_reply_parse(msg, &seqno, &message, &data);
+
+        if (status < 0)
+            launch_fail(l, -1, "Zygote launch request failed.");
+
+        if (status != 0)
+            launch_fail(l, status, "Zygote launch request failed (%d: %s).",
+                        status, message);
+
+        if (!iot_json_get_integer(data, "pid", &pid))
+            launch_fail(l, EINVAL, "Zygote did not tell application pid.");
+
+        launch_info("Application launched by zygote as process %d.", pid);
+
+        if (!l->foreground)
+            exit(0);
+
+        l->pid = pid;
+        return;
+    }
+
+    if (!strcmp(type, "event")) {
+        if (msg_event_parse(msg, &event, &data) < 0)
+            return;
+
+        if (!strcmp(event, "exited")) {
+            if (!iot_json_get_integer(data, "pid", &pid) || pid != l->pid)
+                return;
+
+            if (!iot_json_get_integer(data, "status", &status))
+                status = 0;
+
+            exit(status);
+        }
+    }
+}
+
+
+static void zygote_closed_conn_cb(iot_transport_t *t, int error,
+                                  void *user_data)
+{
+    launcher_t *l = (launcher_t *)user_data;
+
+    IOT_UNUSED(t);
+    IOT_UNUSED(l);
+
+    launch_fail(l, error ? error : EPIPE, "Connection to zygote closed.");
+}
+
+
+static int zygote_launch(launcher_t *l)
+{
+    static iot_transport_evt_t evt = {
+        { .recvjson     = zygote_recv_cb        },
+        { .recvjsonfrom = NULL                  },
+          .closed       = zygote_closed_conn_cb,
+    };
+
+    const char     *runtime, *library, *symbol, *type;
+    char            zaddr[256];
+    iot_sockaddr_t  addr;
+    socklen_t       len;
+    iot_json_t     *req;
+    struct ucred    cred;
+    char            cwd[PATH_MAX];
+    int             fds[3] = { 0, 1, 2 }, nenv;
+
+    /*
+     * Notes:
+     *   Try to launch an application through a zygote.
+     *
+     *   If the manifest declares a zygote runtime for the application and
+     *   we have not been asked to do a cold launch, try to connect to the
+     *   zygote for that runtime and ask it to launch the application. If
+     *   this fails, we fall back to launching the application ourselves.
+     *
+     *   We hand our standard I/O, environment, and working directory to
+     *   the zygote, so we only talk to one running as root. Anybody could
+     *   be listening on a stale zygote socket address.
+     */
+
+    if (l->cold || l->label || l->user || l->groups || l->privileges ||
+        l->manifest || l->shell || l->bringup || l->unconfined)
+        return -1;
+
+    if (iot_manifest_zygote(l->m, l->app, &runtime, &library, &symbol) != 1)
+        return -1;
+
+    snprintf(zaddr, sizeof(zaddr), IOT_ZYGOTE_ADDRESS, runtime);
+
+    len = iot_transport_resolve(NULL, zaddr, &addr, sizeof(addr), &type);
+
+    if (len <= 0)
+        return -1;
+
+    l->t = iot_transport_create(l->ml, type, &evt, l, IOT_TRANSPORT_MODE_JSON);
+
+    if (l->t == NULL)
+        return -1;
+
+    if (!iot_transport_connect(l->t, &addr, len)) {
+        launch_info("No %s zygote, launching %s directly.", runtime, l->fqai);
+        goto cold;
+    }
+
+    len = sizeof(cred);
+
+    if (!iot_transport_getopt(l->t, IOT_TRANSPORT_OPT_PEERCRED, &cred, &len)) {
+        launch_warn("Can't verify %s zygote, launching %s directly.",
+                    runtime, l->fqai);
+        goto cold;
+    }
+
+    if (cred.uid != 0) {
+        launch_warn("Untrusted %s zygote (uid %u), launching %s directly.",
+                    runtime, cred.uid, l->fqai);
+        goto cold;
+    }
+
+    req = iot_json_create(IOT_JSON_OBJECT);
+
+    if (req == NULL)
+        launch_fail(l, ENOMEM, "Failed to create launch request.");
+
+    for (nenv = 0; environ[nenv] != NULL; nenv++)
+        ;
+
+    iot_json_add_string(req, "app", l->appid);
+    iot_json_add_string_array(req, "args", (const char **)l->argv, l->argc);
+    iot_json_add_string_array(req, "env", (const char **)environ, nenv);
+
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+        iot_json_add_string(req, "cwd", cwd);
+
+    req = create_request(l, "launch", req);
+
+    if (req == NULL || !iot_transport_sendjsonfds(l->t, req, fds, 3))
+        launch_fail(l, EIO, "Failed to send launch request to zygote.");
+
+    iot_json_unref(req);
+
+    return 0;
+
+ cold:
+    iot_transport_destroy(l->t);
+    l->t = NULL;
+
+    return -1;
+}
+
+
 int main(int argc, char *argv[], char **envp)
 {
     launcher_t  l;
@@ -1238,24 +2419,42 @@ int main(int argc, char *argv[], char **envp)
     parse_cmdline(&l, argc, argv, envp);
     setup_logging(&l);
 
+    if (l.mode == LAUNCHER_ZYGOTE) {
+        zygote_serve(&l);
+        return 0;
+    }
+
     if (l.mode == LAUNCHER_SETUP || l.mode == LAUNCHER_STOP) {
         resolve_identities(&l);
 
-        if (l.manifest == NULL)
-            resolve_manifest(&l);
-        else
-            override_manifest(&l);
+        if (!l.bulk) {
+            if (l.manifest == NULL)
+                resolve_manifest(&l);
+            else
+                override_manifest(&l);
 
-        resolve_appid(&l);
+            resolve_appid(&l);
+        }
     }
 
     switch (l.mode) {
     case LAUNCHER_SETUP:
+        if (l.bulk) {
+            req = create_bulk_setup_request(&l);
+            break;
+        }
+        if (zygote_launch(&l) == 0) {
+            run_mainloop(&l);
+            return 0;
+        }
         req = create_setup_request(&l);
         break;
 
     case LAUNCHER_STOP:
-        req = create_stop_request(&l);
+        if (l.bulk)
+            req = create_bulk_stop_request(&l);
+        else
+            req = create_stop_request(&l);
         break;
 
     case LAUNCHER_CLEANUP:
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/wait.h>
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/log.h>
+
+#define bench_fail(...) do {                            \
+        iot_log_error("fatal error: "__VA_ARGS__);      \
+        exit(1);                                        \
+    } while (0)
+
+/*
+ * Measure the latency of starting a python application from scratch
+ * against starting it from a zygote. A cold start forks and executes
+ * python, which then gets dynamically linked and initialized. A linked
+ * zygote start forks a process which already has the python library
+ * loaded and linked, and calls Py_BytesMain directly. An initialized
+ * zygote start forks a process with an initialized interpreter and the
+ * modules needed to run the application already imported, then only runs
+ * the application, as iot-launch in zygote mode does. All include the
+ * full lifetime of the started process, so with a trivial application
+ * (by default -c pass) they measure the startup overhead. The setup
+ * request round-trip to the launcher daemon is the same for all, and is
+ * not included here.
+ */
+
+#ifndef PYTHON_LIBRARY
+#    define PYTHON_LIBRARY "libpython3.so"
+#endif
+
+typedef struct {
+    int          nlaunch;                /* number of launches */
+    const char  *library;                /* python library */
+    const char  *exe;                    /* python executable */
+    char       **argv;                   /* application arguments */
+    int          argc;
+    void        *h;                      /* python library handle */
+    int        (*main)(int, char **);    /* Py_BytesMain */
+    int        (*run)(const char *);     /* PyRun_SimpleString */
+    char         cmd[4096];              /* application runner command */
+} bench_t;
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static void wait_child(pid_t pid)
+{
+    int status;
+
+    if (waitpid(pid, &status, 0) != pid)
+        bench_fail("failed to wait for process %u", pid);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        bench_fail("process %u failed (status 0x%x)", pid, status);
+}
+
+
+static pid_t fork_child(void)
+{
+    pid_t pid;
+
+    fflush(stdout);
+
+    if ((pid = fork()) < 0)
+        bench_fail("fork failed (%d: %s)", errno, strerror(errno));
+
+    return pid;
+}
+
+
+static double launch_cold(bench_t *b)
+{
+    double start = now();
+    pid_t  pid;
+
+    if ((pid = fork_child()) == 0) {
+        execv(b->exe, b->argv);
+        _exit(127);
+    }
+
+    wait_child(pid);
+
+    return now() - start;
+}
+
+
+static double launch_linked(bench_t *b)
+{
+    double start = now();
+    pid_t  pid;
+
+    if ((pid = fork_child()) == 0)
+        _exit(b->main(b->argc, b->argv));
+
+    wait_child(pid);
+
+    return now() - start;
+}
+
+
+static double launch_initialized(bench_t *b)
+{
+    double start = now();
+    pid_t  pid;
+
+    if ((pid = fork_child()) == 0) {
+        b->run(b->cmd);
+        _exit(1);
+    }
+
+    wait_child(pid);
+
+    return now() - start;
+}
+
+
+static void preload(bench_t *b)
+{
+    void  (*init)(int);
+    double  start = now();
+    int     i, n;
+
+    if ((b->h = dlopen(b->library, RTLD_NOW | RTLD_GLOBAL)) == NULL)
+        bench_fail("failed to load '%s' (%s)", b->library, dlerror());
+
+    b->main = (int (*)(int, char **))dlsym(b->h, "Py_BytesMain");
+    b->run  = (int (*)(const char *))dlsym(b->h, "PyRun_SimpleString");
+    init    = (void (*)(int))dlsym(b->h, "Py_InitializeEx");
+
+    if (b->main == NULL || b->run == NULL || init == NULL)
+        bench_fail("failed to find python entry points (%s)", dlerror());
+
+    printf("  zygote preload of %s: %.3f ms\n", b->library,
+           1000.0 * (now() - start));
+
+    start = now();
+    init(1);
+
+    if (b->run("import sys, os, runpy, pkgutil") < 0)
+        bench_fail("failed to initialize python");
+
+    printf("  zygote initialization: %.3f ms\n", 1000.0 * (now() - start));
+
+    n = snprintf(b->cmd, sizeof(b->cmd), "sys.argv = [");
+
+    for (i = 1; i < b->argc && n < (int)sizeof(b->cmd); i++)
+        n += snprintf(b->cmd + n, sizeof(b->cmd) - n, "%s'%s'",
+                      i > 1 ? ", " : "", b->argv[i]);
+
+    if (n < (int)sizeof(b->cmd))
+        n += snprintf(b->cmd + n, sizeof(b->cmd) - n, "]\n"
+                      "if sys.argv[0] == '-c':\n"
+                      "    exec(compile(sys.argv[1], '<string>', 'exec'),"
+                      " { '__name__': '__main__' })\n"
+                      "else:\n"
+                      "    runpy.run_path(sys.argv[0], run_name='__main__')\n"
+                      "sys.stdout.flush()\n"
+                      "os._exit(0)\n");
+
+    if (n >= (int)sizeof(b->cmd))
+        bench_fail("application arguments too long");
+}
+
+
+static void bench_launch(bench_t *b, const char *name,
+                         double (*launch)(bench_t *))
+{
+    double t, total, min, max;
+    int    i;
+
+    total = max = 0;
+    min   = 1e9;
+
+    for (i = 0; i < b->nlaunch; i++) {
+        t      = launch(b);
+        total += t;
+
+        if (t < min)
+            min = t;
+        if (t > max)
+            max = t;
+    }
+
+    printf("  %-12s  %8.3f ms/launch  (min %8.3f, max %8.3f)\n", name,
+           1000.0 * total / b->nlaunch, 1000.0 * min, 1000.0 * max);
+}
+
+
+static void print_usage(const char *argv0, int exit_code)
+{
+    printf("usage: %s [options] [-- application arguments]\n\n"
+           "The possible options are:\n"
+           "  -n, --launches=<n>             number of launches\n"
+           "  -l, --library=<path>           python library to preload\n"
+           "  -x, --exe=<path>               python executable\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    exit(exit_code);
+}
+
+
+static void parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "n:l:x:h"
+    struct option options[] = {
+        { "launches"     , required_argument, NULL, 'n' },
+        { "library"      , required_argument, NULL, 'l' },
+        { "exe"          , required_argument, NULL, 'x' },
+        { "help"         , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    static char *defargs[] = { NULL, "-c", "pass", NULL };
+    int          opt, i;
+
+    b->nlaunch = 50;
+    b->library = PYTHON_LIBRARY;
+    b->exe     = "/usr/bin/python3";
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            b->nlaunch = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'l':
+            b->library = optarg;
+            break;
+        case 'x':
+            b->exe = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0], 0);
+            break;
+        default:
+            print_usage(argv[0], EINVAL);
+        }
+    }
+
+    if (b->nlaunch <= 0)
+        print_usage(argv[0], EINVAL);
+
+    if (optind < argc) {
+        b->argc = argc - optind + 1;
+        b->argv = calloc(b->argc + 1, sizeof(b->argv[0]));
+
+        if (b->argv == NULL)
+            bench_fail("out of memory");
+
+        for (i = 1; i < b->argc; i++)
+            b->argv[i] = argv[optind + i - 1];
+    }
+    else {
+        b->argc = IOT_ARRAY_SIZE(defargs) - 1;
+        b->argv = defargs;
+    }
+
+    b->argv[0] = (char *)b->exe;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static bench_t b;
+
+    iot_log_set_mask(IOT_LOG_UPTO(IOT_LOG_WARNING));
+    iot_log_set_target(IOT_LOG_TO_STDERR);
+
+    parse_cmdline(&b, argc, argv);
+
+    printf("application startup latency, %d launches of %s:\n",
+           b.nlaunch, b.exe);
+
+    preload(&b);
+
+    bench_launch(&b, "cold"       , launch_cold);
+    bench_launch(&b, "linked"     , launch_linked);
+    bench_launch(&b, "initialized", launch_initialized);
+
+    return 0;
+}
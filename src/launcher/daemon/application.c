@@ -27,11 +27,15 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <limits.h>
 
 #include <iot/common/macros.h>
 #include <iot/common/log.h>
+#include <iot/common/hash-table.h>
 #include <iot/utils/appid.h>
 
 #include "launcher/daemon/launcher.h"
@@ -40,6 +44,8 @@
 #include "launcher/daemon/event.h"
 #include "launcher/daemon/cgroup.h"
 #include "launcher/daemon/privilege.h"
+#include "launcher/daemon/worker.h"
+#include "launcher/daemon/keyset.h"
 
 #define STOPPED_EVENT "stopped"
 
@@ -50,11 +56,13 @@ static IOT_LIST_HOOK(hooks);
 typedef enum {
     HOOK_INIT = 0,
     HOOK_EXIT,
+    HOOK_PREPARE,
     HOOK_STARTUP,
     HOOK_CLEANUP
 } hook_event_t;
 
 static int application_sigterm(application_t *app);
+static void cgroup_empty(launcher_t *l, const char *dir, void *user_data);
 
 
 void application_hook_register(app_hook_t *h)
@@ -69,7 +77,15 @@ static int hook_trigger(launcher_t *l, application_t *a, hook_event_t e)
     iot_list_hook_t *p, *n;
     app_hook_t      *h;
 
-    iot_list_join(&l->hooks, &hooks);
+    /*
+     * Notes:
+     *   HOOK_PREPARE is triggered in worker threads. Hooks only get
+     *   registered during startup, so the hook list doesn't change once
+     *   the mainloop is running and it is safe to walk it from there.
+     */
+
+    if (e != HOOK_PREPARE)
+        iot_list_join(&l->hooks, &hooks);
 
     iot_list_foreach(&l->hooks, p, n) {
         h = iot_list_entry(p, typeof(*h), hook);
@@ -83,8 +99,12 @@ static int hook_trigger(launcher_t *l, application_t *a, hook_event_t e)
             if (h->exit)
                 h->exit();
             break;
+        case HOOK_PREPARE:
+            if (h->prepare && h->prepare(a) < 0)
+                return -1;
+            break;
         case HOOK_STARTUP:
-            if (h->setup(a) < 0)
+            if (h->setup && h->setup(a) < 0)
                 return -1;
             break;
         case HOOK_CLEANUP:
@@ -102,6 +122,24 @@ static int hook_trigger(launcher_t *l, application_t *a, hook_event_t e)
 
 int application_init(launcher_t *l)
 {
+    iot_hashtbl_config_t cfg;
+
+    iot_clear(&cfg);
+    cfg.hash    = iot_hash_string;
+    cfg.comp    = iot_comp_string;
+    cfg.nbucket = 64;
+
+    l->app_cgroups = iot_hashtbl_create(&cfg);
+    l->app_ids     = iot_hashtbl_create(&cfg);
+
+    cfg.hash    = iot_hash_direct;
+    cfg.comp    = iot_comp_direct;
+
+    l->app_uids = iot_hashtbl_create(&cfg);
+
+    if (l->app_cgroups == NULL || l->app_ids == NULL || l->app_uids == NULL)
+        return -1;
+
     iot_list_move(&l->hooks, &hooks);
 
     if (hook_trigger(l, NULL, HOOK_INIT) < 0)
@@ -173,124 +211,688 @@ static void free_arguments(char **argv)
 }
 
 
-iot_json_t *application_setup(client_t *c, iot_json_t *req)
+static void application_unregister(application_t *a)
 {
-    launcher_t     *l = c->l;
-    iot_json_t     *s;
-    application_t  *a;
-    iot_manifest_t *m;
-    const char     *f, *manifest, *app, *base;
-    uid_t           uid;
-    gid_t           gid;
-    iot_json_t     *exec, *dbg;
-    char            dir[PATH_MAX];
+    launcher_t *l = a->l;
 
-    a = NULL;
+    iot_list_delete(&a->hook);
 
-    if (!iot_json_get_string (req, f="manifest", &manifest) ||
-        !iot_json_get_string (req, f="app"     , &app     ) ||
-        !iot_json_get_integer(req, f="user"    , &uid     ) ||
-        !iot_json_get_integer(req, f="group"   , &gid     ) ||
-        !iot_json_get_array  (req, f="exec"    , &exec    )) {
-        s = msg_status_error(EINVAL, "malformed message, missing field %s", f);
+    cgroup_unwatch(a->watch);
+    a->watch = NULL;
+
+    if (a->id.cgrp != NULL &&
+        iot_hashtbl_lookup(l->app_cgroups, a->id.cgrp,
+                           IOT_HASH_COOKIE_NONE) == a)
+        iot_hashtbl_remove(l->app_cgroups, a->id.cgrp, IOT_HASH_COOKIE_NONE);
+
+    key_ref_unlink(&a->by_appid);
+    key_ref_unlink(&a->by_uid);
+}
+
+
+static int application_register(application_t *a)
+{
+    launcher_t *l   = a->l;
+    const void *uid = (void *)(ptrdiff_t)a->id.uid;
+
+    if (iot_hashtbl_lookup(l->app_cgroups, a->id.cgrp,
+                           IOT_HASH_COOKIE_NONE) != NULL) {
+        errno = EEXIST;
         goto fail;
     }
 
-    m = iot_manifest_read(manifest);
+    if (iot_hashtbl_add(l->app_cgroups, a->id.cgrp, a, NULL) < 0)
+        goto fail;
+
+    if (key_ref_link(&a->by_appid, a,
+                     key_set_get(l->app_ids, a->appid, a->appid)) < 0)
+        goto fail;
+
+    if (key_ref_link(&a->by_uid, a, key_set_get(l->app_uids, uid, NULL)) < 0)
+        goto fail;
+
+    iot_list_append(&l->apps, &a->hook);
+
+    return 0;
+
+ fail:
+    application_unregister(a);
+    return -1;
+}
+
+
+static void application_free(application_t *a)
+{
+    if (a == NULL)
+        return;
+
+    if (a->m != NULL)
+        iot_manifest_unref(a->m);
+
+    iot_free(a->app);
+    iot_free(a->appid);
+    iot_free(a->id.cgrp);
+    free_arguments(a->id.argv);
+    iot_free(a);
+}
+
+
+/*
+ * an application setup request in progress
+ *
+ * Setting up an application involves reading its manifest, creating its
+ * cgroup and running the prepare stage of the application hooks, all of
+ * which can block. We do these in a worker thread. Applying resource
+ * controls, running the rest of the application hooks, and registering
+ * the application all touch launcher state shared with the mainloop, so
+ * these are done in the mainloop once the worker is done.
+ */
+
+typedef struct {
+    application_t *a;                    /* application being set up */
+    char          *manifest;             /* path to application manifest */
+    char          *base;                 /* cgroup directory base name */
+    pending_t     *p;                    /* pending setup request */
+    iot_json_t    *status;               /* error status, if failed */
+    iot_manifest_resources_t res;        /* resource controls */
+    int            limits;               /* whether to apply res */
+    struct bulk_s *bulk;                 /* bulk request, if part of one */
+} setup_t;
+
+
+static void setup_free(setup_t *s)
+{
+    if (s == NULL)
+        return;
+
+    application_free(s->a);
+    iot_free(s->manifest);
+    iot_free(s->base);
+    iot_free(s);
+}
+
+
+static int setup_prepare(setup_t *s, iot_manifest_t *m)
+{
+    application_t *a = s->a;
+    char           appid[256];
 
     if (m == NULL) {
-        s = msg_status_error(EINVAL, "failed to load manifest '%s'", manifest);
+        s->status = msg_status_error(EINVAL, "failed to load manifest '%s'",
+                                     s->manifest);
+        return -1;
+    }
+
+    a->m = m;
+
+    snprintf(appid, sizeof(appid), "%s:%s", iot_manifest_package(m), a->app);
+
+    if ((a->appid = iot_strdup(appid)) == NULL) {
+        s->status = msg_status_error(ENOMEM, "out of memory");
+        return -1;
+    }
+
+    /* check resource controls before we create any cgroup */
+    switch (iot_manifest_resources(m, a->app, &s->res)) {
+    case 0:
+        break;
+    case 1:
+        s->limits = 1;
+        break;
+    default:
+        s->status = msg_status_error(EINVAL, "invalid resource controls");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void setup_hooks(setup_t *s)
+{
+    if (hook_trigger(s->a->l, s->a, HOOK_PREPARE) < 0)
+        s->status = msg_status_error(errno, "prepare hook failed");
+}
+
+
+static void setup_finish(setup_t *s)
+{
+    application_t *a = s->a;
+    launcher_t    *l = a->l;
+
+    if (s->status != NULL)               /* failed in the worker */
+        goto fail;
+
+    if (s->limits && cgroup_set_limits(l, a->id.cgrp, &s->res) < 0) {
+        if (errno != EOPNOTSUPP) {
+            s->status = msg_status_error(errno,
+                                         "failed to apply resource controls");
+            goto fail;
+        }
+
+        iot_log_warning("Resource controls of %s ignored, no cgroup v2.",
+                        a->appid);
+    }
+
+    if (hook_trigger(l, a, HOOK_STARTUP) < 0) {
+        s->status = msg_status_error(errno, "startup hook failed");
         goto fail;
     }
 
+    return;
+
+ fail:
+    if (a->id.cgrp != NULL)
+        cgroup_release(l, a->id.cgrp);
+}
+
+
+static void setup_work(void *data)
+{
+    setup_t       *s = (setup_t *)data;
+    application_t *a = s->a;
+    launcher_t    *l = a->l;
+    char           dir[PATH_MAX];
+
+    if (setup_prepare(s, iot_manifest_read(s->manifest)) < 0)
+        return;
+
+    if (cgroup_mkdir(l, a->id.uid, s->base, a->id.pid, dir, sizeof(dir)) < 0) {
+        s->status = msg_status_error(errno, "failed to create cgroup directory");
+        return;
+    }
+
+    if ((a->id.cgrp = iot_strdup(dir)) == NULL) {
+        s->status = msg_status_error(ENOMEM, "out of memory");
+        return;
+    }
+
+    setup_hooks(s);
+}
+
+
+static iot_json_t *setup_register(setup_t *s, client_t *c)
+{
+    application_t *a = s->a;
+    launcher_t    *l = a->l;
+    iot_json_t    *status;
+
+    if ((status = s->status) != NULL) {
+        s->status = NULL;
+        return status;
+    }
+
+    a->c = c;
+
+    if (application_register(a) < 0) {
+        status = msg_status_error(errno, "failed to register application");
+        hook_trigger(l, a, HOOK_CLEANUP);
+        cgroup_release(l, a->id.cgrp);
+        return status;
+    }
+
+    if (l->cgmonitor)
+        a->watch = cgroup_watch(l, a->id.cgrp, cgroup_empty, a);
+
+    s->a = NULL;
+
+    return msg_status_ok(NULL);
+}
+
+
+static void setup_done(void *data)
+{
+    setup_t *s = (setup_t *)data;
+
+    setup_finish(s);
+
+    transport_complete(s->p, setup_register(s, s->p->c));
+    setup_free(s);
+}
+
+
+static setup_t *setup_create(launcher_t *l, const char *manifest,
+                             const char *app, uid_t uid, gid_t gid, pid_t pid,
+                             iot_json_t *exec)
+{
+    application_t *a;
+    setup_t       *s;
+    const char    *base;
+
+    s = iot_allocz(sizeof(*s));
     a = iot_allocz(sizeof(*a));
 
-    if (a == NULL)
+    if (s == NULL || a == NULL) {
+        iot_free(s);
+        iot_free(a);
+        errno = ENOMEM;
         return NULL;
+    }
 
     iot_list_init(&a->hook);
     a->l = l;
-    a->c = c;
-    a->m = m;
+    s->a = a;
 
     a->app     = iot_strdup(app);
     a->id.argc = copy_arguments(exec, &a->id.argv);
 
-    if (a->app == NULL || a->id.argc < 0) {
-        s = NULL;
-        goto fail;
-    }
+    if (a->app == NULL || a->id.argc < 0)
+        goto nomem;
 
-    /* XXX TODO: should handle identity from dbg here... */
-    iot_json_get_object(req, "dbg", &dbg);
+    if (a->id.argc == 0) {
+        setup_free(s);
+        errno = EINVAL;
+        return NULL;
+    }
 
-    a->id.uid = (uid != NO_UID ? uid : c->id.uid);
-    a->id.gid = (gid != NO_GID ? gid : c->id.gid);
-    a->id.pid = c->id.pid;
+    a->id.uid = uid;
+    a->id.gid = gid;
+    a->id.pid = pid;
+    a->id.app = a->app;
 
     if ((base = strrchr(a->id.argv[0], '/')) != NULL)
         base++;
     else
         base = a->id.argv[0];
 
-    if (cgroup_mkdir(l, a->id.uid, base, a->id.pid, dir, sizeof(dir)) < 0) {
-        s = msg_status_error(errno, "failed to create cgroup directory");
-        goto fail;
+    s->manifest = iot_strdup(manifest);
+    s->base     = iot_strdup(base);
+
+    if (s->manifest == NULL || s->base == NULL)
+        goto nomem;
+
+    return s;
+
+ nomem:
+    setup_free(s);
+    errno = ENOMEM;
+    return NULL;
+}
+
+
+iot_json_t *application_setup(client_t *c, iot_json_t *req)
+{
+    launcher_t     *l = c->l;
+    iot_json_t     *status;
+    setup_t        *s;
+    const char     *f, *manifest, *app;
+    uid_t           uid;
+    gid_t           gid;
+    iot_json_t     *exec, *dbg;
+
+    if (!iot_json_get_string (req, f="manifest", &manifest) ||
+        !iot_json_get_string (req, f="app"     , &app     ) ||
+        !iot_json_get_integer(req, f="user"    , &uid     ) ||
+        !iot_json_get_integer(req, f="group"   , &gid     ) ||
+        !iot_json_get_array  (req, f="exec"    , &exec    ))
+        return msg_status_error(EINVAL, "malformed message, missing field %s",
+                                f);
+
+    /* XXX TODO: should handle identity from dbg here... */
+    iot_json_get_object(req, "dbg", &dbg);
+
+    s = setup_create(l, manifest, app,
+                     uid != NO_UID ? uid : c->id.uid,
+                     gid != NO_GID ? gid : c->id.gid,
+                     c->id.pid, exec);
+
+    if (s == NULL) {
+        if (errno == EINVAL)
+            return msg_status_error(EINVAL, "malformed message, empty exec");
+        return msg_status_error(ENOMEM, "out of memory");
     }
 
-    a->id.app  = a->app;
-    a->id.cgrp = iot_strdup(dir);
+    if ((s->p = transport_pending(c)) == NULL) {
+        setup_free(s);
+        return msg_status_error(ENOMEM, "out of memory");
+    }
 
-    if (a->id.cgrp == NULL) {
-        s = NULL;
-        goto fail;
+    if (worker_run(l, setup_work, setup_done, s) < 0) {
+        status = msg_status_error(errno, "failed to queue setup request");
+        transport_complete(s->p, status);
+        setup_free(s);
     }
 
-    if (hook_trigger(l, a, HOOK_STARTUP) < 0) {
-        s = msg_status_error(errno, "startup hook failed");
-        goto fail;
+    return REQUEST_PENDING;
+}
+
+
+/*
+ * a bulk application setup request in progress
+ *
+ * A bulk setup request carries a list of applications to set up at once,
+ * typically the ones autostarted during boot. For every application the
+ * client forks a child which waits for the reply, then execs the
+ * application. We load every distinct manifest only once and create all
+ * cgroups in a single batch in a worker thread. Then we run the hook
+ * prepare stage of each application as a worker job of its own. Once all
+ * of them are done, we finish the setup of each application in the
+ * mainloop and reply with a status for each application in request order.
+ */
+
+typedef struct bulk_s {
+    launcher_t  *l;                      /* launcher context */
+    pending_t   *p;                      /* pending bulk setup request */
+    pid_t        owner;                  /* requesting process */
+    uid_t        uid;                    /* user to set up applications for */
+    setup_t    **s;                      /* per-application setups */
+    int          n;                      /* number of applications */
+    int          busy;                   /* prepare jobs still in progress */
+} bulk_t;
+
+
+static void bulk_free(bulk_t *b)
+{
+    int i;
+
+    if (b == NULL)
+        return;
+
+    for (i = 0; i < b->n; i++)
+        setup_free(b->s[i]);
+
+    iot_free(b->s);
+    iot_free(b);
+}
+
+
+static pid_t process_parent(pid_t pid)
+{
+    char  path[64], buf[512], *p;
+    pid_t ppid;
+    int   fd, n;
+
+    snprintf(path, sizeof(path), "/proc/%u/stat", pid);
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if (n <= 0)
+        return -1;
+
+    buf[n] = '\0';
+
+    /* the command name may contain anything, the state follows its ')' */
+    if ((p = strrchr(buf, ')')) == NULL)
+        return -1;
+
+    if (sscanf(p + 1, " %*c %d", &ppid) != 1)
+        return -1;
+
+    return ppid;
+}
+
+
+static void bulk_work(void *data)
+{
+    bulk_t         *b = (bulk_t *)data;
+    launcher_t     *l = b->l;
+    cgroup_mkdir_t *cg;
+    int            *idx;
+    setup_t        *s;
+    iot_manifest_t *m;
+    pid_t           pid;
+    int             i, j, k, cnt;
+
+    /*
+     * Notes:
+     *   Load the manifests, sharing a single copy between applications
+     *   of the same package, and check that each process to set up is
+     *   either the client itself or a child of it. Then create all the
+     *   cgroups in one batch. Since the children are blocked waiting for
+     *   the reply, and only the client can reap them, their pids can't
+     *   get reused under our feet.
+     */
+
+    cg  = iot_allocz_array(cgroup_mkdir_t, b->n);
+    idx = iot_allocz_array(int, b->n);
+
+    if (cg == NULL || idx == NULL) {
+        for (i = 0; i < b->n; i++)
+            b->s[i]->status = msg_status_error(ENOMEM, "out of memory");
+        goto out;
     }
 
-    iot_list_append(&l->apps, &a->hook);
+    for (i = cnt = 0; i < b->n; i++) {
+        s = b->s[i];
 
-    return msg_status_ok(NULL);
+        for (j = 0; j < i; j++)
+            if (!strcmp(b->s[j]->manifest, s->manifest))
+                break;
 
- fail:
-    if (a) {
-        iot_free(a->app);
-        iot_free(a->id.cgrp);
-        free_arguments(a->id.argv);
-        iot_free(a);
+        if (j < i)
+            m = b->s[j]->a->m ? iot_manifest_ref(b->s[j]->a->m) : NULL;
+        else
+            m = iot_manifest_read(s->manifest);
+
+        if (setup_prepare(s, m) < 0)
+            continue;
+
+        pid = s->a->id.pid;
+
+        if (pid != b->owner && process_parent(pid) != b->owner) {
+            s->status = msg_status_error(EPERM, "process %u not a child of %u",
+                                         pid, b->owner);
+            continue;
+        }
+
+        cg[cnt].base = s->base;
+        cg[cnt].pid  = pid;
+        idx[cnt]     = i;
+        cnt++;
     }
 
-    return s;
+    if (cnt > 0)
+        cgroup_mkdir_bulk(l, b->uid, cg, cnt);
+
+    for (k = 0; k < cnt; k++) {
+        s = b->s[idx[k]];
+
+        if (cg[k].error != 0)
+            s->status = msg_status_error(cg[k].error,
+                                         "failed to create cgroup directory");
+        else if ((s->a->id.cgrp = iot_strdup(cg[k].dir)) == NULL)
+            s->status = msg_status_error(ENOMEM, "out of memory");
+    }
+
+ out:
+    iot_free(cg);
+    iot_free(idx);
 }
 
 
-iot_json_t *application_stop(client_t *c, iot_json_t *req)
+static void bulk_reply(bulk_t *b)
+{
+    iot_json_t *rpl, *status;
+    char        app[256];
+    int         i;
+
+    rpl = iot_json_create(IOT_JSON_ARRAY);
+
+    for (i = 0; i < b->n; i++) {
+        snprintf(app, sizeof(app), "%s", b->s[i]->a->app);
+        status = setup_register(b->s[i], b->p->c);
+
+        if (status == NULL || rpl == NULL) {
+            iot_json_unref(status);
+            continue;
+        }
+
+        iot_json_add_string(status, "app", app);
+        iot_json_array_append(rpl, status);
+    }
+
+    if (rpl != NULL)
+        transport_complete(b->p, msg_status_ok(rpl));
+    else
+        transport_complete(b->p, msg_status_error(ENOMEM, "out of memory"));
+
+    bulk_free(b);
+}
+
+
+static void bulk_finish(bulk_t *b)
+{
+    int i;
+
+    for (i = 0; i < b->n; i++)
+        setup_finish(b->s[i]);
+
+    bulk_reply(b);
+}
+
+
+static void bulk_prepare_work(void *data)
+{
+    setup_hooks((setup_t *)data);
+}
+
+
+static void bulk_prepare_done(void *data)
+{
+    bulk_t *b = ((setup_t *)data)->bulk;
+
+    if (--b->busy == 0)
+        bulk_finish(b);
+}
+
+
+static void bulk_done(void *data)
+{
+    bulk_t  *b = (bulk_t *)data;
+    setup_t *s;
+    int      i;
+
+    /*
+     * Notes:
+     *   The hook prepare stage can block for a long time (for instance
+     *   the security manager), so we run it for every application as a
+     *   worker job of its own instead of serializing them. We hold an
+     *   extra busy count while queuing, since without worker threads the
+     *   jobs are run synchronously.
+     */
+
+    b->busy = 1;
+
+    for (i = 0; i < b->n; i++) {
+        s = b->s[i];
+
+        if (s->status != NULL)
+            continue;
+
+        s->bulk = b;
+        b->busy++;
+
+        if (worker_run(b->l, bulk_prepare_work, bulk_prepare_done, s) < 0) {
+            s->status = msg_status_error(errno, "failed to queue setup");
+            b->busy--;
+        }
+    }
+
+    if (--b->busy == 0)
+        bulk_finish(b);
+}
+
+
+iot_json_t *application_setup_bulk(client_t *c, iot_json_t *req)
+{
+    launcher_t     *l = c->l;
+    iot_json_t     *status, *apps, *o, *exec;
+    bulk_t         *b;
+    const char     *f, *manifest, *app;
+    uid_t           uid;
+    gid_t           gid;
+    pid_t           pid;
+    int             n, i;
+
+    if (!iot_json_get_integer(req, f="user" , &uid ) ||
+        !iot_json_get_integer(req, f="group", &gid ) ||
+        !iot_json_get_array  (req, f="apps" , &apps))
+        return msg_status_error(EINVAL, "malformed message, missing field %s",
+                                f);
+
+    if ((n = iot_json_array_length(apps)) <= 0)
+        return msg_status_error(EINVAL, "malformed message, no applications");
+
+    if ((b = iot_allocz(sizeof(*b))) == NULL ||
+        (b->s = iot_allocz_array(setup_t *, n)) == NULL)
+        goto nomem;
+
+    b->l     = l;
+    b->owner = c->id.pid;
+    b->uid   = (uid != NO_UID ? uid : c->id.uid);
+    gid      = (gid != NO_GID ? gid : c->id.gid);
+
+    for (i = 0; i < n; i++) {
+        if (!iot_json_array_get_object(apps, i, &o) ||
+            !iot_json_get_string (o, f="manifest", &manifest) ||
+            !iot_json_get_string (o, f="app"     , &app     ) ||
+            !iot_json_get_integer(o, f="pid"     , &pid     ) ||
+            !iot_json_get_array  (o, f="exec"    , &exec    )) {
+            bulk_free(b);
+            return msg_status_error(EINVAL, "malformed message, application "
+                                    "#%d missing field %s", i, f);
+        }
+
+        if ((b->s[i] = setup_create(l, manifest, app, b->uid, gid, pid,
+                                    exec)) == NULL) {
+            bulk_free(b);
+            if (errno == EINVAL)
+                return msg_status_error(EINVAL, "malformed message, "
+                                        "application #%d has empty exec", i);
+            return msg_status_error(ENOMEM, "out of memory");
+        }
+
+        b->n++;
+    }
+
+    if ((b->p = transport_pending(c)) == NULL)
+        goto nomem;
+
+    if (worker_run(l, bulk_work, bulk_done, b) < 0) {
+        status = msg_status_error(errno, "failed to queue bulk setup request");
+        transport_complete(b->p, status);
+        bulk_free(b);
+    }
+
+    return REQUEST_PENDING;
+
+ nomem:
+    bulk_free(b);
+
+    return msg_status_error(ENOMEM, "out of memory");
+}
+
+
+static iot_json_t *stop_app(client_t *c, const char *appid)
 {
     launcher_t *l = c->l;
     application_t *app, *a;
+    app_set_t *set;
+    app_ref_t *r;
     iot_list_hook_t *p, *n;
-    const char *appid;
-    char pkg[128], id[128];
-
-    if (!iot_json_get_string(req, "app", &appid))
-        goto invalid;
+    char pkg[128], id[128], key[256];
 
     if (iot_appid_parse(appid, NULL, 0, pkg, sizeof(pkg), id, sizeof(id)) < 0)
         goto invalid;
 
+    snprintf(key, sizeof(key), "%s:%s", pkg, id);
+
     app = NULL;
-    iot_list_foreach(&l->apps, p, n) {
-        a = iot_list_entry(p, typeof(*a), hook);
+    set = iot_hashtbl_lookup(l->app_ids, key, IOT_HASH_COOKIE_NONE);
 
-        if (c->id.uid != a->id.uid && c->id.uid != 0)
-            continue;
+    if (set != NULL) {
+        iot_list_foreach(&set->refs, p, n) {
+            r = iot_list_entry(p, typeof(*r), hook);
+            a = r->obj;
 
-        if (!strcmp(iot_manifest_package(a->m), pkg) && !strcmp(a->id.app, id)) {
-            app = a;
-            break;
+            if (c->id.uid == a->id.uid || c->id.uid == 0) {
+                app = a;
+                break;
+            }
         }
     }
 
@@ -316,6 +918,49 @@ iot_json_t *application_stop(client_t *c, iot_json_t *req)
 }
 
 
+iot_json_t *application_stop(client_t *c, iot_json_t *req)
+{
+    const char *appid;
+
+    if (!iot_json_get_string(req, "app", &appid))
+        return msg_status_error(EINVAL, "invalid stop request");
+
+    return stop_app(c, appid);
+}
+
+
+iot_json_t *application_stop_bulk(client_t *c, iot_json_t *req)
+{
+    iot_json_t *apps, *rpl, *status;
+    const char *appid;
+    int         n, i;
+
+    if (!iot_json_get_array(req, "apps", &apps) ||
+        (n = iot_json_array_length(apps)) <= 0)
+        return msg_status_error(EINVAL, "invalid stop request");
+
+    if ((rpl = iot_json_create(IOT_JSON_ARRAY)) == NULL)
+        return msg_status_error(ENOMEM, "out of memory");
+
+    for (i = 0; i < n; i++) {
+        if (!iot_json_array_get_string(apps, i, &appid)) {
+            iot_json_unref(rpl);
+            return msg_status_error(EINVAL, "invalid stop request");
+        }
+
+        if ((status = stop_app(c, appid)) == NULL) {
+            iot_json_unref(rpl);
+            return msg_status_error(ENOMEM, "out of memory");
+        }
+
+        iot_json_add_string(status, "app", appid);
+        iot_json_array_append(rpl, status);
+    }
+
+    return msg_status_ok(rpl);
+}
+
+
 static void application_sigkill(iot_timer_t *t, void *user_data)
 {
     application_t *app = (application_t *)user_data;
@@ -341,36 +986,52 @@ static int application_sigterm(application_t *app)
 
 static application_t *application_for_cgroup(launcher_t *l, const char *cgrp)
 {
-    iot_list_hook_t *p, *n;
-    application_t   *a;
-
-    iot_list_foreach(&l->apps, p, n) {
-        a = iot_list_entry(p, typeof(*a), hook);
-
-        if (!strcmp(a->id.cgrp, cgrp))
-            return a;
-    }
-
-    return NULL;
+    return iot_hashtbl_lookup(l->app_cgroups, cgrp, IOT_HASH_COOKIE_NONE);
 }
 
 
 static void send_stopped_event(application_t *a)
 {
     iot_json_t *e;
-    char        appid[256];
 
     e = iot_json_create(IOT_JSON_OBJECT);
 
     if (e == NULL)
         return;
 
-    snprintf(appid, sizeof(appid), "%s:%s",
-             iot_manifest_package(a->m), a->id.app);
-
-    iot_json_add_string (e, "appid", appid);
+    iot_json_add_string (e, "appid", a->appid);
 
     event_send(a->l, a->killer, STOPPED_EVENT, e);
+
+    iot_json_unref(e);
+}
+
+
+static void application_reap(application_t *a)
+{
+    launcher_t *l = a->l;
+
+    iot_timer_del(a->stop);
+    a->stop = NULL;
+    application_unregister(a);
+    hook_trigger(l, a, HOOK_CLEANUP);
+
+    send_stopped_event(a);
+
+    cgroup_rmdir(l, a->id.cgrp);
+
+    application_free(a);
+}
+
+
+static void cgroup_empty(launcher_t *l, const char *dir, void *user_data)
+{
+    application_t *a = (application_t *)user_data;
+
+    IOT_UNUSED(l);
+    IOT_UNUSED(dir);
+
+    application_reap(a);
 }
 
 
@@ -391,16 +1052,47 @@ iot_json_t *application_cleanup(client_t *c, iot_json_t *req)
     if (a == NULL)
         return msg_status_ok(NULL);
 
-    iot_timer_del(a->stop);
-    a->stop = NULL;
-    iot_list_delete(&a->hook);
-    hook_trigger(l, a, HOOK_CLEANUP);
+    application_reap(a);
 
-    send_stopped_event(a);
+    return msg_status_ok(NULL);
+}
+
+
+static int list_app(iot_json_t *apps, application_t *a)
+{
+    iot_json_t     *app, *usage;
+    const char     *descr, *desktop;
+    cgroup_usage_t  u;
+
+    app = iot_json_create(IOT_JSON_OBJECT);
+
+    if (app == NULL)
+        return -1;
+
+    descr   = iot_manifest_description(a->m, a->app);
+    desktop = iot_manifest_desktop_path(a->m, a->app);
 
-    cgroup_rmdir(l, cgrp);
+    iot_json_add_string (app, "app"        , a->appid);
+    iot_json_add_string (app, "description", descr);
+    iot_json_add_string (app, "desktop"    , desktop ? desktop : "");
+    iot_json_add_integer(app, "user"       , a->id.uid);
+    iot_json_add_string_array(app, "argv", a->id.argv, a->id.argc);
 
-     return msg_status_ok(NULL);
+    if (cgroup_usage(a->l, a->id.cgrp, &u) == 0) {
+        usage = iot_json_create(IOT_JSON_OBJECT);
+
+        if (usage != NULL) {
+            iot_json_add_double (usage, "cpu-time"   , u.cpu_usec / 1000000.0);
+            iot_json_add_integer(usage, "rss-kb"     , u.rss       / 1024);
+            iot_json_add_integer(usage, "io-read-kb" , u.io_rbytes / 1024);
+            iot_json_add_integer(usage, "io-write-kb", u.io_wbytes / 1024);
+            iot_json_add(app, "usage", usage);
+        }
+    }
+
+    iot_json_array_append(apps, app);
+
+    return 0;
 }
 
 
@@ -408,44 +1100,43 @@ static iot_json_t *list_running(client_t *c)
 {
     launcher_t      *l = c->l;
     application_t   *a;
+    app_set_t       *set;
+    app_ref_t       *r;
     iot_list_hook_t *p, *n;
-    iot_json_t      *apps, *app;
-    const char      *descr, *desktop;
-    char             appid[1024];
+    iot_json_t      *apps;
 
     apps = iot_json_create(IOT_JSON_ARRAY);
 
     if (apps == NULL)
         return NULL;
 
-    iot_list_foreach(&l->apps, p, n) {
-        a = iot_list_entry(p, typeof(*a), hook);
-
-        if (c->id.uid != a->id.uid && c->id.uid != 0)
-            continue;
+    if (c->id.uid == 0) {
+        iot_list_foreach(&l->apps, p, n) {
+            a = iot_list_entry(p, typeof(*a), hook);
 
-        app = iot_json_create(IOT_JSON_OBJECT);
-
-        if (app == NULL) {
-            iot_json_unref(apps);
-            return NULL;
+            if (list_app(apps, a) < 0)
+                goto fail;
         }
+    }
+    else {
+        set = iot_hashtbl_lookup(l->app_uids, (void *)(ptrdiff_t)c->id.uid,
+                                 IOT_HASH_COOKIE_NONE);
 
-        descr   = iot_manifest_description(a->m, a->app);
-        desktop = iot_manifest_desktop_path(a->m, a->app);
-        snprintf(appid, sizeof(appid), "%s:%s",
-                 iot_manifest_package(a->m), a->app);
-
-        iot_json_add_string (app, "app"        , appid);
-        iot_json_add_string (app, "description", descr);
-        iot_json_add_string (app, "desktop"    , desktop ? desktop : "");
-        iot_json_add_integer(app, "user"       , a->id.uid);
-        iot_json_add_string_array(app, "argv", a->id.argv, a->id.argc);
+        if (set != NULL) {
+            iot_list_foreach(&set->refs, p, n) {
+                r = iot_list_entry(p, typeof(*r), hook);
 
-        iot_json_array_append(apps, app);
+                if (list_app(apps, r->obj) < 0)
+                    goto fail;
+            }
+        }
     }
 
     return msg_status_ok(apps);
+
+ fail:
+    iot_json_unref(apps);
+    return NULL;
 }
 
 
@@ -28,16 +28,27 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <sys/vfs.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
 
 #include <iot/common/macros.h>
+#include <iot/common/mm.h>
 #include <iot/common/log.h>
+#include <iot/common/list.h>
+#include <iot/common/mainloop.h>
+#include <iot/common/hash-table.h>
 
 #include "launcher/daemon/launcher.h"
 #include "launcher/daemon/cgroup.h"
@@ -46,15 +57,49 @@
 #    define PATH_MAX 1024
 #endif
 
+#ifndef CGROUP2_SUPER_MAGIC
+#    define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+
 static int mount_cgdir(launcher_t *l);
 static int umount_cgdir(launcher_t *l);
 static int cgopen(launcher_t *l, const char *dir, const char *entry, int flags);
+static int cgwrite(launcher_t *l, const char *dir, const char *entry,
+                   const char *value);
+static void enable_controllers(launcher_t *l, const char *dir);
+static void freeze_flush(void);
 
 int cgroup_init(launcher_t *l)
 {
+    struct statfs stfs;
+
     l->cgroot = CGROUP_ROOT;
     l->cgdir  = CGROUP_ROOT"/"CGROUP_DIR;
 
+    /*
+     * On a cgroup v2 (unified) hierarchy we can't mount a named hierarchy
+     * of our own, and there is no release agent either. Instead we create
+     * our directory in the unified hierarchy and always monitor cgroups
+     * for emptiness ourselves.
+     */
+
+    if (statfs(l->cgroot, &stfs) == 0 && stfs.f_type == CGROUP2_SUPER_MAGIC) {
+        iot_log_info("Using cgroup v2 unified hierarchy %s...", l->cgroot);
+
+        l->cgv2      = TRUE;
+        l->cgmonitor = TRUE;
+
+        if (mkdir(l->cgdir, 0755) < 0 && errno != EEXIST) {
+            iot_log_error("Failed to create cgroup directory %s (%d: %s).",
+                          l->cgdir, errno, strerror(errno));
+            return -1;
+        }
+
+        enable_controllers(l, l->cgdir);
+
+        return 0;
+    }
+
     if (mount_cgdir(l) < 0)
         return -1;
 
@@ -64,9 +109,12 @@ int cgroup_init(launcher_t *l)
 
 int cgroup_exit(launcher_t *l)
 {
-    IOT_UNUSED(l);
+    freeze_flush();
 
-    umount_cgdir(l);
+    if (l->cgv2)
+        rmdir(l->cgdir);
+    else
+        umount_cgdir(l);
 
     return 0;
 }
@@ -75,49 +123,116 @@ int cgroup_exit(launcher_t *l)
 int cgroup_mkdir(launcher_t *l, uid_t uid, const char *base, pid_t pid,
                  char *idbuf, size_t idsize)
 {
-    char path[PATH_MAX];
-    int  fd, n, u;
+    cgroup_mkdir_t m;
+    int            n;
 
-    n = snprintf(path, sizeof(path), "%s/user-%u", l->cgdir, uid);
+    m.base = base;
+    m.pid  = pid;
 
-    if (n < 0 || n >= (int)sizeof(path))
+    if (cgroup_mkdir_bulk(l, uid, &m, 1) != 1) {
+        errno = m.error;
         return -1;
+    }
 
-    if (mkdir(path, 0755) < 0 && errno != EEXIST)
-        return -1;
+    if (idbuf != NULL) {
+        n = snprintf(idbuf, idsize, "%s", m.dir);
 
-    u = n;
-    n = snprintf(path + u, sizeof(path) - u, "/%s-%u", base, pid);
+        if (n < 0 || n >= (int)idsize)
+            return -1;
+    }
 
-    if (n < 0 || n > (int)sizeof(path) - u)
-        return -1;
+    return 0;
+}
 
-    if (mkdir(path, 0755) < 0)
-        goto cleanup;
 
-    if (pid) {
-        if ((fd = cgopen(l, path, "tasks", O_WRONLY)) < 0)
-            goto cleanup;
-        n = dprintf(fd, "%u\n", pid);
-        close(fd);
+int cgroup_mkdir_bulk(launcher_t *l, uid_t uid, cgroup_mkdir_t *items, int n)
+{
+    char path[PATH_MAX], name[NAME_MAX + 1], procs[PATH_MAX];
+    int  ufd, fd, i, len, cnt, err;
+
+    /*
+     * Notes:
+     *   Create the per-user directory (and enable controllers in it)
+     *   only once, then create all application cgroups relative to an
+     *   open descriptor of it. This saves repeated path lookups through
+     *   the cgroup filesystem when a whole batch of applications is set
+     *   up at once, for instance by autostart at boot.
+     */
+
+    len = snprintf(path, sizeof(path), "%s/user-%u", l->cgdir, uid);
+
+    if (len < 0 || len >= (int)sizeof(path)) {
+        err = ENAMETOOLONG;
+        goto fail;
+    }
 
-        if (n < 0)
-            goto cleanup;
+    if (mkdir(path, 0755) < 0) {
+        if (errno != EEXIST) {
+            err = errno;
+            goto fail;
+        }
     }
+    else
+        enable_controllers(l, path);
 
-    if (idbuf != NULL) {
-        n = snprintf(idbuf, idsize, "%s", path + strlen(l->cgdir) + 1);
+    if ((ufd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        err = errno;
+        goto fail;
+    }
 
-        if (n < 0 || n >= (int)idsize)
-            return -1;
+    for (i = cnt = 0; i < n; i++) {
+        items[i].dir[0] = '\0';
+        items[i].error  = 0;
+
+        len = snprintf(name, sizeof(name), "%s-%u", items[i].base,
+                       items[i].pid);
+
+        if (len < 0 || len >= (int)sizeof(name)) {
+            items[i].error = ENAMETOOLONG;
+            continue;
+        }
+
+        if (mkdirat(ufd, name, 0755) < 0) {
+            items[i].error = errno;
+            continue;
+        }
+
+        if (items[i].pid) {
+            snprintf(procs, sizeof(procs), "%s/cgroup.procs", name);
+
+            if ((fd = openat(ufd, procs, O_WRONLY | O_CLOEXEC)) < 0 ||
+                dprintf(fd, "%u\n", items[i].pid) < 0) {
+                items[i].error = errno;
+                if (fd >= 0)
+                    close(fd);
+                unlinkat(ufd, name, AT_REMOVEDIR);
+                continue;
+            }
+
+            close(fd);
+        }
+
+        snprintf(items[i].dir, sizeof(items[i].dir), "user-%u/%s", uid, name);
+        cnt++;
     }
 
-    return 0;
+    close(ufd);
+
+    /*
+     * Notes:
+     *   We leave the per-user directory in place even if we failed to
+     *   create anything in it. Other workers might be setting up cgroups
+     *   for the same user concurrently, and removing it would make them
+     *   fail. An empty per-user directory is harmless and gets reused.
+     */
+
+    return cnt;
 
- cleanup:
-    rmdir(path);
-    path[u] = '\0';
-    rmdir(path);
+ fail:
+    for (i = 0; i < n; i++) {
+        items[i].dir[0] = '\0';
+        items[i].error  = err;
+    }
 
     return -1;
 }
@@ -140,71 +255,227 @@ int cgroup_rmdir(launcher_t *l, const char *dir)
 }
 
 
-int cgroup_signal(launcher_t *l, const char *dir, int sig)
+static int signal_procs(launcher_t *l, const char *dir, int sig)
 {
-    char  path[PATH_MAX], buf[4096], *p;
-    int   n, fd;
-    pid_t pid;
-    int   tries;
+    char   path[PATH_MAX], line[64], *e;
+    pid_t  pid;
+    int    n, fd;
+    FILE  *fp;
 
-    n = snprintf(path, sizeof(path), "%s/%s/tasks", l->cgdir, dir);
+    n = snprintf(path, sizeof(path), "%s/%s", l->cgdir, dir);
 
     if (n < 0 || n >= (int)sizeof(path))
         return -1;
 
-    tries = 0;
-    while (tries++ < 3) {
-        fd = open(path, O_RDONLY);
+    if ((fd = cgopen(l, path, "cgroup.procs", O_RDONLY)) < 0)
+        return -1;
 
-        if (fd < 0)
-            goto failed;
+    if ((fp = fdopen(fd, "r")) == NULL) {
+        close(fd);
+        return -1;
+    }
 
-        n = read(fd, buf, sizeof(buf) - 1);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        pid = (pid_t)strtoul(line, &e, 10);
 
-        if (n < 0) {
-            if (errno == EINTR || errno == EAGAIN) {
-                close(fd);
-                continue;
-            }
-            else
-                goto failed;
-        }
+        if (e == line || pid <= 0)
+            continue;
 
-        close(fd);
+        iot_debug("sending pid %u the %s (%d) signal...", pid,
+                  strsignal(sig), sig);
+        kill(pid, sig);
+    }
+
+    fclose(fp);
+
+    return 0;
+}
 
-        buf[n] = '\0';
 
-        pid = 0;
-        p   = buf;
+/*
+ * Freezing a cgroup is asynchronous. While we wait for a cgroup to report
+ * being frozen, we keep track of the pending signal here. cgroup.events is
+ * pollable for changes, so we watch it instead of blocking the mainloop.
+ */
 
-        while (*p) {
-            if (*p == '\n') {
-                iot_debug("sending pid %u the %s (%d) signal...", pid,
-                          strsignal(sig), sig);
-                kill(pid, sig);
-                pid = 0;
-            }
-            else {
-                pid *= 10;
-                pid += *p - '0';
-            }
+#define FREEZE_TIMEOUT 100               /* max. msecs to wait for freezing */
 
-            p++;
-        }
+typedef struct {
+    launcher_t      *l;                  /* launcher context */
+    char            *dir;                /* cgroup to signal (relative) */
+    int              sig;                /* signal to deliver once frozen */
+    int              fd;                 /* cgroup.events, or -1 */
+    iot_io_watch_t  *w;                  /* I/O watch for cgroup.events */
+    iot_timer_t     *t;                  /* timer for freezing timeout */
+    iot_list_hook_t  hook;               /* to pending freezes */
+} cgfreeze_t;
 
-        if (n < (int)sizeof(buf) - 1)
-            break;
+static IOT_LIST_HOOK(freezes);           /* cgroups being frozen */
+
+
+static int freeze_cgroup(launcher_t *l, const char *dir, int freeze)
+{
+    char path[PATH_MAX];
+    int  n;
+
+    n = snprintf(path, sizeof(path), "%s/%s", l->cgdir, dir);
+
+    if (n < 0 || n >= (int)sizeof(path))
+        return -1;
+
+    return cgwrite(l, path, "cgroup.freeze", freeze ? "1\n" : "0\n");
+}
+
+
+static int check_frozen(int fd)
+{
+    char buf[256], *p;
+    int  n;
+
+    if ((n = pread(fd, buf, sizeof(buf) - 1, 0)) < 0)
+        return -1;
+
+    buf[n] = '\0';
+
+    return (p = strstr(buf, "frozen ")) != NULL && p[7] == '1';
+}
+
+
+static void freeze_done(cgfreeze_t *f, int frozen)
+{
+    if (!frozen)
+        iot_log_warning("cgroup %s did not freeze in time.", f->dir);
+
+    signal_procs(f->l, f->dir, f->sig);
+    freeze_cgroup(f->l, f->dir, FALSE);
+
+    iot_list_delete(&f->hook);
+    iot_del_io_watch(f->w);
+    iot_del_timer(f->t);
+
+    if (f->fd >= 0)
+        close(f->fd);
+
+    iot_free(f->dir);
+    iot_free(f);
+}
+
+
+static void events_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                      void *user_data)
+{
+    cgfreeze_t *f = (cgfreeze_t *)user_data;
+    int         frozen;
+
+    IOT_UNUSED(w);
+    IOT_UNUSED(events);
+
+    if ((frozen = check_frozen(fd)) != 0)
+        freeze_done(f, frozen > 0);
+}
+
+
+static void freeze_timeout_cb(iot_timer_t *t, void *user_data)
+{
+    cgfreeze_t *f = (cgfreeze_t *)user_data;
+
+    IOT_UNUSED(t);
+
+    freeze_done(f, check_frozen(f->fd) > 0);
+}
+
+
+static int freeze_signal(launcher_t *l, const char *path, const char *dir,
+                         int sig)
+{
+    cgfreeze_t *f;
+    int         frozen;
+
+    if (freeze_cgroup(l, dir, TRUE) < 0)
+        return -1;
+
+    if ((f = iot_allocz(sizeof(*f))) == NULL)
+        goto fail;
+
+    iot_list_init(&f->hook);
+    f->l   = l;
+    f->sig = sig;
+    f->fd  = cgopen(l, path, "cgroup.events", O_RDONLY);
+
+    if ((f->dir = iot_strdup(dir)) == NULL || f->fd < 0)
+        goto fail;
+
+    iot_list_append(&freezes, &f->hook);
+
+    if ((frozen = check_frozen(f->fd)) != 0) {
+        freeze_done(f, frozen > 0);
+        return 0;
     }
 
+    f->w = iot_add_io_watch(l->ml, f->fd, IOT_IO_EVENT_PRI, events_cb, f);
+    f->t = iot_add_timer(l->ml, FREEZE_TIMEOUT, freeze_timeout_cb, f);
+
+    if (f->w == NULL || f->t == NULL)
+        freeze_done(f, FALSE);
+
     return 0;
 
- failed:
-    if (fd >= 0)
-        close(fd);
+ fail:
+    if (f != NULL) {
+        if (f->fd >= 0)
+            close(f->fd);
+        iot_free(f->dir);
+        iot_free(f);
+    }
+
+    freeze_cgroup(l, dir, FALSE);
+
     return -1;
 }
 
 
+static void freeze_flush(void)
+{
+    cgfreeze_t *f;
+
+    while (!iot_list_empty(&freezes)) {
+        f = iot_list_entry(freezes.next, typeof(*f), hook);
+        freeze_done(f, check_frozen(f->fd) > 0);
+    }
+}
+
+
+int cgroup_signal(launcher_t *l, const char *dir, int sig)
+{
+    char path[PATH_MAX];
+    int  n;
+
+    n = snprintf(path, sizeof(path), "%s/%s", l->cgdir, dir);
+
+    if (n < 0 || n >= (int)sizeof(path))
+        return -1;
+
+    /*
+     * Kill the whole cgroup atomically if the kernel supports it. For
+     * other signals, freeze the cgroup while signalling its processes so
+     * that none can fork under our feet. Otherwise just signal whatever
+     * processes are in the cgroup.
+     *
+     * Notes:
+     *   With freezing, the processes get signalled once the cgroup is
+     *   frozen (or we give up waiting), after we have already returned.
+     */
+
+    if (sig == SIGKILL && cgwrite(l, path, "cgroup.kill", "1\n") == 0)
+        return 0;
+
+    if (l->cgv2 && freeze_signal(l, path, dir, sig) == 0)
+        return 0;
+
+    return signal_procs(l, dir, sig);
+}
+
+
 static int rwmount(const char *path)
 {
     unsigned long  flags = MS_REMOUNT|MS_NOSUID|MS_NODEV|MS_NOEXEC;
@@ -273,6 +544,23 @@ static int cgopen(launcher_t *l, const char *dir, const char *entry, int flags)
 }
 
 
+static int cgwrite(launcher_t *l, const char *dir, const char *entry,
+                   const char *value)
+{
+    int fd, n, len;
+
+    if ((fd = cgopen(l, dir, entry, O_WRONLY)) < 0)
+        return -1;
+
+    len = strlen(value);
+    n   = write(fd, value, len);
+
+    close(fd);
+
+    return n == len ? 0 : -1;
+}
+
+
 static int mount_cgdir(launcher_t *l)
 {
     unsigned long flags = MS_NOSUID|MS_NODEV|MS_NOEXEC|MS_RELATIME;
@@ -290,6 +578,15 @@ static int mount_cgdir(launcher_t *l)
     if (mount("cgroup", l->cgdir, "cgroup", flags, data) < 0)
         goto removedir;
 
+    /*
+     * When we monitor cgroups ourselves, leave notify_on_release off so
+     * that it is not inherited by application cgroups. We'll turn it on
+     * per cgroup only if we fail to monitor one.
+     */
+
+    if (l->cgmonitor)
+        return 0;
+
     if ((fd = cgopen(l, NULL, "notify_on_release", O_WRONLY)) < 0)
         goto removedir;
     n = write(fd, "1\n", 2);
@@ -321,7 +618,7 @@ static int umount_cgdir(launcher_t *l)
 
 char *cgroup_path(char *buf, size_t size, const char *name, pid_t pid)
 {
-    char    cgroup[PATH_MAX], entry[1024], *p, *r;
+    char    cgroup[PATH_MAX], entry[1024], *p, *e, *r;
     FILE   *fp;
     size_t  len;
 
@@ -335,7 +632,28 @@ char *cgroup_path(char *buf, size_t size, const char *name, pid_t pid)
     len = strlen(name);
     r   = NULL;
 
+    /*
+     * Look for our named (v1) hierarchy, or for our directory within the
+     * unified (v2) one. Either way, return the path relative to our own
+     * cgroup directory.
+     */
+
     while (fgets(entry, sizeof(entry), fp) != NULL) {
+        if ((e = strchr(entry, '\n')) != NULL)
+            *e = '\0';
+
+        if (!strncmp(entry, "0::/", 4)) {
+            p = entry + 4;
+
+            if (!strncmp(p, name, len) && p[len] == '/') {
+                if (snprintf(buf, size, "%s", p + len) < (int)size)
+                    r = buf;
+                break;
+            }
+
+            continue;
+        }
+
         p = strstr(entry, ":name=");
 
         if (p == NULL)
@@ -354,3 +672,748 @@ char *cgroup_path(char *buf, size_t size, const char *name, pid_t pid)
 
     return r;
 }
+
+
+/*
+ * per-application resource control and accounting
+ *
+ * Resource controls are only available on a cgroup v2 hierarchy where
+ * we enable the cpu, memory, io and pids controllers (as far as they are
+ * available to us) for application cgroups. Usage is read from the
+ * controller statistics if available, otherwise it is summed up from the
+ * /proc entries of the processes in the cgroup.
+ */
+
+static void enable_controllers(launcher_t *l, const char *dir)
+{
+    static const char *wanted[] = { "cpu", "memory", "io", "pids", NULL };
+    char   buf[256], ctrl[16], *p;
+    int    fd, n, i, len;
+
+    if (!l->cgv2)
+        return;
+
+    if ((fd = cgopen(l, dir, "cgroup.controllers", O_RDONLY)) < 0)
+        return;
+
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if (n <= 0)
+        return;
+
+    buf[n] = '\0';
+
+    for (i = 0; wanted[i] != NULL; i++) {
+        len = strlen(wanted[i]);
+
+        for (p = strstr(buf, wanted[i]); p != NULL; p = strstr(p + 1, wanted[i]))
+            if ((p == buf || p[-1] == ' ') &&
+                (p[len] == ' ' || p[len] == '\n' || p[len] == '\0'))
+                break;
+
+        if (p == NULL)
+            continue;
+
+        snprintf(ctrl, sizeof(ctrl), "+%s\n", wanted[i]);
+
+        if (cgwrite(l, dir, "cgroup.subtree_control", ctrl) < 0)
+            iot_log_warning("Failed to enable %s controller for %s.",
+                            wanted[i], dir);
+    }
+}
+
+
+static int set_limit(launcher_t *l, const char *path, const char *entry,
+                     const char *fmt, ...)
+{
+    va_list ap;
+    char    value[64];
+
+    va_start(ap, fmt);
+    vsnprintf(value, sizeof(value), fmt, ap);
+    va_end(ap);
+
+    if (cgwrite(l, path, entry, value) == 0)
+        return 0;
+
+    if (errno != ENOENT)
+        return -1;
+
+    iot_log_warning("Controller for %s not available, can't set it to %s",
+                    entry, value);
+
+    return 0;
+}
+
+
+int cgroup_set_limits(launcher_t *l, const char *dir,
+                      iot_manifest_resources_t *r)
+{
+    char path[PATH_MAX];
+    int  n;
+
+    if (!l->cgv2) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    n = snprintf(path, sizeof(path), "%s/%s", l->cgdir, dir);
+
+    if (n < 0 || n >= (int)sizeof(path))
+        return -1;
+
+    if (r->cpu_weight &&
+        set_limit(l, path, "cpu.weight", "%d", r->cpu_weight) < 0)
+        return -1;
+
+    if (r->cpu_quota &&
+        set_limit(l, path, "cpu.max", "%d 100000", r->cpu_quota * 1000) < 0)
+        return -1;
+
+    if (r->memory_high &&
+        set_limit(l, path, "memory.high", "%lld",
+                  (long long)r->memory_high) < 0)
+        return -1;
+
+    if (r->memory_max &&
+        set_limit(l, path, "memory.max", "%lld",
+                  (long long)r->memory_max) < 0)
+        return -1;
+
+    if (r->io_weight &&
+        set_limit(l, path, "io.weight", "default %d", r->io_weight) < 0)
+        return -1;
+
+    if (r->pids_max &&
+        set_limit(l, path, "pids.max", "%d", r->pids_max) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static FILE *cgfopen(launcher_t *l, const char *path, const char *entry)
+{
+    FILE *fp;
+    int   fd;
+
+    if ((fd = cgopen(l, path, entry, O_RDONLY)) < 0)
+        return NULL;
+
+    if ((fp = fdopen(fd, "r")) == NULL)
+        close(fd);
+
+    return fp;
+}
+
+
+static int read_keyed(launcher_t *l, const char *path, const char *entry,
+                      const char **keys, uint64_t *values)
+{
+    char      line[256], *v;
+    FILE     *fp;
+    int       i, len;
+
+    if ((fp = cgfopen(l, path, entry)) == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        for (i = 0; keys[i] != NULL; i++) {
+            len = strlen(keys[i]);
+
+            if (!strncmp(line, keys[i], len) && line[len] == ' ') {
+                v = line + len + 1;
+                values[i] += strtoull(v, NULL, 10);
+            }
+        }
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+
+static int read_io_stat(launcher_t *l, const char *path, cgroup_usage_t *u)
+{
+    char  line[512], *p;
+    FILE *fp;
+
+    if ((fp = cgfopen(l, path, "io.stat")) == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if ((p = strstr(line, " rbytes=")) != NULL)
+            u->io_rbytes += strtoull(p + 8, NULL, 10);
+        if ((p = strstr(line, " wbytes=")) != NULL)
+            u->io_wbytes += strtoull(p + 8, NULL, 10);
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+
+static void read_proc_usage(pid_t pid, cgroup_usage_t *u, int cpu, int rss,
+                            int io)
+{
+    static long  hz, pgsize;
+    char         path[64], line[1024], *p;
+    unsigned long long utime, stime, pages;
+    FILE        *fp;
+
+    if (!hz) {
+        hz     = sysconf(_SC_CLK_TCK);
+        pgsize = sysconf(_SC_PAGESIZE);
+    }
+
+    if (cpu) {
+        snprintf(path, sizeof(path), "/proc/%u/stat", pid);
+
+        if ((fp = fopen(path, "r")) != NULL) {
+            /* skip over pid and (comm), which may contain spaces */
+            if (fgets(line, sizeof(line), fp) != NULL &&
+                (p = strrchr(line, ')')) != NULL &&
+                sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                       "%llu %llu", &utime, &stime) == 2)
+                u->cpu_usec += (utime + stime) * 1000000 / hz;
+
+            fclose(fp);
+        }
+    }
+
+    if (rss) {
+        snprintf(path, sizeof(path), "/proc/%u/statm", pid);
+
+        if ((fp = fopen(path, "r")) != NULL) {
+            if (fscanf(fp, "%*u %llu", &pages) == 1)
+                u->rss += pages * pgsize;
+
+            fclose(fp);
+        }
+    }
+
+    if (io) {
+        snprintf(path, sizeof(path), "/proc/%u/io", pid);
+
+        if ((fp = fopen(path, "r")) != NULL) {
+            while (fgets(line, sizeof(line), fp) != NULL) {
+                if (!strncmp(line, "read_bytes: ", 12))
+                    u->io_rbytes += strtoull(line + 12, NULL, 10);
+                else if (!strncmp(line, "write_bytes: ", 13))
+                    u->io_wbytes += strtoull(line + 13, NULL, 10);
+            }
+
+            fclose(fp);
+        }
+    }
+}
+
+
+int cgroup_usage(launcher_t *l, const char *dir, cgroup_usage_t *u)
+{
+    static const char *cpu_keys[] = { "usage_usec", NULL };
+    static const char *mem_keys[] = { "anon", "file_mapped", NULL };
+    char      path[PATH_MAX], line[64], *e;
+    uint64_t  mem[2];
+    int       cpu, rss, io, n;
+    pid_t     pid;
+    FILE     *fp;
+
+    iot_clear(u);
+
+    n = snprintf(path, sizeof(path), "%s/%s", l->cgdir, dir);
+
+    if (n < 0 || n >= (int)sizeof(path))
+        return -1;
+
+    mem[0] = mem[1] = 0;
+
+    cpu = read_keyed(l, path, "cpu.stat", cpu_keys, &u->cpu_usec) < 0;
+    rss = read_keyed(l, path, "memory.stat", mem_keys, mem) < 0;
+    io  = read_io_stat(l, path, u) < 0;
+
+    u->rss = mem[0] + mem[1];
+
+    if (!cpu && !rss && !io)
+        return 0;
+
+    if ((fp = cgfopen(l, path, "cgroup.procs")) == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        pid = (pid_t)strtoul(line, &e, 10);
+
+        if (e != line && pid > 0)
+            read_proc_usage(pid, u, cpu, rss, io);
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+
+/*
+ * in-daemon cgroup emptiness monitoring
+ *
+ * Instead of having the kernel exec our release agent for every emptied
+ * cgroup, which then connects back to us to request a cleanup, we can
+ * watch application cgroups for emptiness ourselves. Cgroups with a
+ * cgroup.events file (cgroup v2) are watched for 'populated 0' using
+ * inotify. For other cgroups we keep a pidfd open for every process in
+ * the cgroup and rescan cgroup.procs whenever one of them exits. If we
+ * fail to monitor a cgroup we turn on notify_on_release for it and let
+ * the release agent take care of it.
+ */
+
+typedef struct {
+    pid_t             pid;               /* tracked process */
+    int               fd;                /* pidfd for process */
+    iot_io_watch_t   *w;                 /* I/O watch for pidfd */
+    int               seen;              /* seen during last scan */
+} cgproc_t;
+
+struct cgroup_watch_s {
+    launcher_t       *l;                 /* launcher context */
+    char             *dir;               /* watched cgroup (relative) */
+    cgroup_empty_cb_t cb;                /* notification callback */
+    void             *user_data;         /* opaque callback data */
+    int               wd;                /* inotify watch, or -1 */
+    cgproc_t         *procs;             /* tracked processes */
+    int               nproc;             /* number of tracked processes */
+    iot_list_hook_t   hook;              /* to pending notifications */
+};
+
+static int             ifd = -1;         /* inotify fd */
+static iot_io_watch_t *iw;               /* I/O watch for inotify fd */
+static iot_hashtbl_t  *wds;              /* cgroup watches by inotify wd */
+static iot_deferred_t *pending;          /* pending notification dispatcher */
+static IOT_LIST_HOOK(emptied);           /* emptied cgroup watches */
+
+
+static int pidfd_open(pid_t pid)
+{
+#ifdef __NR_pidfd_open
+    return syscall(__NR_pidfd_open, pid, 0);
+#else
+    IOT_UNUSED(pid);
+
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+static void notify_cb(iot_deferred_t *d, void *user_data)
+{
+    cgroup_watch_t *w;
+
+    IOT_UNUSED(user_data);
+
+    while (!iot_list_empty(&emptied)) {
+        w = iot_list_entry(emptied.next, typeof(*w), hook);
+        iot_list_delete(&w->hook);
+
+        iot_debug("cgroup %s is empty", w->dir);
+
+        w->cb(w->l, w->dir, w->user_data);
+    }
+
+    iot_disable_deferred(d);
+}
+
+
+static void proc_del(cgroup_watch_t *w, int i)
+{
+    cgproc_t *p = w->procs + i;
+
+    iot_del_io_watch(p->w);
+    close(p->fd);
+
+    if (i < w->nproc - 1)
+        *p = w->procs[w->nproc - 1];
+
+    w->nproc--;
+}
+
+
+static void watch_stop(cgroup_watch_t *w)
+{
+    while (w->nproc > 0)
+        proc_del(w, w->nproc - 1);
+
+    if (w->wd >= 0) {
+        iot_hashtbl_remove(wds, (void *)(ptrdiff_t)w->wd, IOT_HASH_COOKIE_NONE);
+        inotify_rm_watch(ifd, w->wd);
+        w->wd = -1;
+    }
+}
+
+
+static void watch_empty(cgroup_watch_t *w)
+{
+    watch_stop(w);
+
+    iot_list_delete(&w->hook);
+    iot_list_append(&emptied, &w->hook);
+    iot_enable_deferred(pending);
+}
+
+
+static int scan_procs(cgroup_watch_t *w);
+
+static void proc_cb(iot_io_watch_t *iow, int fd, iot_io_event_t events,
+                    void *user_data)
+{
+    cgroup_watch_t *w = (cgroup_watch_t *)user_data;
+    int             i;
+
+    IOT_UNUSED(iow);
+    IOT_UNUSED(events);
+
+    for (i = 0; i < w->nproc; i++) {
+        if (w->procs[i].fd == fd) {
+            proc_del(w, i);
+            break;
+        }
+    }
+
+    if (scan_procs(w) == 0)
+        watch_empty(w);
+}
+
+
+static int proc_add(cgroup_watch_t *w, pid_t pid)
+{
+    struct pollfd  pfd;
+    cgproc_t      *p;
+    int            fd;
+
+    if ((fd = pidfd_open(pid)) < 0)
+        return errno == ESRCH ? 0 : -1;
+
+    /* a process that has already exited is not a member any more */
+    pfd.fd      = fd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, 0) > 0) {
+        close(fd);
+        return 0;
+    }
+
+    if (iot_reallocz(w->procs, w->nproc, w->nproc + 1) == NULL)
+        goto fail;
+
+    p = w->procs + w->nproc;
+    p->pid  = pid;
+    p->fd   = fd;
+    p->seen = TRUE;
+    p->w    = iot_add_io_watch(w->l->ml, fd, IOT_IO_EVENT_IN, proc_cb, w);
+
+    if (p->w == NULL)
+        goto fail;
+
+    w->nproc++;
+
+    return 1;
+
+ fail:
+    close(fd);
+    return -1;
+}
+
+
+static int scan_procs(cgroup_watch_t *w)
+{
+    char   buf[4096], *e;
+    pid_t  pid;
+    int    fd, n, i, found;
+    FILE  *fp;
+
+    n = snprintf(buf, sizeof(buf), "%s/%s", w->l->cgdir, w->dir);
+
+    if (n < 0 || n >= (int)sizeof(buf))
+        return -1;
+
+    if ((fd = cgopen(w->l, buf, "cgroup.procs", O_RDONLY)) < 0)
+        return -1;
+
+    if ((fp = fdopen(fd, "r")) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    for (i = 0; i < w->nproc; i++)
+        w->procs[i].seen = FALSE;
+
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        pid = (pid_t)strtoul(buf, &e, 10);
+
+        if (e == buf || pid <= 0)
+            continue;
+
+        for (i = 0, found = FALSE; i < w->nproc && !found; i++) {
+            if (w->procs[i].pid == pid)
+                found = w->procs[i].seen = TRUE;
+        }
+
+        if (!found && proc_add(w, pid) < 0) {
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+
+    /* forget processes that have been moved out of the cgroup */
+    for (i = w->nproc - 1; i >= 0; i--)
+        if (!w->procs[i].seen)
+            proc_del(w, i);
+
+    return w->nproc;
+}
+
+
+static int check_populated(cgroup_watch_t *w)
+{
+    char  path[PATH_MAX], line[64];
+    FILE *fp;
+    int   n, populated;
+
+    n = snprintf(path, sizeof(path), "%s/%s/cgroup.events", w->l->cgdir, w->dir);
+
+    if (n < 0 || n >= (int)sizeof(path))
+        return -1;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+
+    populated = -1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (!strncmp(line, "populated ", 10)) {
+            populated = (int)strtol(line + 10, NULL, 10);
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    return populated;
+}
+
+
+static void inotify_cb(iot_io_watch_t *iow, int fd, iot_io_event_t events,
+                       void *user_data)
+{
+    char                  buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *e;
+    cgroup_watch_t       *w;
+    ssize_t               n;
+    char                 *p;
+
+    IOT_UNUSED(iow);
+    IOT_UNUSED(events);
+    IOT_UNUSED(user_data);
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + n; p += sizeof(*e) + e->len) {
+            e = (struct inotify_event *)p;
+            w = iot_hashtbl_lookup(wds, (void *)(ptrdiff_t)e->wd,
+                                   IOT_HASH_COOKIE_NONE);
+
+            if (w == NULL || w->wd < 0)
+                continue;
+
+            if (check_populated(w) == 0)
+                watch_empty(w);
+        }
+    }
+}
+
+
+static int monitor_init(launcher_t *l)
+{
+    iot_hashtbl_config_t cfg;
+
+    if (pending != NULL)
+        return 0;
+
+    iot_clear(&cfg);
+    cfg.hash    = iot_hash_direct;
+    cfg.comp    = iot_comp_direct;
+    cfg.nbucket = 64;
+
+    if ((wds = iot_hashtbl_create(&cfg)) == NULL)
+        return -1;
+
+    if ((pending = iot_add_deferred(l->ml, notify_cb, NULL)) == NULL)
+        return -1;
+
+    iot_disable_deferred(pending);
+
+    return 0;
+}
+
+
+static int watch_events(cgroup_watch_t *w)
+{
+    char path[PATH_MAX];
+    int  n;
+
+    n = snprintf(path, sizeof(path), "%s/%s/cgroup.events", w->l->cgdir, w->dir);
+
+    if (n < 0 || n >= (int)sizeof(path))
+        return -1;
+
+    if (access(path, R_OK) < 0)
+        return 0;
+
+    if (ifd < 0) {
+        ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+        if (ifd < 0)
+            return -1;
+
+        iw = iot_add_io_watch(w->l->ml, ifd, IOT_IO_EVENT_IN, inotify_cb, NULL);
+
+        if (iw == NULL) {
+            close(ifd);
+            ifd = -1;
+            return -1;
+        }
+    }
+
+    w->wd = inotify_add_watch(ifd, path, IN_MODIFY);
+
+    if (w->wd < 0)
+        return -1;
+
+    if (iot_hashtbl_add(wds, (void *)(ptrdiff_t)w->wd, w, NULL) < 0) {
+        inotify_rm_watch(ifd, w->wd);
+        w->wd = -1;
+        return -1;
+    }
+
+    return 1;
+}
+
+
+static void release_on_empty(launcher_t *l, const char *dir)
+{
+    char path[PATH_MAX];
+    int  n;
+
+    if (l->cgv2) {
+        iot_log_error("No release agent to fall back to for cgroup %s.", dir);
+        return;
+    }
+
+    n = snprintf(path, sizeof(path), "%s/%s", l->cgdir, dir);
+
+    if (n < 0 || n >= (int)sizeof(path))
+        return;
+
+    if (cgwrite(l, path, "notify_on_release", "1\n") < 0)
+        iot_log_error("Failed to enable release agent for cgroup %s.", dir);
+}
+
+
+cgroup_watch_t *cgroup_watch(launcher_t *l, const char *dir,
+                             cgroup_empty_cb_t cb, void *user_data)
+{
+    cgroup_watch_t *w;
+    int             r;
+
+    if (monitor_init(l) < 0)
+        goto fallback;
+
+    w = iot_allocz(sizeof(*w));
+
+    if (w == NULL)
+        goto fallback;
+
+    iot_list_init(&w->hook);
+    w->l         = l;
+    w->cb        = cb;
+    w->user_data = user_data;
+    w->wd        = -1;
+    w->dir       = iot_strdup(dir);
+
+    if (w->dir == NULL)
+        goto fail;
+
+    if ((r = watch_events(w)) < 0)
+        goto fail;
+
+    if (r > 0)
+        r = check_populated(w);
+    else
+        r = scan_procs(w);
+
+    if (r < 0)
+        goto fail;
+
+    if (r == 0)
+        watch_empty(w);
+
+    return w;
+
+ fail:
+    cgroup_unwatch(w);
+ fallback:
+    iot_log_warning("Failed to monitor cgroup %s, falling back to agent.", dir);
+    release_on_empty(l, dir);
+    return NULL;
+}
+
+
+void cgroup_unwatch(cgroup_watch_t *w)
+{
+    if (w == NULL)
+        return;
+
+    watch_stop(w);
+    iot_list_delete(&w->hook);
+
+    iot_free(w->procs);
+    iot_free(w->dir);
+    iot_free(w);
+}
+
+
+static void release_cb(launcher_t *l, const char *dir, void *user_data)
+{
+    cgroup_watch_t *w = (cgroup_watch_t *)user_data;
+
+    if (cgroup_rmdir(l, dir) < 0)
+        iot_log_error("Failed to remove cgroup %s (%d: %s).", dir,
+                      errno, strerror(errno));
+
+    cgroup_unwatch(w);
+}
+
+
+int cgroup_release(launcher_t *l, const char *dir)
+{
+    cgroup_watch_t *w;
+
+    /*
+     * Notes:
+     *   Used for cgroups created for an application we ended up failing
+     *   to set up. We can't remove the cgroup right away, since the
+     *   process is already in it, so remove it once the process is gone.
+     */
+
+    if ((w = cgroup_watch(l, dir, release_cb, NULL)) == NULL)
+        return -1;
+
+    w->user_data = w;
+
+    return 0;
+}
@@ -30,6 +30,9 @@
 #ifndef __IOT_LAUNCHER_CGROUP_H__
 #define __IOT_LAUNCHER_CGROUP_H__
 
+#include <stdint.h>
+#include <limits.h>
+
 #include "launcher.h"
 
 #define CGROUP_ROOT "/sys/fs/cgroup"
@@ -44,6 +47,49 @@ int cgroup_mkdir(launcher_t *l, uid_t uid, const char *base, pid_t pid,
 int cgroup_rmdir(launcher_t *l, const char *dir);
 int cgroup_signal(launcher_t *l, const char *dir, int sig);
 
+/*
+ * batched application cgroup creation
+ */
+
+typedef struct {
+    const char *base;                    /* cgroup name prefix */
+    pid_t       pid;                     /* process to move in, name suffix */
+    char        dir[PATH_MAX];           /* created cgroup, relative */
+    int         error;                   /* errno on failure, or 0 */
+} cgroup_mkdir_t;
+
+int cgroup_mkdir_bulk(launcher_t *l, uid_t uid, cgroup_mkdir_t *items, int n);
+
 char *cgroup_path(char *buf, size_t size, const char *name, pid_t pid);
 
+/*
+ * per-application resource control and accounting
+ */
+
+typedef struct {
+    uint64_t cpu_usec;                   /* CPU time used */
+    uint64_t rss;                        /* resident memory in bytes */
+    uint64_t io_rbytes;                  /* bytes read from storage */
+    uint64_t io_wbytes;                  /* bytes written to storage */
+} cgroup_usage_t;
+
+int cgroup_set_limits(launcher_t *l, const char *dir,
+                      iot_manifest_resources_t *r);
+int cgroup_usage(launcher_t *l, const char *dir, cgroup_usage_t *u);
+
+/*
+ * in-daemon cgroup emptiness monitoring
+ */
+
+typedef struct cgroup_watch_s cgroup_watch_t;
+
+typedef void (*cgroup_empty_cb_t)(launcher_t *l, const char *dir,
+                                  void *user_data);
+
+cgroup_watch_t *cgroup_watch(launcher_t *l, const char *dir,
+                             cgroup_empty_cb_t cb, void *user_data);
+void cgroup_unwatch(cgroup_watch_t *w);
+
+int cgroup_release(launcher_t *l, const char *dir);
+
 #endif /* __IOT_LAUNCHER_CGROUP_H__ */
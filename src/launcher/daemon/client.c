@@ -29,6 +29,7 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #define __USE_GNU
@@ -44,20 +45,142 @@
 #include "launcher/daemon/cgroup.h"
 #include "launcher/daemon/event.h"
 #include "launcher/daemon/client.h"
+#include "launcher/daemon/keyset.h"
+#include "launcher/daemon/transport.h"
+
+
+/*
+ * an event subscription of a client
+ */
+
+typedef struct {
+    iot_list_hook_t  hook;               /* to client subscriptions */
+    client_ref_t     ref;                /* event index reference */
+} subscription_t;
 
 
 static int get_credentials(client_t *c);
 
 
+int client_init(launcher_t *l)
+{
+    iot_hashtbl_config_t cfg;
+
+    iot_clear(&cfg);
+    cfg.hash    = iot_hash_direct;
+    cfg.comp    = iot_comp_direct;
+    cfg.nbucket = 64;
+
+    l->pids = iot_hashtbl_create(&cfg);
+    l->uids = iot_hashtbl_create(&cfg);
+
+    cfg.hash    = iot_hash_string;
+    cfg.comp    = iot_comp_string;
+
+    l->labels = iot_hashtbl_create(&cfg);
+
+    if (l->pids == NULL || l->uids == NULL || l->labels == NULL)
+        return -1;
+
+    l->events = iot_allocz_array(client_set_t *, l->max_events);
+
+    if (l->events == NULL)
+        return -1;
+
+    return 0;
+}
+
+
+int client_register(client_t *c)
+{
+    launcher_t *l   = c->l;
+    const void *pid = (void *)(ptrdiff_t)c->id.pid;
+    const void *uid = (void *)(ptrdiff_t)c->id.uid;
+
+    if (key_ref_link(&c->by_pid, c, key_set_get(l->pids, pid, NULL)) < 0)
+        goto fail;
+
+    if (key_ref_link(&c->by_uid, c, key_set_get(l->uids, uid, NULL)) < 0)
+        goto fail;
+
+    if (c->id.label != NULL) {
+        if (key_ref_link(&c->by_label, c,
+                     key_set_get(l->labels, c->id.label, c->id.label)) < 0)
+            goto fail;
+    }
+
+    iot_list_append(&l->clients, &c->hook);
+
+    return 0;
+
+ fail:
+    client_unregister(c);
+    return -1;
+}
+
+
+void client_unregister(client_t *c)
+{
+    iot_list_hook_t *p, *n;
+    subscription_t  *s;
+
+    iot_list_delete(&c->hook);
+
+    key_ref_unlink(&c->by_pid);
+    key_ref_unlink(&c->by_uid);
+    key_ref_unlink(&c->by_label);
+
+    iot_list_foreach(&c->subscriptions, p, n) {
+        s = iot_list_entry(p, typeof(*s), hook);
+
+        iot_list_delete(&s->hook);
+        key_ref_unlink(&s->ref);
+        iot_free(s);
+    }
+}
+
+
+client_set_t *client_pid_set(launcher_t *l, pid_t pid)
+{
+    return iot_hashtbl_lookup(l->pids, (void *)(ptrdiff_t)pid,
+                              IOT_HASH_COOKIE_NONE);
+}
+
+
+client_set_t *client_uid_set(launcher_t *l, uid_t uid)
+{
+    return iot_hashtbl_lookup(l->uids, (void *)(ptrdiff_t)uid,
+                              IOT_HASH_COOKIE_NONE);
+}
+
+
+client_set_t *client_label_set(launcher_t *l, const char *label)
+{
+    return iot_hashtbl_lookup(l->labels, label, IOT_HASH_COOKIE_NONE);
+}
+
+
+client_set_t *client_event_set(launcher_t *l, int id)
+{
+    if (id < 0 || id >= l->max_events)
+        return NULL;
+
+    return l->events[id];
+}
+
+
 client_t *client_create(launcher_t *l, iot_transport_t *t)
 {
     client_t *c     = iot_allocz(sizeof(*c));
-    int       flags = IOT_TRANSPORT_REUSEADDR | IOT_TRANSPORT_CLOEXEC;
+    int       flags = IOT_TRANSPORT_REUSEADDR | IOT_TRANSPORT_CLOEXEC |
+        IOT_TRANSPORT_NONBLOCK | IOT_TRANSPORT_BATCH;
 
     if (c == NULL)
         goto reject;
 
     iot_list_init(&c->hook);
+    iot_list_init(&c->subscriptions);
+    iot_list_init(&c->pending);
     c->l = l;
     c->t = iot_transport_accept(t, c, flags);
 
@@ -70,7 +193,9 @@ client_t *client_create(launcher_t *l, iot_transport_t *t)
         goto fail;
 
     iot_mask_init(&c->mask);
-    iot_list_append(&l->clients, &c->hook);
+
+    if (client_register(c) < 0)
+        goto fail;
 
     return c;
 
@@ -94,7 +219,8 @@ void client_destroy(client_t *c)
     if (c == NULL)
         return;
 
-    iot_list_delete(&c->hook);
+    client_unregister(c);
+    transport_orphan(c);
 
     iot_transport_disconnect(c->t);
     iot_transport_destroy(c->t);
@@ -106,6 +232,42 @@ void client_destroy(client_t *c)
 }
 
 
+static int subscribe_event(client_t *c, int id)
+{
+    launcher_t     *l = c->l;
+    subscription_t *s;
+
+    if (id < 0 || id >= l->max_events)
+        return -1;
+
+    if (iot_mask_test(&c->mask, id))
+        return 0;
+
+    if (l->events[id] == NULL) {
+        l->events[id] = key_set_get(NULL, (void *)(ptrdiff_t)id, NULL);
+
+        if (l->events[id] == NULL)
+            return -1;
+    }
+
+    s = iot_allocz(sizeof(*s));
+
+    if (s == NULL)
+        return -1;
+
+    if (!iot_mask_set(&c->mask, id)) {
+        iot_free(s);
+        return -1;
+    }
+
+    iot_list_init(&s->hook);
+    key_ref_link(&s->ref, c, l->events[id]);
+    iot_list_append(&c->subscriptions, &s->hook);
+
+    return 0;
+}
+
+
 iot_json_t *client_subscribe(client_t *c, iot_json_t *req)
 {
     iot_json_t *events;
@@ -120,7 +282,7 @@ iot_json_t *client_subscribe(client_t *c, iot_json_t *req)
         if (!iot_json_array_get_string(events, i, &e))
             return msg_status_error(EINVAL, "failed to get list of events");
 
-        if (!iot_mask_set(&c->mask, event_register(e)))
+        if (subscribe_event(c, event_register(e)) < 0)
             return msg_status_error(EINVAL, "failed to subscribe for '%s'", e);
     }
 
@@ -36,9 +36,19 @@
 
 #include "launcher/daemon/launcher.h"
 
+int client_init(launcher_t *l);
+
 client_t *client_create(launcher_t *l, iot_transport_t *t);
 void client_destroy(client_t *c);
 
+int client_register(client_t *c);
+void client_unregister(client_t *c);
+
+client_set_t *client_pid_set(launcher_t *l, pid_t pid);
+client_set_t *client_uid_set(launcher_t *l, uid_t uid);
+client_set_t *client_label_set(launcher_t *l, const char *label);
+client_set_t *client_event_set(launcher_t *l, int id);
+
 iot_json_t *client_subscribe(client_t *c, iot_json_t *req);
 
 #endif /* __IOT_LAUNCHER_CLIENT_H__ */
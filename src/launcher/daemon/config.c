@@ -90,6 +90,7 @@ static void print_usage(launcher_t *l, const char *argv0, int exit_code,
            "  -L  --launcher=<addr>          launcher socket address\n"
            "  -A  --appfw=<addr>             IoT app client socket address\n"
            "  -a  --agent=<path>             cgroup notification agent\n"
+           "  -M, --monitor-cgroups          monitor cgroups without the agent\n"
            "  -t, --log-target=<target>      log target to use\n"
            "      TARGET is one of stderr,stdout,syslog, or a logfile path\n"
            "  -l, --log-level=<levels>       logging level to use\n"
@@ -97,6 +98,9 @@ static void print_usage(launcher_t *l, const char *argv0, int exit_code,
            "  -v, --verbose                  increase logging verbosity\n"
            "  -d, --debug                    enable given debug configuration\n"
            "  -f, --foreground               don't daemonize\n"
+           "  -E, --max-events=<n>           max. number of events to register\n"
+           "  -w, --workers=<n>              number of request worker threads\n"
+           "      0 handles all requests synchronously in the mainloop\n"
            "  -h, --help                     show help on usage\n"
            "  -V, --valgrind                 run through valgrind\n"
 #ifdef SYSTEMD_ENABLED
@@ -147,6 +151,8 @@ static void config_set_defaults(launcher_t *l, char *argv0)
     l->app_fd     = -1;
     l->log_mask   = IOT_LOG_UPTO(IOT_LOG_WARNING);
     l->log_target = IOT_LOG_TO_STDERR;
+    l->max_events = MAX_EVENTS;
+    l->nworker    = NWORKER;
 
     iot_log_set_mask(l->log_mask);
     iot_log_set_target(l->log_target);
@@ -254,16 +260,19 @@ static void parse_cmdline(launcher_t *l, int argc, char **argv, char **envp)
 {
 #define MAX_ARGS 256
 
-#define OPTIONS "L:A:a:l:t:vd:fhVS:D:"
+#define OPTIONS "L:A:a:Ml:t:vd:fE:w:hVS:D:"
     struct option options[] = {
         { "launcher"         , required_argument, NULL, 'L' },
         { "appfw"            , required_argument, NULL, 'A' },
         { "agent"            , required_argument, NULL, 'a' },
+        { "monitor-cgroups"  , no_argument      , NULL, 'M' },
         { "log-level"        , required_argument, NULL, 'l' },
         { "log-target"       , required_argument, NULL, 't' },
         { "verbose"          , optional_argument, NULL, 'v' },
         { "debug"            , required_argument, NULL, 'd' },
         { "foreground"       , no_argument      , NULL, 'f' },
+        { "max-events"       , required_argument, NULL, 'E' },
+        { "workers"          , required_argument, NULL, 'w' },
         { "help"             , no_argument      , NULL, 'h' },
         { "valgrind"         , optional_argument, NULL, 'V' },
         { "sockets"          , required_argument, NULL, 'S' },
@@ -283,7 +292,8 @@ static void parse_cmdline(launcher_t *l, int argc, char **argv, char **envp)
     char *saved_argv[MAX_ARGS];
     int   saved_argc;
 
-    int opt, help, delay;
+    int   opt, help, delay;
+    char *end;
 
     help = FALSE;
     saved_argc = 0;
@@ -308,6 +318,11 @@ static void parse_cmdline(launcher_t *l, int argc, char **argv, char **envp)
             l->cgagent = optarg;
             break;
 
+        case 'M':
+            SAVE_OPT("-M");
+            l->cgmonitor = TRUE;
+            break;
+
         case 'v':
             SAVE_OPT("-v");
             l->log_mask <<= 1;
@@ -343,6 +358,22 @@ static void parse_cmdline(launcher_t *l, int argc, char **argv, char **envp)
             l->foreground = TRUE;
             break;
 
+        case 'E':
+            SAVE_OPTARG("-E", optarg);
+            l->max_events = (int)strtol(optarg, &end, 10);
+            if (*end || l->max_events <= 0)
+                print_usage(l, argv[0], EINVAL,
+                            "invalid max. number of events '%s'", optarg);
+            break;
+
+        case 'w':
+            SAVE_OPTARG("-w", optarg);
+            l->nworker = (int)strtol(optarg, &end, 10);
+            if (*end || l->nworker < 0)
+                print_usage(l, argv[0], EINVAL,
+                            "invalid number of workers '%s'", optarg);
+            break;
+
         case 'h':
             SAVE_OPT("-h");
             help = TRUE;
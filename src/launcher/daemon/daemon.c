@@ -56,7 +56,10 @@
 #include "launcher/daemon/transport.h"
 #include "launcher/daemon/application.h"
 #include "launcher/daemon/cgroup.h"
+#include "launcher/daemon/client.h"
+#include "launcher/daemon/event.h"
 #include "launcher/daemon/privilege.h"
+#include "launcher/daemon/worker.h"
 
 
 static void launcher_init(launcher_t *l)
@@ -69,6 +72,29 @@ static void launcher_init(launcher_t *l)
 }
 
 
+static void registry_init(launcher_t *l)
+{
+    if (event_init(l) < 0) {
+        iot_log_error("Failed to create event registry.");
+        exit(1);
+    }
+
+    if (client_init(l) < 0) {
+        iot_log_error("Failed to create client indexes.");
+        exit(1);
+    }
+}
+
+
+static void start_workers(launcher_t *l)
+{
+    if (worker_init(l) < 0) {
+        iot_log_error("Failed to create request worker threads.");
+        exit(1);
+    }
+}
+
+
 static void daemonize(launcher_t *l)
 {
     if (l->foreground)
@@ -87,14 +113,17 @@ int main(int argc, char *argv[], char **envp)
     launcher_init(&l);
     signal_init(&l);
     config_parse(&l, argc, argv, envp);
+    registry_init(&l);
     application_init(&l);
     transport_init(&l);
     cgroup_init(&l);
     privilege_init(&l);
     daemonize(&l);
+    start_workers(&l);
 
     iot_mainloop_run(l.ml);
 
+    worker_exit(&l);
     privilege_exit(&l);
     cgroup_exit(&l);
 
@@ -30,6 +30,7 @@
 #include <iot/common/macros.h>
 #include <iot/common/log.h>
 #include <iot/common/list.h>
+#include <iot/common/hash-table.h>
 #include <iot/common/transport.h>
 #include <iot/common/mask.h>
 
@@ -37,45 +38,103 @@
 #include "launcher/daemon/msg.h"
 #include "launcher/daemon/transport.h"
 #include "launcher/daemon/privilege.h"
+#include "launcher/daemon/client.h"
 #include "launcher/daemon/event.h"
 
 
 /*
  * a registered event
+ *
+ * Events are interned: each name is registered once, hashed by name for
+ * resolving subscriptions and routing requests, and stored in a dense table
+ * indexed by its id for reverse lookups. Ids are never reused.
  */
 
 typedef struct {
-    iot_list_hook_t  hook;               /* to list of known events */
     char            *name;               /* public event name */
     int              id;                 /* internal event id */
 } event_t;
 
-static IOT_LIST_HOOK(events);            /* registered events */
-static int           nevent;             /* number of registered events */
+static iot_hashtbl_t *names;             /* registered events by name */
+static event_t      **events;            /* registered events by id */
+static int            nevent;            /* number of registered events */
+static int            nalloc;            /* allocated size of events */
+static int            nmax = MAX_EVENTS; /* max. number of events */
 
 
-int event_id(const char *name, int register_missing)
+int event_init(launcher_t *l)
+{
+    iot_hashtbl_config_t cfg;
+
+    if (l->max_events <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    nmax = l->max_events;
+
+    iot_clear(&cfg);
+    cfg.hash    = iot_hash_string;
+    cfg.comp    = iot_comp_string;
+    cfg.nbucket = nmax < 256 ? nmax : 256;
+
+    names = iot_hashtbl_create(&cfg);
+
+    if (names == NULL)
+        return -1;
+
+    return 0;
+}
+
+
+static int event_grow(void)
 {
-    iot_list_hook_t *p, *n;
-    event_t         *e;
+    int n;
 
-    iot_list_foreach(&events, p, n) {
-        e = iot_list_entry(p, typeof(*e), hook);
+    if (nevent < nalloc)
+        return 0;
 
-        if (!strcmp(e->name, name))
-            return e->id;
+    n = nalloc ? 2 * nalloc : 32;
+
+    if (n > nmax)
+        n = nmax;
+
+    if (iot_realloc(events, n * sizeof(events[0])) == NULL)
+        return -1;
+
+    nalloc = n;
+
+    return 0;
+}
+
+
+int event_id(const char *name, int register_missing)
+{
+    event_t *e;
+
+    if (names == NULL) {
+        errno = ENOENT;
+        return -1;
     }
 
+    e = iot_hashtbl_lookup(names, name, IOT_HASH_COOKIE_NONE);
+
+    if (e != NULL)
+        return e->id;
+
     if (!register_missing) {
         errno = ENOENT;
         return -1;
     }
 
-    if (nevent >= MAX_EVENTS) {
+    if (nevent >= nmax) {
         errno = ENOSPC;
         return -1;
     }
 
+    if (event_grow() < 0)
+        return -1;
+
     e = iot_allocz(sizeof(*e));
 
     if (e == NULL)
@@ -88,10 +147,14 @@ int event_id(const char *name, int register_missing)
         return -1;
     }
 
-    iot_list_init(&e->hook);
-    e->id = nevent++;
+    if (iot_hashtbl_add(names, e->name, e, NULL) < 0) {
+        iot_free(e->name);
+        iot_free(e);
+        return -1;
+    }
 
-    iot_list_append(&events, &e->hook);
+    e->id = nevent++;
+    events[e->id] = e;
 
     return e->id;
 }
@@ -99,66 +162,63 @@ int event_id(const char *name, int register_missing)
 
 const char *event_name(int id)
 {
-    iot_list_hook_t *p, *n;
-    event_t         *e;
-
-    if (id < 0 || id >= nevent)
-        goto notfound;
-
-    iot_list_foreach(&events, p, n) {
-        e = iot_list_entry(p, typeof(*e), hook);
-
-        if (e->id == id)
-            return e->name;
+    if (id < 0 || id >= nevent) {
+        errno = ENOENT;
+        return NULL;
     }
 
- notfound:
-    errno = ENOENT;
-    return NULL;
+    return events[id]->name;
 }
 
 
 int event_send(launcher_t *l, pid_t pid, const char *event, iot_json_t *data)
 {
-    client_t        *t;
-    iot_list_hook_t *p, *n;
-    iot_json_t      *e;
+    client_set_t *set = client_pid_set(l, pid);
+    client_ref_t *r;
+    iot_json_t   *e;
 
+    if (set == NULL || iot_list_empty(&set->refs)) {
+        errno = ENOENT;
+        return -1;
+    }
 
-    iot_list_foreach(&l->clients, p, n) {
-        t = iot_list_entry(p, typeof(*t), hook);
+    r = iot_list_entry(set->refs.next, typeof(*r), hook);
+    e = msg_event_create(event, data);
 
-        if (t->id.pid != pid)
-            continue;
+    if (e == NULL)
+        return -1;
 
-        e = msg_event_create(event, data);
+    iot_debug("sending event: '%s'", iot_json_object_to_string(e));
 
-        if (e == NULL)
-            return -1;
+    transport_send(r->obj, e);
 
-        iot_debug("sending event: '%s'", iot_json_object_to_string(e));
+    iot_json_unref(e);
 
-        transport_send(t, e);
+    return 0;
+}
 
-        iot_json_unref(e);
 
-        return 0;
-    }
+static client_set_t *narrower(client_set_t *s1, client_set_t *s2)
+{
+    if (s1 == NULL || s2 == NULL)
+        return NULL;
 
-    errno = ENOENT;
-    return -1;
+    return s2->cnt < s1->cnt ? s2 : s1;
 }
 
 
 iot_json_t *event_route(client_t *c, iot_json_t *req)
 {
-    launcher_t      *l = c->l;
-    client_t        *t;
-    iot_list_hook_t *p, *n;
-    const char      *event;
-    identity_t       dst;
-    iot_json_t      *e, *data;
-    int              id, cnt;
+    launcher_t          *l = c->l;
+    client_t            *t;
+    client_set_t        *set;
+    client_ref_t        *r;
+    iot_list_hook_t     *p, *n;
+    const char          *event;
+    identity_t           dst;
+    iot_json_t          *e, *data;
+    iot_transport_msg_t *m;
+    int                  id, cnt;
 
     if (!iot_json_get_string(req, "event", &event))
         return msg_status_error(EINVAL, "malformed request, missing 'event'");
@@ -174,6 +234,7 @@ iot_json_t *event_route(client_t *c, iot_json_t *req)
     iot_clear(&dst);
     dst.uid = NO_UID;
     dst.gid = NO_GID;
+    data    = NULL;
 
     iot_json_get_string (req, "label"  , &dst.label);
     iot_json_get_string (req, "appid"  , &dst.app);
@@ -182,11 +243,31 @@ iot_json_t *event_route(client_t *c, iot_json_t *req)
     iot_json_get_integer(req, "process", &dst.pid);
     iot_json_get_object (req, "data"   , &data);
 
+    /*
+     * Pick the smallest of the candidate sets selected by the event
+     * and the destination filters, then check the rest of the filters
+     * for each candidate. A filter with no matching clients means that
+     * there are no receivers at all.
+     */
+
+    set = client_event_set(l, id);
+
+    if (dst.pid != NO_PID)
+        set = narrower(set, client_pid_set(l, dst.pid));
+    if (dst.uid != NO_UID)
+        set = narrower(set, client_uid_set(l, dst.uid));
+    if (dst.label != NULL)
+        set = narrower(set, client_label_set(l, dst.label));
+
+    if (set == NULL)
+        return msg_status_ok(NULL);
+
     cnt = 0;
-    e   = NULL;
+    m   = NULL;
 
-    iot_list_foreach(&l->clients, p, n) {
-        t = iot_list_entry(p, typeof(*t), hook);
+    iot_list_foreach(&set->refs, p, n) {
+        r = iot_list_entry(p, typeof(*r), hook);
+        t = r->obj;
 
         if (!iot_mask_test(&t->mask, id))
             continue;
@@ -196,16 +277,30 @@ iot_json_t *event_route(client_t *c, iot_json_t *req)
               (dst.pid == NO_PID || dst.pid == t->id.pid)))
             continue;
 
-        if (e == NULL && (e = msg_event_create(event, data)) == NULL)
-            return msg_status_error(EINVAL, "failed to create event message");
+        if (dst.label != NULL &&
+            (t->id.label == NULL || strcmp(dst.label, t->id.label)))
+            continue;
+
+        if (m == NULL) {
+            if ((e = msg_event_create(event, data)) == NULL)
+                return msg_status_error(EINVAL,
+                                        "failed to create event message");
 
-        iot_debug("sending event: '%s'", iot_json_object_to_string(e));
+            iot_debug("sending event: '%s'", iot_json_object_to_string(e));
 
-        transport_send(t, e);
+            m = iot_transport_msg_create(e);
+            iot_json_unref(e);
+
+            if (m == NULL)
+                return msg_status_error(ENOMEM,
+                                        "failed to create event message");
+        }
+
+        transport_sendmsg(t, m);
         cnt++;
     }
 
-    iot_json_unref(e);
+    iot_transport_msg_unref(m);
 
     return msg_status_ok(NULL);
 }
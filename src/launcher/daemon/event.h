@@ -32,6 +32,7 @@
 
 #include "launcher/daemon/launcher.h"
 
+int event_init(launcher_t *l);
 int event_id(const char *name, int add_missing);
 const char *event_name(int id);
 
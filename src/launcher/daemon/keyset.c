@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/list.h>
+#include <iot/common/hash-table.h>
+
+#include "launcher/daemon/launcher.h"
+#include "launcher/daemon/keyset.h"
+
+
+key_set_t *key_set_get(iot_hashtbl_t *tbl, const void *key, const char *str)
+{
+    key_set_t *s;
+    size_t     len;
+
+    if (tbl != NULL) {
+        s = iot_hashtbl_lookup(tbl, key, IOT_HASH_COOKIE_NONE);
+
+        if (s != NULL)
+            return s;
+    }
+
+    len = (str != NULL ? strlen(str) + 1 : 0);
+    s   = iot_allocz(sizeof(*s) + len);
+
+    if (s == NULL)
+        return NULL;
+
+    iot_list_init(&s->refs);
+
+    if (str != NULL) {
+        strcpy((char *)(s + 1), str);
+        key = s + 1;
+    }
+
+    s->tbl = tbl;
+    s->key = key;
+
+    if (tbl != NULL && iot_hashtbl_add(tbl, key, s, NULL) < 0) {
+        iot_free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+
+void key_set_put(key_set_t *s)
+{
+    if (s->cnt > 0 || s->tbl == NULL)
+        return;
+
+    iot_hashtbl_remove(s->tbl, s->key, IOT_HASH_COOKIE_NONE);
+    iot_free(s);
+}
+
+
+int key_ref_link(key_ref_t *r, void *obj, key_set_t *s)
+{
+    if (s == NULL)
+        return -1;
+
+    iot_list_init(&r->hook);
+    r->obj = obj;
+    r->set = s;
+
+    iot_list_append(&s->refs, &r->hook);
+    s->cnt++;
+
+    return 0;
+}
+
+
+void key_ref_unlink(key_ref_t *r)
+{
+    key_set_t *s = r->set;
+
+    if (s == NULL)
+        return;
+
+    iot_list_delete(&r->hook);
+    r->set = NULL;
+
+    s->cnt--;
+    key_set_put(s);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IOT_LAUNCHER_KEYSET_H__
+#define __IOT_LAUNCHER_KEYSET_H__
+
+#include "launcher/daemon/launcher.h"
+
+/*
+ * key sets
+ *
+ * Both clients and applications are indexed by a number of keys (pid,
+ * uid, label, event, appid). Each index is a hash table of key sets,
+ * with every object in a set linked in by a key reference embedded in
+ * it. Sets are created on first lookup, and sets in an index are freed
+ * when their last reference is unlinked. Sets created without an index
+ * are kept around.
+ */
+
+key_set_t *key_set_get(iot_hashtbl_t *tbl, const void *key, const char *str);
+void key_set_put(key_set_t *s);
+
+int key_ref_link(key_ref_t *r, void *obj, key_set_t *s);
+void key_ref_unlink(key_ref_t *r);
+
+#endif /* __IOT_LAUNCHER_KEYSET_H__ */
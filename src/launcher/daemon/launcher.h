@@ -39,6 +39,7 @@
 #include <iot/common/mainloop.h>
 #include <iot/common/transport.h>
 #include <iot/common/mask.h>
+#include <iot/common/hash-table.h>
 #include <iot/utils/manifest.h>
 
 #ifndef PATH_MAX
@@ -46,7 +47,37 @@
 #endif
 
 
-#define MAX_EVENTS 1024                  /* max. events to register */
+#define MAX_EVENTS 1024                  /* default max. events to register */
+#define NWORKER       4                  /* default number of worker threads */
+
+
+/*
+ * a set of objects sharing a common key (see keyset.h)
+ */
+
+typedef struct client_s client_t;
+typedef struct application_s application_t;
+
+typedef struct {
+    iot_list_hook_t  refs;               /* member references */
+    int              cnt;                /* number of members in this set */
+    iot_hashtbl_t   *tbl;                /* index this set is hashed in */
+    const void      *key;                /* key for this set in tbl */
+} key_set_t;
+
+typedef struct {
+    iot_list_hook_t  hook;               /* to key set */
+    key_set_t       *set;                /* set we're in, if any */
+    void            *obj;                /* referenced object */
+} key_ref_t;
+
+/* clients sharing a pid, uid, label, or event */
+typedef key_set_t client_set_t;
+typedef key_ref_t client_ref_t;
+
+/* applications sharing an appid or uid */
+typedef key_set_t app_set_t;
+typedef key_ref_t app_ref_t;
 
 
 /*
@@ -58,17 +89,29 @@ typedef struct {
     iot_transport_t *lnc;                /* launcher transport */
     iot_transport_t *app;                /* IoT app. transport */
     iot_list_hook_t  clients;            /* clients */
+    iot_hashtbl_t   *pids;               /* clients by process id */
+    iot_hashtbl_t   *uids;               /* clients by user id */
+    iot_hashtbl_t   *labels;             /* clients by SMACK label */
+    client_set_t   **events;             /* clients by subscribed event */
     iot_list_hook_t  apps;               /* launched/tracked applications */
+    iot_hashtbl_t   *app_cgroups;        /* applications by cgroup path */
+    iot_hashtbl_t   *app_ids;            /* applications by appid */
+    iot_hashtbl_t   *app_uids;           /* applications by user id */
     iot_list_hook_t  hooks;              /* application hooks */
+    struct worker_pool_s *workers;       /* request worker threads */
 
     const char      *lnc_addr;           /* launcher transport address */
     const char      *app_addr;           /* IoT app. transport address */
     int              log_mask;           /* what to log */
     const char      *log_target;         /* where to log */
     int              foreground;         /* stay in foreground */
+    int              max_events;         /* max. events to register */
+    int              nworker;            /* number of worker threads */
     const char      *cgroot;             /* cgroup fs mount point */
     const char      *cgdir;              /* our cgroup directory */
     const char      *cgagent;            /* our cgroup release agent */
+    int              cgmonitor;          /* monitor cgroups in-daemon */
+    int              cgv2;               /* cgroup v2 unified hierarchy */
     int              lnc_fd;             /* systemd-passed socket for lnc */
     int              app_fd;             /* systemd-passed socket for app */
     void            *cyn;                /* cynara context */
@@ -104,30 +147,40 @@ typedef enum {
     CLIENT_IOTAPP
 } client_type_t;
 
-typedef struct {
+struct client_s {
     int              type;               /* client type */
     iot_list_hook_t  hook;               /* to list of clients */
     launcher_t      *l;                  /* launcher context */
     iot_transport_t *t;                  /* transport to this client */
     identity_t       id;                 /* client identity */
     iot_mask_t       mask;               /* mask of subscribed events */
-} client_t;
+    client_ref_t     by_pid;             /* pid index reference */
+    client_ref_t     by_uid;             /* uid index reference */
+    client_ref_t     by_label;           /* label index reference */
+    iot_list_hook_t  subscriptions;      /* event index references */
+    int              seqno;              /* seqno of request being handled */
+    iot_list_hook_t  pending;            /* pending (asynchronous) requests */
+};
 
 
 /*
  * a launched/tracked application
  */
 
-typedef struct {
+struct application_s {
     iot_list_hook_t  hook;               /* to list of applications */
     launcher_t      *l;                  /* launcher context */
     client_t        *c;                  /* launcher client, if any */
     iot_manifest_t  *m;                  /* application manifest */
     char            *app;                /* application within manifest */
+    char            *appid;              /* <pkg>:<app> */
     identity_t       id;                 /* application identity */
     iot_timer_t     *stop;               /* stopping timer */
     pid_t            killer;             /* process that sent stop request */
-} application_t;
+    struct cgroup_watch_s *watch;        /* cgroup emptiness watch */
+    app_ref_t        by_appid;           /* appid index reference */
+    app_ref_t        by_uid;             /* uid index reference */
+};
 
 
 /*
@@ -143,6 +196,13 @@ typedef struct {
 
 /*
  * application handling hooks
+ *
+ * Hooks are called in the mainloop, except for prepare which is called
+ * in a worker thread once the application cgroup has been created, and
+ * before setup. Hooks doing slow work, for instance talking to another
+ * daemon, should do it in prepare. prepare may be called concurrently
+ * for several applications, and it must not touch any launcher state
+ * other than the application being set up. Logging is fine.
  */
 
 typedef struct {
@@ -151,13 +211,16 @@ typedef struct {
     /* optional hook setup and cleanup callbacks */
     int            (*init)(void);
     void           (*exit)(void);
-    /* mandatory application setup and cleanup callbacks */
+    /* optional thread-safe application setup callback */
+    int            (*prepare)(application_t *app);
+    /* application setup and cleanup callbacks, cleanup mandatory */
     int            (*setup)(application_t *app);
     int            (*cleanup)(application_t *app);
 } app_hook_t;
 
 
-#define IOT_REGISTER_APPHOOK(_prfx, _descr, _init, _exit, _setup, _cleanup) \
+#define IOT_REGISTER_APPHOOK_PREPARE(_prfx, _descr, _init, _exit, _prepare, \
+                                     _setup, _cleanup)                  \
     static void _prfx##_register(void) IOT_INIT;                        \
                                                                         \
     static void _prfx##_register(void) {                                \
@@ -165,6 +228,7 @@ typedef struct {
             .name    = _descr,                                          \
             .init    = _init,                                           \
             .exit    = _exit,                                           \
+            .prepare = _prepare,                                        \
             .setup   = _setup,                                          \
             .cleanup = _cleanup,                                        \
         };                                                              \
@@ -173,5 +237,9 @@ typedef struct {
     }                                                                   \
     struct __iot_allow_trailing_semicolon
 
+#define IOT_REGISTER_APPHOOK(_prfx, _descr, _init, _exit, _setup, _cleanup) \
+    IOT_REGISTER_APPHOOK_PREPARE(_prfx, _descr, _init, _exit, NULL,     \
+                                 _setup, _cleanup)
+
 
 #endif /* __IOT_LAUNCHER_H__ */
@@ -48,7 +48,8 @@ static void sm_exit(void)
 }
 
 
-static int sm_setup(application_t *a)
+/* called in a worker thread */
+static int sm_prepare(application_t *a)
 {
     iot_log_info("Setting security manager rules for process %u (%s)...",
                  a->id.pid, a->id.argv[0]);
@@ -66,6 +67,6 @@ static int sm_cleanup(application_t *a)
 }
 
 
-IOT_REGISTER_APPHOOK(sm, "security-manager",
-                     sm_init, sm_exit,
-                     sm_setup, sm_cleanup);
+IOT_REGISTER_APPHOOK_PREPARE(sm, "security-manager",
+                             sm_init, sm_exit,
+                             sm_prepare, NULL, sm_cleanup);
@@ -27,10 +27,12 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include <signal.h>
 
 #include <iot/common/mainloop.h>
 #include <iot/common/log.h>
+#include <iot/common/transport.h>
 
 #include "launcher/daemon/launcher.h"
 
@@ -58,6 +60,11 @@ static void signal_handler(iot_sighandler_t *h, int signum, void *user_data)
         else
             exit(0);
         break;
+
+    case SIGUSR1:
+        iot_log_info("Received SIGUSR1, dumping transport statistics...");
+        iot_transport_log_stats();
+        break;
     }
 }
 
@@ -66,6 +73,7 @@ void signal_init(launcher_t *l)
 {
     iot_add_sighandler(l->ml, SIGINT , signal_handler, l);
     iot_add_sighandler(l->ml, SIGTERM, signal_handler, l);
+    iot_add_sighandler(l->ml, SIGUSR1, signal_handler, l);
 }
 
 
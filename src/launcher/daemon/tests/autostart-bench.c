@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/log.h>
+#include <iot/common/json.h>
+#include <iot/common/mainloop.h>
+
+#include "launcher/daemon/launcher.h"
+#include "launcher/daemon/msg.h"
+#include "launcher/daemon/transport.h"
+#include "launcher/daemon/privilege.h"
+#include "launcher/daemon/client.h"
+#include "launcher/daemon/event.h"
+#include "launcher/daemon/application.h"
+#include "launcher/daemon/worker.h"
+
+#define bench_fail(...) do {                            \
+        iot_log_error("fatal error: "__VA_ARGS__);      \
+        exit(1);                                        \
+    } while (0)
+
+/*
+ * Measure how long it takes the daemon to set up a set of applications
+ * autostarted at boot, first with one setup request per application (as
+ * if every application was started by an iot-launch of its own), then
+ * with a single bulk setup request for all of them. The applications are
+ * spread over a number of packages, so several of them share a manifest.
+ * As in iot-launch-bench, cgroup directories are plain directories under
+ * a fake cgroup root and a benchmark hook stands in for the security
+ * manager by sleeping for a configurable amount of time. Besides the
+ * total time, we report the time the mainloop was kept busy and the
+ * number of mainloop iterations it took to get all replies out.
+ */
+
+typedef struct {
+    int         napp;                    /* number of applications */
+    int         npkg;                    /* number of packages */
+    int         nworker;                 /* number of worker threads */
+    int         delay;                   /* hook delay (usecs) */
+    char        root[64];                /* fake cgroup root, manifests */
+    launcher_t  l;                       /* simulated launcher context */
+    client_t   *clients;                 /* simulated clients */
+    int         nreply;                  /* number of replies sent */
+    int         ndone;                   /* number of completed setups */
+    int         nfail;                   /* number of failed setups */
+} bench_t;
+
+static bench_t *bench;
+
+
+/*
+ * stand-ins for the real transport and privilege checking
+ */
+
+int transport_send(client_t *c, iot_json_t *msg)
+{
+    IOT_UNUSED(c);
+    IOT_UNUSED(msg);
+
+    return 0;
+}
+
+
+int transport_sendmsg(client_t *c, iot_transport_msg_t *msg)
+{
+    IOT_UNUSED(c);
+    IOT_UNUSED(msg);
+
+    return 0;
+}
+
+
+pending_t *transport_pending(client_t *c)
+{
+    pending_t *p;
+
+    if ((p = iot_allocz(sizeof(*p))) == NULL)
+        return NULL;
+
+    iot_list_init(&p->hook);
+    p->c     = c;
+    p->seqno = c->seqno;
+
+    return p;
+}
+
+
+static void count_status(bench_t *b, iot_json_t *status)
+{
+    int code = -1;
+
+    iot_json_get_integer(status, "status", &code);
+
+    if (code != 0)
+        b->nfail++;
+
+    b->ndone++;
+}
+
+
+int transport_complete(pending_t *p, iot_json_t *status)
+{
+    iot_json_t *data, *s;
+    int         i;
+
+    /* a bulk reply carries the status of each application as its data */
+    if (iot_json_get_array(status, "data", &data)) {
+        for (i = 0; iot_json_array_get_object(data, i, &s); i++)
+            count_status(bench, s);
+    }
+    else
+        count_status(bench, status);
+
+    bench->nreply++;
+
+    iot_json_unref(status);
+    iot_free(p);
+
+    return 0;
+}
+
+
+void transport_orphan(client_t *c)
+{
+    IOT_UNUSED(c);
+}
+
+
+int privilege_check(launcher_t *l, const char *label, uid_t uid,
+                    const char *privilege)
+{
+    IOT_UNUSED(l);
+    IOT_UNUSED(label);
+    IOT_UNUSED(uid);
+    IOT_UNUSED(privilege);
+
+    return 1;
+}
+
+
+static int bench_hook_prepare(application_t *a)
+{
+    IOT_UNUSED(a);
+
+    if (bench->delay > 0)
+        usleep(bench->delay);
+
+    return 0;
+}
+
+
+static int bench_hook_cleanup(application_t *a)
+{
+    IOT_UNUSED(a);
+
+    return 0;
+}
+
+
+IOT_REGISTER_APPHOOK_PREPARE(bench, "autostart-bench",
+                             NULL, NULL,
+                             bench_hook_prepare, NULL, bench_hook_cleanup);
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static void manifest_path(bench_t *b, int pkg, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s/autostart-%d.manifest", b->root, pkg);
+}
+
+
+static void setup(bench_t *b)
+{
+    launcher_t *l = &b->l;
+    client_t   *c;
+    char        path[PATH_MAX];
+    FILE       *fp;
+    int         i;
+
+    snprintf(b->root, sizeof(b->root), "/tmp/iot-autostart-bench.XXXXXX");
+
+    if (mkdtemp(b->root) == NULL)
+        bench_fail("failed to create fake cgroup root (%d: %s)",
+                   errno, strerror(errno));
+
+    for (i = 0; i < b->npkg; i++) {
+        manifest_path(b, i, path, sizeof(path));
+
+        if ((fp = fopen(path, "w")) == NULL)
+            bench_fail("failed to create manifest '%s'", path);
+
+        fprintf(fp, "{\n"
+                "  \"application\": \"bench\",\n"
+                "  \"description\": \"Autostart benchmark application.\",\n"
+                "  \"privileges\": [ \"none\" ],\n"
+                "  \"execute\": [ \"/usr/bin/bench\" ]\n"
+                "}\n");
+        fclose(fp);
+    }
+
+    iot_list_init(&l->clients);
+    iot_list_init(&l->apps);
+
+    l->ml         = iot_mainloop_create();
+    l->cgdir      = b->root;
+    l->max_events = MAX_EVENTS;
+
+    if (l->ml == NULL)
+        bench_fail("failed to create mainloop");
+
+    if (event_init(l) < 0 || client_init(l) < 0 || application_init(l) < 0)
+        bench_fail("failed to initialize launcher context");
+
+    b->clients = iot_allocz_array(client_t, b->napp);
+
+    if (b->clients == NULL)
+        bench_fail("failed to allocate clients");
+
+    for (i = 0; i < b->napp; i++) {
+        c = b->clients + i;
+
+        iot_list_init(&c->hook);
+        iot_list_init(&c->subscriptions);
+        iot_list_init(&c->pending);
+
+        c->type   = CLIENT_LAUNCHER;
+        c->l      = l;
+        c->id.uid = 5000;
+        c->id.gid = 5000;
+        c->id.pid = NO_PID;
+    }
+}
+
+
+static void cleanup(bench_t *b)
+{
+    char path[PATH_MAX];
+    int  i;
+
+    snprintf(path, sizeof(path), "%s/user-5000", b->root);
+    rmdir(path);
+
+    for (i = 0; i < b->npkg; i++) {
+        manifest_path(b, i, path, sizeof(path));
+        unlink(path);
+    }
+
+    rmdir(b->root);
+
+    iot_free(b->clients);
+}
+
+
+static iot_json_t *app_request(bench_t *b, int run, int i)
+{
+    iot_json_t *req, *exec;
+    char        argv0[64], pkg[64], manifest[PATH_MAX];
+
+    req  = iot_json_create(IOT_JSON_OBJECT);
+    exec = iot_json_create(IOT_JSON_ARRAY);
+
+    if (req == NULL || exec == NULL)
+        bench_fail("failed to create setup request");
+
+    /* cgroup directories are named after argv[0], keep them unique */
+    snprintf(argv0, sizeof(argv0), "/usr/bin/bench-%d-%d", run, i);
+    iot_json_array_append_string(exec, argv0);
+
+    /* single-application manifests name their application after the package */
+    snprintf(pkg, sizeof(pkg), "autostart-%d", i % b->npkg);
+    manifest_path(b, i % b->npkg, manifest, sizeof(manifest));
+
+    iot_json_add_string (req, "manifest", manifest);
+    iot_json_add_string (req, "app"     , pkg);
+    iot_json_add        (req, "exec"    , exec);
+
+    return req;
+}
+
+
+static void stop_apps(bench_t *b)
+{
+    launcher_t      *l = &b->l;
+    application_t   *a;
+    iot_list_hook_t *p, *n;
+    iot_json_t      *req;
+    char             cgrp[PATH_MAX];
+    client_t         root;
+
+    iot_clear(&root);
+    root.l = l;
+
+    iot_list_foreach(&l->apps, p, n) {
+        a = iot_list_entry(p, typeof(*a), hook);
+
+        snprintf(cgrp, sizeof(cgrp), "/%s", a->id.cgrp);
+
+        req = iot_json_create(IOT_JSON_OBJECT);
+        iot_json_add_string(req, "cgroup", cgrp);
+        iot_json_unref(application_cleanup(&root, req));
+        iot_json_unref(req);
+    }
+
+    if (!iot_list_empty(&l->apps))
+        bench_fail("applications left after cleanup");
+}
+
+
+static void bench_autostart(bench_t *b, int bulk, int run)
+{
+    launcher_t *l = &b->l;
+    iot_json_t *req, *apps, *rpl;
+    double      start, busy, t;
+    int         i, nloop, nreq;
+
+    l->nworker = b->nworker;
+
+    if (worker_init(l) < 0)
+        bench_fail("failed to create %d worker threads", b->nworker);
+
+    b->nreply = b->ndone = b->nfail = 0;
+    busy      = 0;
+    nloop     = 0;
+    start     = now();
+
+    if (!bulk) {
+        for (i = 0; i < b->napp; i++) {
+            req = app_request(b, run, i);
+            iot_json_add_integer(req, "user" , -1);
+            iot_json_add_integer(req, "group", -1);
+            b->clients[i].seqno = i;
+
+            t   = now();
+            rpl = application_setup(b->clients + i, req);
+            busy += now() - t;
+
+            if (rpl != REQUEST_PENDING)
+                bench_fail("setup request #%d failed", i);
+
+            iot_json_unref(req);
+        }
+
+        nreq = b->napp;
+    }
+    else {
+        req  = iot_json_create(IOT_JSON_OBJECT);
+        apps = iot_json_create(IOT_JSON_ARRAY);
+
+        if (req == NULL || apps == NULL)
+            bench_fail("failed to create bulk setup request");
+
+        iot_json_add_integer(req, "user" , -1);
+        iot_json_add_integer(req, "group", -1);
+        iot_json_add        (req, "apps" , apps);
+
+        for (i = 0; i < b->napp; i++) {
+            rpl = app_request(b, run, i);
+            iot_json_add_integer(rpl, "pid", NO_PID);
+            iot_json_array_append(apps, rpl);
+        }
+
+        t   = now();
+        rpl = application_setup_bulk(b->clients, req);
+        busy += now() - t;
+
+        if (rpl != REQUEST_PENDING)
+            bench_fail("bulk setup request failed");
+
+        iot_json_unref(req);
+
+        nreq = 1;
+    }
+
+    while (b->ndone < b->napp) {
+        iot_mainloop_prepare(l->ml);
+        iot_mainloop_poll(l->ml, TRUE);
+
+        t = now();
+        iot_mainloop_dispatch(l->ml);
+        busy += now() - t;
+        nloop++;
+    }
+
+    t = now() - start;
+
+    worker_exit(l);
+
+    if (b->nfail)
+        bench_fail("%d of %d setups failed", b->nfail, b->napp);
+
+    printf("  %-6s %3d requests  %8.3f ms total  %8.3f ms/app  "
+           "mainloop busy %7.3f ms, %3d iterations\n",
+           bulk ? "bulk" : "single", nreq, 1000.0 * t,
+           1000.0 * t / b->napp, 1000.0 * busy, nloop);
+
+    stop_apps(b);
+}
+
+
+static void print_usage(const char *argv0, int exit_code)
+{
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -a, --apps=<n>                 number of applications to start\n"
+           "  -p, --packages=<n>             number of packages to use\n"
+           "  -w, --workers=<n>              number of worker threads\n"
+           "  -d, --delay=<usecs>            application hook delay\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    exit(exit_code);
+}
+
+
+static void parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "a:p:w:d:h"
+    struct option options[] = {
+        { "apps"         , required_argument, NULL, 'a' },
+        { "packages"     , required_argument, NULL, 'p' },
+        { "workers"      , required_argument, NULL, 'w' },
+        { "delay"        , required_argument, NULL, 'd' },
+        { "help"         , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+
+    b->napp    = 50;
+    b->npkg    = 10;
+    b->nworker = NWORKER;
+    b->delay   = 2000;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'a':
+            b->napp = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'p':
+            b->npkg = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'w':
+            b->nworker = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'd':
+            b->delay = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'h':
+            print_usage(argv[0], 0);
+            break;
+        default:
+            print_usage(argv[0], EINVAL);
+        }
+    }
+
+    if (b->napp <= 0 || b->npkg <= 0 || b->nworker < 0 || b->delay < 0)
+        print_usage(argv[0], EINVAL);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static bench_t b;
+
+    iot_log_set_mask(IOT_LOG_UPTO(IOT_LOG_WARNING));
+    iot_log_set_target(IOT_LOG_TO_STDERR);
+
+    bench = &b;
+
+    parse_cmdline(&b, argc, argv);
+    setup(&b);
+
+    printf("boot-time autostart, %d applications from %d packages, "
+           "%d workers, %d us hook delay:\n", b.napp, b.npkg, b.nworker,
+           b.delay);
+
+    bench_autostart(&b, FALSE, 0);
+    bench_autostart(&b, TRUE, 1);
+
+    cleanup(&b);
+
+    return 0;
+}
@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/log.h>
+#include <iot/common/mainloop.h>
+
+#include "launcher/daemon/launcher.h"
+#include "launcher/daemon/cgroup.h"
+
+#define bench_fail(...) do {                            \
+        iot_log_error("fatal error: "__VA_ARGS__);      \
+        exit(1);                                        \
+    } while (0)
+
+/*
+ * Measure the cost of noticing a mass exit of applications, with cgroup
+ * release agents and with in-daemon cgroup monitoring. We don't need
+ * (nor usually have the privileges) to set up a real cgroup hierarchy
+ * for this. Instead we create a directory per application with a
+ * cgroup.procs file listing the application process, which is all the
+ * monitor needs. Applications block on a pipe, and exit all at once when
+ * we close it. For agents, we emulate what the kernel does on release:
+ * exec an agent per emptied cgroup, which connects to us and sends us
+ * the cgroup to clean up.
+ */
+
+typedef struct {
+    iot_mainloop_t *ml;                  /* our mainloop */
+    launcher_t      l;                   /* launcher context for cgroups */
+    char            root[64];            /* fake cgroup root */
+    char            sock[96];            /* socket for agents */
+    const char     *exe;                 /* us, for exec'ing agents */
+    int             napp;                /* number of applications */
+    pid_t          *apps;                /* application processes */
+    int             pipe[2];             /* pipe to block applications on */
+    int             ncleanup;            /* number of cleanups received */
+} bench_t;
+
+static bench_t *bench;
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static double cputime(int who)
+{
+    struct rusage ru;
+
+    getrusage(who, &ru);
+
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0 +
+        ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+}
+
+
+static int agent(const char *sock, const char *dir)
+{
+    struct sockaddr_un addr;
+    int                fd, n;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+        return 1;
+
+    iot_clear(&addr);
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return 1;
+
+    n = strlen(dir) + 1;
+
+    return write(fd, dir, n) == n ? 0 : 1;
+}
+
+
+static void start_apps(bench_t *b)
+{
+    char  path[PATH_MAX];
+    FILE *fp;
+    char  c;
+    int   i;
+
+    if (pipe(b->pipe) < 0)
+        bench_fail("failed to create pipe");
+
+    for (i = 0; i < b->napp; i++) {
+        snprintf(path, sizeof(path), "%s/app-%d", b->root, i);
+
+        if (mkdir(path, 0755) < 0 && errno != EEXIST)
+            bench_fail("failed to create directory %s", path);
+
+        switch ((b->apps[i] = fork())) {
+        case -1:
+            bench_fail("failed to fork application");
+        case 0:
+            close(b->pipe[1]);
+            while (read(b->pipe[0], &c, 1) < 0 && errno == EINTR)
+                ;
+            _exit(0);
+        default:
+            break;
+        }
+
+        snprintf(path, sizeof(path), "%s/app-%d/cgroup.procs", b->root, i);
+
+        if ((fp = fopen(path, "w")) == NULL)
+            bench_fail("failed to create %s", path);
+
+        fprintf(fp, "%u\n", b->apps[i]);
+        fclose(fp);
+    }
+
+    close(b->pipe[0]);
+}
+
+
+static void reap_apps(bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < b->napp; i++)
+        waitpid(b->apps[i], NULL, 0);
+}
+
+
+static void cgroup_empty(launcher_t *l, const char *dir, void *user_data)
+{
+    bench_t        *b = bench;
+    cgroup_watch_t *w = *(cgroup_watch_t **)user_data;
+
+    IOT_UNUSED(l);
+    IOT_UNUSED(dir);
+
+    cgroup_unwatch(w);
+
+    if (++b->ncleanup == b->napp)
+        iot_mainloop_quit(b->ml, 0);
+}
+
+
+static void bench_monitor(bench_t *b)
+{
+    cgroup_watch_t **w;
+    char             dir[64];
+    double           start, end, cpu;
+    int              i;
+
+    w = iot_allocz_array(cgroup_watch_t *, b->napp);
+
+    if (w == NULL)
+        bench_fail("failed to allocate watches");
+
+    start_apps(b);
+
+    for (i = 0; i < b->napp; i++) {
+        snprintf(dir, sizeof(dir), "app-%d", i);
+
+        if ((w[i] = cgroup_watch(&b->l, dir, cgroup_empty, w + i)) == NULL)
+            bench_fail("failed to watch cgroup %s", dir);
+    }
+
+    b->ncleanup = 0;
+    cpu         = cputime(RUSAGE_SELF);
+    start       = now();
+
+    close(b->pipe[1]);
+    iot_mainloop_run(b->ml);
+
+    end = now();
+    cpu = cputime(RUSAGE_SELF) - cpu;
+
+    reap_apps(b);
+    iot_free(w);
+
+    printf("  %-8s %6d exits %9.3f ms total %8.1f us/exit  "
+           "cpu %8.1f us/exit\n", "monitor", b->napp,
+           1000.0 * (end - start), 1000000.0 * (end - start) / b->napp,
+           1000000.0 * cpu / b->napp);
+}
+
+
+static void agent_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                     void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+    char     dir[PATH_MAX];
+    int      c, n;
+
+    IOT_UNUSED(w);
+    IOT_UNUSED(events);
+
+    while ((c = accept(fd, NULL, NULL)) >= 0) {
+        n = read(c, dir, sizeof(dir));
+        close(c);
+
+        if (n > 0 && ++b->ncleanup == b->napp)
+            iot_mainloop_quit(b->ml, 0);
+    }
+}
+
+
+static void bench_agent(bench_t *b)
+{
+    struct sockaddr_un  addr;
+    iot_io_watch_t     *w;
+    pid_t              *agents;
+    char                dir[64];
+    double              start, end, cpu;
+    int                 fd, i;
+
+    agents = iot_allocz_array(pid_t, b->napp);
+
+    if (agents == NULL)
+        bench_fail("failed to allocate agents");
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    iot_clear(&addr);
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", b->sock);
+
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 128) < 0)
+        bench_fail("failed to create agent socket %s", b->sock);
+
+    if ((w = iot_add_io_watch(b->ml, fd, IOT_IO_EVENT_IN, agent_cb, b)) == NULL)
+        bench_fail("failed to watch agent socket");
+
+    start_apps(b);
+
+    b->ncleanup = 0;
+    cpu         = cputime(RUSAGE_SELF) + cputime(RUSAGE_CHILDREN);
+    start       = now();
+
+    close(b->pipe[1]);
+    reap_apps(b);
+
+    for (i = 0; i < b->napp; i++) {
+        snprintf(dir, sizeof(dir), "app-%d", i);
+
+        switch ((agents[i] = fork())) {
+        case -1:
+            bench_fail("failed to fork agent");
+        case 0:
+            execl(b->exe, b->exe, "--agent", b->sock, dir, NULL);
+            _exit(1);
+        default:
+            break;
+        }
+    }
+
+    iot_mainloop_run(b->ml);
+
+    end = now();
+
+    for (i = 0; i < b->napp; i++)
+        waitpid(agents[i], NULL, 0);
+
+    cpu = cputime(RUSAGE_SELF) + cputime(RUSAGE_CHILDREN) - cpu;
+
+    iot_del_io_watch(w);
+    close(fd);
+    unlink(b->sock);
+    iot_free(agents);
+
+    printf("  %-8s %6d exits %9.3f ms total %8.1f us/exit  "
+           "cpu %8.1f us/exit\n", "agent", b->napp,
+           1000.0 * (end - start), 1000000.0 * (end - start) / b->napp,
+           1000000.0 * cpu / b->napp);
+}
+
+
+static void cleanup(bench_t *b)
+{
+    char path[PATH_MAX];
+    int  i;
+
+    for (i = 0; i < b->napp; i++) {
+        snprintf(path, sizeof(path), "%s/app-%d/cgroup.procs", b->root, i);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/app-%d", b->root, i);
+        rmdir(path);
+    }
+
+    rmdir(b->root);
+}
+
+
+static void print_usage(const char *argv0, int exit_code)
+{
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -n, --apps=<n>                 number of exiting applications\n"
+           "  -m, --mode=<mode>              agent, monitor, or both\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    exit(exit_code);
+}
+
+
+int main(int argc, char *argv[])
+{
+#   define OPTIONS "n:m:h"
+    struct option options[] = {
+        { "apps", required_argument, NULL, 'n' },
+        { "mode", required_argument, NULL, 'm' },
+        { "help", no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    static bench_t  b;
+    const char     *mode;
+    int             opt;
+
+    if (argc == 4 && !strcmp(argv[1], "--agent"))
+        return agent(argv[2], argv[3]);
+
+    iot_log_set_mask(IOT_LOG_UPTO(IOT_LOG_WARNING));
+    iot_log_set_target(IOT_LOG_TO_STDERR);
+
+    b.napp = 500;
+    mode   = "both";
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            b.napp = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'm':
+            mode = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0], 0);
+            break;
+        default:
+            print_usage(argv[0], EINVAL);
+        }
+    }
+
+    if (b.napp <= 0 || (strcmp(mode, "agent") && strcmp(mode, "monitor") &&
+                        strcmp(mode, "both")))
+        print_usage(argv[0], EINVAL);
+
+    b.exe  = "/proc/self/exe";
+    b.apps = iot_allocz_array(pid_t, b.napp);
+    b.ml   = iot_mainloop_create();
+
+    snprintf(b.root, sizeof(b.root), "/tmp/iot-cgroup-bench.%u", getpid());
+    snprintf(b.sock, sizeof(b.sock), "%s/agent", b.root);
+
+    if (b.apps == NULL || b.ml == NULL || mkdir(b.root, 0755) < 0)
+        bench_fail("failed to set up benchmark");
+
+    b.l.ml    = b.ml;
+    b.l.cgdir = b.root;
+
+    bench = &b;
+
+    printf("cleanup after a mass exit of %d applications:\n", b.napp);
+
+    if (strcmp(mode, "monitor"))
+        bench_agent(&b);
+    if (strcmp(mode, "agent"))
+        bench_monitor(&b);
+
+    cleanup(&b);
+
+    return 0;
+}
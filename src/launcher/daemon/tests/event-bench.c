@@ -0,0 +1,528 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/log.h>
+#include <iot/common/json.h>
+
+#include "launcher/daemon/launcher.h"
+#include "launcher/daemon/msg.h"
+#include "launcher/daemon/transport.h"
+#include "launcher/daemon/privilege.h"
+#include "launcher/daemon/client.h"
+#include "launcher/daemon/event.h"
+
+#define bench_fail(...) do {                            \
+        iot_log_error("fatal error: "__VA_ARGS__);      \
+        exit(1);                                        \
+    } while (0)
+
+/*
+ * Simulate a launcher daemon with a large number of connected clients
+ * and measure the cost of routing events to them. Clients are spread
+ * over a number of users and SMACK labels, and each one subscribes to
+ * a few of the registered events. Events are routed both with the
+ * client indexes (event_route) and with a linear scan over all clients,
+ * the way routing used to be done.
+ */
+
+typedef struct {
+    int         iterations;              /* number of routed events */
+    int         nclient;                 /* number of clients */
+    int         nuser;                   /* number of distinct users */
+    int         nlabel;                  /* number of distinct labels */
+    int         nevent;                  /* number of events */
+    int         nsub;                    /* subscriptions per client */
+    launcher_t  l;                       /* simulated launcher context */
+    client_t   *clients;                 /* simulated clients */
+    client_t    sender;                  /* event sender */
+    int         nsent;                   /* number of events sent */
+} bench_t;
+
+static bench_t *bench;
+
+
+/*
+ * stand-ins for the real transport and privilege checking
+ */
+
+int transport_send(client_t *c, iot_json_t *msg)
+{
+    IOT_UNUSED(c);
+    IOT_UNUSED(msg);
+
+    bench->nsent++;
+
+    return 0;
+}
+
+
+int transport_sendmsg(client_t *c, iot_transport_msg_t *msg)
+{
+    IOT_UNUSED(c);
+    IOT_UNUSED(msg);
+
+    bench->nsent++;
+
+    return 0;
+}
+
+
+void transport_orphan(client_t *c)
+{
+    IOT_UNUSED(c);
+}
+
+
+int privilege_check(launcher_t *l, const char *label, uid_t uid,
+                    const char *privilege)
+{
+    IOT_UNUSED(l);
+    IOT_UNUSED(label);
+    IOT_UNUSED(uid);
+    IOT_UNUSED(privilege);
+
+    return 1;
+}
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static void client_label(char *buf, size_t size, int idx)
+{
+    snprintf(buf, size, "User::App::bench%d", idx);
+}
+
+
+static void setup(bench_t *b)
+{
+    launcher_t *l = &b->l;
+    client_t   *c;
+    iot_json_t *req, *events;
+    char        name[64];
+    int         i, j;
+
+    iot_list_init(&l->clients);
+    iot_list_init(&l->apps);
+
+    l->max_events = b->nevent;
+
+    if (event_init(l) < 0)
+        bench_fail("failed to create event registry");
+
+    if (client_init(l) < 0)
+        bench_fail("failed to create client indexes");
+
+    for (i = 0; i < b->nevent; i++) {
+        snprintf(name, sizeof(name), "bench-event-%d", i);
+
+        if (event_register(name) < 0)
+            bench_fail("failed to register event '%s'", name);
+    }
+
+    b->clients = iot_allocz_array(client_t, b->nclient);
+
+    if (b->clients == NULL)
+        bench_fail("failed to allocate clients");
+
+    for (i = 0; i < b->nclient; i++) {
+        c = b->clients + i;
+
+        iot_list_init(&c->hook);
+        iot_list_init(&c->subscriptions);
+        iot_mask_init(&c->mask);
+
+        client_label(name, sizeof(name), i % b->nlabel);
+
+        c->type     = CLIENT_IOTAPP;
+        c->l        = l;
+        c->id.label = iot_strdup(name);
+        c->id.uid   = 5000 + i % b->nuser;
+        c->id.gid   = 5000 + i % b->nuser;
+        c->id.pid   = 10000 + i;
+
+        if (c->id.label == NULL || client_register(c) < 0)
+            bench_fail("failed to register client #%d", i);
+
+        req    = iot_json_create(IOT_JSON_OBJECT);
+        events = iot_json_create(IOT_JSON_ARRAY);
+
+        for (j = 0; j < b->nsub; j++) {
+            snprintf(name, sizeof(name), "bench-event-%d",
+                     (i + j * 7) % b->nevent);
+            iot_json_array_append_string(events, name);
+        }
+
+        iot_json_add(req, "events", events);
+        iot_json_unref(client_subscribe(c, req));
+        iot_json_unref(req);
+    }
+
+    c = &b->sender;
+    iot_list_init(&c->hook);
+    iot_list_init(&c->subscriptions);
+    iot_mask_init(&c->mask);
+    c->type   = CLIENT_LAUNCHER;
+    c->l      = l;
+    c->id.uid = 0;
+    c->id.pid = 1;
+}
+
+
+static void cleanup(bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < b->nclient; i++) {
+        client_unregister(b->clients + i);
+        iot_mask_reset(&b->clients[i].mask);
+        iot_free(b->clients[i].id.label);
+    }
+
+    if (!iot_list_empty(&b->l.clients))
+        bench_fail("clients left in the registry");
+
+    iot_free(b->clients);
+}
+
+
+/*
+ * routing by scanning all clients, as it used to be done
+ */
+
+static iot_json_t *route_linear(client_t *c, iot_json_t *req)
+{
+    launcher_t      *l = c->l;
+    client_t        *t;
+    iot_list_hook_t *p, *n;
+    const char      *event;
+    identity_t       dst;
+    iot_json_t      *e, *data;
+    int              id;
+
+    if (!iot_json_get_string(req, "event", &event))
+        return msg_status_error(EINVAL, "malformed request, missing 'event'");
+
+    if ((id = event_lookup(event)) < 0)
+        return msg_status_error(EINVAL, "unknown event '%s'", event);
+
+    iot_clear(&dst);
+    dst.uid = NO_UID;
+    dst.gid = NO_GID;
+    data    = NULL;
+
+    iot_json_get_string (req, "label"  , &dst.label);
+    iot_json_get_integer(req, "user"   , &dst.uid);
+    iot_json_get_integer(req, "group"  , &dst.gid);
+    iot_json_get_integer(req, "process", &dst.pid);
+    iot_json_get_object (req, "data"   , &data);
+
+    e = NULL;
+
+    iot_list_foreach(&l->clients, p, n) {
+        t = iot_list_entry(p, typeof(*t), hook);
+
+        if (!iot_mask_test(&t->mask, id))
+            continue;
+
+        if (!((dst.uid == NO_UID || dst.uid == t->id.uid) &&
+              (dst.gid == NO_GID || dst.gid == t->id.gid) &&
+              (dst.pid == NO_PID || dst.pid == t->id.pid)))
+            continue;
+
+        if (dst.label != NULL &&
+            (t->id.label == NULL || strcmp(dst.label, t->id.label)))
+            continue;
+
+        if (e == NULL && (e = msg_event_create(event, data)) == NULL)
+            return msg_status_error(EINVAL, "failed to create event message");
+
+        transport_send(t, e);
+    }
+
+    iot_json_unref(e);
+
+    return msg_status_ok(NULL);
+}
+
+
+typedef enum {
+    DST_ALL,
+    DST_PROCESS,
+    DST_USER,
+    DST_LABEL,
+} dst_t;
+
+
+static iot_json_t *route_request(bench_t *b, int i, dst_t dst)
+{
+    iot_json_t *req;
+    char        name[64];
+    int         idx = (i * 31) % b->nclient;
+
+    req = iot_json_create(IOT_JSON_OBJECT);
+
+    if (req == NULL)
+        bench_fail("failed to create routing request");
+
+    snprintf(name, sizeof(name), "bench-event-%d", idx % b->nevent);
+    iot_json_add_string(req, "event", name);
+
+    switch (dst) {
+    case DST_PROCESS:
+        iot_json_add_integer(req, "process", b->clients[idx].id.pid);
+        break;
+    case DST_USER:
+        iot_json_add_integer(req, "user", b->clients[idx].id.uid);
+        break;
+    case DST_LABEL:
+        client_label(name, sizeof(name), idx % b->nlabel);
+        iot_json_add_string(req, "label", name);
+        break;
+    default:
+        break;
+    }
+
+    return req;
+}
+
+
+static double bench_route(bench_t *b, dst_t dst, int linear, int *nsent)
+{
+    iot_json_t *req, *rpl;
+    double      start, t;
+    int         i;
+
+    b->nsent = 0;
+    t        = 0;
+
+    for (i = 0; i < b->iterations; i++) {
+        req   = route_request(b, i, dst);
+        start = now();
+
+        if (linear)
+            rpl = route_linear(&b->sender, req);
+        else
+            rpl = event_route(&b->sender, req);
+
+        t += now() - start;
+
+        iot_json_unref(rpl);
+        iot_json_unref(req);
+    }
+
+    *nsent = b->nsent;
+
+    return t;
+}
+
+
+static void bench_dst(bench_t *b, const char *name, dst_t dst)
+{
+    double tl, ti;
+    int    nl, ni;
+
+    tl = bench_route(b, dst, TRUE , &nl);
+    ti = bench_route(b, dst, FALSE, &ni);
+
+    if (nl != ni)
+        bench_fail("%s: indexed routing sent %d events instead of %d",
+                   name, ni, nl);
+
+    printf("  %-16s %7.1f rcvrs/event  linear %8.3f us/event  "
+           "indexed %8.3f us/event\n", name, (double)ni / b->iterations,
+           1000000.0 * tl / b->iterations, 1000000.0 * ti / b->iterations);
+}
+
+
+static void bench_send(bench_t *b)
+{
+    double start, t;
+    int    i;
+
+    b->nsent = 0;
+    start    = now();
+
+    for (i = 0; i < b->iterations; i++)
+        if (event_send(&b->l, b->clients[(i * 31) % b->nclient].id.pid,
+                       "bench-event-0", NULL) < 0)
+            bench_fail("failed to send event to client");
+
+    t = now() - start;
+
+    if (b->nsent != b->iterations)
+        bench_fail("sent %d events instead of %d", b->nsent, b->iterations);
+
+    printf("  %-16s %7.1f rcvrs/event  indexed %8.3f us/event\n",
+           "event_send", 1.0, 1000000.0 * t / b->iterations);
+}
+
+
+static void bench_lookup(bench_t *b)
+{
+    char   name[64];
+    double start, t;
+    int    i, id;
+
+    start = now();
+
+    for (i = 0; i < b->iterations; i++) {
+        snprintf(name, sizeof(name), "bench-event-%d", (i * 7) % b->nevent);
+
+        if ((id = event_lookup(name)) < 0 || event_name(id) == NULL)
+            bench_fail("failed to look up event '%s'", name);
+    }
+
+    t = now() - start;
+
+    printf("  %-16s %7s              indexed %8.3f us/event\n",
+           "event_lookup", "", 1000000.0 * t / b->iterations);
+}
+
+
+static void print_usage(const char *argv0, int exit_code)
+{
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -n, --iterations=<n>           number of routed events\n"
+           "  -c, --clients=<n>              number of clients\n"
+           "  -u, --users=<n>                number of distinct users\n"
+           "  -l, --labels=<n>               number of distinct labels\n"
+           "  -e, --events=<n>               number of events\n"
+           "  -s, --subscriptions=<n>        subscriptions per client\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    exit(exit_code);
+}
+
+
+static void parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "n:c:u:l:e:s:h"
+    struct option options[] = {
+        { "iterations"   , required_argument, NULL, 'n' },
+        { "clients"      , required_argument, NULL, 'c' },
+        { "users"        , required_argument, NULL, 'u' },
+        { "labels"       , required_argument, NULL, 'l' },
+        { "events"       , required_argument, NULL, 'e' },
+        { "subscriptions", required_argument, NULL, 's' },
+        { "help"         , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+
+    b->iterations = 10000;
+    b->nclient    = 1000;
+    b->nuser      = 10;
+    b->nlabel     = 100;
+    b->nevent     = 50;
+    b->nsub       = 2;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            b->iterations = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            b->nclient = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'u':
+            b->nuser = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'l':
+            b->nlabel = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'e':
+            b->nevent = (int)strtol(optarg, NULL, 10);
+            break;
+        case 's':
+            b->nsub = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'h':
+            print_usage(argv[0], 0);
+            break;
+        default:
+            print_usage(argv[0], EINVAL);
+        }
+    }
+
+    if (b->iterations <= 0 || b->nclient <= 0 || b->nuser <= 0 ||
+        b->nlabel <= 0 || b->nevent <= 0 ||
+        b->nsub < 0)
+        print_usage(argv[0], EINVAL);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static bench_t b;
+
+    iot_log_set_mask(IOT_LOG_UPTO(IOT_LOG_WARNING));
+    iot_log_set_target(IOT_LOG_TO_STDERR);
+
+    bench = &b;
+
+    parse_cmdline(&b, argc, argv);
+    setup(&b);
+
+    printf("event routing, %d clients, %d users, %d labels, %d events, "
+           "%d subscriptions/client:\n", b.nclient, b.nuser, b.nlabel,
+           b.nevent, b.nsub);
+
+    bench_dst(&b, "all subscribers", DST_ALL);
+    bench_dst(&b, "by process", DST_PROCESS);
+    bench_dst(&b, "by user", DST_USER);
+    bench_dst(&b, "by label", DST_LABEL);
+    bench_send(&b);
+    bench_lookup(&b);
+
+    cleanup(&b);
+
+    return 0;
+}
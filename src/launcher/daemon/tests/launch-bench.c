@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2016, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/log.h>
+#include <iot/common/json.h>
+#include <iot/common/mainloop.h>
+
+#include "launcher/daemon/launcher.h"
+#include "launcher/daemon/msg.h"
+#include "launcher/daemon/transport.h"
+#include "launcher/daemon/privilege.h"
+#include "launcher/daemon/client.h"
+#include "launcher/daemon/event.h"
+#include "launcher/daemon/application.h"
+#include "launcher/daemon/worker.h"
+
+#define bench_fail(...) do {                            \
+        iot_log_error("fatal error: "__VA_ARGS__);      \
+        exit(1);                                        \
+    } while (0)
+
+/*
+ * Measure the throughput of concurrent application setup requests, and
+ * how long the mainloop is kept busy handling them. A number of clients
+ * send setup requests at the same time, as if they had all arrived in a
+ * single mainloop iteration. Setting up an application reads its manifest
+ * and creates its cgroup directory (a plain directory here), then runs
+ * the application hooks. A benchmark hook stands in for the security
+ * manager, which usually needs a round-trip to another daemon, by
+ * sleeping for a configurable amount of time in its prepare stage. Requests are handled both
+ * synchronously in the mainloop and by a pool of worker threads.
+ */
+
+typedef struct {
+    int         nclient;                 /* number of clients */
+    int         nworker;                 /* number of worker threads */
+    int         delay;                   /* hook delay (usecs) */
+    char        root[64];                /* fake cgroup root, manifest */
+    char        manifest[128];           /* application manifest */
+    launcher_t  l;                       /* simulated launcher context */
+    client_t   *clients;                 /* simulated clients */
+    int         ndone;                   /* number of completed setups */
+    int         nfail;                   /* number of failed setups */
+} bench_t;
+
+static bench_t *bench;
+
+
+/*
+ * stand-ins for the real transport and privilege checking
+ */
+
+int transport_send(client_t *c, iot_json_t *msg)
+{
+    IOT_UNUSED(c);
+    IOT_UNUSED(msg);
+
+    return 0;
+}
+
+
+int transport_sendmsg(client_t *c, iot_transport_msg_t *msg)
+{
+    IOT_UNUSED(c);
+    IOT_UNUSED(msg);
+
+    return 0;
+}
+
+
+pending_t *transport_pending(client_t *c)
+{
+    pending_t *p;
+
+    if ((p = iot_allocz(sizeof(*p))) == NULL)
+        return NULL;
+
+    iot_list_init(&p->hook);
+    p->c     = c;
+    p->seqno = c->seqno;
+
+    return p;
+}
+
+
+int transport_complete(pending_t *p, iot_json_t *status)
+{
+    int code = -1;
+
+    iot_json_get_integer(status, "status", &code);
+
+    if (code != 0)
+        bench->nfail++;
+
+    bench->ndone++;
+
+    iot_json_unref(status);
+    iot_free(p);
+
+    return 0;
+}
+
+
+void transport_orphan(client_t *c)
+{
+    IOT_UNUSED(c);
+}
+
+
+int privilege_check(launcher_t *l, const char *label, uid_t uid,
+                    const char *privilege)
+{
+    IOT_UNUSED(l);
+    IOT_UNUSED(label);
+    IOT_UNUSED(uid);
+    IOT_UNUSED(privilege);
+
+    return 1;
+}
+
+
+static int bench_hook_prepare(application_t *a)
+{
+    IOT_UNUSED(a);
+
+    if (bench->delay > 0)
+        usleep(bench->delay);
+
+    return 0;
+}
+
+
+static int bench_hook_cleanup(application_t *a)
+{
+    IOT_UNUSED(a);
+
+    return 0;
+}
+
+
+IOT_REGISTER_APPHOOK_PREPARE(bench, "launch-bench",
+                             NULL, NULL,
+                             bench_hook_prepare, NULL, bench_hook_cleanup);
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static void setup(bench_t *b)
+{
+    launcher_t *l = &b->l;
+    client_t   *c;
+    FILE       *fp;
+    int         i;
+
+    snprintf(b->root, sizeof(b->root), "/tmp/iot-launch-bench.XXXXXX");
+
+    if (mkdtemp(b->root) == NULL)
+        bench_fail("failed to create fake cgroup root (%d: %s)",
+                   errno, strerror(errno));
+
+    snprintf(b->manifest, sizeof(b->manifest), "%s/bench.manifest", b->root);
+
+    if ((fp = fopen(b->manifest, "w")) == NULL)
+        bench_fail("failed to create manifest '%s'", b->manifest);
+
+    fprintf(fp, "{\n"
+            "  \"application\": \"bench\",\n"
+            "  \"description\": \"Launch benchmark application.\",\n"
+            "  \"privileges\": [ \"none\" ],\n"
+            "  \"execute\": [ \"/usr/bin/bench\" ]\n"
+            "}\n");
+    fclose(fp);
+
+    iot_list_init(&l->clients);
+    iot_list_init(&l->apps);
+
+    l->ml         = iot_mainloop_create();
+    l->cgdir      = b->root;
+    l->max_events = MAX_EVENTS;
+
+    if (l->ml == NULL)
+        bench_fail("failed to create mainloop");
+
+    if (event_init(l) < 0 || client_init(l) < 0 || application_init(l) < 0)
+        bench_fail("failed to initialize launcher context");
+
+    b->clients = iot_allocz_array(client_t, b->nclient);
+
+    if (b->clients == NULL)
+        bench_fail("failed to allocate clients");
+
+    for (i = 0; i < b->nclient; i++) {
+        c = b->clients + i;
+
+        iot_list_init(&c->hook);
+        iot_list_init(&c->subscriptions);
+        iot_list_init(&c->pending);
+
+        c->type   = CLIENT_LAUNCHER;
+        c->l      = l;
+        c->id.uid = 5000;
+        c->id.gid = 5000;
+        c->id.pid = NO_PID;
+    }
+}
+
+
+static void cleanup(bench_t *b)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/user-5000", b->root);
+    rmdir(path);
+    unlink(b->manifest);
+    rmdir(b->root);
+
+    iot_free(b->clients);
+}
+
+
+static iot_json_t *setup_request(bench_t *b, int run, int i)
+{
+    iot_json_t *req, *exec;
+    char        argv0[64];
+
+    req  = iot_json_create(IOT_JSON_OBJECT);
+    exec = iot_json_create(IOT_JSON_ARRAY);
+
+    if (req == NULL || exec == NULL)
+        bench_fail("failed to create setup request");
+
+    /* cgroup directories are named after argv[0], keep them unique */
+    snprintf(argv0, sizeof(argv0), "/usr/bin/bench-%d-%d", run, i);
+    iot_json_array_append_string(exec, argv0);
+
+    iot_json_add_string (req, "manifest", b->manifest);
+    iot_json_add_string (req, "app"     , "bench");
+    iot_json_add_integer(req, "user"    , -1);
+    iot_json_add_integer(req, "group"   , -1);
+    iot_json_add        (req, "exec"    , exec);
+
+    return req;
+}
+
+
+static void stop_apps(bench_t *b)
+{
+    launcher_t      *l = &b->l;
+    application_t   *a;
+    iot_list_hook_t *p, *n;
+    iot_json_t      *req;
+    char             cgrp[PATH_MAX];
+    client_t         root;
+
+    iot_clear(&root);
+    root.l = l;
+
+    iot_list_foreach(&l->apps, p, n) {
+        a = iot_list_entry(p, typeof(*a), hook);
+
+        snprintf(cgrp, sizeof(cgrp), "/%s", a->id.cgrp);
+
+        req = iot_json_create(IOT_JSON_OBJECT);
+        iot_json_add_string(req, "cgroup", cgrp);
+        iot_json_unref(application_cleanup(&root, req));
+        iot_json_unref(req);
+    }
+
+    if (!iot_list_empty(&l->apps))
+        bench_fail("applications left after cleanup");
+}
+
+
+static void bench_launch(bench_t *b, int nworker, int run)
+{
+    launcher_t *l = &b->l;
+    iot_json_t *req, *rpl;
+    double      start, busy, t;
+    int         i;
+
+    l->nworker = nworker;
+
+    if (worker_init(l) < 0)
+        bench_fail("failed to create %d worker threads", nworker);
+
+    b->ndone = b->nfail = 0;
+    busy     = 0;
+    start    = now();
+
+    for (i = 0; i < b->nclient; i++) {
+        req = setup_request(b, run, i);
+        b->clients[i].seqno = i;
+
+        t   = now();
+        rpl = application_setup(b->clients + i, req);
+        busy += now() - t;
+
+        if (rpl != REQUEST_PENDING)
+            bench_fail("setup request #%d failed", i);
+
+        iot_json_unref(req);
+    }
+
+    while (b->ndone < b->nclient) {
+        iot_mainloop_prepare(l->ml);
+        iot_mainloop_poll(l->ml, TRUE);
+
+        t = now();
+        iot_mainloop_dispatch(l->ml);
+        busy += now() - t;
+    }
+
+    t = now() - start;
+
+    worker_exit(l);
+
+    if (b->nfail)
+        bench_fail("%d of %d setup requests failed", b->nfail, b->nclient);
+
+    printf("  %2d workers  %8.1f launches/s  %8.3f ms/launch  "
+           "mainloop busy %8.3f ms\n", nworker, b->nclient / t,
+           1000.0 * t / b->nclient, 1000.0 * busy);
+
+    stop_apps(b);
+}
+
+
+static void print_usage(const char *argv0, int exit_code)
+{
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -c, --clients=<n>              number of concurrent clients\n"
+           "  -w, --workers=<n>              number of worker threads\n"
+           "  -d, --delay=<usecs>            application hook delay\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    exit(exit_code);
+}
+
+
+static void parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "c:w:d:h"
+    struct option options[] = {
+        { "clients"      , required_argument, NULL, 'c' },
+        { "workers"      , required_argument, NULL, 'w' },
+        { "delay"        , required_argument, NULL, 'd' },
+        { "help"         , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+
+    b->nclient = 200;
+    b->nworker = NWORKER;
+    b->delay   = 2000;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'c':
+            b->nclient = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'w':
+            b->nworker = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'd':
+            b->delay = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'h':
+            print_usage(argv[0], 0);
+            break;
+        default:
+            print_usage(argv[0], EINVAL);
+        }
+    }
+
+    if (b->nclient <= 0 || b->nworker <= 0 || b->delay < 0)
+        print_usage(argv[0], EINVAL);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static bench_t b;
+
+    iot_log_set_mask(IOT_LOG_UPTO(IOT_LOG_WARNING));
+    iot_log_set_target(IOT_LOG_TO_STDERR);
+
+    bench = &b;
+
+    parse_cmdline(&b, argc, argv);
+    setup(&b);
+
+    printf("concurrent application setup, %d clients, %d us hook delay:\n",
+           b.nclient, b.delay);
+
+    bench_launch(&b, 0, 0);
+    bench_launch(&b, b.nworker, 1);
+
+    cleanup(&b);
+
+    return 0;
+}
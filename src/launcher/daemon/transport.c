@@ -34,7 +34,9 @@
 #include <sys/socket.h>
 
 #include <iot/common/macros.h>
+#include <iot/common/mm.h>
 #include <iot/common/log.h>
+#include <iot/common/debug.h>
 #include <iot/common/transport.h>
 
 #include "launcher/daemon/launcher.h"
@@ -81,7 +83,7 @@ void transport_init(launcher_t *l)
     }
 
     flags = IOT_TRANSPORT_REUSEADDR | IOT_TRANSPORT_NONBLOCK |  \
-        IOT_TRANSPORT_MODE_JSON;
+        IOT_TRANSPORT_MODE_JSON | IOT_TRANSPORT_MODE_MSGPACK;
 
     if (l->lnc_fd < 0) {
         l->lnc = iot_transport_create(ml, type, &lnc_evt, l, flags);
@@ -120,7 +122,8 @@ void transport_init(launcher_t *l)
     }
 
     flags = IOT_TRANSPORT_REUSEADDR | IOT_TRANSPORT_NONBLOCK |  \
-        IOT_TRANSPORT_MODE_JSON;
+        IOT_TRANSPORT_MODE_JSON | IOT_TRANSPORT_MODE_MSGPACK |  \
+        IOT_TRANSPORT_MODE_COMPRESS;
 
     if (l->app_fd < 0) {
         l->app = iot_transport_create(ml, type, &app_evt, l, flags);
@@ -232,15 +235,17 @@ static handler_t request_handler(const char *type)
         const char        *type;
         handler_t  fn;
     } handlers[] = {
-        { "setup"           , application_setup   },
-        { "cleanup"         , application_cleanup },
-        { "list"            , application_list    },
-        { "stop"            , application_stop    },
+        { "setup"           , application_setup      },
+        { "setup-bulk"      , application_setup_bulk },
+        { "cleanup"         , application_cleanup    },
+        { "list"            , application_list       },
+        { "stop"            , application_stop       },
+        { "stop-bulk"       , application_stop_bulk  },
 #if 0
-        { "query"           , application_query   },
+        { "query"           , application_query      },
 #endif
-        { "send-event"      , event_route         },
-        { "subscribe-events", client_subscribe    },
+        { "send-event"      , event_route            },
+        { "subscribe-events", client_subscribe       },
 
         { NULL, NULL },
     }, *h;
@@ -258,7 +263,7 @@ static void lnc_recv(iot_transport_t *t, iot_json_t *msg, void *user_data)
     client_t   *c = (client_t *)user_data;
     handler_t   h;
     const char *f, *type;
-    iot_json_t *req, *rpl, *s;
+    iot_json_t *req, *s;
     int         seq;
 
     IOT_UNUSED(t);
@@ -279,21 +284,90 @@ static void lnc_recv(iot_transport_t *t, iot_json_t *msg, void *user_data)
         return;
     }
 
-    if ((s = h(c, req)) == NULL)
+    c->seqno = seq;
+
+    if ((s = h(c, req)) == NULL || s == REQUEST_PENDING)
         return;
 
+    transport_reply(c, seq, s);
+}
+
+
+int transport_reply(client_t *c, int seqno, iot_json_t *status)
+{
+    iot_json_t *rpl;
+    int         r;
+
     if ((rpl = iot_json_create(IOT_JSON_OBJECT)) == NULL) {
-        iot_json_unref(s);
-        return;
+        iot_json_unref(status);
+        return -1;
     }
 
     iot_json_add_string (rpl, "type"  , "status");
-    iot_json_add_integer(rpl, "seqno" , seq     );
-    iot_json_add_object (rpl, "status", s       );
+    iot_json_add_integer(rpl, "seqno" , seqno   );
+    iot_json_add_object (rpl, "status", status  );
 
-    transport_send(c, rpl);
+    r = transport_send(c, rpl);
 
     iot_json_unref(rpl);
+
+    return r;
+}
+
+
+pending_t *transport_pending(client_t *c)
+{
+    pending_t *p;
+
+    if ((p = iot_allocz(sizeof(*p))) == NULL)
+        return NULL;
+
+    iot_list_init(&p->hook);
+    p->c     = c;
+    p->seqno = c->seqno;
+
+    iot_list_append(&c->pending, &p->hook);
+
+    return p;
+}
+
+
+int transport_complete(pending_t *p, iot_json_t *status)
+{
+    int r;
+
+    if (p == NULL) {
+        iot_json_unref(status);
+        return -1;
+    }
+
+    iot_list_delete(&p->hook);
+
+    if (p->c != NULL)
+        r = transport_reply(p->c, p->seqno, status);
+    else {
+        iot_debug("dropping reply #%d to closed client", p->seqno);
+        iot_json_unref(status);
+        r = 0;
+    }
+
+    iot_free(p);
+
+    return r;
+}
+
+
+void transport_orphan(client_t *c)
+{
+    iot_list_hook_t *p, *n;
+    pending_t       *pr;
+
+    iot_list_foreach(&c->pending, p, n) {
+        pr = iot_list_entry(p, typeof(*pr), hook);
+
+        iot_list_delete(&pr->hook);
+        pr->c = NULL;
+    }
 }
 
 
@@ -310,3 +384,17 @@ int transport_send(client_t *c, iot_json_t *msg)
 }
 
 
+int transport_sendmsg(client_t *c, iot_transport_msg_t *msg)
+{
+    dump_message(iot_transport_msg_json(msg), "Sending %s message: ",
+                 client_type(c));
+
+    if (!iot_transport_sendmsg(c->t, msg)) {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+
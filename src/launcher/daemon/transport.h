@@ -32,7 +32,28 @@
 
 #include "launcher/daemon/launcher.h"
 
+/*
+ * Request handlers which can't produce a status reply right away return
+ * REQUEST_PENDING, after creating a pending request with
+ * transport_pending(). The reply is sent later, once the handler calls
+ * transport_complete() with the final status.
+ */
+
+#define REQUEST_PENDING ((iot_json_t *)-1)
+
+typedef struct {
+    iot_list_hook_t  hook;               /* to client pending requests */
+    client_t        *c;                  /* requesting client, NULL if gone */
+    int              seqno;              /* request sequence number */
+} pending_t;
+
 void transport_init(launcher_t *l);
 int transport_send(client_t *c, iot_json_t *msg);
+int transport_sendmsg(client_t *c, iot_transport_msg_t *msg);
+int transport_reply(client_t *c, int seqno, iot_json_t *status);
+
+pending_t *transport_pending(client_t *c);
+int transport_complete(pending_t *p, iot_json_t *status);
+void transport_orphan(client_t *c);
 
 #endif /* __IOT_LAUNCHER_TRANSPORT_H__ */
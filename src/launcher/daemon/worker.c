@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <iot/common/macros.h>
+#include <iot/common/mm.h>
+#include <iot/common/log.h>
+#include <iot/common/list.h>
+#include <iot/common/mainloop.h>
+
+#include "launcher/daemon/launcher.h"
+#include "launcher/daemon/worker.h"
+
+/*
+ * a pool of worker threads for running the blocking stages of requests
+ *
+ * Jobs are queued for the workers, and once a worker has finished with
+ * a job the job is put on a list of finished jobs. The mainloop is woken
+ * up through an eventfd to run the done callbacks of finished jobs. If
+ * no workers are configured, jobs are run synchronously by worker_run.
+ *
+ * Notes: the debugging memory allocator is not thread-safe, so we never
+ * create workers when it is enabled.
+ */
+
+typedef struct {
+    iot_list_hook_t  hook;               /* to queued or finished jobs */
+    worker_fn_t      work;               /* work callback */
+    worker_fn_t      done;               /* done callback */
+    void            *data;               /* opaque callback data */
+} job_t;
+
+typedef struct worker_pool_s {
+    launcher_t      *l;                  /* launcher context */
+    pthread_t       *threads;            /* worker threads */
+    int              nthread;            /* number of worker threads */
+    pthread_mutex_t  lock;               /* lock protecting job lists */
+    pthread_cond_t   cond;               /* signalled for queued jobs */
+    iot_list_hook_t  queued;             /* jobs waiting for a worker */
+    iot_list_hook_t  finished;           /* jobs waiting for done */
+    int              stopping;           /* whether we're shutting down */
+    int              efd;                /* eventfd for waking up mainloop */
+    iot_io_watch_t  *w;                  /* I/O watch for efd */
+} worker_pool_t;
+
+
+static void *worker_main(void *ptr);
+static void finished_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                        void *user_data);
+
+
+int worker_init(launcher_t *l)
+{
+    worker_pool_t *wp;
+    int            i;
+
+    if (l->nworker > 0 && iot_mm_config_bool("debug", FALSE)) {
+        iot_log_warning("Debug memory allocator enabled, not using workers.");
+        l->nworker = 0;
+    }
+
+    if (l->nworker <= 0) {
+        iot_log_info("Handling all requests synchronously.");
+        return 0;
+    }
+
+    if ((wp = iot_allocz(sizeof(*wp))) == NULL)
+        return -1;
+
+    iot_list_init(&wp->queued);
+    iot_list_init(&wp->finished);
+    pthread_mutex_init(&wp->lock, NULL);
+    pthread_cond_init(&wp->cond, NULL);
+    wp->l   = l;
+    wp->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (wp->efd < 0)
+        goto fail;
+
+    wp->w = iot_add_io_watch(l->ml, wp->efd, IOT_IO_EVENT_IN, finished_cb, wp);
+
+    if (wp->w == NULL)
+        goto fail;
+
+    wp->threads = iot_allocz_array(pthread_t, l->nworker);
+
+    if (wp->threads == NULL)
+        goto fail;
+
+    l->workers = wp;
+
+    for (i = 0; i < l->nworker; i++) {
+        if ((errno = pthread_create(wp->threads + i, NULL, worker_main, wp))) {
+            iot_log_error("Failed to create worker thread (%d: %s).",
+                          errno, strerror(errno));
+            worker_exit(l);
+            return -1;
+        }
+
+        wp->nthread++;
+    }
+
+    iot_log_info("Created %d request worker threads.", wp->nthread);
+
+    return 0;
+
+ fail:
+    iot_del_io_watch(wp->w);
+    if (wp->efd >= 0)
+        close(wp->efd);
+    iot_free(wp);
+
+    return -1;
+}
+
+
+static void run_finished(worker_pool_t *wp)
+{
+    iot_list_hook_t  jobs, *p, *n;
+    job_t           *j;
+
+    iot_list_init(&jobs);
+
+    pthread_mutex_lock(&wp->lock);
+    iot_list_foreach(&wp->finished, p, n) {
+        iot_list_delete(p);
+        iot_list_append(&jobs, p);
+    }
+    pthread_mutex_unlock(&wp->lock);
+
+    iot_list_foreach(&jobs, p, n) {
+        j = iot_list_entry(p, typeof(*j), hook);
+
+        iot_list_delete(&j->hook);
+        j->done(j->data);
+        iot_free(j);
+    }
+}
+
+
+void worker_exit(launcher_t *l)
+{
+    worker_pool_t *wp = l->workers;
+    int            i;
+
+    if (wp == NULL)
+        return;
+
+    pthread_mutex_lock(&wp->lock);
+    wp->stopping = TRUE;
+    pthread_cond_broadcast(&wp->cond);
+    pthread_mutex_unlock(&wp->lock);
+
+    for (i = 0; i < wp->nthread; i++)
+        pthread_join(wp->threads[i], NULL);
+
+    run_finished(wp);
+
+    iot_del_io_watch(wp->w);
+    close(wp->efd);
+    pthread_cond_destroy(&wp->cond);
+    pthread_mutex_destroy(&wp->lock);
+    iot_free(wp->threads);
+    iot_free(wp);
+
+    l->workers = NULL;
+}
+
+
+int worker_run(launcher_t *l, worker_fn_t work, worker_fn_t done, void *data)
+{
+    worker_pool_t *wp = l->workers;
+    job_t         *j;
+
+    if (wp == NULL) {
+        work(data);
+        done(data);
+
+        return 0;
+    }
+
+    if ((j = iot_allocz(sizeof(*j))) == NULL)
+        return -1;
+
+    iot_list_init(&j->hook);
+    j->work = work;
+    j->done = done;
+    j->data = data;
+
+    pthread_mutex_lock(&wp->lock);
+    iot_list_append(&wp->queued, &j->hook);
+    pthread_cond_signal(&wp->cond);
+    pthread_mutex_unlock(&wp->lock);
+
+    return 0;
+}
+
+
+static void *worker_main(void *ptr)
+{
+    worker_pool_t *wp  = (worker_pool_t *)ptr;
+    uint64_t       one = 1;
+    job_t         *j;
+
+    for (;;) {
+        pthread_mutex_lock(&wp->lock);
+
+        while (iot_list_empty(&wp->queued) && !wp->stopping)
+            pthread_cond_wait(&wp->cond, &wp->lock);
+
+        if (iot_list_empty(&wp->queued)) {
+            pthread_mutex_unlock(&wp->lock);
+            break;
+        }
+
+        j = iot_list_entry(wp->queued.next, typeof(*j), hook);
+        iot_list_delete(&j->hook);
+
+        pthread_mutex_unlock(&wp->lock);
+
+        j->work(j->data);
+
+        pthread_mutex_lock(&wp->lock);
+        iot_list_append(&wp->finished, &j->hook);
+        pthread_mutex_unlock(&wp->lock);
+
+        if (write(wp->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            iot_log_error("Failed to wake up mainloop (%d: %s).",
+                          errno, strerror(errno));
+    }
+
+    return NULL;
+}
+
+
+static void finished_cb(iot_io_watch_t *w, int fd, iot_io_event_t events,
+                        void *user_data)
+{
+    worker_pool_t *wp = (worker_pool_t *)user_data;
+    uint64_t       cnt;
+
+    IOT_UNUSED(w);
+    IOT_UNUSED(events);
+
+    if (read(fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        iot_log_error("Failed to read worker eventfd (%d: %s).",
+                      errno, strerror(errno));
+
+    run_finished(wp);
+}
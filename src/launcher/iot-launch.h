@@ -33,4 +33,10 @@
 #define IOT_LAUNCH_ADDRESS "unxs:@iot-launcher"
 #define IOT_APPFW_ADDRESS "unxs:@iot-appfw"
 
+/* address template of zygotes, formatted with the runtime name */
+#define IOT_ZYGOTE_ADDRESS "unxs:@iot-zygote-%s"
+
+/* environment variable to override IOT_APPFW_ADDRESS with, eg. shm:@iot-appfw */
+#define IOT_APPFW_ADDRESS_ENVVAR "IOT_APPFW_ADDRESS"
+
 #endif /* __IOT_LAUNCH_H__ */
@@ -68,6 +68,8 @@ iot_manifest_t *iotpm_manifest_load(iotpm_t *iotpm,
         { IOT_MANIFEST_INVALID_BINARY,     "invalid field"     },
         { IOT_MANIFEST_INVALID_PRIVILEGE,  "invalid privilege" },
         { IOT_MANIFEST_INVALID_DESKTOP,    "invalid desktop"   },
+        { IOT_MANIFEST_INVALID_RESOURCES,  "invalid resources" },
+        { IOT_MANIFEST_INVALID_ZYGOTE,     "invalid zygote"    },
         {        0,                              NULL          }
     };
 
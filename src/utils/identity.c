@@ -265,6 +265,32 @@ int iot_switch_userid(iot_userid_t which)
 }
 
 
+int iot_assume_userid(uid_t uid, gid_t gid)
+{
+    struct passwd pw, *found;
+    char          buf[4096];
+    int           r;
+
+    if ((r = getpwuid_r(uid, &pw, buf, sizeof(buf), &found)) != 0 || !found) {
+        errno = r ? r : ENOENT;
+        return -1;
+    }
+
+    if (initgroups(pw.pw_name, gid) < 0)
+        return -1;
+
+    if (setresgid(gid, -1, -1) < 0 || setresuid(uid, -1, -1) < 0)
+        return -1;
+
+    _iot_ruid = uid;
+    _iot_rgid = gid;
+
+    iot_debug("assumed user/group id %u/%u", uid, gid);
+
+    return 0;
+}
+
+
 char *iot_application_id(char *buf, size_t size, uid_t uid, const char *pkg,
                          const char *app)
 {
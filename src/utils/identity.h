@@ -147,6 +147,22 @@ typedef enum {
  */
 int iot_switch_userid(iot_userid_t which);
 
+/**
+ * @brief Take on the real identity of another user.
+ *
+ * Set the real user and group ids (and the supplementary groups) of a
+ * privileged process to those of the given user, keeping the effective
+ * and saved ids intact. Afterwards the process looks as if the given
+ * user had started it from a setuid binary, and @iot_switch_userid can
+ * be used to switch between the two identities.
+ *
+ * @param [in] uid  user id to take on
+ * @param [in] gid  primary group id to take on
+ *
+ * @return Returns 0 on success, -1 upon error.
+ */
+int iot_assume_userid(uid_t uid, gid_t gid);
+
 /**
  * @brief Generate a fully qualified application id.
  *
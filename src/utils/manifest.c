@@ -392,6 +392,12 @@ iot_manifest_t *iot_manifest_read(const char *path)
 }
 
 
+iot_manifest_t *iot_manifest_ref(iot_manifest_t *m)
+{
+    return manifest_ref(m);
+}
+
+
 void iot_manifest_unref(iot_manifest_t *m)
 {
     manifest_unref(m);
@@ -584,6 +590,192 @@ const char *iot_manifest_desktop_path(iot_manifest_t *m, const char *app)
 }
 
 
+static int parse_size(iot_json_t *val, int64_t *sizep)
+{
+    const char *s;
+    char       *e;
+    int64_t     size, mult;
+
+    switch (iot_json_get_type(val)) {
+    case IOT_JSON_INTEGER:
+        size = iot_json_integer_value(val);
+        break;
+
+    case IOT_JSON_STRING:
+        s     = iot_json_string_value(val);
+        errno = 0;
+        size  = strtoll(s, &e, 10);
+
+        if (e == s || errno == ERANGE || size <= 0)
+            return -1;
+
+        switch (*e) {
+        case 'k': case 'K': mult = 1024;               e++; break;
+        case 'm': case 'M': mult = 1024 * 1024;        e++; break;
+        case 'g': case 'G': mult = 1024 * 1024 * 1024; e++; break;
+        default:            mult = 1;                       break;
+        }
+
+        if (*e || size > INT64_MAX / mult)
+            return -1;
+
+        size *= mult;
+        break;
+
+    default:
+        return -1;
+    }
+
+    if (size <= 0)
+        return -1;
+
+    *sizep = size;
+
+    return 0;
+}
+
+
+static int parse_resources(iot_json_t *res, iot_manifest_resources_t *r)
+{
+    iot_json_iter_t  it;
+    const char      *key;
+    iot_json_t      *val;
+    int              i, min, max, *ip;
+
+    iot_clear(r);
+
+    if (iot_json_get_type(res) != IOT_JSON_OBJECT)
+        return -1;
+
+    iot_json_foreach_member(res, key, val, it) {
+        if (!strcmp(key, "memory-max")) {
+            if (parse_size(val, &r->memory_max) < 0)
+                return -1;
+            continue;
+        }
+
+        if (!strcmp(key, "memory-high")) {
+            if (parse_size(val, &r->memory_high) < 0)
+                return -1;
+            continue;
+        }
+
+        if (!strcmp(key, "cpu-weight")) {
+            ip = &r->cpu_weight; min = 1; max = 10000;
+        }
+        else if (!strcmp(key, "cpu-quota")) {
+            ip = &r->cpu_quota; min = 1; max = 100 * 1024;
+        }
+        else if (!strcmp(key, "io-weight")) {
+            ip = &r->io_weight; min = 1; max = 10000;
+        }
+        else if (!strcmp(key, "pids-max")) {
+            ip = &r->pids_max; min = 1; max = INT_MAX;
+        }
+        else {
+            iot_debug("unknown resource control '%s'", key);
+            return -1;
+        }
+
+        if (iot_json_get_type(val) != IOT_JSON_INTEGER)
+            return -1;
+
+        i = iot_json_integer_value(val);
+
+        if (i < min || i > max)
+            return -1;
+
+        *ip = i;
+    }
+
+    return 0;
+}
+
+
+int iot_manifest_resources(iot_manifest_t *m, const char *app,
+                           iot_manifest_resources_t *r)
+{
+    iot_json_t *data, *res;
+
+    iot_clear(r);
+
+    if ((data = app_data(m, app)) == NULL)
+        return -1;
+
+    if ((res = iot_json_get(data, "resources")) == NULL)
+        return 0;
+
+    if (parse_resources(res, r) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 1;
+}
+
+
+static int parse_zygote(iot_json_t *o, const char **runtime,
+                        const char **library, const char **entry)
+{
+    iot_json_iter_t  it;
+    const char      *key, **strp;
+    iot_json_t      *val;
+
+    *runtime = *library = *entry = NULL;
+
+    if (iot_json_get_type(o) != IOT_JSON_OBJECT)
+        return -1;
+
+    iot_json_foreach_member(o, key, val, it) {
+        if (!strcmp(key, "runtime"))
+            strp = runtime;
+        else if (!strcmp(key, "library"))
+            strp = library;
+        else if (!strcmp(key, "entry"))
+            strp = entry;
+        else {
+            iot_debug("unknown zygote field '%s'", key);
+            return -1;
+        }
+
+        if (iot_json_get_type(val) != IOT_JSON_STRING)
+            return -1;
+
+        if (!*(*strp = iot_json_string_value(val)))
+            return -1;
+    }
+
+    if (*runtime == NULL)
+        return -1;
+
+    if (!strcmp(*runtime, "native") && (*library == NULL || *entry == NULL))
+        return -1;
+
+    return 0;
+}
+
+
+int iot_manifest_zygote(iot_manifest_t *m, const char *app,
+                        const char **runtime, const char **library,
+                        const char **entry)
+{
+    iot_json_t *data, *o;
+
+    if ((data = app_data(m, app)) == NULL)
+        return -1;
+
+    if ((o = iot_json_get(data, "zygote")) == NULL)
+        return 0;
+
+    if (parse_zygote(o, runtime, library, entry) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 1;
+}
+
+
 static int validate_manifest_data(const char *pkg, iot_json_t *data,
                                   bool needs_appid)
 {
@@ -700,6 +892,24 @@ static int validate_manifest_data(const char *pkg, iot_json_t *data,
             continue;
         }
 
+        if (!strcmp(key, "resources")) {
+            iot_manifest_resources_t r;
+
+            if (parse_resources(val, &r) < 0)
+                status |= IOT_MANIFEST_INVALID_RESOURCES;
+
+            continue;
+        }
+
+        if (!strcmp(key, "zygote")) {
+            const char *runtime, *library, *entry;
+
+            if (parse_zygote(val, &runtime, &library, &entry) < 0)
+                status |= IOT_MANIFEST_INVALID_ZYGOTE;
+
+            continue;
+        }
+
         iot_debug("unknown field '%s'", key);
         status |= IOT_MANIFEST_INVALID_FIELD;
     }
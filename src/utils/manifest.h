@@ -30,6 +30,8 @@
 #ifndef __IOT_UTILS_MANIFEST_H__
 #define __IOT_UTILS_MANIFEST_H__
 
+#include <stdint.h>
+
 #include <iot/config.h>
 #include <iot/common/macros.h>
 #include <iot/common/json.h>
@@ -141,6 +143,19 @@ typedef struct iot_manifest_s iot_manifest_t;
  */
 iot_manifest_t *iot_manifest_get(uid_t usr, const char *pkg);
 
+/**
+ * @brief Add a reference to the given loaded manifest.
+ *
+ * Increment the reference count on the given manifest, for instance to
+ * share a single loaded manifest between several users.
+ *
+ * @param [in] m  the manifest to increment the refcount on
+ *
+ * @return Returns @m.
+ */
+iot_manifest_t *iot_manifest_ref(iot_manifest_t *m);
+
+
 /**
  * @brief Unreference the given loaded manifest.
  *
@@ -279,6 +294,62 @@ iot_json_t *iot_manifest_data(iot_manifest_t *m, const char *app);
  */
 const char *iot_manifest_desktop_path(iot_manifest_t *m, const char *app);
 
+/**
+ * @brief Resource controls declared for an application.
+ *
+ * Fields left at 0 are not declared in the manifest and should be left
+ * at their system defaults.
+ */
+typedef struct {
+    int      cpu_weight;                 /**< relative CPU weight, 1-10000 */
+    int      cpu_quota;                  /**< CPU quota in % of one CPU */
+    int64_t  memory_max;                 /**< hard memory limit in bytes */
+    int64_t  memory_high;                /**< memory throttling limit in bytes */
+    int      io_weight;                  /**< relative IO weight, 1-10000 */
+    int      pids_max;                   /**< max. number of processes */
+} iot_manifest_resources_t;
+
+/**
+ * @brief Get the resource controls for the given application.
+ *
+ * Fetch the resource controls declared in the 'resources' object of
+ * the given application. Memory limits are either integers (in bytes),
+ * or strings with an optional K, M, or G suffix.
+ *
+ * @param [in]  m    manifest to get the resource controls from
+ * @param [in]  app  application to fetch the resource controls for
+ * @param [out] r    buffer to store the resource controls in
+ *
+ * @return Returns 1 if resource controls were declared, 0 if none were,
+ *         or -1 if the declared resource controls are invalid.
+ */
+int iot_manifest_resources(iot_manifest_t *m, const char *app,
+                           iot_manifest_resources_t *r);
+
+/**
+ * @brief Get the zygote runtime for the given application.
+ *
+ * Fetch the runtime declared in the 'zygote' object of the given
+ * application. Applications with a zygote runtime can be launched by
+ * forking a pre-initialized process for that runtime instead of
+ * executing them from scratch. For the 'native' runtime the library
+ * implementing the application and its entry point are mandatory, for
+ * other runtimes the entry point is provided by the runtime itself.
+ *
+ * @param [in]  m        manifest to get the zygote runtime from
+ * @param [in]  app      application to fetch the zygote runtime for
+ * @param [out] runtime  pointer to set to the runtime name
+ * @param [out] library  pointer to set to the library, or @NULL
+ * @param [out] entry    pointer to set to the entry point, or @NULL
+ *
+ * @return Returns 1 if a zygote runtime was declared, 0 if none was,
+ *         or -1 if the declaration is invalid. The returned data is
+ *         valid only until the manifest is freed.
+ */
+int iot_manifest_zygote(iot_manifest_t *m, const char *app,
+                        const char **runtime, const char **library,
+                        const char **entry);
+
 
 /**
  * @brief Map a file path to a 'file type' and application.
@@ -300,6 +371,8 @@ typedef enum {
     IOT_MANIFEST_INVALID_BINARY    = 0x040,  /**< invalid/unexecutable binary */
     IOT_MANIFEST_INVALID_PRIVILEGE = 0x080,  /**< invalid/unknown privilege */
     IOT_MANIFEST_INVALID_DESKTOP   = 0x100,  /**< invalid desktop file */
+    IOT_MANIFEST_INVALID_RESOURCES = 0x200,  /**< invalid resource controls */
+    IOT_MANIFEST_INVALID_ZYGOTE    = 0x400,  /**< invalid zygote runtime */
 } iot_manifest_status_t;
 
 /**